@@ -0,0 +1,368 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file ouster_ros_bench.cpp
+ * @brief Microbenchmarks of the scan conversion hot paths
+ *
+ * Every benchmark runs against synthetic frames for each lidar mode and lidar
+ * profile, the frames are generated as raw lidar packets by
+ * tests/synthetic_frames.h and batched into a LidarScan the same way the
+ * driver does. Besides the timings, benchmarks
+ * report the number of points processed per second and the number of heap
+ * allocations per frame.
+ */
+
+// prevent clang-format from altering the location of "ouster_ros/ros.h", the
+// header file needs to be the first include due to PCL_NO_PRECOMPILE flag
+// clang-format off
+#include "ouster_ros/os_ros.h"
+// clang-format on
+
+#include <benchmark/benchmark.h>
+#include <pcl_conversions/pcl_conversions.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <ouster/image_processing.h>
+#include <ouster/lidar_scan.h>
+#include <ouster/types.h>
+
+#include "ouster_ros/os_cuda_point_cloud_serializer.h"
+#include "ouster_ros/os_point_cloud_serializer.h"
+#include "synthetic_frames.h"
+
+namespace sensor = ouster::sensor;
+using sensor::ChanField;
+
+// count the heap allocations made by the code under test, operator new goes
+// through malloc as well
+#ifdef __GLIBC__
+namespace {
+std::atomic<size_t> allocation_count{0};
+}  // namespace
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+}
+
+namespace {
+size_t allocations() {
+    return allocation_count.load(std::memory_order_relaxed);
+}
+}  // namespace
+#else
+namespace {
+size_t allocations() { return 0; }
+}  // namespace
+#endif
+
+namespace {
+
+const std::vector<sensor::lidar_mode> lidar_modes = {
+    sensor::MODE_512x10, sensor::MODE_512x20, sensor::MODE_1024x10,
+    sensor::MODE_1024x20, sensor::MODE_2048x10, sensor::MODE_4096x5};
+
+using ouster_ros::test::Frames;
+using ouster_ros::test::lidar_profiles;
+using ouster_ros::test::make_frames;
+
+const Frames& frames_for(sensor::lidar_mode mode,
+                         sensor::UDPProfileLidar profile) {
+    static std::map<std::pair<int, int>, Frames> cache;
+    const auto key = std::make_pair(static_cast<int>(mode),
+                                    static_cast<int>(profile));
+    auto it = cache.find(key);
+    if (it == cache.end())
+        it = cache.emplace(key, make_frames(mode, profile)).first;
+    return it->second;
+}
+
+std::chrono::nanoseconds scan_start(const ouster::LidarScan& ls) {
+    return std::chrono::nanoseconds{ls.timestamp()[0]};
+}
+
+// times the frames of each iteration and reports the throughput counters
+class FrameReport {
+   public:
+    FrameReport(benchmark::State& state, size_t points_per_frame)
+        : state(state),
+          points_per_frame(points_per_frame),
+          allocations_start(allocations()) {}
+
+    ~FrameReport() {
+        const double frames = static_cast<double>(state.iterations());
+        state.counters["points"] = benchmark::Counter(
+            frames * points_per_frame, benchmark::Counter::kIsRate);
+        state.counters["allocs_per_frame"] =
+            frames > 0 ? (allocations() - allocations_start) / frames : 0.0;
+    }
+
+   private:
+    benchmark::State& state;
+    size_t points_per_frame;
+    size_t allocations_start;
+};
+
+void BM_ScanBatcher(benchmark::State& state, sensor::lidar_mode mode,
+                    sensor::UDPProfileLidar profile) {
+    const auto& frames = frames_for(mode, profile);
+    ouster::LidarScan ls(frames.scan.w, frames.scan.h, profile);
+    ouster::ScanBatcher batcher(frames.info);
+    int f = 0;
+    FrameReport report(state, frames.points());
+    for (auto _ : state) {
+        bool complete = false;
+        for (const auto& packet : frames.packets[f])
+            complete |= batcher(packet.data(), ls);
+        f ^= 1;
+        benchmark::DoNotOptimize(complete);
+    }
+    state.SetBytesProcessed(state.iterations() * frames.packets[0].size() *
+                            frames.packets[0][0].size());
+}
+
+template <typename PointT>
+void BM_ScanToCloudF(benchmark::State& state, sensor::lidar_mode mode,
+                     sensor::UDPProfileLidar profile, bool destagger) {
+    const auto& frames = frames_for(mode, profile);
+    auto xyz_lut = ouster::make_xyz_lut(frames.info);
+    ouster::PointsF lut_direction = xyz_lut.direction.cast<float>();
+    ouster::PointsF lut_offset = xyz_lut.offset.cast<float>();
+    ouster::PointsF points(lut_direction.rows(), lut_direction.cols());
+    pcl::PointCloud<PointT> cloud(frames.scan.w, frames.scan.h);
+    pcl::PointCloud<PointT> destaggered(frames.scan.w, frames.scan.h);
+    auto shifts = frames.pixel_shift_by_row;
+    FrameReport report(state, frames.points());
+    for (auto _ : state) {
+        ouster_ros::scan_to_cloud_f(points, lut_direction, lut_offset,
+                                    scan_start(frames.scan), frames.scan,
+                                    cloud, destaggered, 0, shifts, destagger);
+        benchmark::ClobberMemory();
+    }
+}
+
+void BM_CloudDestagger(benchmark::State& state, sensor::lidar_mode mode,
+                       sensor::UDPProfileLidar profile) {
+    const auto& frames = frames_for(mode, profile);
+    auto xyz_lut = ouster::make_xyz_lut(frames.info);
+    ouster::PointsF lut_direction = xyz_lut.direction.cast<float>();
+    ouster::PointsF lut_offset = xyz_lut.offset.cast<float>();
+    ouster::PointsF points(lut_direction.rows(), lut_direction.cols());
+    ouster_ros::Cloud cloud(frames.scan.w, frames.scan.h);
+    ouster_ros::Cloud unused;
+    auto shifts = frames.pixel_shift_by_row;
+    ouster_ros::scan_to_cloud_f(points, lut_direction, lut_offset,
+                                scan_start(frames.scan), frames.scan, cloud,
+                                unused, 0, shifts, false);
+    FrameReport report(state, frames.points());
+    for (auto _ : state) {
+        auto destaggered = ouster_ros::clouddestagger(cloud, shifts);
+        benchmark::DoNotOptimize(destaggered.points.data());
+    }
+}
+
+void BM_CloudToCloudMsg(benchmark::State& state, sensor::lidar_mode mode,
+                        sensor::UDPProfileLidar profile) {
+    const auto& frames = frames_for(mode, profile);
+    auto xyz_lut = ouster::make_xyz_lut(frames.info);
+    ouster::PointsF lut_direction = xyz_lut.direction.cast<float>();
+    ouster::PointsF lut_offset = xyz_lut.offset.cast<float>();
+    ouster::PointsF points(lut_direction.rows(), lut_direction.cols());
+    ouster_ros::Cloud cloud(frames.scan.w, frames.scan.h);
+    ouster_ros::Cloud unused;
+    auto shifts = frames.pixel_shift_by_row;
+    ouster_ros::scan_to_cloud_f(points, lut_direction, lut_offset,
+                                scan_start(frames.scan), frames.scan, cloud,
+                                unused, 0, shifts, false);
+    const ros::Time stamp(1, 0);
+    FrameReport report(state, frames.points());
+    for (auto _ : state) {
+        auto msg = ouster_ros::cloud_to_cloud_msg(cloud, stamp, "os_sensor");
+        benchmark::DoNotOptimize(msg.data.data());
+    }
+}
+
+void BM_Serialize(benchmark::State& state, sensor::lidar_mode mode,
+                  sensor::UDPProfileLidar profile,
+                  const std::string& point_type, bool staggered,
+                  bool destagger, bool cuda = false) {
+    const auto& frames = frames_for(mode, profile);
+    const auto& ls = frames.scan;
+    std::string reason;
+    if (cuda && !ouster_ros::cuda_backend_supports({}, reason))
+        throw std::runtime_error(reason);
+    auto serializer =
+        cuda ? ouster_ros::make_cuda_point_cloud_serializer(point_type,
+                                                            frames.info)
+             : ouster_ros::make_point_cloud_serializer(point_type,
+                                                       frames.info);
+    sensor_msgs::PointCloud2 msg, destaggered_msg;
+    serializer->layout(msg);
+    serializer->layout(destaggered_msg);
+    Eigen::Ref<const ouster::img_t<uint32_t>> range =
+        ls.field<uint32_t>(ChanField::RANGE);
+    const auto reflectivity =
+        ouster_ros::get_field_view(ChanField::REFLECTIVITY, ls);
+    const auto near_ir = ouster_ros::get_field_view(ChanField::NEAR_IR, ls);
+    const auto signal = ouster_ros::get_field_view(ChanField::SIGNAL, ls);
+    FrameReport report(state, frames.points());
+    for (auto _ : state) {
+        serializer->serialize(staggered ? &msg : nullptr,
+                              destagger ? &destaggered_msg : nullptr, ls,
+                              scan_start(ls), range, reflectivity, near_ir,
+                              signal);
+        benchmark::ClobberMemory();
+    }
+}
+
+void BM_PacketToImuMsg(benchmark::State& state, sensor::lidar_mode mode,
+                       sensor::UDPProfileLidar profile) {
+    const auto& frames = frames_for(mode, profile);
+    const auto& pf = sensor::get_format(frames.info);
+    const ros::Time stamp(1, 0);
+    const std::string frame = "os_imu";
+    FrameReport report(state, 1);
+    for (auto _ : state) {
+        auto msg = ouster_ros::packet_to_imu_msg(frames.imu_packet.data(),
+                                                 stamp, frame, pf);
+        benchmark::DoNotOptimize(msg);
+    }
+}
+
+// the per frame stages of the image generation: destaggering, exposure
+// correction and conversion to 16 bit pixels of each image
+void BM_ImagePipeline(benchmark::State& state, sensor::lidar_mode mode,
+                      sensor::UDPProfileLidar profile) {
+    const auto& frames = frames_for(mode, profile);
+    const auto& ls = frames.scan;
+    const auto& shifts = frames.pixel_shift_by_row;
+    const size_t H = ls.h;
+    const size_t W = ls.w;
+    ouster::viz::AutoExposure signal_ae, reflec_ae, nearir_ae;
+    ouster::viz::BeamUniformityCorrector nearir_buc;
+    ouster::img_t<uint16_t> pixels(H, W);
+    ouster::img_t<float> image(H, W);
+
+    auto to_image = [&](ChanField f) {
+        ouster_ros::get_field_view(f, ls).read(0, H * W, image.data());
+        image = ouster::destagger<float>(image, shifts);
+    };
+
+    FrameReport report(state, frames.points());
+    for (auto _ : state) {
+        auto range = ouster::destagger<uint32_t>(
+            ls.field<uint32_t>(ChanField::RANGE), shifts);
+        pixels = ((range + 0b10) / 4)
+                     .min(std::numeric_limits<uint16_t>::max())
+                     .cast<uint16_t>();
+        benchmark::DoNotOptimize(pixels.data());
+
+        to_image(ChanField::SIGNAL);
+        signal_ae(image);
+        pixels = (image.sqrt() * 65535.0f).cast<uint16_t>();
+        benchmark::DoNotOptimize(pixels.data());
+
+        to_image(ChanField::REFLECTIVITY);
+        reflec_ae(image);
+        pixels = (image * 65535.0f).cast<uint16_t>();
+        benchmark::DoNotOptimize(pixels.data());
+
+        to_image(ChanField::NEAR_IR);
+        nearir_buc(image);
+        nearir_ae(image);
+        pixels = (image.sqrt() * 65535.0f).cast<uint16_t>();
+        benchmark::DoNotOptimize(pixels.data());
+    }
+}
+
+void register_benchmarks() {
+    for (auto mode : lidar_modes) {
+        for (auto profile : lidar_profiles) {
+            const std::string suffix = "/" + sensor::to_string(mode) + "/" +
+                                       sensor::to_string(profile);
+            // frames of a profile the packet layout isn't known for are
+            // reported as errors
+            auto reg = [&suffix](const std::string& name, auto fn) {
+                benchmark::RegisterBenchmark(
+                    (name + suffix).c_str(),
+                    [fn](benchmark::State& s) {
+                        try {
+                            fn(s);
+                        } catch (const std::exception& e) {
+                            s.SkipWithError(e.what());
+                        }
+                    })
+                    ->Unit(benchmark::kMicrosecond);
+            };
+
+            reg("ScanBatcher", [=](benchmark::State& s) {
+                BM_ScanBatcher(s, mode, profile);
+            });
+            reg("ScanToCloudF", [=](benchmark::State& s) {
+                BM_ScanToCloudF<ouster_ros::Point>(s, mode, profile, false);
+            });
+            reg("ScanToCloudF_destagger", [=](benchmark::State& s) {
+                BM_ScanToCloudF<ouster_ros::Point>(s, mode, profile, true);
+            });
+            reg("CloudDestagger", [=](benchmark::State& s) {
+                BM_CloudDestagger(s, mode, profile);
+            });
+            reg("CloudToCloudMsg", [=](benchmark::State& s) {
+                BM_CloudToCloudMsg(s, mode, profile);
+            });
+            for (const std::string point_type :
+                 {"original", "xyz", "xyzi", "xyzirt"}) {
+                reg("Serialize_" + point_type, [=](benchmark::State& s) {
+                    BM_Serialize(s, mode, profile, point_type, true, true);
+                });
+                // skipped unless built with BUILD_CUDA on a host with a device
+                reg("SerializeCuda_" + point_type, [=](benchmark::State& s) {
+                    BM_Serialize(s, mode, profile, point_type, true, true,
+                                 true);
+                });
+            }
+            reg("PacketToImuMsg", [=](benchmark::State& s) {
+                BM_PacketToImuMsg(s, mode, profile);
+            });
+            reg("ImagePipeline", [=](benchmark::State& s) {
+                BM_ImagePipeline(s, mode, profile);
+            });
+        }
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    register_benchmarks();
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
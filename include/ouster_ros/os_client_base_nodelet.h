@@ -7,6 +7,8 @@
  *
  */
 
+#pragma once
+
 #include <nodelet/nodelet.h>
 #include <ros/ros.h>
 
@@ -25,9 +27,16 @@ class OusterClientBase : public nodelet::Nodelet {
 
     void display_lidar_info(const ouster::sensor::sensor_info& info);
 
+    /**
+     * Publish cached_metadata on the latched metadata topic, which lets the
+     * consumers follow the changes of the sensor configuration
+     */
+    void publish_metadata();
+
    protected:
     ouster::sensor::sensor_info info;
     ros::ServiceServer get_metadata_srv;
+    ros::Publisher metadata_pub;
     std::string cached_metadata;
 };
 
@@ -0,0 +1,115 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_cuda_point_cloud_kernels.h
+ * @brief Device side of the CUDA point cloud backend
+ *
+ * Kept free of ROS, PCL and Eigen so that it compiles with nvcc alone; only
+ * built with the BUILD_CUDA option.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace ouster_ros {
+namespace cuda {
+
+/**
+ * Byte offsets of the values within a point record, -1 for the values the
+ * point type doesn't hold
+ */
+struct PointLayout {
+    uint32_t step;
+    int32_t x;
+    int32_t y;
+    int32_t z;
+    // the fourth coordinate of the PCL aligned point types, always 1
+    int32_t w;
+    int32_t intensity;
+    int32_t t;
+    int32_t reflectivity;
+    int32_t ring;
+    int32_t ambient;
+    int32_t range;
+};
+
+/**
+ * A host channel field in its native element type, empty when size is 0
+ */
+struct ChannelView {
+    const void* data;
+    // the size of an element in bytes: 0, 1, 2, 4 or 8
+    int size;
+};
+
+/**
+ * Owns the device copies of the xyz lut and the destaggering remap of a
+ * sensor, along with the device and pinned host buffers a frame goes through.
+ * Calls must not overlap.
+ */
+class CloudKernels {
+   public:
+    /**
+     * Upload the tables of a sensor
+     * @param[in] width the columns of a scan
+     * @param[in] height the rows of a scan
+     * @param[in] lut the direction then the offset of every pixel, one
+     * contiguous array of width * height entries per axis
+     * @param[in] destaggered_index the index of every pixel within the
+     * destaggered cloud
+     * @param[in] layout the point record to write
+     * @throw std::runtime_error if the device can't be set up
+     */
+    CloudKernels(uint32_t width, uint32_t height, const float* lut,
+                 const uint32_t* destaggered_index, const PointLayout& layout);
+
+    ~CloudKernels();
+
+    CloudKernels(const CloudKernels&) = delete;
+    CloudKernels& operator=(const CloudKernels&) = delete;
+
+    /**
+     * Upload rows [row_begin, row_end) of a scan, write their point records
+     * in a single kernel launch and copy them back through pinned memory
+     * @param[in] range the range channel of the scan
+     * @param[in] signal the signal channel of the scan
+     * @param[in] reflectivity the reflectivity channel of the scan
+     * @param[in] near_ir the near ir channel of the scan
+     * @param[in] timestamps the column timestamps of the scan
+     * @param[in] scan_ts the start of the scan in nanoseconds
+     * @param[in] range_min the smallest range kept
+     * @param[in] range_span ranges above range_min + range_span are dropped
+     * @param[in] rotations the row major rotation of every column as nine
+     * arrays of width entries, may be null
+     * @param[in] row_begin the first row to write
+     * @param[in] row_end one past the last row to write
+     * @param[out] staggered the records of the whole staggered cloud, of
+     * which only the rows written are touched; may be null
+     * @param[out] destaggered same as staggered for the destaggered cloud
+     * @param[out] error the reason of a failure
+     * @return false if the device failed
+     */
+    bool convert(const uint32_t* range, ChannelView signal,
+                 ChannelView reflectivity, ChannelView near_ir,
+                 const uint64_t* timestamps, uint64_t scan_ts,
+                 uint32_t range_min, uint32_t range_span,
+                 const float* rotations, uint32_t row_begin, uint32_t row_end,
+                 uint8_t* staggered, uint8_t* destaggered, std::string& error);
+
+    /**
+     * @param[out] reason why no device can be used
+     * @return whether a CUDA device is available
+     */
+    static bool device_available(std::string& reason);
+
+   private:
+    struct Device;
+    Device* device;
+};
+
+}  // namespace cuda
+}  // namespace ouster_ros
@@ -0,0 +1,46 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_cuda_point_cloud_serializer.h
+ * @brief Generates the point clouds on a CUDA device
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "ouster_ros/os_point_cloud_serializer.h"
+
+namespace ouster_ros {
+
+/**
+ * Check whether the CUDA backend can generate the point clouds, which takes
+ * ouster_ros built with the BUILD_CUDA option and a CUDA device
+ * @param[in] filter the output stages of the full frame clouds, the backend
+ * only implements the range bounds
+ * @param[out] reason why the backend can't be used
+ * @return whether the backend can be used
+ */
+bool cuda_backend_supports(const CloudFilter& filter, std::string& reason);
+
+/**
+ * Create a serializer that keeps the xyz lut and the destaggering remap
+ * resident on the CUDA device, uploads the channels of every scan and writes
+ * the staggered and destaggered records of a return in a single kernel launch
+ * before copying them back through pinned memory. Sectors, and frames the
+ * device fails to convert, are serialized by the cpu serializer, which remains
+ * the reference.
+ * @param[in] point_type one of "original", "xyz", "xyzi" or "xyzirt"
+ * @param[in] info sensor metadata providing the cloud dimensions, the xyz
+ * lut and the destaggering shifts
+ * @param[in] filter the output stages of the full frame clouds
+ * @return the serializer, or a null pointer if the point type is unknown or
+ * cuda_backend_supports() fails
+ */
+std::unique_ptr<PointCloudSerializer> make_cuda_point_cloud_serializer(
+    const std::string& point_type, const sensor::sensor_info& info,
+    const CloudFilter& filter = {});
+
+}  // namespace ouster_ros
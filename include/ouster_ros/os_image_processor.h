@@ -0,0 +1,120 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_image_processor.h
+ * @brief Generates and publishes the range, signal, reflectivity and near ir
+ * images of a sensor
+ */
+
+#pragma once
+
+// prevent clang-format from altering the location of "ouster_ros/ros.h", the
+// header file needs to be the first include due to PCL_NO_PRECOMPILE flag
+// clang-format off
+#include "ouster_ros/os_ros.h"
+// clang-format on
+
+#include <ros/ros.h>
+#include <sensor_msgs/Image.h>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "ouster/image_processing.h"
+#include "ouster_ros/os_message_pool.h"
+
+namespace ouster_ros {
+
+/**
+ * Publishes the destaggered range_image, signal_image and reflec_image of
+ * every return (suffixed with 2 for the second return) and the nearir_image.
+ * Images are generated either straight from the channel fields of a LidarScan
+ * or from a point cloud of ouster_ros::Point, and only for the topics that
+ * have subscribers. Please bear in mind that there is rounding/clamping to
+ * display 8 bit images.
+ *
+ * Rows are destaggered with two contiguous copies each into persistent work
+ * buffers, the auto exposure runs in place on those buffers and the scaled
+ * pixels are written in a single pass into pooled messages, so no memory is
+ * allocated per frame.
+ */
+class ImageProcessor {
+   public:
+    using pixel_type = uint16_t;
+
+    /**
+     * @param[in] info sensor metadata
+     * @param[in] nh the node handle used to advertise the image topics
+     * @param[in] on_connection invoked whenever a subscriber connects to or
+     * disconnects from one of the image topics, may be empty
+     * @param[in] queue_size the depth of the publish queues of the images
+     */
+    ImageProcessor(const sensor::sensor_info& info, ros::NodeHandle& nh,
+                   const ros::SubscriberStatusCallback& on_connection =
+                       ros::SubscriberStatusCallback(),
+                   int queue_size = 100);
+
+    /**
+     * @param[in] return_index index of the return starting at 0
+     * @return whether any image of the return has subscribers
+     */
+    bool has_subscribers(int return_index) const;
+
+    /**
+     * @return whether any image has subscribers
+     */
+    bool has_subscribers() const;
+
+    /**
+     * Generate the images of every return from the channel fields of a scan
+     * and publish them
+     * @param[in] ls the scan to convert
+     * @param[in] scan_ts scan start, unused by the images
+     * @param[in] msg_ts the timestamp to apply to the published messages
+     */
+    void operator()(const ouster::LidarScan& ls,
+                    std::chrono::nanoseconds scan_ts, const ros::Time& msg_ts);
+
+    /**
+     * Generate the images of a return from its staggered point cloud and
+     * publish them
+     * @param[in] cloud the staggered cloud of the return
+     * @param[in] return_index index of the return starting at 0
+     * @param[in] msg_ts the timestamp to apply to the published messages
+     */
+    void operator()(const Cloud& cloud, int return_index,
+                    const ros::Time& msg_ts);
+
+   private:
+    // Source holds the range, signal, reflec and nearir channels of a return,
+    // each read like a FieldView, see the sources in the implementation
+    template <typename Source>
+    void process(int return_index, const ros::Time& msg_ts,
+                 const Source& source);
+
+    sensor_msgs::ImagePtr make_image_msg(const ros::Time& stamp);
+
+    sensor::sensor_info info;
+    int n_returns;
+    // the shift of every row reduced to [0, width)
+    std::vector<size_t> row_shift;
+
+    ouster::img_t<uint32_t> range_buf;
+    ouster::img_t<float> signal_buf;
+    ouster::img_t<float> reflec_buf;
+    ouster::img_t<float> nearir_buf;
+    std::unique_ptr<MessagePool<sensor_msgs::Image>> image_pool;
+
+    ros::Publisher nearir_image_pub;
+    std::vector<ros::Publisher> range_image_pubs;
+    std::vector<ros::Publisher> signal_image_pubs;
+    std::vector<ros::Publisher> reflec_image_pubs;
+
+    ouster::viz::AutoExposure nearir_ae, signal_ae, reflec_ae;
+    ouster::viz::BeamUniformityCorrector nearir_buc;
+};
+
+}  // namespace ouster_ros
@@ -0,0 +1,65 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_imu_packet_handler.h
+ * @brief Converts imu packets to ROS imu messages and publishes them
+ */
+
+#pragma once
+
+#include <ros/ros.h>
+#include <sensor_msgs/Imu.h>
+
+#include <memory>
+#include <string>
+
+#include <ouster/types.h>
+
+#include "ouster_ros/ImuBatchMsg.h"
+#include "ouster_ros/os_message_pool.h"
+
+namespace ouster_ros {
+
+/**
+ * Publishes the imu messages decoded from raw imu packets on the imu topic.
+ * Messages are taken from a pool and only their measurements are written per
+ * packet. Optionally, consecutive samples are also published together on the
+ * imu_batch topic, in which case the imu topic is only published while it has
+ * subscribers.
+ */
+class ImuPacketHandler {
+   public:
+    /**
+     * @param[in] info sensor metadata
+     * @param[in] nh the node handle used to advertise the imu topics
+     * @param[in] imu_frame the frame of the published imu messages
+     * @param[in] use_ros_time whether to stamp messages with the ROS time
+     * rather than the sensor time
+     * @param[in] batch_size the number of samples of an imu_batch message,
+     * zero disables the batches
+     */
+    ImuPacketHandler(const ouster::sensor::sensor_info& info,
+                     ros::NodeHandle& nh, const std::string& imu_frame,
+                     bool use_ros_time, size_t batch_size = 0);
+
+    /**
+     * Process a raw imu packet
+     * @param[in] packet_buf the raw imu packet
+     */
+    void operator()(const uint8_t* packet_buf);
+
+   private:
+    const ouster::sensor::packet_format& pf;
+    bool use_ros_time;
+    ros::Publisher imu_pub;
+    std::unique_ptr<MessagePool<sensor_msgs::Imu>> imu_pool;
+
+    size_t batch_size;
+    ros::Publisher imu_batch_pub;
+    std::unique_ptr<MessagePool<ImuBatchMsg>> batch_pool;
+    ImuBatchMsg::Ptr batch;
+    size_t batch_count = 0;
+};
+
+}  // namespace ouster_ros
@@ -0,0 +1,149 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_lidar_packet_handler.h
+ * @brief Assembles lidar packets into complete LidarScan objects
+ */
+
+#pragma once
+
+#include <ros/ros.h>
+
+#include <chrono>
+#include <functional>
+#include <memory>
+
+#include <ouster/lidar_scan.h>
+#include <ouster/types.h>
+
+#include "ouster_ros/os_scan_pipeline.h"
+#include "ouster_ros/os_stats.h"
+
+namespace ouster_ros {
+
+/**
+ * Feeds raw lidar packets to a ScanBatcher and hands every complete scan over
+ * to a callback along with the timestamps that should be applied to the
+ * messages generated from it. The callback either runs on the thread feeding
+ * the packets, or on the worker of a ScanPipeline when several scan buffers
+ * or a shared pool are requested.
+ */
+class LidarPacketHandler {
+   public:
+    /**
+     * @param[in] ls the completed scan
+     * @param[in] scan_ts the timestamp of the first valid column of the scan
+     * @param[in] msg_ts the timestamp to apply to messages generated from
+     * the scan, depends on the active timestamp mode
+     */
+    using ScanCallback = ScanPipeline::ScanCallback;
+
+    /**
+     * @param[in] ls the scan being assembled
+     * @param[in] col_begin the first column of the sector
+     * @param[in] col_end one past the last column of the sector
+     * @param[in] sector_ts the timestamp of the first valid column of the
+     * sector
+     * @param[in] msg_ts the timestamp to apply to messages generated from
+     * the sector, depends on the active timestamp mode
+     */
+    using SectorCallback = std::function<void(
+        const ouster::LidarScan& ls, uint32_t col_begin, uint32_t col_end,
+        std::chrono::nanoseconds sector_ts, const ros::Time& msg_ts)>;
+
+    /**
+     * @param[in] info sensor metadata
+     * @param[in] use_ros_time whether messages should be stamped with the ROS
+     * time at which packets are received rather than the sensor time
+     * @param[in] on_scan invoked with every complete scan
+     * @param[in] scan_buffers the number of scan buffers; with more than one
+     * on_scan runs on a dedicated thread while the next scans are assembled
+     * @param[in] conversion_cpu when non negative and scan_buffers is more
+     * than one, the thread running on_scan is pinned to that cpu
+     * @param[in] stats when given, records the time spent assembling and
+     * converting every scan and the latency from the packet completing a scan
+     * to the return of on_scan
+     * @param[in] pool when given, on_scan runs on that pool shared with other
+     * handlers rather than on a dedicated thread, with at least two scan
+     * buffers; conversion_cpu is then ignored
+     */
+    LidarPacketHandler(const ouster::sensor::sensor_info& info,
+                       bool use_ros_time, ScanCallback on_scan,
+                       size_t scan_buffers = 1, int conversion_cpu = -1,
+                       std::shared_ptr<PipelineStats> stats = nullptr,
+                       std::shared_ptr<WorkStealingPool> pool = nullptr);
+
+    /**
+     * Process a raw lidar packet
+     * @param[in] packet_buf the raw lidar packet
+     * @param[in] packet_receive_time the time at which the packet was received
+     */
+    void operator()(const uint8_t* packet_buf,
+                    const ros::Time& packet_receive_time);
+
+    /**
+     * Additionally hand every sector of consecutive columns over to a
+     * callback as soon as its last packet is processed, on the thread feeding
+     * the packets. The last sector of a frame holds the remaining columns. A
+     * sector missing packets is handed over once a packet past it is
+     * processed, with the columns of the lost packets left invalid.
+     * @param[in] sector_columns the number of columns of a sector, a multiple
+     * of the columns per packet
+     * @param[in] on_sector invoked with every complete sector
+     */
+    void set_sector_callback(uint32_t sector_columns, SectorCallback on_sector);
+
+   private:
+    ouster::LidarScan& current_scan() {
+        return pipeline ? pipeline->writable() : ls;
+    }
+
+    // feed a packet to the batcher, true once it completes a scan
+    bool batch_packet(const uint8_t* packet_buf);
+
+    // hand the assembled scan over, stamped with msg_ts if given or with the
+    // scan start otherwise; false if the scan has no valid column
+    bool complete_scan(const ros::Time* msg_ts);
+
+    // track the columns written by a packet and emit the completed sectors
+    void track_sector(const uint8_t* packet_buf);
+
+    // emit the sectors of the columns [emitted_end, col_end), one per sector
+    // boundary crossed, skipping the sectors with no valid column
+    void emit_sectors(uint32_t col_end);
+
+    void emit_sector(uint32_t col_begin, uint32_t col_end);
+
+    void handle_sensor_time(const uint8_t* packet_buf);
+
+    void handle_ros_time(const uint8_t* packet_buf,
+                         const ros::Time& packet_receive_time);
+
+    const ouster::sensor::packet_format& pf;
+    std::unique_ptr<ouster::ScanBatcher> scan_batcher;
+    ouster::LidarScan ls;
+    std::unique_ptr<ScanPipeline> pipeline;
+    bool use_ros_time;
+    ros::Time frame_ts;
+    ScanCallback on_scan;
+
+    uint32_t columns_per_frame;
+    uint32_t sector_columns = 0;
+    SectorCallback on_sector;
+    // one past the last column written in the current frame
+    uint32_t written_end = 0;
+    uint32_t emitted_end = 0;
+    ros::Time sector_receive_ts;
+
+    std::shared_ptr<PipelineStats> stats;
+    LatencyHistogram* batching_time = nullptr;
+    LatencyHistogram* conversion_time = nullptr;
+    LatencyHistogram* scan_latency = nullptr;
+    StatsCounter* scan_count = nullptr;
+    // time spent batching the packets of the scan being assembled
+    std::chrono::nanoseconds scan_batching{0};
+    StageTimer::clock::time_point packet_received_at;
+};
+
+}  // namespace ouster_ros
@@ -0,0 +1,126 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_message_pool.h
+ * @brief A pool of preallocated ROS messages that are recycled once all of
+ * their subscribers have released them
+ */
+
+#pragma once
+
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace ouster_ros {
+
+/**
+ * Hands out shared pointers to preallocated messages. Publishing these
+ * pointers allows nodelets in the same manager to receive the message without
+ * a copy, while the custom deleter returns the message to the pool (with its
+ * buffers intact) once the last subscriber drops it. When the pool runs dry a
+ * new message is allocated, so the pool grows until it matches the number of
+ * messages in flight and stops allocating from there on.
+ */
+template <typename MsgT>
+class MessagePool {
+   public:
+    using Ptr = boost::shared_ptr<MsgT>;
+    using Initializer = std::function<void(MsgT&)>;
+
+    /**
+     * @param[in] capacity the number of messages to preallocate
+     * @param[in] init invoked once on every newly allocated message, use it to
+     * size the message buffers
+     */
+    explicit MessagePool(size_t capacity, Initializer init = Initializer())
+        : state(boost::make_shared<State>()) {
+        state->init = std::move(init);
+        state->free.reserve(capacity);
+        for (size_t i = 0; i < capacity; ++i)
+            state->free.push_back(state->allocate());
+    }
+
+    /**
+     * Get a message from the pool, the content of the message is whatever
+     * was left by its previous user.
+     * @return a shared pointer that recycles the message on release
+     */
+    Ptr acquire() {
+        std::unique_ptr<MsgT> msg;
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (!state->free.empty()) {
+                msg = std::move(state->free.back());
+                state->free.pop_back();
+            }
+        }
+        if (!msg) msg = state->allocate();
+        return Ptr(msg.release(), Recycler{state});
+    }
+
+    /**
+     * @return the number of messages that are ready to be acquired
+     */
+    size_t available() const {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        return state->free.size();
+    }
+
+    /**
+     * @return the number of messages handed out and not released yet, e.g.
+     * the ones waiting in subscriber queues
+     */
+    size_t in_use() const {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        return state->allocated - state->free.size();
+    }
+
+   private:
+    struct State {
+        std::unique_ptr<MsgT> allocate() {
+            std::unique_ptr<MsgT> msg(new MsgT());
+            if (init) init(*msg);
+            std::lock_guard<std::mutex> lock(mutex);
+            ++allocated;
+            return msg;
+        }
+
+        mutable std::mutex mutex;
+        size_t allocated = 0;
+        std::vector<std::unique_ptr<MsgT>> free;
+        Initializer init;
+    };
+
+    // holds a weak reference so that messages still in flight when the pool
+    // goes away are simply deleted
+    struct Recycler {
+        boost::weak_ptr<State> state;
+
+        void operator()(MsgT* msg) {
+            std::unique_ptr<MsgT> owned(msg);
+            if (auto s = state.lock()) {
+                std::lock_guard<std::mutex> lock(s->mutex);
+                s->free.push_back(std::move(owned));
+            }
+        }
+    };
+
+    boost::shared_ptr<State> state;
+};
+
+/**
+ * Size a pool of the frame sized messages of a processor: a couple of
+ * messages per topic covers the ones still held by subscribers while the next
+ * one is filled
+ * @param[in] topics the number of topics the messages are published on
+ * @return the number of messages to preallocate
+ */
+inline size_t frame_pool_capacity(size_t topics) { return 2 * topics; }
+
+}  // namespace ouster_ros
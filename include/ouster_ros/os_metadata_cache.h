@@ -0,0 +1,158 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_metadata_cache.h
+ * @brief Shares the parsed sensor metadata and its xyz lut within a process
+ * and persists them across restarts
+ */
+
+#pragma once
+
+#include <ros/ros.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <ouster/lidar_scan.h>
+#include <ouster/types.h>
+
+namespace ouster_ros {
+
+/**
+ * The metadata of a sensor as served by the get_metadata service, parsed,
+ * along with the single precision xyz lut the point clouds are computed with.
+ * The lut is only computed once it's first asked for.
+ */
+class SensorMetadata {
+   public:
+    /**
+     * @param[in] json the metadata
+     * @param[in] info the metadata parsed by sensor::parse_metadata()
+     */
+    SensorMetadata(std::string json, ouster::sensor::sensor_info info);
+
+    /**
+     * @param[in] json the metadata
+     * @param[in] info the metadata parsed by sensor::parse_metadata()
+     * @param[in] lut_direction the direction of every pixel, as computed by
+     * ouster::make_xyz_lut()
+     * @param[in] lut_offset the offset of every pixel
+     */
+    SensorMetadata(std::string json, ouster::sensor::sensor_info info,
+                   ouster::PointsF lut_direction, ouster::PointsF lut_offset);
+
+    const std::string& json() const { return metadata; }
+
+    const ouster::sensor::sensor_info& info() const { return sensor_info; }
+
+    const ouster::PointsF& lut_direction() const;
+
+    const ouster::PointsF& lut_offset() const;
+
+    /**
+     * Get the single precision xyz lut of a sensor, the point clouds gain
+     * nothing from computing their coordinates in double precision. The lut
+     * is shared with the metadata of the sensor alive in the process, if any,
+     * and computed otherwise.
+     * @param[in] info the parsed metadata of the sensor
+     * @param[out] lut_direction the direction of every pixel
+     * @param[out] lut_offset the offset of every pixel
+     */
+    static void lut_of(const ouster::sensor::sensor_info& info,
+                       ouster::PointsF& lut_direction,
+                       ouster::PointsF& lut_offset);
+
+   private:
+    void compute_lut() const;
+
+    std::string metadata;
+    ouster::sensor::sensor_info sensor_info;
+    mutable std::once_flag lut_computed;
+    mutable ouster::PointsF direction;
+    mutable ouster::PointsF offset;
+};
+
+/**
+ * Parse metadata, the nodelets of a process that parse the same metadata
+ * share the result, and its lut, for as long as one of them holds it
+ * @param[in] json the metadata
+ * @return the parsed metadata
+ * @throws std::runtime_error if the metadata is invalid
+ */
+std::shared_ptr<const SensorMetadata> make_sensor_metadata(
+    const std::string& json);
+
+/**
+ * Find the parsed metadata of a sensor that is alive in the process
+ * @param[in] info the parsed metadata to look for
+ * @return the metadata, or a null pointer if none matches
+ */
+std::shared_ptr<const SensorMetadata> find_sensor_metadata(
+    const ouster::sensor::sensor_info& info);
+
+/**
+ * Make the metadata served by a get_metadata service available to the
+ * nodelets of the process, replacing the previous one. To be called before
+ * the service is advertised.
+ * @param[in] service the resolved name of the service
+ * @param[in] metadata the metadata
+ */
+void share_sensor_metadata(const std::string& service,
+                           std::shared_ptr<const SensorMetadata> metadata);
+
+/**
+ * Get the metadata served by the get_metadata service of a node handle,
+ * straight from the nodelet serving it when it runs in the same process,
+ * through the service, which is waited for, otherwise
+ * @param[in] nh the node handle the service is resolved with
+ * @return the metadata, or a null pointer if the service call failed
+ */
+std::shared_ptr<const SensorMetadata> fetch_sensor_metadata(
+    ros::NodeHandle& nh);
+
+/**
+ * Persists the parsed metadata of sensors and their lut in versioned binary
+ * files of a directory, one per serial number and firmware revision, so that
+ * a restarted driver skips fetching and parsing the metadata and computing
+ * the lut. The file of the sensor last seen at a hostname is recorded along
+ * with the sensor config it was stored under, an entry is only loaded for the
+ * same hostname and config.
+ */
+class MetadataCache {
+   public:
+    /**
+     * @param[in] dir the directory holding the files, created if missing
+     * @throws std::runtime_error if the directory can't be created
+     */
+    explicit MetadataCache(std::string dir);
+
+    /**
+     * Load the entry of the sensor last stored for a hostname
+     * @param[in] hostname the hostname of the sensor
+     * @param[in] config the current config of the sensor, as printed by
+     * sensor::to_string()
+     * @return the metadata, shared with the process as make_sensor_metadata()
+     * would, or a null pointer if there is no entry, it is unreadable or
+     * was stored under another config
+     */
+    std::shared_ptr<const SensorMetadata> load(const std::string& hostname,
+                                               const std::string& config) const;
+
+    /**
+     * Store the entry of a sensor and record it as the one of its hostname,
+     * files are replaced atomically
+     * @param[in] hostname the hostname of the sensor
+     * @param[in] config the config the metadata was retrieved under
+     * @param[in] metadata the metadata
+     * @return false if the files couldn't be written
+     */
+    bool store(const std::string& hostname, const std::string& config,
+               const SensorMetadata& metadata) const;
+
+   private:
+    std::string dir;
+};
+
+}  // namespace ouster_ros
@@ -0,0 +1,176 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_metadata_listener.h
+ * @brief Follows the changes of the sensor metadata and switches the
+ * processing of a nodelet over to a pipeline rebuilt for them
+ */
+
+#pragma once
+
+#include <ros/ros.h>
+#include <std_msgs/String.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <ouster/types.h>
+
+#include "ouster_ros/os_metadata_cache.h"
+
+namespace ouster_ros {
+
+/**
+ * Subscribes to the latched metadata topic published along the get_metadata
+ * service and hands every metadata that differs from the current one over to
+ * a callback on a worker thread, so that rebuilding the processing never
+ * stalls the packet callbacks. Updates received while the callback runs are
+ * coalesced, only the latest one is handed over next.
+ */
+class MetadataListener {
+   public:
+    /**
+     * @param[in] metadata the parsed metadata, the callback runs with it
+     */
+    using MetadataCallback =
+        std::function<void(std::shared_ptr<const SensorMetadata> metadata)>;
+
+    /**
+     * @param[in] nh the node handle the metadata topic is resolved with
+     * @param[in] current the metadata the nodelet started with
+     * @param[in] on_metadata invoked on the worker thread with every change,
+     * exceptions are logged
+     */
+    MetadataListener(ros::NodeHandle& nh,
+                     std::shared_ptr<const SensorMetadata> current,
+                     MetadataCallback on_metadata);
+
+    ~MetadataListener();
+
+    MetadataListener(const MetadataListener&) = delete;
+    MetadataListener& operator=(const MetadataListener&) = delete;
+
+   private:
+    void metadata_handler(const std_msgs::String::ConstPtr& msg);
+    void worker_loop();
+
+    MetadataCallback on_metadata;
+    // the last metadata received, only used by the subscription callback
+    std::string current;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::string pending;
+    bool has_pending = false;
+    bool active = true;
+    std::thread worker;
+
+    ros::Subscriber metadata_sub;
+};
+
+/**
+ * Holds the pipeline a nodelet processes its messages with, and switches
+ * over to the one rebuilt for new metadata. Once suspend() is called the lidar
+ * packets are dropped, as they no longer match the active pipeline, until the
+ * pipeline staged for the new metadata takes over with the first packet of a
+ * new frame, so that a switch costs the frames received before the new
+ * pipeline is ready and the partial frame only. Readers hold the pipeline
+ * they were given, the one replaced is destroyed by its last reader.
+ * @tparam Pipeline the state the nodelet rebuilds for new metadata
+ */
+template <typename Pipeline>
+class PipelineSwitch {
+   public:
+    /**
+     * @return the active pipeline, null until the first activate()
+     */
+    std::shared_ptr<Pipeline> get() const {
+        return std::atomic_load(&active);
+    }
+
+    /**
+     * Make a pipeline the active one right away, for the initial pipeline
+     * and for inputs that hold whole frames
+     * @param[in] next the pipeline
+     */
+    void activate(std::shared_ptr<Pipeline> next) {
+        std::shared_ptr<Pipeline> discarded;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            discarded = std::move(staged);
+            switching.store(false);
+        }
+        auto previous = std::atomic_exchange(&active, std::move(next));
+    }
+
+    /**
+     * Drop the lidar packets until a pipeline is staged and takes over,
+     * discarding the one staged for previous metadata
+     */
+    void suspend() {
+        std::shared_ptr<Pipeline> previous;
+        std::lock_guard<std::mutex> lock(mutex);
+        previous = std::move(staged);
+        last_frame_id = -1;
+        switching.store(true);
+    }
+
+    /**
+     * Stage the pipeline that takes over on the next frame boundary
+     * @param[in] next the pipeline
+     * @param[in] info the metadata the pipeline was built for, which the
+     * frame ids of the packets are read with
+     */
+    void stage(std::shared_ptr<Pipeline> next,
+               const ouster::sensor::sensor_info& info) {
+        const auto& pf = ouster::sensor::get_format(info);
+        std::lock_guard<std::mutex> lock(mutex);
+        std::swap(staged, next);
+        staged_pf = &pf;
+        last_frame_id = -1;
+        switching.store(true);
+    }
+
+    /**
+     * @param[in] packet_buf the raw lidar packet about to be processed
+     * @return the pipeline to process the packet with, or null if it must be
+     * dropped
+     */
+    std::shared_ptr<Pipeline> for_lidar_packet(const uint8_t* packet_buf) {
+        if (!switching.load()) return get();
+
+        std::shared_ptr<Pipeline> next;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!staged) return nullptr;
+            const int frame_id = staged_pf->frame_id(packet_buf);
+            const bool boundary =
+                last_frame_id >= 0 && frame_id != last_frame_id;
+            last_frame_id = frame_id;
+            if (!boundary) return nullptr;
+            next = std::move(staged);
+            switching.store(false);
+        }
+        // the previous pipeline is released once its readers are done
+        auto previous = std::atomic_exchange(&active, next);
+        return next;
+    }
+
+   private:
+    std::shared_ptr<Pipeline> active;
+    std::atomic<bool> switching{false};
+
+    std::mutex mutex;
+    std::shared_ptr<Pipeline> staged;
+    const ouster::sensor::packet_format* staged_pf = nullptr;
+    int last_frame_id = -1;
+};
+
+}  // namespace ouster_ros
@@ -0,0 +1,95 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_motion_compensator.h
+ * @brief Integrates the imu to deskew the point clouds
+ */
+
+#pragma once
+
+// prevent clang-format from altering the location of "ouster_ros/ros.h", the
+// header file needs to be the first include due to PCL_NO_PRECOMPILE flag
+// clang-format off
+#include "ouster_ros/os_ros.h"
+// clang-format on
+
+#include <Eigen/Core>
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "ouster_ros/os_point_cloud_serializer.h"
+
+namespace ouster_ros {
+
+/**
+ * Keeps the recent angular velocities of the imu packets of a sensor and
+ * integrates them into the rotation of the sensor at the time of every column
+ * of a scan, relative to the start of the scan. The serializer applies those
+ * rotations while computing the points, so the clouds come out deskewed
+ * without another pass over them.
+ *
+ * Only the rotation is compensated: integrating the accelerations twice drifts
+ * too fast to correct the translation within a scan. The imu packets and the
+ * scans may be handled on different threads.
+ */
+class MotionCompensator {
+   public:
+    /**
+     * @param[in] info sensor metadata providing the imu packet format and the
+     * orientation of the imu in the sensor frame
+     * @param[in] history the number of imu samples kept, which must cover
+     * more than a scan
+     * @param[in] max_extrapolation how long past the last imu sample the
+     * angular velocity is assumed constant, scans ending later are not
+     * compensated
+     */
+    MotionCompensator(const sensor::sensor_info& info, size_t history = 256,
+                      std::chrono::nanoseconds max_extrapolation =
+                          std::chrono::milliseconds(50));
+
+    /**
+     * Record the angular velocity of a raw imu packet
+     * @param[in] packet_buf the raw imu packet
+     */
+    void add_imu_packet(const uint8_t* packet_buf);
+
+    /**
+     * Compute the rotation of every column of a scan relative to the start
+     * of the scan, columns without a timestamp get the identity
+     * @param[in] ls the scan, used for the column timestamps
+     * @param[in] scan_ts the start of the scan
+     * @param[out] rotations the rotations, sized to the scan width
+     * @return false if the imu samples don't cover the scan, the rotations
+     * are then left untouched
+     */
+    bool column_rotations(const ouster::LidarScan& ls,
+                          std::chrono::nanoseconds scan_ts,
+                          ColumnRotations& rotations);
+
+   private:
+    struct Sample {
+        uint64_t ts;
+        // in the sensor frame, in rad/s
+        Eigen::Vector3d angular_velocity;
+    };
+
+    const sensor::packet_format& pf;
+    Eigen::Matrix3d imu_to_sensor;
+    uint64_t max_extrapolation;
+
+    std::mutex mutex;
+    // a ring of the latest samples, oldest at head
+    std::vector<Sample> samples;
+    size_t head = 0;
+    size_t count = 0;
+
+    // the samples covering the scan being compensated, only touched by
+    // column_rotations()
+    std::vector<Sample> window;
+};
+
+}  // namespace ouster_ros
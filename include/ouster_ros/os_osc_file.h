@@ -0,0 +1,239 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_osc_file.h
+ * @brief Writes and reads lossless compressed recordings of sensor packets,
+ * chunked per lidar frame
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <ouster/types.h>
+
+struct ZSTD_CCtx_s;
+struct ZSTD_DCtx_s;
+
+namespace ouster_ros {
+
+/**
+ * The ouster scan chunks (.osc) format holds the metadata of the sensor
+ * followed by one chunk per lidar frame. A chunk holds the lidar packets of
+ * the frame and the imu packets received meanwhile, in receive order, along
+ * with their receive timestamps. Before the chunk is compressed with zstd the
+ * lidar packets are transposed: the column records of the frame, then the
+ * packet headers and footers, are split into planes of 16 bit words, each
+ * plane holding the same word of every record delta coded against the
+ * previous record. Slowly varying channels such as range, signal or the
+ * column timestamps turn into long runs of small values that compress well
+ * while decoding restores the packets bit for bit. Every chunk is
+ * self-contained, which allows seeking to any frame.
+ */
+namespace osc {
+
+/**
+ * @param[in] pf the packet format of the lidar packets
+ * @param[in] packets n consecutive lidar packets
+ * @param[in] n the number of packets
+ * @param[out] out n * pf.lidar_packet_size bytes, the transposed packets
+ */
+void transpose_lidar_packets(const ouster::sensor::packet_format& pf,
+                             const uint8_t* packets, size_t n, uint8_t* out);
+
+/**
+ * Inverse of transpose_lidar_packets()
+ * @param[in] pf the packet format of the lidar packets
+ * @param[in] planes the output of transpose_lidar_packets()
+ * @param[in] n the number of packets
+ * @param[out] packets n * pf.lidar_packet_size bytes, the restored packets
+ */
+void restore_lidar_packets(const ouster::sensor::packet_format& pf,
+                           const uint8_t* planes, size_t n, uint8_t* packets);
+
+}  // namespace osc
+
+/**
+ * Records packets to an .osc file. Packets are appended to the chunk of the
+ * current lidar frame from any single thread; complete chunks are encoded,
+ * compressed and written by a background thread so that the caller never
+ * waits on the disk. When the writer falls further behind than a bounded
+ * number of chunks, whole chunks are dropped and counted.
+ */
+class OscWriter {
+   public:
+    /**
+     * @param[in] file path of the file to create
+     * @param[in] metadata the sensor metadata, stored in the file
+     * @param[in] level the zstd compression level
+     * @param[in] max_pending the number of chunks that may wait for the
+     * writer thread
+     * @throws std::runtime_error if the file can't be created or the
+     * metadata is invalid
+     */
+    OscWriter(const std::string& file, const std::string& metadata,
+              int level = 1, size_t max_pending = 8);
+
+    /**
+     * Writes the last chunk and closes the file
+     */
+    ~OscWriter();
+
+    OscWriter(const OscWriter&) = delete;
+    OscWriter& operator=(const OscWriter&) = delete;
+
+    /**
+     * @param[in] buf a raw lidar packet
+     * @param[in] size the size of the packet, packets of any other size than
+     * the lidar packet size of the sensor are ignored
+     * @param[in] stamp the time at which the packet was received
+     */
+    void add_lidar_packet(const uint8_t* buf, size_t size,
+                          std::chrono::nanoseconds stamp);
+
+    /**
+     * @param[in] buf a raw imu packet
+     * @param[in] size the size of the packet, packets of any other size than
+     * the imu packet size of the sensor are ignored
+     * @param[in] stamp the time at which the packet was received
+     */
+    void add_imu_packet(const uint8_t* buf, size_t size,
+                        std::chrono::nanoseconds stamp);
+
+    /**
+     * @return the number of chunks dropped because the writer fell behind
+     */
+    size_t dropped_chunks() const { return dropped.load(); }
+
+   private:
+    struct Chunk {
+        // 1 for lidar packets, 0 for imu packets
+        std::vector<uint8_t> kinds;
+        std::vector<int64_t> stamps;
+        std::vector<uint8_t> lidar;
+        std::vector<uint8_t> imu;
+        size_t n_lidar = 0;
+        size_t n_imu = 0;
+        uint16_t frame_id = 0;
+
+        void clear();
+    };
+
+    void add_packet(bool lidar, const uint8_t* buf,
+                    std::chrono::nanoseconds stamp);
+    void submit();
+    void write_loop();
+    void write_chunk(const Chunk& chunk);
+
+    ouster::sensor::sensor_info info;
+    const ouster::sensor::packet_format& pf;
+    std::FILE* out = nullptr;
+    int level;
+    size_t max_pending;
+
+    std::unique_ptr<Chunk> current;
+    std::deque<std::unique_ptr<Chunk>> pending;
+    std::vector<std::unique_ptr<Chunk>> spare;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool active = true;
+    std::atomic<size_t> dropped{0};
+
+    // owned by the writer thread
+    std::vector<uint8_t> raw;
+    std::vector<uint8_t> compressed;
+    ZSTD_CCtx_s* cctx = nullptr;
+    std::thread writer;
+};
+
+/**
+ * Reads back the packets of an .osc file, one decompressed chunk at a time
+ */
+class OscReader {
+   public:
+    struct Packet {
+        bool lidar;
+        // valid until the next call to next(), seek() or rewind()
+        const uint8_t* data;
+        size_t size;
+        // receive time of the packet
+        std::chrono::nanoseconds stamp;
+    };
+
+    /**
+     * @param[in] file path of the .osc file
+     * @throws std::runtime_error if the file can't be read or isn't an .osc
+     * file
+     */
+    explicit OscReader(const std::string& file);
+
+    ~OscReader();
+
+    OscReader(const OscReader&) = delete;
+    OscReader& operator=(const OscReader&) = delete;
+
+    /**
+     * @return the sensor metadata stored in the file
+     */
+    const std::string& metadata() const { return metadata_json; }
+
+    /**
+     * @return the number of chunks, i.e. lidar frames, of the file
+     */
+    size_t chunk_count() const { return chunk_offsets.size(); }
+
+    /**
+     * Continue reading from the first packet of a chunk
+     * @param[in] chunk the index of the chunk
+     */
+    void seek(size_t chunk);
+
+    /**
+     * Restart from the first packet of the file
+     */
+    void rewind() { seek(0); }
+
+    /**
+     * Advance to the next packet
+     * @param[out] packet the packet
+     * @return false once the end of the file is reached
+     * @throws std::runtime_error if a chunk is corrupted
+     */
+    bool next(Packet& packet);
+
+   private:
+    bool load_chunk();
+
+    std::FILE* in = nullptr;
+    std::string metadata_json;
+    ouster::sensor::sensor_info info;
+    const ouster::sensor::packet_format* pf = nullptr;
+    std::vector<uint64_t> chunk_offsets;
+    size_t next_chunk = 0;
+
+    std::vector<uint8_t> compressed;
+    std::vector<uint8_t> raw;
+    std::vector<uint8_t> lidar_packets;
+    size_t n_packets = 0;
+    size_t packet_index = 0;
+    size_t lidar_index = 0;
+    size_t imu_index = 0;
+    const uint8_t* kinds = nullptr;
+    const uint8_t* imu_packets = nullptr;
+    int64_t stamp = 0;
+    const uint8_t* stamp_deltas = nullptr;
+    ZSTD_DCtx_s* dctx = nullptr;
+};
+
+}  // namespace ouster_ros
@@ -0,0 +1,77 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_packet_backlog.h
+ * @brief Discards whole frames of lidar packets once their processing falls
+ * behind the sensor
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <memory>
+
+#include <ouster/types.h>
+
+#include "ouster_ros/os_stats.h"
+
+namespace ouster_ros {
+
+/**
+ * Bounds the backlog of lidar packets queued ahead of a nodelet. The lag of
+ * the packets is the delay between the sensor timestamp of a packet and its
+ * processing, beyond the smallest delay observed over the last few seconds,
+ * which leaves out the offset between the sensor and the host clocks. When
+ * the first packet of a frame lags by more than the bound, the frame is
+ * discarded as a whole, which is much cheaper than assembling it and drains
+ * the queue, until the packets catch up. Frames are thus either processed
+ * whole or not at all, and the clouds stay fresh at the cost of completeness.
+ */
+class PacketBacklog {
+   public:
+    /**
+     * @param[in] info sensor metadata
+     * @param[in] max_lag the lag beyond which frames are discarded
+     * @param[in] stats when given, counts the frames discarded
+     */
+    PacketBacklog(const ouster::sensor::sensor_info& info,
+                  std::chrono::nanoseconds max_lag,
+                  std::shared_ptr<PipelineStats> stats = nullptr);
+
+    /**
+     * @param[in] packet_buf the raw lidar packet about to be processed
+     * @return false if the packet belongs to a discarded frame
+     */
+    bool admit(const uint8_t* packet_buf);
+
+    /**
+     * @return the number of frames discarded so far
+     */
+    uint64_t dropped_frames() const { return dropped; }
+
+   private:
+    using clock = std::chrono::steady_clock;
+
+    // the lag of a packet, or a negative value if it carries no timestamp
+    int64_t lag_of(const uint8_t* packet_buf, clock::time_point now);
+
+    const ouster::sensor::packet_format& pf;
+    int64_t max_lag;
+    int frame_id = -1;
+    bool discarding = false;
+    clock::time_point discarding_since;
+    uint64_t dropped = 0;
+
+    // the smallest delays of the current and the previous windows
+    clock::time_point window_start;
+    int64_t window_min = std::numeric_limits<int64_t>::max();
+    int64_t previous_min = std::numeric_limits<int64_t>::max();
+
+    std::shared_ptr<PipelineStats> stats;
+    StatsCounter* dropped_count = nullptr;
+};
+
+}  // namespace ouster_ros
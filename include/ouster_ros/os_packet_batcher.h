@@ -0,0 +1,89 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_packet_batcher.h
+ * @brief Groups consecutive lidar packets into PacketBatchMsg messages
+ */
+
+#pragma once
+
+#include <ros/ros.h>
+
+#include <memory>
+#include <string>
+
+#include <ouster/types.h>
+
+#include "ouster_ros/PacketBatchMsg.h"
+#include "ouster_ros/os_message_pool.h"
+
+namespace ouster_ros {
+
+namespace sensor = ouster::sensor;
+
+/**
+ * Accumulates lidar packets into batches drawn from a message pool. A batch is
+ * complete once it holds a given number of packets, once a packet belonging to
+ * the next frame arrives or once its time budget elapsed, depending on the
+ * selected mode. A time budget elapsing without a packet to notice it, in the
+ * dead zone of an azimuth window or while the stream pauses, is caught by
+ * expire().
+ */
+class LidarPacketBatcher {
+   public:
+    enum class Mode { COUNT, FRAME, TIME };
+
+    /**
+     * @param[in] info sensor metadata used to size the batches
+     * @param[in] mode the criteria used to complete a batch
+     * @param[in] count number of packets per batch when using Mode::COUNT
+     * @param[in] duration the time budget of a batch when using Mode::TIME
+     */
+    LidarPacketBatcher(const sensor::sensor_info& info, Mode mode, size_t count,
+                       ros::Duration duration);
+
+    /**
+     * Append a packet to the current batch
+     * @param[in] buf the raw lidar packet
+     * @param[in] stamp the time at which the packet was received
+     * @return the completed batch if adding the packet completed one or a null
+     * pointer otherwise
+     */
+    PacketBatchMsg::Ptr add(const uint8_t* buf, const ros::Time& stamp);
+
+    /**
+     * Hand over the current batch regardless of its completion
+     * @return the current batch, or a null pointer if it holds no packets
+     */
+    PacketBatchMsg::Ptr flush();
+
+    /**
+     * Hand over the current batch once its time budget elapsed, to be called
+     * periodically when using Mode::TIME
+     * @param[in] now the current time, on the clock of the packet stamps
+     * @return the expired batch, or a null pointer if there is none
+     */
+    PacketBatchMsg::Ptr expire(const ros::Time& now);
+
+   private:
+    const sensor::packet_format& pf;
+    Mode mode;
+    size_t count;
+    ros::Duration duration;
+    std::unique_ptr<MessagePool<PacketBatchMsg>> pool;
+    PacketBatchMsg::Ptr batch;
+    uint16_t batch_frame_id = 0;
+};
+
+/**
+ * Parse the name of a batching mode, as accepted by the packet_batch_mode
+ * parameter
+ * @param[in] mode_arg one of "count", "frame" or "time"
+ * @param[out] mode the parsed mode
+ * @return whether the name was recognized
+ */
+bool packet_batch_mode_of_string(const std::string& mode_arg,
+                                 LidarPacketBatcher::Mode& mode);
+
+}  // namespace ouster_ros
@@ -0,0 +1,150 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_packet_logger.h
+ * @brief Logs the received udp payloads straight to memory mapped pcap files
+ */
+
+#pragma once
+
+#include <ros/ros.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ouster_ros/os_stats.h"
+
+namespace ouster_ros {
+
+/**
+ * Appends packets to a series of preallocated segment files, each a classic
+ * pcap capture of raw IPv4 udp datagrams with nanosecond timestamps which
+ * PcapReader, and thus the replay nodelet, reads back. The datagrams carry
+ * the udp ports of the sensor with unspecified addresses.
+ *
+ * Logging a packet copies it into the memory mapping of the current segment
+ * without any system call. A flush thread writes the mapping back to disk
+ * behind the packets and releases the written pages, which bounds the memory
+ * held by the logger, faults in the pages ahead of the packets and keeps the
+ * next segment allocated and mapped so that switching segments never waits
+ * on the file system. Packets that find no room because the flush thread
+ * fell behind on preparing the next segment are dropped and counted.
+ */
+class PacketLogger {
+   public:
+    /**
+     * @param[in] prefix path prefix of the segment files, segment n is
+     * written to "<prefix>_<n>.pcap"
+     * @param[in] segment_size the size preallocated for every segment
+     * @param[in] lidar_port the udp port of the lidar packets
+     * @param[in] imu_port the udp port of the imu packets
+     * @param[in] stats the statistics to report to, null disables them
+     * @param[in] flush_period the time between two flushes
+     * @throws std::runtime_error if the first segment can't be created
+     */
+    PacketLogger(const std::string& prefix, size_t segment_size,
+                 uint16_t lidar_port, uint16_t imu_port,
+                 std::shared_ptr<PipelineStats> stats = nullptr,
+                 std::chrono::milliseconds flush_period =
+                     std::chrono::milliseconds(100));
+
+    /**
+     * Flushes the logged packets and truncates the last segment to its
+     * content
+     */
+    ~PacketLogger();
+
+    PacketLogger(const PacketLogger&) = delete;
+    PacketLogger& operator=(const PacketLogger&) = delete;
+
+    /**
+     * Log a lidar packet, to be called from a single thread
+     * @param[in] buf the packet
+     * @param[in] size the size of the packet
+     * @param[in] stamp the time at which the packet was received
+     * @return false if the packet was dropped
+     */
+    bool log_lidar_packet(const uint8_t* buf, size_t size,
+                          const ros::Time& stamp) {
+        return log(lidar_port, buf, size, stamp);
+    }
+
+    /**
+     * Log an imu packet, to be called from the thread logging lidar packets
+     * @param[in] buf the packet
+     * @param[in] size the size of the packet
+     * @param[in] stamp the time at which the packet was received
+     * @return false if the packet was dropped
+     */
+    bool log_imu_packet(const uint8_t* buf, size_t size,
+                        const ros::Time& stamp) {
+        return log(imu_port, buf, size, stamp);
+    }
+
+    /**
+     * @return the number of packets dropped so far
+     */
+    size_t dropped_packets() const { return dropped.load(); }
+
+   private:
+    struct Segment {
+        std::string path;
+        int fd = -1;
+        uint8_t* base = nullptr;
+        size_t size = 0;
+    };
+
+    struct Retired {
+        std::unique_ptr<Segment> segment;
+        size_t used;
+    };
+
+    bool log(uint16_t port, const uint8_t* buf, size_t size,
+             const ros::Time& stamp);
+    bool switch_segment();
+    std::unique_ptr<Segment> open_segment();
+    void close_segment(Segment& segment, size_t used);
+    void flush_loop();
+    void flush(Segment& segment, size_t begin, size_t end);
+
+    std::string prefix;
+    size_t segment_size;
+    uint16_t lidar_port;
+    uint16_t imu_port;
+    std::chrono::milliseconds flush_period;
+    size_t page_size;
+
+    // owned by the logging thread
+    std::unique_ptr<Segment> current;
+    size_t offset = 0;
+    uint16_t ip_id = 0;
+
+    // the part of the current segment the logging thread is done with
+    std::atomic<size_t> committed{0};
+    std::atomic<size_t> dropped{0};
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool active = true;
+    // the segment the flush thread follows, the current one once switched
+    Segment* flushing = nullptr;
+    std::unique_ptr<Segment> next;
+    std::vector<Retired> retired;
+    size_t segment_index = 0;
+
+    StatsCounter* logged_count = nullptr;
+    StatsCounter* dropped_count = nullptr;
+    LatencyHistogram* flush_time = nullptr;
+    std::thread flush_thread;
+};
+
+}  // namespace ouster_ros
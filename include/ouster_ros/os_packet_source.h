@@ -0,0 +1,72 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_packet_source.h
+ * @brief Reads recorded lidar and imu packets from bag, pcap and osc files
+ */
+
+#pragma once
+
+#include <ros/ros.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <ouster/types.h>
+
+namespace ouster_ros {
+
+/**
+ * A recorded packet
+ */
+struct ReplayPacket {
+    // whether it is a lidar or an imu packet
+    bool lidar;
+    // valid until the next call to PacketSource::next() or rewind()
+    const uint8_t* buf;
+    size_t size;
+    // the time at which the packet was received during the recording
+    ros::Time stamp;
+};
+
+/**
+ * Hands out the packets of a recording in the order they were received
+ */
+class PacketSource {
+   public:
+    virtual ~PacketSource() = default;
+
+    /**
+     * Advance to the next packet of the recording
+     * @param[out] packet the packet
+     * @return false once the end of the recording is reached
+     */
+    virtual bool next(ReplayPacket& packet) = 0;
+
+    /**
+     * Restart from the first packet of the recording
+     */
+    virtual void rewind() = 0;
+};
+
+/**
+ * Open a recording, the format is selected from the file extension:
+ * - .bag files recorded by record.launch, the lidar_packets, imu_packets and
+ *   lidar_packet_batches topics of any namespace are read
+ * - .pcap files captured from the sensor, udp datagrams are told apart by
+ *   their size, which identifies lidar and imu packets for the lidar profile
+ *   of the metadata. Given a segment <prefix>_<n>.pcap written by
+ *   PacketLogger, the segments that follow it are read as well
+ * - .osc files recorded by the OusterRecorder nodelet, see os_osc_file.h
+ * @param[in] file path of the recording
+ * @param[in] info sensor metadata of the recording
+ * @throws std::runtime_error if the file can't be opened
+ * @return the source reading the file
+ */
+std::unique_ptr<PacketSource> open_packet_source(
+    const std::string& file, const ouster::sensor::sensor_info& info);
+
+}  // namespace ouster_ros
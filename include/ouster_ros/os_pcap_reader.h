@@ -0,0 +1,101 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_pcap_reader.h
+ * @brief Reads the udp payloads of a pcap capture through a memory mapping
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace ouster_ros {
+
+/**
+ * Iterates over the udp datagrams of a classic pcap capture. The file is
+ * memory mapped and read ahead of the cursor in large windows, pages behind
+ * the cursor are released so the resident size stays bounded regardless of
+ * the size of the capture. Unfragmented datagrams are handed out straight
+ * from the mapping, IPv4 fragments are reassembled into an internal buffer.
+ * Ethernet (optionally VLAN tagged), Linux cooked and raw IP captures are
+ * supported.
+ */
+class PcapReader {
+   public:
+    struct Packet {
+        uint16_t dst_port;
+        // valid until the next call to next() or rewind()
+        const uint8_t* data;
+        size_t size;
+        // capture time of the packet, relative to the unix epoch
+        std::chrono::nanoseconds stamp;
+    };
+
+    /**
+     * @param[in] file path of the pcap file
+     * @throws std::runtime_error if the file can't be mapped or isn't a
+     * supported capture
+     */
+    explicit PcapReader(const std::string& file);
+
+    ~PcapReader();
+
+    PcapReader(const PcapReader&) = delete;
+    PcapReader& operator=(const PcapReader&) = delete;
+
+    /**
+     * Advance to the next udp datagram of the capture
+     * @param[out] packet the datagram
+     * @return false once the end of the capture is reached
+     */
+    bool next(Packet& packet);
+
+    /**
+     * Restart from the first packet of the capture
+     */
+    void rewind();
+
+   private:
+    // source address, destination address and identification
+    using FragmentKey = std::tuple<uint32_t, uint32_t, uint16_t>;
+
+    struct Fragments {
+        std::vector<uint8_t> data;
+        size_t received = 0;
+        // known once the last fragment arrives
+        size_t total = 0;
+        uint64_t seq = 0;
+    };
+
+    uint32_t read32(const uint8_t* p) const;
+
+    bool parse_frame(const uint8_t* frame, size_t len, Packet& packet);
+    bool parse_ipv4(const uint8_t* ip, size_t len, Packet& packet);
+    bool parse_ipv6(const uint8_t* ip, size_t len, Packet& packet);
+    bool parse_udp(const uint8_t* udp, size_t len, Packet& packet);
+
+    void read_ahead();
+
+    uint8_t* base = nullptr;
+    size_t file_size = 0;
+    size_t offset = 0;
+    size_t advised_end = 0;
+    size_t released_end = 0;
+
+    bool swapped = false;
+    bool nanosecond = false;
+    uint32_t link_type = 0;
+
+    std::map<FragmentKey, Fragments> fragments;
+    uint64_t fragment_seq = 0;
+    std::vector<uint8_t> assembled;
+};
+
+}  // namespace ouster_ros
@@ -28,6 +28,68 @@ struct EIGEN_ALIGN16 Point {
     uint32_t color;
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 };
+
+/**
+ * Compact point layouts, selected through the point_type parameter. Unlike
+ * Point these carry no alignment padding so their PointCloud2 records are as
+ * small as the fields they hold.
+ */
+struct PointXYZ {
+    float x;
+    float y;
+    float z;
+};
+
+struct PointXYZI {
+    float x;
+    float y;
+    float z;
+    float intensity;
+};
+
+struct PointXYZIRT {
+    float x;
+    float y;
+    float z;
+    float intensity;
+    uint32_t t;
+    uint16_t ring;
+};
+
+/**
+ * Fill a point from the values of a single pixel; each point type keeps the
+ * values it has room for and drops the rest.
+ */
+inline void set_point(Point& pt, float x, float y, float z, uint32_t signal,
+                      uint32_t t, uint16_t reflectivity, uint16_t ring,
+                      uint16_t near_ir, uint32_t range) {
+    pt = Point{{{x, y, z, 1.0f}},
+               static_cast<float>(signal),
+               t,
+               reflectivity,
+               ring,
+               near_ir,
+               range,
+               0};
+}
+
+inline void set_point(PointXYZ& pt, float x, float y, float z, uint32_t,
+                      uint32_t, uint16_t, uint16_t, uint16_t, uint32_t) {
+    pt = PointXYZ{x, y, z};
+}
+
+inline void set_point(PointXYZI& pt, float x, float y, float z,
+                      uint32_t signal, uint32_t, uint16_t, uint16_t, uint16_t,
+                      uint32_t) {
+    pt = PointXYZI{x, y, z, static_cast<float>(signal)};
+}
+
+inline void set_point(PointXYZIRT& pt, float x, float y, float z,
+                      uint32_t signal, uint32_t t, uint16_t, uint16_t ring,
+                      uint16_t, uint32_t) {
+    pt = PointXYZIRT{x, y, z, static_cast<float>(signal), t, ring};
+}
+
 }  // namespace ouster_ros
 
 // clang-format off
@@ -43,4 +105,26 @@ POINT_CLOUD_REGISTER_POINT_STRUCT(ouster_ros::Point,
     (std::uint16_t, ambient, ambient)
     (std::uint32_t, range, range)
 )
+
+POINT_CLOUD_REGISTER_POINT_STRUCT(ouster_ros::PointXYZ,
+    (float, x, x)
+    (float, y, y)
+    (float, z, z)
+)
+
+POINT_CLOUD_REGISTER_POINT_STRUCT(ouster_ros::PointXYZI,
+    (float, x, x)
+    (float, y, y)
+    (float, z, z)
+    (float, intensity, intensity)
+)
+
+POINT_CLOUD_REGISTER_POINT_STRUCT(ouster_ros::PointXYZIRT,
+    (float, x, x)
+    (float, y, y)
+    (float, z, z)
+    (float, intensity, intensity)
+    (std::uint32_t, t, t)
+    (std::uint16_t, ring, ring)
+)
 // clang-format on
@@ -0,0 +1,142 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_point_cloud_processor.h
+ * @brief Converts LidarScan objects into point cloud messages and publishes
+ * them
+ */
+
+#pragma once
+
+// prevent clang-format from altering the location of "ouster_ros/ros.h", the
+// header file needs to be the first include due to PCL_NO_PRECOMPILE flag
+// clang-format off
+#include "ouster_ros/os_ros.h"
+// clang-format on
+
+#include <ros/ros.h>
+#include <sensor_msgs/PointCloud2.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ouster_ros/os_message_pool.h"
+#include "ouster_ros/os_motion_compensator.h"
+#include "ouster_ros/os_point_cloud_serializer.h"
+#include "ouster_ros/os_stats.h"
+#include "ouster_ros/os_thread_pool.h"
+
+namespace ouster_ros {
+
+/**
+ * Generates the point clouds of every return of a LidarScan and publishes them
+ * on the points and/or destaggeredpoints topics. Both clouds are written in a
+ * single pass over the scan. Only the clouds that have subscribers are
+ * generated and only the channels read by the selected point type are
+ * read from the scan, in place and without copies. Given a thread pool, the rows of all returns are
+ * serialized concurrently and each return is published as soon as its last
+ * rows are written. Given a MotionCompensator, the rotations of the columns
+ * of a scan are integrated once and applied to the points of all returns.
+ */
+class PointCloudProcessor {
+   public:
+    /**
+     * @param[in] info sensor metadata
+     * @param[in] nh the node handle used to advertise the point cloud topics
+     * @param[in] sensor_frame the frame of the published point clouds
+     * @param[in] staggered whether to publish staggered point clouds
+     * @param[in] destagger whether to publish destaggered point clouds
+     * @param[in] serializer writes the points in the selected point type, see
+     * make_point_cloud_serializer()
+     * @param[in] thread_pool the pool splitting the conversion across cores,
+     * the conversion runs on the calling thread when null
+     * @param[in] stats when given, records the serialization time and the
+     * number of clouds still held by the publish queues and subscribers
+     * @param[in] motion_compensator when given, deskews the clouds of the
+     * scans its imu samples cover; the others are published as is
+     * @param[in] queue_size the depth of the publish queues of the clouds
+     */
+    PointCloudProcessor(
+        const sensor::sensor_info& info, ros::NodeHandle& nh,
+        const std::string& sensor_frame, bool staggered, bool destagger,
+        std::shared_ptr<const PointCloudSerializer> serializer,
+        std::shared_ptr<ThreadPool> thread_pool = nullptr,
+        std::shared_ptr<PipelineStats> stats = nullptr,
+        std::shared_ptr<MotionCompensator> motion_compensator = nullptr,
+        int queue_size = 10);
+
+    ~PointCloudProcessor();
+
+    /**
+     * Convert a scan to point clouds and publish them
+     * @param[in] ls the scan to convert
+     * @param[in] scan_ts scan start used to calculate relative timestamps for
+     * points
+     * @param[in] msg_ts the timestamp to apply to the published messages
+     * @param[in] dense the is_dense flag of the published messages, cleared
+     * to mark the clouds of incomplete scans
+     */
+    void operator()(const ouster::LidarScan& ls,
+                    std::chrono::nanoseconds scan_ts, const ros::Time& msg_ts,
+                    bool dense = true);
+
+   private:
+    // the clouds of a single return being generated
+    struct ReturnOutput {
+        FieldView reflectivity;
+        FieldView signal;
+        FieldView near_ir;
+        sensor_msgs::PointCloud2::Ptr pc_ptr;
+        sensor_msgs::PointCloud2::Ptr destaggeredpc_ptr;
+        std::atomic<size_t> remaining_chunks{0};
+    };
+
+    void serialize_chunk(const ouster::LidarScan& ls,
+                         std::chrono::nanoseconds scan_ts, int return_index,
+                         size_t chunk, const ColumnRotations* rotations);
+    void publish(int return_index);
+
+    sensor::sensor_info info;
+    int n_returns = 0;
+    bool staggered;
+    bool destagger;
+    std::string sensor_frame;
+
+    std::vector<ros::Publisher> lidar_pubs;
+    std::vector<ros::Publisher> destaggeredlidar_pubs;
+
+    std::shared_ptr<const PointCloudSerializer> serializer;
+    std::unique_ptr<MessagePool<sensor_msgs::PointCloud2>> cloud_pool;
+    std::shared_ptr<ThreadPool> thread_pool;
+    size_t chunks_per_return = 1;
+    std::unique_ptr<ReturnOutput[]> outputs;
+
+    std::shared_ptr<MotionCompensator> motion_compensator;
+    // the rotations of the scan being converted, reused across scans
+    ColumnRotations rotations;
+
+    std::shared_ptr<PipelineStats> stats;
+    LatencyHistogram* serialization_time = nullptr;
+    StatsCounter* uncompensated_count = nullptr;
+};
+
+/**
+ * Get the number of returns produced by a lidar profile
+ * @param[in] info sensor metadata
+ * @return 2 for dual return profiles, 1 otherwise
+ */
+int get_n_returns(const sensor::sensor_info& info);
+
+/**
+ * Get the suffix appended to topic names of a given return
+ * @param[in] return_index index of the return starting at 0
+ * @return an empty string for the first return, the one based index of the
+ * return otherwise
+ */
+std::string topic_suffix(int return_index);
+
+}  // namespace ouster_ros
@@ -0,0 +1,352 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_point_cloud_serializer.h
+ * @brief Writes LidarScan points straight into PointCloud2 messages
+ */
+
+#pragma once
+
+// prevent clang-format from altering the location of "ouster_ros/ros.h", the
+// header file needs to be the first include due to PCL_NO_PRECOMPILE flag
+// clang-format off
+#include "ouster_ros/os_ros.h"
+// clang-format on
+
+#include <pcl/conversions.h>
+#include <pcl_conversions/pcl_conversions.h>
+#include <ros/ros.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/PointField.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace ouster_ros {
+
+/**
+ * Describe the layout of a point type as PointCloud2 fields, the same way
+ * pcl::toROSMsg would
+ * @return the fields registered for PointT
+ */
+template <typename PointT>
+std::vector<sensor_msgs::PointField> make_point_fields() {
+    std::vector<pcl::PCLPointField> pcl_fields;
+    pcl::for_each_type<typename pcl::traits::fieldList<PointT>::type>(
+        pcl::detail::FieldAdder<PointT>(pcl_fields));
+    std::vector<sensor_msgs::PointField> fields;
+    pcl_conversions::fromPCL(pcl_fields, fields);
+    return fields;
+}
+
+/**
+ * Output stages of the full frame clouds applied while serializing them, so
+ * that the points they drop are never computed nor packed
+ */
+struct CloudFilter {
+    // keep every row_stride-th row and every column_stride-th column of the
+    // staggered, or destaggered, clouds
+    uint32_t row_stride = 1;
+    uint32_t column_stride = 1;
+    // bounds of the raw range channel in millimeters, a max_range of 0 keeps
+    // the points of any range
+    uint32_t min_range = 0;
+    uint32_t max_range = 0;
+    // windows of the beam directions in the sensor frame in degrees, an
+    // azimuth_min above azimuth_max selects a window wrapping through 180
+    double azimuth_min = -180.0;
+    double azimuth_max = 180.0;
+    double elevation_min = -90.0;
+    double elevation_max = 90.0;
+    // pack the kept points into unorganized clouds of a single row, without
+    // the points lacking a return
+    bool dense = false;
+
+    /**
+     * @return whether the filter selects a subset of the pixels or changes
+     * the layout of the clouds, range bounds alone do neither
+     */
+    bool selects() const;
+};
+
+/**
+ * Rotation of the sensor at the time of every column of a scan relative to its
+ * orientation at the start of the scan. Applied to the points of each column
+ * while serializing, it expresses all the points of the scan in the sensor
+ * frame at the start of the scan.
+ */
+struct ColumnRotations {
+    uint32_t columns = 0;
+    // the row major rotation matrices, one contiguous array of columns
+    // entries per matrix element: element (i, j) of column v is at
+    // (3 * i + j) * columns + v
+    std::vector<float> matrix;
+};
+
+/**
+ * Serializes the points of a LidarScan as point records directly into the
+ * data buffer of a PointCloud2 message. The message layout is computed once so
+ * that messages only need to be sized a single time, after which every frame
+ * is written in place without intermediate clouds. Staggered and destaggered
+ * clouds are written in the same pass through a precomputed index remap, and
+ * the cartesian coordinates are computed in that same pass from the xyz lut
+ * held by the serializer. Channels are read through views of the scan fields
+ * and cast block by block, so serializing a frame allocates no memory.
+ *
+ * A CloudFilter decimates, crops or packs the full frame clouds within the
+ * same pass: the pixels it keeps in either cloud and their lut entries are
+ * selected once at construction, every frame then only gathers those.
+ * Likewise, ColumnRotations deskew the full frame clouds as their points are
+ * computed, one rotation per column shared by all the pixels of the column.
+ */
+class PointCloudSerializer {
+   public:
+    /**
+     * The channels a point type reads on top of range
+     */
+    struct Channels {
+        bool signal;
+        bool reflectivity;
+        bool near_ir;
+    };
+
+    virtual ~PointCloudSerializer() = default;
+
+    /**
+     * @return the channels read by serialize(), the views of the other
+     * channels are never accessed and may be left empty
+     */
+    const Channels& channels() const { return used_channels; }
+
+    /**
+     * @return the number of rows of the clouds written by serialize_rows(),
+     * 1 for dense clouds
+     */
+    uint32_t rows() const { return out_height; }
+
+    /**
+     * @return the fields of a point record
+     */
+    const std::vector<sensor_msgs::PointField>& point_fields() const {
+        return fields;
+    }
+
+    /**
+     * @return the size of a point record in bytes
+     */
+    uint32_t point_size() const { return point_step; }
+
+    /**
+     * Set the fields and dimensions of a message and size its data buffer
+     * @param[out] msg the message to prepare
+     */
+    void layout(sensor_msgs::PointCloud2& msg) const;
+
+    /**
+     * Set the fields and dimensions of a message holding a sector of
+     * consecutive columns and size its data buffer
+     * @param[out] msg the message to prepare
+     * @param[in] columns the number of columns of the sector
+     */
+    void layout_sector(sensor_msgs::PointCloud2& msg, uint32_t columns) const;
+
+    /**
+     * Write the points of a scan into messages prepared by layout()
+     * @param[out] msg the destination of the staggered cloud, may be null
+     * @param[out] destaggered_msg the destination of the destaggered cloud,
+     * may be null
+     * @param[in] ls input lidar data, used for the column timestamps
+     * @param[in] scan_ts scan start used to calculate relative timestamps for
+     * points
+     * @param[in] range view of the range channel
+     * @param[in] reflectivity view of the reflectivity channel
+     * @param[in] near_ir view of the near ir channel
+     * @param[in] signal view of the signal channel
+     * @param[in] rotations when given, the rotations of the columns of the
+     * scan applied to their points
+     */
+    void serialize(sensor_msgs::PointCloud2* msg,
+                   sensor_msgs::PointCloud2* destaggered_msg,
+                   const ouster::LidarScan& ls,
+                   std::chrono::nanoseconds scan_ts,
+                   Eigen::Ref<const ouster::img_t<uint32_t>> range,
+                   const FieldView& reflectivity, const FieldView& near_ir,
+                   const FieldView& signal,
+                   const ColumnRotations* rotations = nullptr) const {
+        serialize_rows(msg, destaggered_msg, ls, scan_ts, range, reflectivity,
+                       near_ir, signal, 0, height, rotations);
+    }
+
+    /**
+     * Same as serialize() limited to a range of the rows() rows of the
+     * clouds. Rows never share points in either output, so disjoint row
+     * ranges of the same scan may be serialized concurrently. Dense clouds
+     * are resized to the points kept.
+     * @param[in] row_begin the first row to write
+     * @param[in] row_end one past the last row to write
+     */
+    virtual void serialize_rows(
+        sensor_msgs::PointCloud2* msg,
+        sensor_msgs::PointCloud2* destaggered_msg, const ouster::LidarScan& ls,
+        std::chrono::nanoseconds scan_ts,
+        Eigen::Ref<const ouster::img_t<uint32_t>> range,
+        const FieldView& reflectivity, const FieldView& near_ir,
+        const FieldView& signal, uint32_t row_begin, uint32_t row_end,
+        const ColumnRotations* rotations = nullptr) const = 0;
+
+    /**
+     * Write the points of a sector of consecutive columns of a scan into a
+     * message prepared by layout_sector(). The sector is staggered, row u of
+     * the message holds the columns [col_begin, col_end) of row u of the scan,
+     * and only those columns of the scan are read.
+     * @param[out] msg the destination of the sector cloud
+     * @param[in] ls input lidar data, used for the column timestamps
+     * @param[in] sector_ts sector start used to calculate relative timestamps
+     * for points
+     * @param[in] range view of the range channel
+     * @param[in] reflectivity view of the reflectivity channel
+     * @param[in] near_ir view of the near ir channel
+     * @param[in] signal view of the signal channel
+     * @param[in] col_begin the first column of the sector
+     * @param[in] col_end one past the last column of the sector
+     */
+    virtual void serialize_sector(
+        sensor_msgs::PointCloud2& msg, const ouster::LidarScan& ls,
+        std::chrono::nanoseconds sector_ts,
+        Eigen::Ref<const ouster::img_t<uint32_t>> range,
+        const FieldView& reflectivity, const FieldView& near_ir,
+        const FieldView& signal, uint32_t col_begin,
+        uint32_t col_end) const = 0;
+
+   protected:
+    // the pixels of one of the filtered clouds
+    struct Selection {
+        // the scan pixel of every point of the cloud, row major
+        std::vector<uint32_t> pixels;
+        // the xyz lut of those pixels, the direction then the offset, one
+        // contiguous array per axis; pixels outside the windows of organized
+        // clouds have null entries which place them at the origin
+        std::vector<float> lut;
+    };
+
+    PointCloudSerializer(const sensor::sensor_info& info,
+                         std::vector<sensor_msgs::PointField> fields,
+                         uint32_t point_step, Channels used_channels,
+                         const CloudFilter& filter);
+
+    void select_pixels(const sensor::sensor_info& info, bool destaggered,
+                       Selection& selection) const;
+
+    uint32_t width;
+    uint32_t height;
+    std::vector<sensor_msgs::PointField> fields;
+    uint32_t point_step;
+    Channels used_channels;
+    ouster::PointsF lut_direction;
+    ouster::PointsF lut_offset;
+    // index of every staggered pixel within the destaggered cloud
+    std::vector<uint32_t> destaggered_index;
+
+    CloudFilter filter;
+    // ranges within [range_min, range_min + range_span] are kept
+    uint32_t range_min;
+    uint32_t range_span;
+    // the dimensions of the full frame clouds, which only differ from the
+    // scan when the filter selects pixels
+    uint32_t out_width;
+    uint32_t out_height;
+    Selection staggered_selection;
+    Selection destaggered_selection;
+};
+
+/**
+ * Serializes clouds of a given point type, instantiated for Point, PointXYZ,
+ * PointXYZI and PointXYZIRT.
+ */
+template <typename PointT>
+class BasicPointCloudSerializer : public PointCloudSerializer {
+   public:
+    /**
+     * @param[in] info sensor metadata providing the cloud dimensions, the xyz
+     * lut and the destaggering shifts
+     * @param[in] filter the output stages of the full frame clouds
+     */
+    explicit BasicPointCloudSerializer(const sensor::sensor_info& info,
+                                       const CloudFilter& filter = {});
+
+    void serialize_rows(
+        sensor_msgs::PointCloud2* msg,
+        sensor_msgs::PointCloud2* destaggered_msg, const ouster::LidarScan& ls,
+        std::chrono::nanoseconds scan_ts,
+        Eigen::Ref<const ouster::img_t<uint32_t>> range,
+        const FieldView& reflectivity, const FieldView& near_ir,
+        const FieldView& signal, uint32_t row_begin, uint32_t row_end,
+        const ColumnRotations* rotations = nullptr) const override;
+
+    void serialize_sector(sensor_msgs::PointCloud2& msg,
+                          const ouster::LidarScan& ls,
+                          std::chrono::nanoseconds sector_ts,
+                          Eigen::Ref<const ouster::img_t<uint32_t>> range,
+                          const FieldView& reflectivity,
+                          const FieldView& near_ir, const FieldView& signal,
+                          uint32_t col_begin, uint32_t col_end) const override;
+
+   private:
+    // write the pixels of rows [row_begin, row_end) and columns [col_begin,
+    // col_end), pixel (u, v) goes to point u * out_width + v - col_begin of
+    // data and to its destaggered index in destaggered_data
+    void write_points(uint8_t* data, uint32_t out_width,
+                      uint8_t* destaggered_data, const ouster::LidarScan& ls,
+                      std::chrono::nanoseconds scan_ts,
+                      Eigen::Ref<const ouster::img_t<uint32_t>> range,
+                      const FieldView& reflectivity, const FieldView& near_ir,
+                      const FieldView& signal, uint32_t row_begin,
+                      uint32_t row_end, uint32_t col_begin, uint32_t col_end,
+                      const ColumnRotations* rotations) const;
+
+    // write the points [begin, end) of a selection into data, packed from
+    // the start of data when dense and at their index in the selection
+    // otherwise; returns the number of points written
+    size_t write_selection(uint8_t* data, const Selection& selection,
+                           const ouster::LidarScan& ls,
+                           std::chrono::nanoseconds scan_ts,
+                           Eigen::Ref<const ouster::img_t<uint32_t>> range,
+                           const FieldView& reflectivity,
+                           const FieldView& near_ir, const FieldView& signal,
+                           size_t begin, size_t end,
+                           const ColumnRotations* rotations) const;
+};
+
+/**
+ * Create the serializer of the point type selected by the point_type
+ * parameter
+ * @param[in] point_type one of "original", "xyz", "xyzi" or "xyzirt"
+ * @param[in] info sensor metadata providing the cloud dimensions and the
+ * destaggering shifts
+ * @param[in] filter the output stages of the full frame clouds
+ * @return the serializer, or a null pointer if the point type is unknown
+ */
+std::unique_ptr<PointCloudSerializer> make_point_cloud_serializer(
+    const std::string& point_type, const sensor::sensor_info& info,
+    const CloudFilter& filter = {});
+
+/**
+ * @param[in] point_type the value of the point_type parameter
+ * @return whether make_point_cloud_serializer() knows the point type
+ */
+bool is_point_type(const std::string& point_type);
+
+/**
+ * Read the output stages of the full frame clouds from the row_stride,
+ * column_stride, min_range, max_range (in meters), azimuth_min,
+ * azimuth_max, elevation_min, elevation_max and dense_output parameters
+ * @param[in] nh the node handle holding the parameters
+ * @param[out] filter the filter
+ * @return false if the parameters are invalid
+ */
+bool cloud_filter_of_params(ros::NodeHandle& nh, CloudFilter& filter);
+
+}  // namespace ouster_ros
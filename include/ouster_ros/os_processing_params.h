@@ -0,0 +1,66 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_processing_params.h
+ * @brief The parameters of the scan processing shared by the nodelets that
+ * generate point clouds
+ */
+
+#pragma once
+
+// prevent clang-format from altering the location of "ouster_ros/ros.h", the
+// header file needs to be the first include due to PCL_NO_PRECOMPILE flag
+// clang-format off
+#include "ouster_ros/os_ros.h"
+// clang-format on
+
+#include <ros/ros.h>
+
+#include <memory>
+#include <string>
+
+#include "ouster_ros/os_point_cloud_serializer.h"
+#include "ouster_ros/os_scan_monitor.h"
+
+namespace ouster_ros {
+
+/**
+ * The parameters OusterCloud, OusterDriver and OusterMultiSensor convert
+ * their scans with
+ */
+struct ProcessingParams {
+    std::string point_type = "original";
+    CloudFilter filter;
+    // "cpu" or "cuda"
+    std::string cloud_backend = "cpu";
+    bool staggered = true;
+    bool destagger = true;
+    ScanMonitor::Policy frame_policy = ScanMonitor::Policy::PUBLISH;
+    double min_completeness = 1.0;
+    int imu_batch_size = 0;
+};
+
+/**
+ * Read and check the processing parameters, along with the cloud filter of
+ * cloud_filter_of_params(), so that the serializer of any metadata can be
+ * created from them
+ * @param[in] pnh the private node handle of the nodelet
+ * @param[in] name the name of the nodelet, prefixing the error messages
+ * @return the parameters
+ * @throws std::runtime_error if a parameter is invalid
+ */
+ProcessingParams processing_params_of(ros::NodeHandle& pnh,
+                                      const std::string& name);
+
+/**
+ * Create the serializer of the point type on the backend of the parameters
+ * @param[in] params parameters returned by processing_params_of()
+ * @param[in] info sensor metadata providing the cloud dimensions, the xyz
+ * lut and the destaggering shifts
+ * @return the serializer
+ */
+std::unique_ptr<PointCloudSerializer> make_point_cloud_serializer(
+    const ProcessingParams& params, const sensor::sensor_info& info);
+
+}  // namespace ouster_ros
@@ -19,8 +19,10 @@
 
 #include <geometry_msgs/TransformStamped.h>
 
+#include <algorithm>
 #include <chrono>
 #include <string>
+#include <vector>
 
 #include <ouster/client.h>
 #include <ouster/lidar_scan.h>
@@ -57,6 +59,38 @@ namespace ouster_ros {
     bool read_lidar_packet(const sensor::client &cli, PacketMsg &pm,
                            const sensor::packet_format &pf);
 
+/**
+ * Parse a raw imu packet into a ROS imu message
+ * @param[in] buf the raw imu packet
+ * @param[in] timestamp the timestamp to give the resulting ROS message
+ * @param[in] frame the frame to set in the resulting ROS message
+ * @param[in] pf the packet format
+ * @return ROS sensor message with fields populated from the packet
+ */
+    sensor_msgs::Imu packet_to_imu_msg(const uint8_t *buf,
+                                       const ros::Time &timestamp,
+                                       const std::string &frame,
+                                       const sensor::packet_format &pf);
+
+/**
+ * Set the fields of an imu message that don't depend on the packets: the
+ * frame, the unknown orientation and the covariances
+ * @param[in] frame the frame to set in the message
+ * @param[out] m the message to initialize
+ */
+    void init_imu_msg(const std::string &frame, sensor_msgs::Imu &m);
+
+/**
+ * Write the measurements of a raw imu packet into an imu message prepared
+ * by init_imu_msg, in place
+ * @param[in] buf the raw imu packet
+ * @param[in] timestamp the timestamp to give the message
+ * @param[in] pf the packet format
+ * @param[out] m the message to update
+ */
+    void fill_imu_msg(const uint8_t *buf, const ros::Time &timestamp,
+                      const sensor::packet_format &pf, sensor_msgs::Imu &m);
+
 /**
  * Parse an imu packet message into a ROS imu message
  * @param[in] pm packet message populated by read_imu_packet
@@ -81,6 +115,179 @@ namespace ouster_ros {
             const PacketMsg &pm, const std::string &frame,
             const sensor::packet_format &pf);
 
+/**
+ * Map a channel field to its counterpart of the requested return
+ * @param[in] input_field the channel field of either return
+ * @param[in] second whether the field of the second return is wanted
+ * @return the channel field of the requested return
+ */
+    sensor::ChanField suitable_return(sensor::ChanField input_field, bool second);
+
+    struct read_and_cast {
+        template<typename T, typename U>
+        void operator()(Eigen::Ref<const ouster::img_t<T>> field,
+                        ouster::img_t<U> &dest) {
+            dest = field.template cast<U>();
+        }
+    };
+
+/**
+ * Copy a channel field of a LidarScan into an image of the requested type
+ * @param[in] f the channel field to copy
+ * @param[in] ls input lidar data
+ * @return the cast channel field, or an image of zeros if the scan lacks it
+ */
+    template<typename T>
+    inline ouster::img_t<T> get_or_fill_zero(sensor::ChanField f,
+                                             const ouster::LidarScan &ls) {
+        if (!ls.field_type(f)) {
+            return ouster::img_t<T>::Zero(ls.h, ls.w);
+        }
+
+        ouster::img_t<T> result{ls.h, ls.w};
+        ouster::impl::visit_field(ls, f, read_and_cast(), result);
+        return result;
+    }
+
+/**
+ * A read only view of a LidarScan channel field in its native element type.
+ * Values are cast as they are read, so consumers never copy the field nor
+ * allocate an image of another type. An empty view reads as zeros.
+ */
+    struct FieldView {
+        const void *data = nullptr;
+        sensor::ChanFieldType type = sensor::ChanFieldType::VOID;
+
+        /**
+         * Read consecutive values of the field cast to the requested type
+         * @param[in] idx the row major index of the first pixel to read
+         * @param[in] n the number of pixels to read
+         * @param[out] dest the destination of the n values
+         */
+        template<typename T>
+        void read(size_t idx, int n, T *dest) const {
+            switch (type) {
+                case sensor::ChanFieldType::UINT8:
+                    cast_n(static_cast<const uint8_t *>(data) + idx, n, dest);
+                    break;
+                case sensor::ChanFieldType::UINT16:
+                    cast_n(static_cast<const uint16_t *>(data) + idx, n, dest);
+                    break;
+                case sensor::ChanFieldType::UINT32:
+                    cast_n(static_cast<const uint32_t *>(data) + idx, n, dest);
+                    break;
+                case sensor::ChanFieldType::UINT64:
+                    cast_n(static_cast<const uint64_t *>(data) + idx, n, dest);
+                    break;
+                default:
+                    std::fill(dest, dest + n, T{0});
+            }
+        }
+
+        /**
+         * Read the values of scattered pixels of the field cast to the
+         * requested type
+         * @param[in] idx the row major indices of the n pixels to read
+         * @param[in] n the number of pixels to read
+         * @param[out] dest the destination of the n values
+         */
+        template<typename T>
+        void gather(const uint32_t *idx, int n, T *dest) const {
+            switch (type) {
+                case sensor::ChanFieldType::UINT8:
+                    cast_gather(static_cast<const uint8_t *>(data), idx, n,
+                                dest);
+                    break;
+                case sensor::ChanFieldType::UINT16:
+                    cast_gather(static_cast<const uint16_t *>(data), idx, n,
+                                dest);
+                    break;
+                case sensor::ChanFieldType::UINT32:
+                    cast_gather(static_cast<const uint32_t *>(data), idx, n,
+                                dest);
+                    break;
+                case sensor::ChanFieldType::UINT64:
+                    cast_gather(static_cast<const uint64_t *>(data), idx, n,
+                                dest);
+                    break;
+                default:
+                    std::fill(dest, dest + n, T{0});
+            }
+        }
+
+        /**
+         * Read a single value of the field cast to the requested type
+         * @param[in] idx the row major index of the pixel to read
+         * @return the value of the pixel
+         */
+        template<typename T>
+        T at(size_t idx) const {
+            T value;
+            read(idx, 1, &value);
+            return value;
+        }
+
+       private:
+        template<typename U, typename T>
+        static void cast_n(const U *src, int n, T *dest) {
+            for (int k = 0; k < n; ++k) dest[k] = static_cast<T>(src[k]);
+        }
+
+        template<typename U, typename T>
+        static void cast_gather(const U *src, const uint32_t *idx, int n,
+                                T *dest) {
+            for (int k = 0; k < n; ++k)
+                dest[k] = static_cast<T>(src[idx[k]]);
+        }
+    };
+
+    struct make_field_view {
+        template<typename T>
+        void operator()(Eigen::Ref<const ouster::img_t<T>> field,
+                        FieldView &view) {
+            // LidarScan fields are dense row major images, so the view covers
+            // the whole field
+            view.data = field.data();
+        }
+    };
+
+/**
+ * Get a view of a channel field of a LidarScan without copying it
+ * @param[in] f the channel field to view
+ * @param[in] ls input lidar data, which must outlive the view
+ * @return the view of the field, or an empty view if the scan lacks it
+ */
+    inline FieldView get_field_view(sensor::ChanField f,
+                                    const ouster::LidarScan &ls) {
+        FieldView view;
+        view.type = ls.field_type(f);
+        if (view.type) ouster::impl::visit_field(ls, f, make_field_view(), view);
+        return view;
+    }
+
+/**
+ * Destagger a channel into a row major image. A staggered row shifted right
+ * by s is two contiguous segments: the first W - s pixels land at column s
+ * and the last s pixels wrap around to column 0.
+ * @param[out] dest the H x W destination
+ * @param[in] H the number of rows
+ * @param[in] W the number of columns
+ * @param[in] row_shift the shift of every row, within [0, W)
+ * @param[in] source the staggered channel, a FieldView or any type reading
+ * consecutive pixels the same way
+ */
+    template<typename T, typename Source = FieldView>
+    void destagger_into(T *dest, size_t H, size_t W,
+                        const std::vector<size_t> &row_shift,
+                        const Source &source) {
+        for (size_t u = 0; u < H; u++) {
+            const size_t s = row_shift[u];
+            const size_t row = u * W;
+            source.read(row, static_cast<int>(W - s), dest + row + s);
+            source.read(row + W - s, static_cast<int>(s), dest + row);
+        }
+    }
+
 /**
  * Populate a PCL point cloud from a LidarScan
  * @param[in] xyz_lut lookup table from sensor beam angles (see lidar_scan.h)
@@ -95,7 +302,8 @@ namespace ouster_ros {
                        ouster_ros::Cloud &cloud, int return_index = 0);
 
 /**
- * Populate a PCL point cloud from a LidarScan.
+ * Populate a PCL point cloud from a LidarScan. Instantiated for Point,
+ * PointXYZ, PointXYZI and PointXYZIRT.
  * @param[in, out] points The points parameters is used to store the results of
  * the cartesian product before it gets packed into the cloud object.
  * @param[in] lut_direction the direction of the xyz lut (with single precision)
@@ -104,15 +312,20 @@ namespace ouster_ros {
  * points
  * @param[in] ls input lidar data
  * @param[out] cloud output pcl pointcloud to populate
+ * @param[out] destaggeredcloud output destaggered pcl pointcloud, filled in the
+ * same pass as cloud and resized on first use
  * @param[in] return_index index of return desired starting at 0
- * @param if true the destaggered cloud is fill with a destaggered point cloud
+ * @param[in] pixel_shift_by_row the row shifts used for destaggering
+ * @param[in] destagger if true the destaggered cloud is filled as well
  */
+    template<typename PointT>
     void scan_to_cloud_f(ouster::PointsF &points,
                          const ouster::PointsF &lut_direction,
                          const ouster::PointsF &lut_offset,
                          ouster::LidarScan::ts_t scan_ts,
                          const ouster::LidarScan &ls,
-                         ouster_ros::Cloud &cloud, ouster_ros::Cloud &destaggeredcloud,
+                         pcl::PointCloud<PointT> &cloud,
+                         pcl::PointCloud<PointT> &destaggeredcloud,
                          int return_index, std::vector<int> &pixel_shift_by_row, bool destagger = false);
 
 /**
@@ -121,7 +334,10 @@ namespace ouster_ros {
  * @param pixel_shift_by_row the row shoft for destaggering
  * @return a destaggered cloud
  */
-    ouster_ros::Cloud clouddestagger(const ouster_ros::Cloud &cloud, const std::vector<int> &pixel_shift_by_row);
+    template<typename PointT>
+    pcl::PointCloud<PointT> clouddestagger(
+            const pcl::PointCloud<PointT> &cloud,
+            const std::vector<int> &pixel_shift_by_row);
 
 /**
  * check if a point cloud is destaggered
@@ -0,0 +1,96 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_scan_monitor.h
+ * @brief Tracks the completeness of assembled scans and applies the policy
+ * for incomplete ones
+ */
+
+#pragma once
+
+#include <ros/ros.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <ouster/lidar_scan.h>
+#include <ouster/types.h>
+
+#include "ouster_ros/ScanStatusMsg.h"
+#include "ouster_ros/os_stats.h"
+
+namespace ouster_ros {
+
+/**
+ * Counts the columns of every scan that were filled by received packets, and
+ * the frames skipped between two scans, from the column status and frame id
+ * the ScanBatcher copies out of the packet headers. The result is published
+ * on the scan_status topic with the stamp of the point clouds generated from
+ * the scan. Scans with fewer valid columns than the completeness threshold
+ * are published as is, marked or dropped.
+ */
+class ScanMonitor {
+   public:
+    enum class Policy {
+        // publish incomplete scans like any other
+        PUBLISH,
+        // publish incomplete scans, their point clouds are flagged as not dense
+        MARK,
+        // skip the conversion of incomplete scans
+        DROP
+    };
+
+    /**
+     * @param[in] info sensor metadata
+     * @param[in] nh the node handle used to advertise the scan_status topic
+     * @param[in] frame the frame of the published status messages
+     * @param[in] policy what to do with incomplete scans
+     * @param[in] min_completeness the fraction of the expected columns below
+     * which a scan is incomplete
+     * @param[in] stats when given, counts the missing packets, skipped frames,
+     * incomplete and dropped scans
+     */
+    ScanMonitor(const ouster::sensor::sensor_info& info, ros::NodeHandle& nh,
+                const std::string& frame, Policy policy,
+                double min_completeness,
+                std::shared_ptr<PipelineStats> stats = nullptr);
+
+    /**
+     * Account for a complete scan and publish its status, must be called with
+     * the scans in order
+     * @param[in] ls the scan
+     * @param[in] msg_ts the timestamp applied to messages generated from the
+     * scan
+     * @return the policy applied to the scan, PUBLISH for complete scans
+     */
+    Policy operator()(const ouster::LidarScan& ls, const ros::Time& msg_ts);
+
+   private:
+    uint32_t columns_per_packet;
+    uint32_t expected_columns;
+    Policy policy;
+    double min_completeness;
+    int32_t last_frame_id = -1;
+
+    ros::Publisher status_pub;
+    ScanStatusMsg status_msg;
+
+    std::shared_ptr<PipelineStats> stats;
+    StatsCounter* missing_packet_count = nullptr;
+    StatsCounter* skipped_frame_count = nullptr;
+    StatsCounter* incomplete_scan_count = nullptr;
+    StatsCounter* dropped_scan_count = nullptr;
+};
+
+/**
+ * Look up an incomplete frame policy by name
+ * @param[in] policy_arg one of "publish", "mark" or "drop"
+ * @param[out] policy the matching policy
+ * @return whether the name was recognized
+ */
+bool frame_policy_of_string(const std::string& policy_arg,
+                            ScanMonitor::Policy& policy);
+
+}  // namespace ouster_ros
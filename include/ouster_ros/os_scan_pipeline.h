@@ -0,0 +1,174 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_scan_pipeline.h
+ * @brief Hands complete scans over from the thread assembling them to a
+ * conversion thread
+ */
+
+#pragma once
+
+#include <ros/ros.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <ouster/lidar_scan.h>
+#include <ouster/types.h>
+
+#include "ouster_ros/os_stats.h"
+#include "ouster_ros/os_work_stealing_pool.h"
+
+namespace ouster_ros {
+
+/**
+ * Decouples the assembly of scans from their conversion. Scans are assembled
+ * into one of a fixed set of LidarScan buffers while a worker thread converts
+ * the ones already completed, so packet ingestion never waits on point cloud
+ * generation. Buffers are passed between the two threads through lock free
+ * single producer single consumer queues. When the worker still holds every
+ * other buffer, a completed scan is dropped as a whole and its buffer is
+ * reused for the next one, which keeps scans from ever being torn.
+ */
+class ScanPipeline {
+   public:
+    /**
+     * @param[in] ls the completed scan
+     * @param[in] scan_ts the timestamp of the first valid column of the scan
+     * @param[in] msg_ts the timestamp to apply to messages generated from
+     * the scan
+     */
+    using ScanCallback = std::function<void(const ouster::LidarScan& ls,
+                                            std::chrono::nanoseconds scan_ts,
+                                            const ros::Time& msg_ts)>;
+
+    /**
+     * @param[in] info sensor metadata
+     * @param[in] n_buffers the number of scan buffers, at least 2; with n
+     * buffers up to n - 2 completed scans can queue up behind the one being
+     * converted
+     * @param[in] on_scan invoked on the worker thread with every scan handed
+     * over
+     * @param[in] cpu when non negative, the worker is pinned to that cpu
+     * @param[in] stats when given, records the time scans spend queued and
+     * converted along with the dropped scans
+     */
+    ScanPipeline(const ouster::sensor::sensor_info& info, size_t n_buffers,
+                 ScanCallback on_scan, int cpu = -1,
+                 std::shared_ptr<PipelineStats> stats = nullptr);
+
+    /**
+     * Converts the scans on a pool shared with other pipelines rather than on
+     * a dedicated thread. The scans of the pipeline are still converted one
+     * at a time and in order, by a task posted to the home worker of the
+     * pipeline whenever a scan is handed over while none is running. A
+     * pipeline constructed on a worker of the pool makes that worker its
+     * home, others are assigned one.
+     * @param[in] info sensor metadata
+     * @param[in] n_buffers the number of scan buffers, at least 2
+     * @param[in] on_scan invoked on a worker of the pool with every scan
+     * handed over
+     * @param[in] pool the pool, must outlive the pipeline
+     * @param[in] stats when given, records the time scans spend queued and
+     * converted along with the dropped scans
+     */
+    ScanPipeline(const ouster::sensor::sensor_info& info, size_t n_buffers,
+                 ScanCallback on_scan, std::shared_ptr<WorkStealingPool> pool,
+                 std::shared_ptr<PipelineStats> stats = nullptr);
+
+    ~ScanPipeline();
+
+    ScanPipeline(const ScanPipeline&) = delete;
+    ScanPipeline& operator=(const ScanPipeline&) = delete;
+
+    /**
+     * @return the buffer the next scan should be assembled into, owned by the
+     * producer until it is handed over by push()
+     */
+    ouster::LidarScan& writable() { return slots[current].ls; }
+
+    /**
+     * Hand the scan assembled into writable() over to the worker
+     * @param[in] scan_ts the timestamp of the first valid column of the scan
+     * @param[in] msg_ts the timestamp to apply to messages generated from
+     * the scan
+     * @param[in] received_at when the packet completing the scan was
+     * received, the start of the reported scan latency
+     * @return false if the scan was dropped because no buffer is free
+     */
+    bool push(std::chrono::nanoseconds scan_ts, const ros::Time& msg_ts,
+              StageTimer::clock::time_point received_at = {});
+
+    /**
+     * @return the number of scans dropped so far
+     */
+    size_t dropped() const { return dropped_scans.load(); }
+
+   private:
+    struct Slot {
+        ouster::LidarScan ls;
+        std::chrono::nanoseconds scan_ts;
+        ros::Time msg_ts;
+        StageTimer::clock::time_point received_at;
+        StageTimer::clock::time_point pushed_at;
+    };
+
+    // single producer single consumer queue of slot indices
+    class IndexQueue {
+       public:
+        explicit IndexQueue(size_t capacity) : ring(capacity + 1) {}
+
+        bool push(size_t index);
+        bool pop(size_t& index);
+        bool empty() const;
+        size_t size() const;
+
+       private:
+        std::vector<size_t> ring;
+        std::atomic<size_t> head{0};
+        std::atomic<size_t> tail{0};
+    };
+
+    void init(const ouster::sensor::sensor_info& info, size_t n_buffers);
+    void worker_loop();
+    // convert the scan of a slot and release it
+    void convert(size_t index);
+    // the task posted to the pool, converts the scans ready
+    void drain();
+
+    std::vector<Slot> slots;
+    size_t current = 0;
+    // completed scans waiting for the worker
+    IndexQueue ready;
+    // buffers released by the worker
+    IndexQueue free;
+    std::atomic<size_t> dropped_scans{0};
+
+    std::shared_ptr<PipelineStats> stats;
+    LatencyHistogram* queue_wait_time = nullptr;
+    LatencyHistogram* conversion_time = nullptr;
+    LatencyHistogram* scan_latency = nullptr;
+    StatsCounter* dropped_count = nullptr;
+
+    ScanCallback on_scan;
+    std::atomic<bool> active{true};
+    std::mutex wake_mutex;
+    std::condition_variable wake_cv;
+    std::thread worker;
+
+    std::shared_ptr<WorkStealingPool> pool;
+    size_t home_worker = 0;
+    // whether a drain task is posted or running
+    std::atomic<bool> scheduled{false};
+    // guarded by wake_mutex
+    bool draining = false;
+};
+
+}  // namespace ouster_ros
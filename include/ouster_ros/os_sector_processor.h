@@ -0,0 +1,90 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_sector_processor.h
+ * @brief Publishes point clouds of azimuth sectors while scans are assembled
+ */
+
+#pragma once
+
+// prevent clang-format from altering the location of "ouster_ros/ros.h", the
+// header file needs to be the first include due to PCL_NO_PRECOMPILE flag
+// clang-format off
+#include "ouster_ros/os_ros.h"
+// clang-format on
+
+#include <ros/ros.h>
+#include <sensor_msgs/PointCloud2.h>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ouster_ros/os_message_pool.h"
+#include "ouster_ros/os_point_cloud_serializer.h"
+
+namespace ouster_ros {
+
+/**
+ * Publishes the points of every sector of consecutive columns as soon as the
+ * last packet of the sector is received, on the sector_points topic (suffixed
+ * with 2 for the second return). Sectors are staggered: row u of a sector
+ * cloud holds the sector columns of row u of the scan, projected with the
+ * same lut entries as the full frame clouds. Sectors are only generated for
+ * the returns that have subscribers.
+ */
+class SectorProcessor {
+   public:
+    /**
+     * @param[in] info sensor metadata
+     * @param[in] nh the node handle used to advertise the sector topics
+     * @param[in] sensor_frame the frame of the published point clouds
+     * @param[in] serializer writes the points in the selected point type, see
+     * make_point_cloud_serializer()
+     * @param[in] sector_columns the number of columns of every sector but the
+     * last one of a frame
+     */
+    SectorProcessor(const sensor::sensor_info& info, ros::NodeHandle& nh,
+                    const std::string& sensor_frame,
+                    std::shared_ptr<const PointCloudSerializer> serializer,
+                    uint32_t sector_columns);
+
+    /**
+     * Convert a sector of a scan being assembled and publish it
+     * @param[in] ls the scan holding the sector
+     * @param[in] col_begin the first column of the sector
+     * @param[in] col_end one past the last column of the sector
+     * @param[in] sector_ts the timestamp of the first valid column of the
+     * sector, used to calculate relative timestamps for points
+     * @param[in] msg_ts the timestamp to apply to the published messages
+     */
+    void operator()(const ouster::LidarScan& ls, uint32_t col_begin,
+                    uint32_t col_end, std::chrono::nanoseconds sector_ts,
+                    const ros::Time& msg_ts);
+
+   private:
+    int n_returns;
+    std::string sensor_frame;
+    std::shared_ptr<const PointCloudSerializer> serializer;
+    std::vector<ros::Publisher> sector_pubs;
+    std::unique_ptr<MessagePool<sensor_msgs::PointCloud2>> sector_pool;
+};
+
+/**
+ * Compute the number of columns of a sector from the sector parameters. The
+ * result is rounded up to whole packets and clamped to a frame.
+ * @param[in] info sensor metadata
+ * @param[in] mode one of "columns", "packets" or "angle"
+ * @param[in] size the number of columns or packets of a sector
+ * @param[in] angle the width of a sector in degrees
+ * @param[out] columns the number of columns of a sector
+ * @return false if the mode is unknown or the sector is empty
+ */
+bool sector_columns_of_params(const sensor::sensor_info& info,
+                              const std::string& mode, int size, double angle,
+                              uint32_t& columns);
+
+}  // namespace ouster_ros
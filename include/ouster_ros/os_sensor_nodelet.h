@@ -0,0 +1,194 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_sensor_nodelet.h
+ * @brief A nodelet that connects to a live ouster sensor
+ */
+
+#pragma once
+
+#include <ros/ros.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <ouster/client.h>
+
+#include "ouster_ros/PacketMsg.h"
+#include "ouster_ros/os_client_base_nodelet.h"
+#include "ouster_ros/os_message_pool.h"
+#include "ouster_ros/os_metadata_cache.h"
+#include "ouster_ros/os_packet_batcher.h"
+#include "ouster_ros/os_packet_logger.h"
+#include "ouster_ros/os_stats.h"
+
+namespace nodelets_os {
+
+class OusterSensor : public OusterClientBase {
+   public:
+    ~OusterSensor() override;
+
+   protected:
+    virtual void onInit() override;
+
+    /**
+     * Invoked once the sensor metadata has been retrieved, right before
+     * packets start flowing, and again whenever the metadata changes while
+     * no packet is received
+     * @param[in] info the sensor metadata
+     */
+    virtual void on_metadata_updated(const ouster::sensor::sensor_info& info);
+
+    /**
+     * Invoked for every lidar packet read from the sensor, publishes the
+     * packet by default
+     * @param[in] packet the packet, backed by a pooled buffer
+     * @param[in] stamp the time at which the packet was received
+     */
+    virtual void on_lidar_packet(const ouster_ros::PacketMsg::Ptr& packet,
+                                 const ros::Time& stamp);
+
+    /**
+     * Invoked for every imu packet read from the sensor, publishes the packet
+     * by default
+     * @param[in] packet the packet, backed by a pooled buffer
+     * @param[in] stamp the time at which the packet was received
+     */
+    virtual void on_imu_packet(const ouster_ros::PacketMsg::Ptr& packet,
+                               const ros::Time& stamp);
+
+   private:
+    using PacketMsgPool = ouster_ros::MessagePool<ouster_ros::PacketMsg>;
+
+    std::string get_sensor_hostname(ros::NodeHandle& nh);
+
+    bool update_config_and_metadata(ouster::sensor::client& cli);
+
+    void use_metadata(
+        std::shared_ptr<const ouster_ros::SensorMetadata> metadata);
+
+    bool sensor_config_applied(const ouster::sensor::sensor_config& config,
+                               uint8_t config_flags);
+
+    bool load_cached_metadata();
+
+    void start_metadata_check();
+
+    void check_cached_metadata(const ouster_ros::SensorMetadata& cached,
+                               const std::string& config);
+
+    void create_metadata_cache(ros::NodeHandle& nh);
+
+    void save_metadata(ros::NodeHandle& nh);
+
+    void create_get_config_service();
+
+    void create_set_config_service();
+
+    std::shared_ptr<ouster::sensor::client> create_sensor_client(
+        const std::string& hostname,
+        const ouster::sensor::sensor_config& config);
+
+    std::pair<ouster::sensor::sensor_config, u_int8_t>
+    create_sensor_config_rosparams(ros::NodeHandle& nh);
+
+    void configure_sensor(const std::string& hostname,
+                          const ouster::sensor::sensor_config& config,
+                          int config_flags);
+
+    bool load_config_file(const std::string& config_file,
+                          ouster::sensor::sensor_config& out_config);
+
+    void populate_metadata_defaults(
+        ouster::sensor::sensor_info& info,
+        ouster::sensor::lidar_mode specified_lidar_mode);
+
+    bool write_metadata(const std::string& meta_file,
+                        const std::string& metadata);
+
+    void start_connection_loop();
+
+    void create_packet_pools();
+
+    void start_reception();
+
+    // once it returns no packet is read until start_reception()
+    void stop_reception();
+
+    // recreate everything sized after the metadata, with reception stopped
+    void rebuild_processing();
+
+    void create_lidar_packet_batcher(ros::NodeHandle& nh);
+
+    void start_receive_thread(ros::NodeHandle& nh);
+
+    void stop_receive_thread();
+
+    void receive_loop();
+
+    void connection_loop(ouster::sensor::client& cli,
+                         const ouster::sensor::sensor_info& info);
+
+    void timer_callback(const ros::TimerEvent&);
+
+    void batch_deadline_callback(const ros::TimerEvent&);
+
+    void create_stats(ros::NodeHandle& nh);
+
+    void create_packet_logger(ros::NodeHandle& nh);
+
+   protected:
+    ros::Publisher lidar_packet_pub;
+    ros::Publisher imu_packet_pub;
+    ros::Publisher lidar_packet_batch_pub;
+    // null unless diagnostics are enabled
+    std::shared_ptr<ouster_ros::PipelineStats> stats;
+
+   private:
+    std::unique_ptr<PacketMsgPool> lidar_packet_pool;
+    std::unique_ptr<PacketMsgPool> imu_packet_pool;
+    // the pools are replaced while the stats timer reads them
+    std::mutex packet_pools_mutex;
+    // held by timer_callback, which only reads packets and re-arms its
+    // timer while reception is active
+    std::mutex reception_mutex;
+    bool reception_active = false;
+    std::unique_ptr<ouster_ros::LidarPacketBatcher> lidar_packet_batcher;
+    // the deadline timer and the packets feed the batcher from other threads
+    std::mutex lidar_packet_batcher_mutex;
+    ros::Timer batch_deadline_timer;
+    // null unless packet logging is enabled
+    std::unique_ptr<ouster_ros::PacketLogger> packet_logger;
+    // null unless the metadata cache is enabled
+    std::unique_ptr<ouster_ros::MetadataCache> metadata_cache;
+    std::thread metadata_check;
+    std::atomic<bool> metadata_check_cancelled{false};
+    // adopts the metadata found by the check on the callback queue
+    ros::Timer metadata_update_timer;
+    std::shared_ptr<ouster::sensor::client> sensor_client;
+    ros::Timer timer_;
+    std::vector<ouster_ros::PacketMsg::Ptr> lidar_packet_ring;
+    std::vector<ros::Time> lidar_packet_stamps;
+    std::vector<ouster_ros::PacketMsg::Ptr> imu_packet_ring;
+    std::vector<ros::Time> imu_packet_stamps;
+    std::thread receive_thread;
+    std::atomic<bool> receive_thread_active{false};
+    std::string sensor_hostname;
+    ros::ServiceServer get_config_srv;
+    ros::ServiceServer set_config_srv;
+    std::string cached_config;
+    std::unique_ptr<ouster_ros::StatsPublisher> stats_publisher;
+    ouster_ros::StatsCounter* lidar_packet_count = nullptr;
+    ouster_ros::StatsCounter* imu_packet_count = nullptr;
+    ouster_ros::StatsCounter* lidar_read_failures = nullptr;
+    ouster_ros::StatsCounter* imu_read_failures = nullptr;
+    ouster_ros::StatsCounter* poll_errors = nullptr;
+};
+
+}  // namespace nodelets_os
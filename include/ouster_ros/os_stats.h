@@ -0,0 +1,192 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_stats.h
+ * @brief Lightweight counters and latency histograms of the processing stages,
+ * periodically published as diagnostics
+ */
+
+#pragma once
+
+#include <diagnostic_msgs/DiagnosticArray.h>
+#include <diagnostic_msgs/DiagnosticStatus.h>
+#include <ros/ros.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace ouster_ros {
+
+/**
+ * Lock free histogram of durations with logarithmic buckets, four per power of
+ * two, which bounds the error of the reported percentiles to about 10%.
+ * Recording costs a few relaxed atomic increments.
+ */
+class LatencyHistogram {
+   public:
+    struct Summary {
+        uint64_t count;
+        std::chrono::nanoseconds mean;
+        std::chrono::nanoseconds p50;
+        std::chrono::nanoseconds p90;
+        std::chrono::nanoseconds p99;
+        std::chrono::nanoseconds max;
+    };
+
+    LatencyHistogram();
+
+    /**
+     * Add a sample, safe to call from any thread
+     * @param[in] duration the sample
+     */
+    void record(std::chrono::nanoseconds duration);
+
+    /**
+     * Summarize the samples recorded since the previous call and start over
+     * @return the summary of the samples
+     */
+    Summary take();
+
+   private:
+    static constexpr int sub_bucket_bits = 2;
+    static constexpr size_t n_buckets = 64 << sub_bucket_bits;
+
+    static size_t bucket_of(uint64_t ns);
+    static uint64_t bucket_value(size_t bucket);
+
+    std::array<std::atomic<uint64_t>, n_buckets> buckets;
+    std::atomic<uint64_t> sum_ns{0};
+    std::atomic<uint64_t> max_ns{0};
+};
+
+/**
+ * A monotonic event counter, safe to increment from any thread
+ */
+class StatsCounter {
+   public:
+    void add(uint64_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+
+    uint64_t load() const { return value.load(std::memory_order_relaxed); }
+
+   private:
+    std::atomic<uint64_t> value{0};
+};
+
+/**
+ * Collects the counters, gauges and histograms of a processing pipeline. The
+ * instruments are registered during setup and referenced directly from the hot
+ * paths afterwards, components hold a null pointer instead of a PipelineStats
+ * when instrumentation is disabled so the only remaining cost is a branch.
+ */
+class PipelineStats {
+   public:
+    /**
+     * @param[in] name the name of the histogram
+     * @return the histogram, registered on first use
+     */
+    LatencyHistogram& histogram(const std::string& name);
+
+    /**
+     * @param[in] name the name of the counter
+     * @param[in] warn whether increments of the counter indicate a problem,
+     * any increment then raises the level of the next report to WARN
+     * @return the counter, registered on first use
+     */
+    StatsCounter& counter(const std::string& name, bool warn = false);
+
+    /**
+     * Register a value sampled whenever a report is generated
+     * @param[in] name the name of the gauge
+     * @param[in] read returns the current value, invoked from the reporting
+     * thread
+     * @param[in] owner identifies the component registering the gauge, which
+     * replaces the gauge of the same name registered by any other component
+     */
+    void gauge(const std::string& name, std::function<double()> read,
+               const void* owner = nullptr);
+
+    /**
+     * Unregister a gauge, components registering gauges remove them before
+     * the state they read is destroyed
+     * @param[in] name the name of the gauge
+     * @param[in] owner the owner given to gauge(), the gauge is left alone if
+     * another component registered it since, e.g. the replacement of the
+     * owner built while the owner was still running
+     */
+    void remove_gauge(const std::string& name, const void* owner = nullptr);
+
+    /**
+     * Summarize the activity since the previous report
+     * @param[out] status receives one key value per statistic, rates are
+     * reported per second and durations in microseconds
+     * @param[in] elapsed the time since the previous report
+     */
+    void report(diagnostic_msgs::DiagnosticStatus& status,
+                std::chrono::duration<double> elapsed);
+
+   private:
+    struct Counter {
+        StatsCounter counter;
+        bool warn;
+        uint64_t reported = 0;
+    };
+
+    std::mutex mutex;
+    std::map<std::string, std::unique_ptr<LatencyHistogram>> histograms;
+    std::map<std::string, std::unique_ptr<Counter>> counters;
+    std::map<std::string, std::pair<const void*, std::function<double()>>>
+        gauges;
+};
+
+/**
+ * Periodically publishes the report of a PipelineStats on /diagnostics
+ */
+class StatsPublisher {
+   public:
+    /**
+     * @param[in] nh the node handle used to create the publisher and timer
+     * @param[in] name the name of the diagnostic status, e.g. the nodelet name
+     * @param[in] hardware_id the hardware id of the diagnostic status
+     * @param[in] stats the statistics to report
+     * @param[in] period the time between two reports in seconds
+     */
+    StatsPublisher(ros::NodeHandle& nh, const std::string& name,
+                   const std::string& hardware_id,
+                   std::shared_ptr<PipelineStats> stats, double period);
+
+   private:
+    void publish(const ros::WallTimerEvent& event);
+
+    std::string name;
+    std::string hardware_id;
+    std::shared_ptr<PipelineStats> stats;
+    ros::Publisher diagnostics_pub;
+    ros::WallTimer timer;
+    ros::WallTime last_report;
+};
+
+/**
+ * Measures the time elapsed since its construction
+ */
+class StageTimer {
+   public:
+    using clock = std::chrono::steady_clock;
+
+    StageTimer() : start(clock::now()) {}
+
+    std::chrono::nanoseconds elapsed() const { return clock::now() - start; }
+
+   private:
+    clock::time_point start;
+};
+
+}  // namespace ouster_ros
@@ -0,0 +1,77 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_tensor_processor.h
+ * @brief Publishes the destaggered channels of every return of a scan as a
+ * single tensor of raw values
+ */
+
+#pragma once
+
+// prevent clang-format from altering the location of "ouster_ros/ros.h", the
+// header file needs to be the first include due to PCL_NO_PRECOMPILE flag
+// clang-format off
+#include "ouster_ros/os_ros.h"
+// clang-format on
+
+#include <ros/ros.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ouster_ros/ScanTensorMsg.h"
+#include "ouster_ros/os_message_pool.h"
+
+namespace ouster_ros {
+
+/**
+ * Generates the scan_tensor topics, one per return, for learning pipelines
+ * that consume the channel stack of a scan as an image. The range, signal,
+ * reflectivity and near ir channels, optionally followed by the cartesian
+ * coordinates of the pixels, are destaggered straight from the fields of the
+ * scan into the planes of one contiguous message. Unlike the images, the
+ * values are neither scaled nor auto exposed. The messages come from a pool,
+ * so that nodelets of the same manager share them without a copy.
+ */
+class TensorProcessor {
+   public:
+    /**
+     * @param[in] info sensor metadata
+     * @param[in] nh the node handle used to advertise the tensor topics
+     * @param[in] frame the frame of the cartesian coordinates
+     * @param[in] xyz whether the x, y and z planes are appended to the
+     * channels
+     */
+    TensorProcessor(const sensor::sensor_info& info, ros::NodeHandle& nh,
+                    const std::string& frame, bool xyz);
+
+    /**
+     * Generate the tensors of the returns that have subscribers from a scan
+     * and publish them
+     * @param[in] ls the scan to convert
+     * @param[in] scan_ts scan start, unused by the tensors
+     * @param[in] msg_ts the timestamp to apply to the published messages
+     */
+    void operator()(const ouster::LidarScan& ls,
+                    std::chrono::nanoseconds scan_ts, const ros::Time& msg_ts);
+
+   private:
+    int n_returns;
+    size_t height;
+    size_t width;
+    bool xyz;
+    // the shift of every row reduced to [0, width)
+    std::vector<size_t> row_shift;
+    // the xyz lut remapped to the destaggered pixels, one plane per
+    // coordinate
+    std::vector<float> direction;
+    std::vector<float> offset;
+
+    std::unique_ptr<MessagePool<ScanTensorMsg>> tensor_pool;
+    std::vector<ros::Publisher> tensor_pubs;
+};
+
+}  // namespace ouster_ros
@@ -0,0 +1,85 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_thread_pool.h
+ * @brief A persistent pool of worker threads used to split the per frame work
+ * of the driver across cores
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ouster_ros {
+
+/**
+ * Runs batches of independent tasks on a fixed set of worker threads. The
+ * thread submitting a batch works on it as well and returns once every task of
+ * the batch completed, so a batch never waits on a busy pool and the pool
+ * needs no queue. Batches are submitted from one thread at a time.
+ */
+class ThreadPool {
+   public:
+    using Task = std::function<void(size_t)>;
+
+    /**
+     * @param[in] n_threads the number of threads working on a batch, including
+     * the submitting thread; values below 2 spawn no worker
+     * @param[in] first_cpu when non negative, worker i is pinned to cpu
+     * first_cpu + i
+     */
+    explicit ThreadPool(size_t n_threads, int first_cpu = -1);
+
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * Invoke task(i) for every i in [0, n_tasks) and wait for all of them.
+     * Tasks may run in any order and concurrently. An exception thrown by a
+     * task is rethrown once the batch completed.
+     * @param[in] n_tasks the number of tasks in the batch
+     * @param[in] task the function invoked with the index of each task
+     */
+    void run(size_t n_tasks, const Task& task);
+
+    /**
+     * @return the number of threads working on a batch, including the
+     * submitting thread
+     */
+    size_t concurrency() const { return workers.size() + 1; }
+
+   private:
+    struct Batch {
+        const Task* task;
+        size_t n_tasks;
+        std::atomic<size_t> next{0};
+        std::atomic<size_t> completed{0};
+        std::exception_ptr error;
+        std::mutex error_mutex;
+    };
+
+    void worker_loop();
+    // work on a batch until none of its tasks is left to start
+    void work_on(Batch& batch);
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable work_cv;
+    std::condition_variable done_cv;
+    std::shared_ptr<Batch> batch;
+    uint64_t generation = 0;
+    bool stopping = false;
+};
+
+}  // namespace ouster_ros
@@ -0,0 +1,40 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_thread_utils.h
+ * @brief Helpers to tune the scheduling of the threads spawned by the driver
+ */
+
+#pragma once
+
+#include <thread>
+#include <vector>
+
+namespace ouster_ros {
+
+/**
+ * Switch a thread to the SCHED_FIFO real-time scheduling policy
+ * @param[in] thread the thread to modify
+ * @param[in] priority the SCHED_FIFO priority; values <= 0 leave the thread
+ * with its inherited scheduling policy
+ * @return whether the scheduling policy was applied (true if nothing to do)
+ */
+bool set_thread_realtime_priority(std::thread& thread, int priority);
+
+/**
+ * Restrict a thread to run only on the given set of cpus
+ * @param[in] thread the thread to modify
+ * @param[in] cpus indices of the cpus the thread is allowed to run on; an
+ * empty list leaves the thread affinity unchanged
+ * @return whether the affinity was applied (true if nothing to do)
+ */
+bool set_thread_cpu_affinity(std::thread& thread, const std::vector<int>& cpus);
+
+/**
+ * @param[in] cpu the index of a cpu
+ * @return the NUMA node of the cpu, -1 if unknown
+ */
+int cpu_numa_node(int cpu);
+
+}  // namespace ouster_ros
@@ -0,0 +1,44 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_transport.h
+ * @brief Reads the queue depths and transports of the topics of a nodelet
+ * from its parameters
+ */
+
+#pragma once
+
+#include <ros/ros.h>
+
+#include <string>
+
+namespace ouster_ros {
+
+/**
+ * Get the queue depth of a topic from the ~<topic>_queue_size parameter.
+ * ROS queues drop their oldest message once full, a depth of 1 thus always
+ * delivers the newest message and never a stale one.
+ * @param[in] pnh the private node handle of the nodelet
+ * @param[in] topic the unqualified name of the topic
+ * @param[in] default_size the depth used when the parameter is unset
+ * @return the depth, at least 1
+ */
+int queue_size_of_params(ros::NodeHandle& pnh, const std::string& topic,
+                         int default_size);
+
+/**
+ * Get the transport a topic is subscribed with from the ~<topic>_transport
+ * parameter, or from ~transport when it is unset: "tcp" (the default),
+ * "tcp_nodelay" which disables the Nagle buffering of the connection, or
+ * "udp" which prefers UDPROS and falls back to "tcp_nodelay". Nodelets of the
+ * same manager exchange their messages in process regardless.
+ * @param[in] pnh the private node handle of the nodelet
+ * @param[in] topic the unqualified name of the topic
+ * @param[out] hints the transport hints to subscribe with
+ * @return false if the transport is unknown
+ */
+bool transport_hints_of_params(ros::NodeHandle& pnh, const std::string& topic,
+                               ros::TransportHints& hints);
+
+}  // namespace ouster_ros
@@ -0,0 +1,101 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_udp_event_loop.h
+ * @brief Receives the udp packets of several sensors on a single thread
+ */
+
+#pragma once
+
+#include <sys/socket.h>
+
+#include <ros/ros.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace ouster_ros {
+
+/**
+ * Owns any number of udp sockets and drains them all from one thread waiting
+ * on an epoll set, so that the number of receiving threads doesn't grow with
+ * the number of sensors. Every wake up reads the datagrams queued on a
+ * socket in batches with recvmmsg until the socket is empty.
+ */
+class UdpEventLoop {
+   public:
+    /**
+     * @param[in] buf the datagram
+     * @param[in] size the size of the datagram
+     * @param[in] stamp the time at which the batch holding the datagram was
+     * received
+     */
+    using Handler = std::function<void(const uint8_t* buf, size_t size,
+                                       const ros::Time& stamp)>;
+
+    /**
+     * @param[in] batch_size the number of datagrams read by a single call
+     * @throws std::runtime_error if the epoll set can't be created
+     */
+    explicit UdpEventLoop(size_t batch_size = 16);
+
+    /**
+     * Stops the loop and closes the sockets
+     */
+    ~UdpEventLoop();
+
+    UdpEventLoop(const UdpEventLoop&) = delete;
+    UdpEventLoop& operator=(const UdpEventLoop&) = delete;
+
+    /**
+     * Bind a socket to receive datagrams on, on every local address, before
+     * the loop is started
+     * @param[in] port the port to bind, 0 binds an ephemeral port
+     * @param[in] handler invoked on the loop thread with every datagram
+     * received on the socket
+     * @return the port bound
+     * @throws std::runtime_error if the socket can't be bound
+     */
+    uint16_t add_socket(uint16_t port, Handler handler);
+
+    /**
+     * Start the loop thread
+     * @param[in] cpu when non negative, the thread is pinned to that cpu
+     * @param[in] priority when positive, the thread is scheduled SCHED_FIFO
+     * at that priority
+     */
+    void start(int cpu = -1, int priority = 0);
+
+    /**
+     * Stop and join the loop thread, at the latest after the poll timeout
+     */
+    void stop();
+
+   private:
+    struct Socket {
+        int fd = -1;
+        Handler handler;
+        // datagrams can take up to the udp maximum, but only the bytes
+        // actually received are ever touched
+        std::unique_ptr<uint8_t[]> buffers;
+        std::vector<mmsghdr> msgs;
+        std::vector<iovec> iovs;
+    };
+
+    void loop();
+    void drain(Socket& socket);
+
+    size_t batch_size;
+    int epoll_fd = -1;
+    std::vector<std::unique_ptr<Socket>> sockets;
+    std::atomic<bool> active{false};
+    std::thread thread;
+};
+
+}  // namespace ouster_ros
@@ -0,0 +1,111 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_work_stealing_pool.h
+ * @brief A pool of worker threads shared by the processing of several sensors
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ouster_ros {
+
+/**
+ * Runs tasks posted asynchronously by any number of clients on a fixed set of
+ * worker threads. Every client is assigned a home worker its tasks are queued
+ * on, which keeps the data of the client in the caches, and with pinned
+ * workers on the NUMA node, of that worker. Idle workers steal queued tasks
+ * from the others, from workers on their own NUMA node first, so that a busy
+ * client never waits on its home worker while another one is idle.
+ */
+class WorkStealingPool {
+   public:
+    using Task = std::function<void()>;
+
+    /**
+     * @param[in] n_threads the number of workers, 0 sizes the pool to the
+     * cpus of the host minus one left to the receiving thread
+     * @param[in] first_cpu when non negative, worker i is pinned to cpu
+     * first_cpu + i
+     */
+    explicit WorkStealingPool(size_t n_threads = 0, int first_cpu = -1);
+
+    /**
+     * Runs the tasks still queued and joins the workers
+     */
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    /**
+     * @return the number of workers
+     */
+    size_t size() const { return workers.size(); }
+
+    /**
+     * @return the home worker of a new client, assigned round robin
+     */
+    size_t assign_worker() { return next_worker++ % workers.size(); }
+
+    /**
+     * @return the worker running the calling thread, -1 if the thread isn't
+     * a worker of this pool
+     */
+    int worker_index() const;
+
+    /**
+     * Queue a task, safe to call from any thread. Tasks throwing exceptions
+     * are logged and otherwise ignored.
+     * @param[in] worker the home worker of the posting client
+     * @param[in] task the task
+     */
+    void post(size_t worker, Task task);
+
+    /**
+     * Run a task on the given worker and wait for it, the task is never
+     * stolen. Allocations made by the task are local to that worker under
+     * the first touch policy of the kernel.
+     * @param[in] worker the worker
+     * @param[in] task the task
+     * @throws whatever the task throws
+     */
+    void run_on(size_t worker, const Task& task);
+
+   private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        // tasks that may not be stolen
+        std::deque<Task> pinned;
+        std::atomic<bool> has_pinned{false};
+        int node = -1;
+        // the other workers, those of the same node first
+        std::vector<size_t> victims;
+        std::thread thread;
+    };
+
+    void worker_loop(size_t self);
+    bool pop(size_t self, Task& task);
+    void wake(bool all);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<size_t> next_worker{0};
+    // the number of stealable tasks queued
+    std::atomic<size_t> queued{0};
+    std::mutex wake_mutex;
+    std::condition_variable wake_cv;
+    bool stopping = false;
+};
+
+}  // namespace ouster_ros
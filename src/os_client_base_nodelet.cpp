@@ -9,6 +9,8 @@
 #include "ouster_ros/os_client_base_nodelet.h"
 
 #include <ouster/impl/build.h>
+#include <std_msgs/String.h>
+
 #include "ouster_ros/GetMetadata.h"
 
 namespace sensor = ouster::sensor;
@@ -27,6 +29,16 @@ void OusterClientBase::onInit() {
             });
 
     NODELET_INFO("get_metadata service created");
+
+    metadata_pub = nh.advertise<std_msgs::String>("metadata", 1, true);
+    publish_metadata();
+}
+
+void OusterClientBase::publish_metadata() {
+    if (cached_metadata.empty()) return;
+    std_msgs::String msg;
+    msg.data = cached_metadata;
+    metadata_pub.publish(msg);
 }
 
 void OusterClientBase::display_lidar_info(const sensor::sensor_info& info) {
@@ -16,21 +16,33 @@
 #include <pluginlib/class_list_macros.h>
 #include <ros/console.h>
 #include <ros/ros.h>
-#include <sensor_msgs/Imu.h>
-#include <sensor_msgs/PointCloud2.h>
-#include <tf2_ros/transform_broadcaster.h>
-#include <pcl_conversions/pcl_conversions.h>
+#include <tf2_ros/static_transform_broadcaster.h>
 
 #include <algorithm>
 #include <chrono>
 #include <memory>
+#include <vector>
 
-#include "ouster_ros/GetMetadata.h"
+#include "ouster_ros/PacketBatchMsg.h"
 #include "ouster_ros/PacketMsg.h"
+#include "ouster_ros/os_image_processor.h"
+#include "ouster_ros/os_imu_packet_handler.h"
+#include "ouster_ros/os_lidar_packet_handler.h"
+#include "ouster_ros/os_metadata_cache.h"
+#include "ouster_ros/os_metadata_listener.h"
+#include "ouster_ros/os_motion_compensator.h"
+#include "ouster_ros/os_packet_backlog.h"
+#include "ouster_ros/os_point_cloud_processor.h"
+#include "ouster_ros/os_processing_params.h"
+#include "ouster_ros/os_scan_monitor.h"
+#include "ouster_ros/os_sector_processor.h"
+#include "ouster_ros/os_stats.h"
+#include "ouster_ros/os_tensor_processor.h"
+#include "ouster_ros/os_transport.h"
 
 namespace sensor = ouster::sensor;
+using ouster_ros::PacketBatchMsg;
 using ouster_ros::PacketMsg;
-using sensor::UDPProfileLidar;
 using namespace std::chrono_literals;
 
 namespace nodelets_os {
@@ -52,10 +64,8 @@ namespace nodelets_os {
             use_ros_time = timestamp_mode_arg == "TIME_FROM_ROS_TIME";
 
             auto &nh = getNodeHandle();
-            ouster_ros::GetMetadata metadata{};
-            auto client = nh.serviceClient<ouster_ros::GetMetadata>("get_metadata");
-            client.waitForExistence();
-            if (!client.call(metadata)) {
+            auto metadata = ouster_ros::fetch_sensor_metadata(nh);
+            if (!metadata) {
                 auto error_msg = "OusterCloud: Calling get_metadata service failed";
                 NODELET_ERROR_STREAM(error_msg);
                 throw std::runtime_error(error_msg);
@@ -63,170 +73,284 @@ namespace nodelets_os {
 
             NODELET_INFO("OusterCloud: retrieved sensor metadata!");
 
-            info = sensor::parse_metadata(metadata.response.metadata);
-            uint32_t H = info.format.pixels_per_column;
-            uint32_t W = info.format.columns_per_frame;
+            const auto &info = metadata->info();
 
-            n_returns = info.format.udp_profile_lidar ==
-                        UDPProfileLidar::PROFILE_RNG19_RFL8_SIG16_NIR16_DUAL
-                        ? 2
-                        : 1;
+            params = ouster_ros::processing_params_of(pnh, "OusterCloud");
 
-            NODELET_INFO_STREAM("Profile has " << n_returns << " return(s)");
+            auto diagnostics_period = pnh.param("diagnostics_period", 0.0);
+            if (diagnostics_period > 0.0) {
+                stats = std::make_shared<ouster_ros::PipelineStats>();
+                lidar_packet_count = &stats->counter("lidar_packets");
+                stats_publisher = std::make_unique<ouster_ros::StatsPublisher>(
+                        nh, getName(), info.sn, stats, diagnostics_period);
+            }
 
-            imu_pub = nh.advertise<sensor_msgs::Imu>("imu", 100);
+            // the pool outlives the pipelines rebuilt for new metadata
+            auto cloud_threads = pnh.param("cloud_threads", 1);
+            if (cloud_threads > 1)
+                thread_pool = std::make_shared<ouster_ros::ThreadPool>(
+                        cloud_threads, pnh.param("cloud_threads_cpu", -1));
+
+            deskew = pnh.param("deskew", false);
+            publish_images = pnh.param("publish_images", false);
+            publish_tensors = pnh.param("publish_tensors", false);
+            tensor_xyz = pnh.param("tensor_xyz", false);
+            scan_buffers = std::max(pnh.param("scan_buffers", 1), 1);
+            conversion_thread_cpu = pnh.param("conversion_thread_cpu", -1);
+            sector_mode = pnh.param("sector_mode", std::string{});
+            sector_size = pnh.param("sector_size", 1);
+            sector_angle = pnh.param("sector_angle", 90.0);
+            points_queue_size =
+                    ouster_ros::queue_size_of_params(pnh, "points", 10);
+            images_queue_size =
+                    ouster_ros::queue_size_of_params(pnh, "images", 100);
+            max_packet_lag = pnh.param("max_packet_lag", 0.0);
+            if (max_packet_lag < 0.0) {
+                auto error_msg = "OusterCloud: max_packet_lag must not be negative";
+                NODELET_ERROR_STREAM(error_msg);
+                throw std::runtime_error(error_msg);
+            }
 
-            auto img_suffix = [](int ind) {
-                if (ind == 0) return std::string();
-                return std::to_string(ind + 1);  // need second return to return 2
+            pipelines.activate(create_pipeline(info));
+
+            // a reconfigured sensor gets its pipeline rebuilt in the
+            // background, the packets switch over on a frame boundary
+            metadata_listener = std::make_unique<ouster_ros::MetadataListener>(
+                    nh, metadata,
+                    [this](std::shared_ptr<const ouster_ros::SensorMetadata>
+                                   metadata) {
+                        const auto &info = metadata->info();
+                        pipelines.suspend();
+                        pipelines.stage(create_pipeline(info), info);
+                    });
+
+            auto transport_of = [&pnh, this](const std::string &topic) {
+                ros::TransportHints hints;
+                if (!ouster_ros::transport_hints_of_params(pnh, topic, hints)) {
+                    auto error_msg =
+                        "OusterCloud: unsupported transport for " + topic;
+                    NODELET_ERROR_STREAM(error_msg);
+                    throw std::runtime_error(error_msg);
+                }
+                return hints;
             };
-
-            lidar_pubs.resize(n_returns);
-            for (int i = 0; i < n_returns; i++) {
-                auto pub = nh.advertise<sensor_msgs::PointCloud2>(
-                        std::string("points") + img_suffix(i), 10);
-                lidar_pubs[i] = pub;
-            }
-            destaggeredlidar_pubs.resize(n_returns);
-            for (int i = 0; i < n_returns; i++) {
-                auto pub = nh.advertise<sensor_msgs::PointCloud2>(
-                        std::string("destaggeredpoints") + img_suffix(i), 10);
-                destaggeredlidar_pubs[i] = pub;
+            using ouster_ros::queue_size_of_params;
+            if (pnh.param("use_packet_batches", false)) {
+                lidar_packet_sub = nh.subscribe<PacketBatchMsg>(
+                        "lidar_packet_batches",
+                        queue_size_of_params(pnh, "lidar_packet_batches", 100),
+                        &OusterCloud::lidar_batch_handler, this,
+                        transport_of("lidar_packet_batches"));
+            } else {
+                lidar_packet_sub = nh.subscribe<PacketMsg>(
+                        "lidar_packets",
+                        queue_size_of_params(pnh, "lidar_packets", 2048),
+                        &OusterCloud::lidar_handler, this,
+                        transport_of("lidar_packets"));
             }
-
-            // The ouster_ros drive currently only uses single precision when it
-            // produces the point cloud. So it isn't of a benefit to compute point
-            //  cloud xyz coordinates using double precision (for the time being).
-            auto xyz_lut = ouster::make_xyz_lut(info);
-            lut_direction = xyz_lut.direction.cast<float>();
-            lut_offset = xyz_lut.offset.cast<float>();
-            points = ouster::PointsF(lut_direction.rows(), lut_offset.cols());
-            pc_ptr = boost::make_shared<sensor_msgs::PointCloud2>();
-            destaggeredpc_ptr = boost::make_shared<sensor_msgs::PointCloud2>();
-
-            ls = ouster::LidarScan{W, H, info.format.udp_profile_lidar};
-            cloud = ouster_ros::Cloud{W, H};
-            destaggeredcloud = ouster_ros::Cloud{H, W};
-            scan_batcher = std::make_unique<ouster::ScanBatcher>(info);
-
-            auto lidar_handler = use_ros_time
-                                 ? &OusterCloud::lidar_handler_ros_time
-                                 : &OusterCloud::lidar_handler_sensor_time;
-            lidar_packet_sub =
-                    nh.subscribe<PacketMsg>("lidar_packets", 2048, lidar_handler, this);
             imu_packet_sub = nh.subscribe<PacketMsg>(
-                    "imu_packets", 100, &OusterCloud::imu_handler, this);
+                    "imu_packets",
+                    queue_size_of_params(pnh, "imu_packets", 100),
+                    &OusterCloud::imu_handler, this,
+                    transport_of("imu_packets"));
         }
 
-        void pcl_toROSMsg(const ouster_ros::Cloud &pcl_cloud, sensor_msgs::PointCloud2 &cloud) {
-            // TODO: remove the staging step in the future
-            static pcl::PCLPointCloud2 pcl_pc2;
-            pcl::toPCLPointCloud2(pcl_cloud, pcl_pc2);
-
-            pcl_conversions::moveFromPCL(pcl_pc2, cloud);
-        }
+        // the processing of the packets, rebuilt whenever the metadata
+        // changes; members are destroyed in reverse order, which stops the
+        // lidar packet handler before the processors it feeds
+        struct Pipeline {
+            std::unique_ptr<ouster_ros::ImuPacketHandler> imu_packet_handler;
+            std::shared_ptr<ouster_ros::MotionCompensator> motion_compensator;
+            std::unique_ptr<ouster_ros::ScanMonitor> scan_monitor;
+            std::unique_ptr<ouster_ros::PointCloudProcessor>
+                    point_cloud_processor;
+            std::unique_ptr<ouster_ros::ImageProcessor> image_processor;
+            std::unique_ptr<ouster_ros::TensorProcessor> tensor_processor;
+            std::unique_ptr<ouster_ros::SectorProcessor> sector_processor;
+            std::unique_ptr<ouster_ros::LidarPacketHandler>
+                    lidar_packet_handler;
+            // null unless max_packet_lag is set
+            std::unique_ptr<ouster_ros::PacketBacklog> packet_backlog;
+
+            bool admit(const uint8_t *packet_buf) {
+                return !packet_backlog || packet_backlog->admit(packet_buf);
+            }
+        };
 
-        void convert_scan_to_pointcloud_publish(std::chrono::nanoseconds scan_ts,
-                                                const ros::Time &msg_ts) {
-            for (int i = 0; i < n_returns; ++i) {
-                scan_to_cloud_f(points, lut_direction, lut_offset, scan_ts, ls, cloud, destaggeredcloud, i,
-                                info.format.pixel_shift_by_row, destagger);
-                pcl_toROSMsg(cloud, *pc_ptr);
-                pc_ptr->header.stamp = msg_ts;
-                pc_ptr->header.frame_id = sensor_frame;
-                if(destagger) {
-                    pcl_toROSMsg(destaggeredcloud, *destaggeredpc_ptr);
-                    destaggeredpc_ptr->header.stamp = msg_ts;
-                    destaggeredpc_ptr->header.frame_id = sensor_frame;
-                    destaggeredlidar_pubs[i].publish(destaggeredpc_ptr);
+        std::shared_ptr<Pipeline> create_pipeline(
+                const sensor::sensor_info &info) {
+            auto &nh = getNodeHandle();
+            NODELET_INFO_STREAM("Profile has " << ouster_ros::get_n_returns(info)
+                                               << " return(s)");
+
+            // shared by the full frame and the sector point clouds
+            std::shared_ptr<const ouster_ros::PointCloudSerializer> serializer =
+                    ouster_ros::make_point_cloud_serializer(params, info);
+
+            uint32_t sector_columns = 0;
+            if (is_arg_set(sector_mode)) {
+                if (!ouster_ros::sector_columns_of_params(
+                            info, sector_mode, sector_size, sector_angle,
+                            sector_columns)) {
+                    auto error_msg =
+                        "OusterCloud: unsupported sector_mode: " + sector_mode;
+                    NODELET_ERROR_STREAM(error_msg);
+                    throw std::runtime_error(error_msg);
                 }
-
-                lidar_pubs[i].publish(pc_ptr);
-
+                NODELET_INFO_STREAM("OusterCloud: streaming sectors of "
+                                    << sector_columns << " columns");
             }
 
-            tf_bcast.sendTransform(ouster_ros::transform_to_tf_msg(
-                    info.lidar_to_sensor_transform, sensor_frame, lidar_frame, msg_ts));
-
+            // the extrinsics never change, late subscribers get them latched
+            static_tf_bcast.sendTransform(
+                    std::vector<geometry_msgs::TransformStamped>{
+                            ouster_ros::transform_to_tf_msg(
+                                    info.imu_to_sensor_transform, sensor_frame,
+                                    imu_frame),
+                            ouster_ros::transform_to_tf_msg(
+                                    info.lidar_to_sensor_transform,
+                                    sensor_frame, lidar_frame)});
+
+            auto p = std::make_shared<Pipeline>();
+            p->scan_monitor = std::make_unique<ouster_ros::ScanMonitor>(
+                    info, nh, sensor_frame, params.frame_policy,
+                    params.min_completeness, stats);
+            p->imu_packet_handler =
+                    std::make_unique<ouster_ros::ImuPacketHandler>(
+                            info, nh, imu_frame, use_ros_time,
+                            params.imu_batch_size);
+            // deskews the full frame clouds with the imu packets received
+            if (deskew)
+                p->motion_compensator =
+                        std::make_shared<ouster_ros::MotionCompensator>(info);
+            p->point_cloud_processor =
+                    std::make_unique<ouster_ros::PointCloudProcessor>(
+                            info, nh, sensor_frame, params.staggered,
+                            params.destagger,
+                            serializer, thread_pool, stats,
+                            p->motion_compensator, points_queue_size);
+            // the images are generated from the same scans as the point clouds,
+            // in place of a separate OusterImage nodelet
+            if (publish_images)
+                p->image_processor =
+                        std::make_unique<ouster_ros::ImageProcessor>(
+                                info, nh, ros::SubscriberStatusCallback(),
+                                images_queue_size);
+            // the raw channel stack of the scans, for learning pipelines
+            if (publish_tensors)
+                p->tensor_processor =
+                        std::make_unique<ouster_ros::TensorProcessor>(
+                                info, nh, sensor_frame, tensor_xyz);
+            // the pipeline owns the handler, which never outlives it
+            auto *raw = p.get();
+            p->lidar_packet_handler =
+                    std::make_unique<ouster_ros::LidarPacketHandler>(
+                    info, use_ros_time,
+                    [raw](const ouster::LidarScan &ls,
+                          std::chrono::nanoseconds scan_ts,
+                          const ros::Time &msg_ts) {
+                        using Policy = ouster_ros::ScanMonitor::Policy;
+                        const auto policy = (*raw->scan_monitor)(ls, msg_ts);
+                        if (policy == Policy::DROP) return;
+                        (*raw->point_cloud_processor)(ls, scan_ts, msg_ts,
+                                                      policy != Policy::MARK);
+                        if (raw->image_processor)
+                            (*raw->image_processor)(ls, scan_ts, msg_ts);
+                        if (raw->tensor_processor)
+                            (*raw->tensor_processor)(ls, scan_ts, msg_ts);
+                    },
+                    scan_buffers, conversion_thread_cpu, stats);
+
+            // stale packets are worth less than no packets at all
+            if (max_packet_lag > 0.0)
+                p->packet_backlog = std::make_unique<ouster_ros::PacketBacklog>(
+                        info,
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                std::chrono::duration<double>(max_packet_lag)),
+                        stats);
+
+            if (sector_columns) {
+                p->sector_processor =
+                        std::make_unique<ouster_ros::SectorProcessor>(
+                        info, nh, sensor_frame, serializer, sector_columns);
+                p->lidar_packet_handler->set_sector_callback(
+                        sector_columns,
+                        [raw](const ouster::LidarScan &ls, uint32_t col_begin,
+                              uint32_t col_end,
+                              std::chrono::nanoseconds sector_ts,
+                              const ros::Time &msg_ts) {
+                            (*raw->sector_processor)(ls, col_begin, col_end,
+                                                     sector_ts, msg_ts);
+                        });
+            }
+            return p;
         }
 
-        void lidar_handler_sensor_time(const PacketMsg::ConstPtr &packet) {
-            if (!(*scan_batcher)(packet->buf.data(), ls)) return;
-            auto ts_v = ls.timestamp();
-            auto idx = std::find_if(ts_v.data(), ts_v.data() + ts_v.size(),
-                                    [](uint64_t h) { return h != 0; });
-            if (idx == ts_v.data() + ts_v.size()) return;
-            auto scan_ts = std::chrono::nanoseconds{ts_v(idx - ts_v.data())};
-            convert_scan_to_pointcloud_publish(scan_ts, to_ros_time(scan_ts));
+        void lidar_handler(const PacketMsg::ConstPtr &packet) {
+            if (stats) lidar_packet_count->add();
+            auto p = pipelines.for_lidar_packet(packet->buf.data());
+            if (p && p->admit(packet->buf.data()))
+                (*p->lidar_packet_handler)(packet->buf.data(),
+                                           ros::Time::now());
         }
 
-        void lidar_handler_ros_time(const PacketMsg::ConstPtr &packet) {
-            auto packet_receive_time = ros::Time::now();
-            static auto frame_ts = packet_receive_time;  // first point cloud time
-            if (!(*scan_batcher)(packet->buf.data(), ls)) return;
-            auto ts_v = ls.timestamp();
-            auto idx = std::find_if(ts_v.data(), ts_v.data() + ts_v.size(),
-                                    [](uint64_t h) { return h != 0; });
-            if (idx == ts_v.data() + ts_v.size()) return;
-            auto scan_ts = std::chrono::nanoseconds{ts_v(idx - ts_v.data())};
-            convert_scan_to_pointcloud_publish(scan_ts, frame_ts);
-
-            frame_ts = packet_receive_time;  // set time for next point cloud msg
+        void lidar_batch_handler(const PacketBatchMsg::ConstPtr &batch) {
+            const auto packet_count = batch->stamps.size();
+            if (batch->buf.size() < packet_count * batch->packet_size) {
+                NODELET_ERROR_THROTTLE(
+                        1, "OusterCloud: dropping malformed packet batch");
+                return;
+            }
+
+            if (stats) lidar_packet_count->add(packet_count);
+            for (size_t i = 0; i < packet_count; ++i) {
+                const auto *buf = batch->buf.data() + i * batch->packet_size;
+                auto p = pipelines.for_lidar_packet(buf);
+                if (p && p->admit(buf))
+                    (*p->lidar_packet_handler)(buf, batch->stamps[i]);
+            }
         }
 
         void imu_handler(const PacketMsg::ConstPtr &packet) {
-            auto pf = sensor::get_format(info);
-            ros::Time msg_ts =
-                    use_ros_time ? ros::Time::now()
-                                 : to_ros_time(pf.imu_gyro_ts(packet->buf.data()));
-            sensor_msgs::Imu imu_msg =
-                    ouster_ros::packet_to_imu_msg(*packet, msg_ts, imu_frame, pf);
-            sensor_msgs::ImuPtr imu_msg_ptr =
-                    boost::make_shared<sensor_msgs::Imu>(imu_msg);
-            imu_pub.publish(imu_msg_ptr);
-
-            tf_bcast.sendTransform(ouster_ros::transform_to_tf_msg(
-                    info.imu_to_sensor_transform, sensor_frame, imu_frame, msg_ts));
+            auto p = pipelines.get();
+            if (p->motion_compensator)
+                p->motion_compensator->add_imu_packet(packet->buf.data());
+            (*p->imu_packet_handler)(packet->buf.data());
         };
 
-        inline ros::Time to_ros_time(uint64_t ts) {
-            ros::Time t;
-            t.fromNSec(ts);
-            return t;
-        }
-
-        inline ros::Time to_ros_time(std::chrono::nanoseconds ts) {
-            return to_ros_time(ts.count());
-        }
-
     private:
         ros::Subscriber lidar_packet_sub;
-        std::vector<ros::Publisher> lidar_pubs;
-        std::vector<ros::Publisher> destaggeredlidar_pubs;
         ros::Subscriber imu_packet_sub;
-        ros::Publisher imu_pub;
-        sensor_msgs::PointCloud2::Ptr pc_ptr;
-        sensor_msgs::PointCloud2::Ptr destaggeredpc_ptr;
-        bool destagger = true;
-
-        sensor::sensor_info info;
-        int n_returns = 0;
-
-        ouster::PointsF lut_direction;
-        ouster::PointsF lut_offset;
-        ouster::PointsF points;
-        ouster::LidarScan ls;
-        ouster_ros::Cloud cloud;
-        ouster_ros::Cloud destaggeredcloud;
-        std::unique_ptr<ouster::ScanBatcher> scan_batcher;
+        tf2_ros::StaticTransformBroadcaster static_tf_bcast;
 
+        // the parameters every pipeline is created with
         std::string sensor_frame;
         std::string imu_frame;
         std::string lidar_frame;
-
-        tf2_ros::TransformBroadcaster tf_bcast;
-
-        bool use_ros_time;
+        bool use_ros_time = false;
+        ouster_ros::ProcessingParams params;
+        bool deskew = false;
+        bool publish_images = false;
+        bool publish_tensors = false;
+        bool tensor_xyz = false;
+        int scan_buffers = 1;
+        int conversion_thread_cpu = -1;
+        std::string sector_mode;
+        int sector_size = 1;
+        double sector_angle = 90.0;
+        int points_queue_size = 10;
+        int images_queue_size = 100;
+        double max_packet_lag = 0.0;
+
+        // null unless diagnostics are enabled
+        std::shared_ptr<ouster_ros::PipelineStats> stats;
+        std::unique_ptr<ouster_ros::StatsPublisher> stats_publisher;
+        ouster_ros::StatsCounter* lidar_packet_count = nullptr;
+        std::shared_ptr<ouster_ros::ThreadPool> thread_pool;
+
+        ouster_ros::PipelineSwitch<Pipeline> pipelines;
+        // stopped before the pipelines are destroyed
+        std::unique_ptr<ouster_ros::MetadataListener> metadata_listener;
     };
 
 }  // namespace nodelets_os
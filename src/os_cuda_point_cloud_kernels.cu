@@ -0,0 +1,324 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_cuda_point_cloud_kernels.cu
+ * @brief implementation of the CloudKernels
+ */
+
+#include <cuda_runtime.h>
+
+#include <cstring>
+#include <stdexcept>
+
+#include "ouster_ros/os_cuda_point_cloud_kernels.h"
+
+namespace ouster_ros {
+namespace cuda {
+
+namespace {
+
+constexpr int threads_per_block = 256;
+
+// the inputs and outputs of a launch, all device pointers cover the whole
+// frame and the launch writes the pixels [begin, end)
+struct Frame {
+    const float* lut;
+    const uint32_t* destaggered_index;
+    const uint32_t* range;
+    const uint8_t* signal;
+    const uint8_t* reflectivity;
+    const uint8_t* near_ir;
+    int signal_size;
+    int reflectivity_size;
+    int near_ir_size;
+    const uint64_t* timestamps;
+    const float* rotations;
+    int64_t scan_ts;
+    uint32_t range_min;
+    uint32_t range_span;
+    uint32_t width;
+    size_t n_pixels;
+    size_t begin;
+    size_t end;
+    uint8_t* staggered;
+    uint8_t* destaggered;
+    PointLayout layout;
+};
+
+// same casts as FieldView::read()
+__device__ uint32_t load(const uint8_t* data, int size, size_t idx) {
+    switch (size) {
+        case 1:
+            return data[idx];
+        case 2:
+            return reinterpret_cast<const uint16_t*>(data)[idx];
+        case 4:
+            return reinterpret_cast<const uint32_t*>(data)[idx];
+        case 8:
+            return static_cast<uint32_t>(
+                reinterpret_cast<const uint64_t*>(data)[idx]);
+        default:
+            return 0;
+    }
+}
+
+template <typename T>
+__device__ void put(uint8_t* record, int32_t offset, T value) {
+    if (offset >= 0) *reinterpret_cast<T*>(record + offset) = value;
+}
+
+// the values of a pixel, as set_point() would write them
+struct Values {
+    float x, y, z;
+    float intensity;
+    uint32_t t;
+    uint16_t reflectivity;
+    uint16_t ring;
+    uint16_t ambient;
+    uint32_t range;
+};
+
+__device__ void write_record(uint8_t* record, const PointLayout& l,
+                             const Values& p) {
+    put(record, l.x, p.x);
+    put(record, l.y, p.y);
+    put(record, l.z, p.z);
+    put(record, l.w, 1.0f);
+    put(record, l.intensity, p.intensity);
+    put(record, l.t, p.t);
+    put(record, l.reflectivity, p.reflectivity);
+    put(record, l.ring, p.ring);
+    put(record, l.ambient, p.ambient);
+    put(record, l.range, p.range);
+}
+
+// a * b + c rounded after each operation like the cpu serializer, nvcc would
+// contract the plain expression into a fused multiply add
+__device__ float mad(float a, float b, float c) {
+    return __fadd_rn(__fmul_rn(a, b), c);
+}
+
+__device__ float dot3(float m0, float m1, float m2, float x, float y,
+                      float z) {
+    return mad(m2, z, mad(m1, y, __fmul_rn(m0, x)));
+}
+
+// one thread per pixel, mirroring cartesian_block() and write_points() of
+// the cpu serializer
+__global__ void write_points(Frame f) {
+    const size_t idx =
+        f.begin + static_cast<size_t>(blockIdx.x) * blockDim.x + threadIdx.x;
+    if (idx >= f.end) return;
+    const uint32_t u = static_cast<uint32_t>(idx / f.width);
+    const uint32_t v = static_cast<uint32_t>(idx % f.width);
+    const size_t n = f.n_pixels;
+
+    Values p;
+    p.range = f.range[idx];
+    const float r = static_cast<float>(static_cast<int32_t>(p.range));
+    const bool valid = p.range - f.range_min <= f.range_span;
+    p.x = valid ? mad(r, f.lut[idx], f.lut[3 * n + idx]) : 0.0f;
+    p.y = valid ? mad(r, f.lut[n + idx], f.lut[4 * n + idx]) : 0.0f;
+    p.z = valid ? mad(r, f.lut[2 * n + idx], f.lut[5 * n + idx]) : 0.0f;
+    if (f.rotations) {
+        const float* m = f.rotations + v;
+        const uint32_t s = f.width;
+        const float x = p.x, y = p.y, z = p.z;
+        p.x = dot3(m[0], m[s], m[2 * s], x, y, z);
+        p.y = dot3(m[3 * s], m[4 * s], m[5 * s], x, y, z);
+        p.z = dot3(m[6 * s], m[7 * s], m[8 * s], x, y, z);
+    }
+
+    const int64_t dt = static_cast<int64_t>(f.timestamps[v]) - f.scan_ts;
+    p.t = static_cast<uint32_t>(dt < f.scan_ts ? dt : f.scan_ts);
+    p.intensity = static_cast<float>(load(f.signal, f.signal_size, idx));
+    p.reflectivity = static_cast<uint16_t>(
+        load(f.reflectivity, f.reflectivity_size, idx));
+    p.ambient = static_cast<uint16_t>(load(f.near_ir, f.near_ir_size, idx));
+    p.ring = static_cast<uint16_t>(u);
+
+    const size_t step = f.layout.step;
+    if (f.staggered) write_record(f.staggered + idx * step, f.layout, p);
+    if (f.destaggered)
+        write_record(f.destaggered + f.destaggered_index[idx] * step,
+                     f.layout, p);
+}
+
+}  // namespace
+
+struct CloudKernels::Device {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    PointLayout layout{};
+    cudaStream_t stream = nullptr;
+
+    // resident for the lifetime of the serializer
+    float* lut = nullptr;
+    uint32_t* destaggered_index = nullptr;
+
+    // uploaded every frame, channels are sized for 8 byte elements
+    uint32_t* range = nullptr;
+    uint8_t* channels[3] = {};
+    uint64_t* timestamps = nullptr;
+    float* rotations = nullptr;
+
+    // the staggered then the destaggered records, with their pinned copies
+    uint8_t* out[2] = {};
+    uint8_t* pinned[2] = {};
+
+    ~Device() {
+        cudaFree(lut);
+        cudaFree(destaggered_index);
+        cudaFree(range);
+        for (auto* c : channels) cudaFree(c);
+        cudaFree(timestamps);
+        cudaFree(rotations);
+        for (auto* o : out) cudaFree(o);
+        for (auto* p : pinned) cudaFreeHost(p);
+        if (stream) cudaStreamDestroy(stream);
+    }
+};
+
+CloudKernels::CloudKernels(uint32_t width, uint32_t height, const float* lut,
+                           const uint32_t* destaggered_index,
+                           const PointLayout& layout)
+    : device(new Device) {
+    auto& d = *device;
+    d.width = width;
+    d.height = height;
+    d.layout = layout;
+    const size_t n = static_cast<size_t>(width) * height;
+    const size_t records = n * layout.step;
+
+    auto check = [this](cudaError_t status) {
+        if (status == cudaSuccess) return;
+        delete device;
+        throw std::runtime_error(std::string("CloudKernels: ") +
+                                 cudaGetErrorString(status));
+    };
+    check(cudaStreamCreateWithFlags(&d.stream, cudaStreamNonBlocking));
+    check(cudaMalloc(&d.lut, 6 * n * sizeof(float)));
+    check(cudaMalloc(&d.destaggered_index, n * sizeof(uint32_t)));
+    check(cudaMalloc(&d.range, n * sizeof(uint32_t)));
+    for (auto& c : d.channels) check(cudaMalloc(&c, n * sizeof(uint64_t)));
+    check(cudaMalloc(&d.timestamps, width * sizeof(uint64_t)));
+    check(cudaMalloc(&d.rotations, 9 * width * sizeof(float)));
+    for (auto& o : d.out) check(cudaMalloc(&o, records));
+    for (auto& p : d.pinned) check(cudaHostAlloc(&p, records, 0));
+
+    check(cudaMemcpy(d.lut, lut, 6 * n * sizeof(float),
+                     cudaMemcpyHostToDevice));
+    check(cudaMemcpy(d.destaggered_index, destaggered_index,
+                     n * sizeof(uint32_t), cudaMemcpyHostToDevice));
+    // the padding of the records is never written and stays zero
+    for (auto& o : d.out) check(cudaMemset(o, 0, records));
+}
+
+CloudKernels::~CloudKernels() { delete device; }
+
+bool CloudKernels::convert(const uint32_t* range, ChannelView signal,
+                           ChannelView reflectivity, ChannelView near_ir,
+                           const uint64_t* timestamps, uint64_t scan_ts,
+                           uint32_t range_min, uint32_t range_span,
+                           const float* rotations, uint32_t row_begin,
+                           uint32_t row_end, uint8_t* staggered,
+                           uint8_t* destaggered, std::string& error) {
+    auto& d = *device;
+    row_end = row_end < d.height ? row_end : d.height;
+    if (row_begin >= row_end || (!staggered && !destaggered)) return true;
+    const size_t begin = static_cast<size_t>(row_begin) * d.width;
+    const size_t end = static_cast<size_t>(row_end) * d.width;
+    const size_t n = end - begin;
+    const size_t step = d.layout.step;
+
+    cudaError_t status = cudaSuccess;
+    auto check = [&status](cudaError_t s) {
+        if (status == cudaSuccess) status = s;
+    };
+
+    // only the rows written are uploaded, at their offsets in the frame
+    check(cudaMemcpyAsync(d.range + begin, range + begin,
+                          n * sizeof(uint32_t), cudaMemcpyHostToDevice,
+                          d.stream));
+    const ChannelView views[3] = {signal, reflectivity, near_ir};
+    for (int c = 0; c < 3; ++c) {
+        if (views[c].size == 0) continue;
+        check(cudaMemcpyAsync(
+            d.channels[c] + begin * views[c].size,
+            static_cast<const uint8_t*>(views[c].data) + begin * views[c].size,
+            n * views[c].size, cudaMemcpyHostToDevice, d.stream));
+    }
+    check(cudaMemcpyAsync(d.timestamps, timestamps,
+                          d.width * sizeof(uint64_t), cudaMemcpyHostToDevice,
+                          d.stream));
+    if (rotations)
+        check(cudaMemcpyAsync(d.rotations, rotations,
+                              9 * d.width * sizeof(float),
+                              cudaMemcpyHostToDevice, d.stream));
+
+    Frame f;
+    f.lut = d.lut;
+    f.destaggered_index = d.destaggered_index;
+    f.range = d.range;
+    f.signal = d.channels[0];
+    f.reflectivity = d.channels[1];
+    f.near_ir = d.channels[2];
+    f.signal_size = signal.size;
+    f.reflectivity_size = reflectivity.size;
+    f.near_ir_size = near_ir.size;
+    f.timestamps = d.timestamps;
+    f.rotations = rotations ? d.rotations : nullptr;
+    f.scan_ts = static_cast<int64_t>(scan_ts);
+    f.range_min = range_min;
+    f.range_span = range_span;
+    f.width = d.width;
+    f.n_pixels = static_cast<size_t>(d.width) * d.height;
+    f.begin = begin;
+    f.end = end;
+    f.staggered = staggered ? d.out[0] : nullptr;
+    f.destaggered = destaggered ? d.out[1] : nullptr;
+    f.layout = d.layout;
+    const auto blocks =
+        static_cast<unsigned>((n + threads_per_block - 1) / threads_per_block);
+    write_points<<<blocks, threads_per_block, 0, d.stream>>>(f);
+    check(cudaGetLastError());
+
+    // destaggering keeps the pixels within their row, so both clouds only
+    // changed within the rows written
+    uint8_t* dest[2] = {staggered, destaggered};
+    for (int o = 0; o < 2; ++o) {
+        if (!dest[o]) continue;
+        check(cudaMemcpyAsync(d.pinned[o] + begin * step,
+                              d.out[o] + begin * step, n * step,
+                              cudaMemcpyDeviceToHost, d.stream));
+    }
+    check(cudaStreamSynchronize(d.stream));
+    if (status != cudaSuccess) {
+        error = cudaGetErrorString(status);
+        return false;
+    }
+    for (int o = 0; o < 2; ++o) {
+        if (dest[o])
+            std::memcpy(dest[o] + begin * step, d.pinned[o] + begin * step,
+                        n * step);
+    }
+    return true;
+}
+
+bool CloudKernels::device_available(std::string& reason) {
+    int count = 0;
+    const auto status = cudaGetDeviceCount(&count);
+    if (status != cudaSuccess) {
+        reason = cudaGetErrorString(status);
+        return false;
+    }
+    if (count == 0) {
+        reason = "no CUDA device found";
+        return false;
+    }
+    return true;
+}
+
+}  // namespace cuda
+}  // namespace ouster_ros
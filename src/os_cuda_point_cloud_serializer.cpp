@@ -0,0 +1,159 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_cuda_point_cloud_serializer.cpp
+ * @brief implementation of the CUDA point cloud serializer
+ */
+
+#include "ouster_ros/os_cuda_point_cloud_serializer.h"
+
+#ifdef OUSTER_ROS_CUDA
+#include <algorithm>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "ouster_ros/os_cuda_point_cloud_kernels.h"
+#endif
+
+namespace ouster_ros {
+
+#ifdef OUSTER_ROS_CUDA
+namespace {
+
+int32_t field_offset(const std::vector<sensor_msgs::PointField>& fields,
+                     const std::string& name) {
+    for (const auto& field : fields)
+        if (field.name == name) return static_cast<int32_t>(field.offset);
+    return -1;
+}
+
+// the channels the point type ignores are never uploaded
+cuda::ChannelView channel_view(const FieldView& view, bool used) {
+    if (!used || !view.data) return {nullptr, 0};
+    return {view.data, static_cast<int>(sensor::field_type_size(view.type))};
+}
+
+class CudaPointCloudSerializer : public PointCloudSerializer {
+   public:
+    CudaPointCloudSerializer(const sensor::sensor_info& info,
+                             const CloudFilter& filter,
+                             std::unique_ptr<PointCloudSerializer> cpu,
+                             bool aligned_points)
+        : PointCloudSerializer(info, cpu->point_fields(), cpu->point_size(),
+                               cpu->channels(), filter),
+          cpu(std::move(cpu)) {
+        cuda::PointLayout layout;
+        layout.step = point_step;
+        layout.x = field_offset(fields, "x");
+        layout.y = field_offset(fields, "y");
+        layout.z = field_offset(fields, "z");
+        // PCL aligned points carry a fourth coordinate of 1 right after z
+        layout.w = aligned_points ? layout.z + 4 : -1;
+        layout.intensity = field_offset(fields, "intensity");
+        layout.t = field_offset(fields, "t");
+        layout.reflectivity = field_offset(fields, "reflectivity");
+        layout.ring = field_offset(fields, "ring");
+        layout.ambient = field_offset(fields, "ambient");
+        layout.range = field_offset(fields, "range");
+
+        // the lut matrices are column major, the device gets the direction
+        // then the offset as six contiguous arrays
+        const size_t n = 3 * static_cast<size_t>(width) * height;
+        std::vector<float> lut(2 * n);
+        std::copy(lut_direction.data(), lut_direction.data() + n, lut.begin());
+        std::copy(lut_offset.data(), lut_offset.data() + n, lut.begin() + n);
+        kernels = std::make_unique<cuda::CloudKernels>(
+            width, height, lut.data(), destaggered_index.data(), layout);
+    }
+
+    void serialize_rows(sensor_msgs::PointCloud2* msg,
+                        sensor_msgs::PointCloud2* destaggered_msg,
+                        const ouster::LidarScan& ls,
+                        std::chrono::nanoseconds scan_ts,
+                        Eigen::Ref<const ouster::img_t<uint32_t>> range,
+                        const FieldView& reflectivity,
+                        const FieldView& near_ir, const FieldView& signal,
+                        uint32_t row_begin, uint32_t row_end,
+                        const ColumnRotations* rotations) const override {
+        const auto timestamp = ls.timestamp();
+        std::string error;
+        bool converted;
+        {
+            // the device buffers are shared by the returns and the chunks
+            std::lock_guard<std::mutex> lock(mutex);
+            converted = kernels->convert(
+                range.data(), channel_view(signal, used_channels.signal),
+                channel_view(reflectivity, used_channels.reflectivity),
+                channel_view(near_ir, used_channels.near_ir),
+                timestamp.data(), scan_ts.count(), range_min, range_span,
+                rotations ? rotations->matrix.data() : nullptr, row_begin,
+                row_end, msg ? msg->data.data() : nullptr,
+                destaggered_msg ? destaggered_msg->data.data() : nullptr,
+                error);
+        }
+        if (converted) return;
+        ROS_ERROR_STREAM_THROTTLE(1, "CudaPointCloudSerializer: " << error
+                                         << ", serializing on the cpu");
+        cpu->serialize_rows(msg, destaggered_msg, ls, scan_ts, range,
+                            reflectivity, near_ir, signal, row_begin, row_end,
+                            rotations);
+    }
+
+    void serialize_sector(sensor_msgs::PointCloud2& msg,
+                          const ouster::LidarScan& ls,
+                          std::chrono::nanoseconds sector_ts,
+                          Eigen::Ref<const ouster::img_t<uint32_t>> range,
+                          const FieldView& reflectivity,
+                          const FieldView& near_ir, const FieldView& signal,
+                          uint32_t col_begin, uint32_t col_end) const override {
+        // sectors are too small to amortize the transfers
+        cpu->serialize_sector(msg, ls, sector_ts, range, reflectivity, near_ir,
+                              signal, col_begin, col_end);
+    }
+
+   private:
+    std::unique_ptr<PointCloudSerializer> cpu;
+    std::unique_ptr<cuda::CloudKernels> kernels;
+    mutable std::mutex mutex;
+};
+
+}  // namespace
+#endif
+
+bool cuda_backend_supports(const CloudFilter& filter, std::string& reason) {
+#ifdef OUSTER_ROS_CUDA
+    if (filter.selects()) {
+        reason =
+            "row_stride, column_stride, the angular windows and dense_output "
+            "are only implemented by the cpu backend";
+        return false;
+    }
+    return cuda::CloudKernels::device_available(reason);
+#else
+    (void)filter;
+    reason = "ouster_ros was built without the BUILD_CUDA option";
+    return false;
+#endif
+}
+
+std::unique_ptr<PointCloudSerializer> make_cuda_point_cloud_serializer(
+    const std::string& point_type, const sensor::sensor_info& info,
+    const CloudFilter& filter) {
+#ifdef OUSTER_ROS_CUDA
+    std::string reason;
+    if (!cuda_backend_supports(filter, reason)) return nullptr;
+    auto cpu = make_point_cloud_serializer(point_type, info, filter);
+    if (!cpu) return nullptr;
+    return std::make_unique<CudaPointCloudSerializer>(
+        info, filter, std::move(cpu), point_type == "original");
+#else
+    (void)point_type;
+    (void)info;
+    (void)filter;
+    return nullptr;
+#endif
+}
+
+}  // namespace ouster_ros
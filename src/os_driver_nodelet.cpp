@@ -0,0 +1,188 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_driver_nodelet.cpp
+ * @brief A nodelet that connects to a live ouster sensor and publishes point
+ * clouds and imu messages directly from the received packets
+ */
+
+// prevent clang-format from altering the location of "ouster_ros/ros.h", the
+// header file needs to be the first include due to PCL_NO_PRECOMPILE flag
+// clang-format off
+#include "ouster_ros/os_ros.h"
+// clang-format on
+
+#include <pluginlib/class_list_macros.h>
+#include <tf2_ros/static_transform_broadcaster.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ouster_ros/os_image_processor.h"
+#include "ouster_ros/os_imu_packet_handler.h"
+#include "ouster_ros/os_lidar_packet_handler.h"
+#include "ouster_ros/os_motion_compensator.h"
+#include "ouster_ros/os_point_cloud_processor.h"
+#include "ouster_ros/os_processing_params.h"
+#include "ouster_ros/os_scan_monitor.h"
+#include "ouster_ros/os_sector_processor.h"
+#include "ouster_ros/os_sensor_nodelet.h"
+#include "ouster_ros/os_tensor_processor.h"
+#include "ouster_ros/os_transport.h"
+
+namespace sensor = ouster::sensor;
+using ouster_ros::PacketMsg;
+
+namespace nodelets_os {
+
+/**
+ * Combines OusterSensor and OusterCloud: lidar packets are assembled into
+ * scans straight from the receive buffers, without a round trip through the
+ * lidar_packets topic. Packets are still published for whoever subscribes to
+ * them, e.g. to record them.
+ */
+class OusterDriver : public OusterSensor {
+   protected:
+    virtual void on_metadata_updated(const sensor::sensor_info& info) override {
+        // a previous handler may still be converting a scan with the
+        // processors replaced below
+        lidar_packet_handler.reset();
+
+        auto& pnh = getPrivateNodeHandle();
+        auto tf_prefix = pnh.param("tf_prefix", std::string{});
+        if (is_arg_set(tf_prefix) && tf_prefix.back() != '/')
+            tf_prefix.append("/");
+        auto sensor_frame = tf_prefix + "os_sensor";
+        auto imu_frame = tf_prefix + "os_imu";
+        auto lidar_frame = tf_prefix + "os_lidar";
+        auto timestamp_mode_arg = pnh.param("timestamp_mode", std::string{});
+        bool use_ros_time = timestamp_mode_arg == "TIME_FROM_ROS_TIME";
+
+        NODELET_INFO_STREAM("Profile has " << ouster_ros::get_n_returns(info)
+                                           << " return(s)");
+
+        const auto params =
+            ouster_ros::processing_params_of(pnh, "OusterDriver");
+        // shared by the full frame and the sector point clouds
+        std::shared_ptr<const ouster_ros::PointCloudSerializer> serializer =
+            ouster_ros::make_point_cloud_serializer(params, info);
+
+        std::shared_ptr<ouster_ros::ThreadPool> thread_pool;
+        auto cloud_threads = pnh.param("cloud_threads", 1);
+        if (cloud_threads > 1)
+            thread_pool = std::make_shared<ouster_ros::ThreadPool>(
+                cloud_threads, pnh.param("cloud_threads_cpu", -1));
+
+        // the extrinsics never change, late subscribers get them latched
+        static_tf_bcast.sendTransform(
+            std::vector<geometry_msgs::TransformStamped>{
+                ouster_ros::transform_to_tf_msg(info.imu_to_sensor_transform,
+                                                sensor_frame, imu_frame),
+                ouster_ros::transform_to_tf_msg(info.lidar_to_sensor_transform,
+                                                sensor_frame, lidar_frame)});
+
+        auto& nh = getNodeHandle();
+        imu_packet_handler = std::make_unique<ouster_ros::ImuPacketHandler>(
+            info, nh, imu_frame, use_ros_time, params.imu_batch_size);
+        scan_monitor = std::make_unique<ouster_ros::ScanMonitor>(
+            info, nh, sensor_frame, params.frame_policy,
+            params.min_completeness, stats);
+        // deskews the full frame clouds with the imu packets received
+        if (pnh.param("deskew", false))
+            motion_compensator =
+                std::make_shared<ouster_ros::MotionCompensator>(info);
+        point_cloud_processor =
+            std::make_unique<ouster_ros::PointCloudProcessor>(
+                info, nh, sensor_frame, params.staggered, params.destagger,
+                serializer, std::move(thread_pool), stats, motion_compensator,
+                ouster_ros::queue_size_of_params(pnh, "points", 10));
+        // the images are generated from the same scans as the point clouds,
+        // in place of a separate OusterImage nodelet
+        if (pnh.param("publish_images", false))
+            image_processor = std::make_unique<ouster_ros::ImageProcessor>(
+                info, nh, ros::SubscriberStatusCallback(),
+                ouster_ros::queue_size_of_params(pnh, "images", 100));
+        // the raw channel stack of the scans, for learning pipelines
+        if (pnh.param("publish_tensors", false))
+            tensor_processor = std::make_unique<ouster_ros::TensorProcessor>(
+                info, nh, sensor_frame, pnh.param("tensor_xyz", false));
+        lidar_packet_handler = std::make_unique<ouster_ros::LidarPacketHandler>(
+            info, use_ros_time,
+            [this](const ouster::LidarScan& ls,
+                   std::chrono::nanoseconds scan_ts, const ros::Time& msg_ts) {
+                using Policy = ouster_ros::ScanMonitor::Policy;
+                const auto policy = (*scan_monitor)(ls, msg_ts);
+                if (policy == Policy::DROP) return;
+                (*point_cloud_processor)(ls, scan_ts, msg_ts,
+                                         policy != Policy::MARK);
+                if (image_processor) (*image_processor)(ls, scan_ts, msg_ts);
+                if (tensor_processor)
+                    (*tensor_processor)(ls, scan_ts, msg_ts);
+            },
+            std::max(pnh.param("scan_buffers", 1), 1),
+            pnh.param("conversion_thread_cpu", -1), stats);
+
+        auto sector_mode = pnh.param("sector_mode", std::string{});
+        if (is_arg_set(sector_mode)) {
+            uint32_t sector_columns;
+            if (!ouster_ros::sector_columns_of_params(
+                    info, sector_mode, pnh.param("sector_size", 1),
+                    pnh.param("sector_angle", 90.0), sector_columns)) {
+                auto error_msg =
+                    "OusterDriver: unsupported sector_mode: " + sector_mode;
+                NODELET_ERROR_STREAM(error_msg);
+                throw std::runtime_error(error_msg);
+            }
+            NODELET_INFO_STREAM("OusterDriver: streaming sectors of "
+                                << sector_columns << " columns");
+            sector_processor = std::make_unique<ouster_ros::SectorProcessor>(
+                info, nh, sensor_frame, serializer, sector_columns);
+            lidar_packet_handler->set_sector_callback(
+                sector_columns,
+                [this](const ouster::LidarScan& ls, uint32_t col_begin,
+                       uint32_t col_end, std::chrono::nanoseconds sector_ts,
+                       const ros::Time& msg_ts) {
+                    (*sector_processor)(ls, col_begin, col_end, sector_ts,
+                                        msg_ts);
+                });
+        }
+    }
+
+    virtual void on_lidar_packet(const PacketMsg::Ptr& packet,
+                                 const ros::Time& stamp) override {
+        (*lidar_packet_handler)(packet->buf.data(), stamp);
+
+        if (lidar_packet_pub.getNumSubscribers() > 0 ||
+            lidar_packet_batch_pub.getNumSubscribers() > 0)
+            OusterSensor::on_lidar_packet(packet, stamp);
+    }
+
+    virtual void on_imu_packet(const PacketMsg::Ptr& packet,
+                               const ros::Time& stamp) override {
+        if (motion_compensator)
+            motion_compensator->add_imu_packet(packet->buf.data());
+        (*imu_packet_handler)(packet->buf.data());
+
+        if (imu_packet_pub.getNumSubscribers() > 0)
+            OusterSensor::on_imu_packet(packet, stamp);
+    }
+
+   private:
+    tf2_ros::StaticTransformBroadcaster static_tf_bcast;
+    std::unique_ptr<ouster_ros::ImuPacketHandler> imu_packet_handler;
+    std::shared_ptr<ouster_ros::MotionCompensator> motion_compensator;
+    std::unique_ptr<ouster_ros::ScanMonitor> scan_monitor;
+    std::unique_ptr<ouster_ros::PointCloudProcessor> point_cloud_processor;
+    std::unique_ptr<ouster_ros::ImageProcessor> image_processor;
+    std::unique_ptr<ouster_ros::TensorProcessor> tensor_processor;
+    std::unique_ptr<ouster_ros::SectorProcessor> sector_processor;
+    std::unique_ptr<ouster_ros::LidarPacketHandler> lidar_packet_handler;
+};
+
+}  // namespace nodelets_os
+
+PLUGINLIB_EXPORT_CLASS(nodelets_os::OusterDriver, nodelet::Nodelet)
@@ -4,7 +4,7 @@
  *
  * @file os_image_nodelet.cpp
  * @brief A nodelet to decode range, near ir and signal images from ouster
- * point cloud
+ * point cloud or lidar packets
  *
  * Publishes ~/range_image, ~/nearir_image, and ~/signal_image.  Please bear
  * in mind that there is rounding/clamping to display 8 bit images. For computer
@@ -22,36 +22,36 @@
 #include <pcl_conversions/pcl_conversions.h>
 #include <pluginlib/class_list_macros.h>
 #include <ros/ros.h>
-#include <sensor_msgs/Image.h>
 #include <sensor_msgs/PointCloud2.h>
-#include <sensor_msgs/image_encodings.h>
 
-#include <iomanip>
-#include <iostream>
-#include <sstream>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
-#include "ouster/image_processing.h"
-#include "ouster_ros/GetMetadata.h"
+#include "ouster_ros/PacketBatchMsg.h"
+#include "ouster_ros/PacketMsg.h"
+#include "ouster_ros/os_image_processor.h"
+#include "ouster_ros/os_lidar_packet_handler.h"
+#include "ouster_ros/os_metadata_cache.h"
+#include "ouster_ros/os_metadata_listener.h"
+#include "ouster_ros/os_packet_backlog.h"
+#include "ouster_ros/os_point_cloud_processor.h"
+#include "ouster_ros/os_transport.h"
 
 namespace sensor = ouster::sensor;
-namespace viz = ouster::viz;
-using sensor::UDPProfileLidar;
-
-using pixel_type = uint16_t;
-const size_t pixel_value_max = std::numeric_limits<pixel_type>::max();
+using ouster_ros::PacketBatchMsg;
+using ouster_ros::PacketMsg;
 
 namespace nodelets_os {
     class OusterImage : public nodelet::Nodelet {
     private:
         virtual void onInit() override {
             auto &nh = getNodeHandle();
+            auto &pnh = getPrivateNodeHandle();
 
-            ouster_ros::GetMetadata metadata{};
-            auto client = nh.serviceClient<ouster_ros::GetMetadata>("get_metadata");
-            client.waitForExistence();
-            if (!client.call(metadata)) {
+            auto metadata = ouster_ros::fetch_sensor_metadata(nh);
+            if (!metadata) {
                 auto error_msg = "OusterImage: Calling get_metadata service failed";
                 NODELET_ERROR_STREAM(error_msg);
                 throw std::runtime_error(error_msg);
@@ -59,122 +59,180 @@ namespace nodelets_os {
 
             NODELET_INFO("OusterImage: retrieved sensor metadata!");
 
-            info = sensor::parse_metadata(metadata.response.metadata);
-
-            const int n_returns =
-                    info.format.udp_profile_lidar ==
-                    UDPProfileLidar::PROFILE_RNG19_RFL8_SIG16_NIR16_DUAL
-                    ? 2
-                    : 1;
-
-            nearir_image_pub =
-                    nh.advertise<sensor_msgs::Image>("nearir_image", 100);
-
-            auto topic = [](auto base, int ind) {
-                if (ind == 0) return std::string(base);
-                return std::string(base) +
-                       std::to_string(ind + 1);  // need second return to return 2
-            };
-
-            ros::Publisher a_pub;
-            for (int i = 0; i < n_returns; i++) {
-                a_pub =
-                        nh.advertise<sensor_msgs::Image>(topic("range_image", i), 100);
-                range_image_pubs.push_back(a_pub);
+            // the images are either decoded from the point clouds or generated
+            // straight from the scans assembled out of the lidar packets,
+            // which skips the point cloud round trip entirely
+            use_lidar_packets = pnh.param("use_lidar_packets", false);
+            use_packet_batches = pnh.param("use_packet_batches", false);
+            auto timestamp_mode_arg =
+                    pnh.param("timestamp_mode", std::string{});
+            use_ros_time = timestamp_mode_arg == "TIME_FROM_ROS_TIME";
+
+            // the topic the images are generated from
+            input_topic = !use_lidar_packets    ? "points"
+                          : use_packet_batches ? "lidar_packet_batches"
+                                               : "lidar_packets";
+            input_queue_size = ouster_ros::queue_size_of_params(
+                    pnh, input_topic,
+                    use_lidar_packets && !use_packet_batches ? 2048 : 100);
+            if (!ouster_ros::transport_hints_of_params(pnh, input_topic,
+                                                       input_transport)) {
+                auto error_msg =
+                    "OusterImage: unsupported transport for " + input_topic;
+                NODELET_ERROR_STREAM(error_msg);
+                throw std::runtime_error(error_msg);
+            }
+            images_queue_size =
+                    ouster_ros::queue_size_of_params(pnh, "images", 100);
+            max_packet_lag = pnh.param("max_packet_lag", 0.0);
+            if (max_packet_lag < 0.0) {
+                auto error_msg = "OusterImage: max_packet_lag must not be negative";
+                NODELET_ERROR_STREAM(error_msg);
+                throw std::runtime_error(error_msg);
+            }
 
-                a_pub =
-                        nh.advertise<sensor_msgs::Image>(topic("signal_image", i), 100);
-                signal_image_pubs.push_back(a_pub);
+            pipelines.activate(create_pipeline(metadata->info()));
+            update_subscriptions();
+
+            // whole point clouds switch over right away, the lidar packets
+            // on a frame boundary
+            metadata_listener = std::make_unique<ouster_ros::MetadataListener>(
+                    nh, metadata,
+                    [this](std::shared_ptr<const ouster_ros::SensorMetadata>
+                                   metadata) {
+                        const auto &info = metadata->info();
+                        if (use_lidar_packets) {
+                            pipelines.suspend();
+                            pipelines.stage(create_pipeline(info), info);
+                        } else {
+                            pipelines.activate(create_pipeline(info));
+                            update_subscriptions();
+                        }
+                    });
+        }
 
-                a_pub =
-                        nh.advertise<sensor_msgs::Image>(topic("reflec_image", i), 100);
-                reflec_image_pubs.push_back(a_pub);
+        // the state of the images, rebuilt whenever the metadata changes;
+        // the lidar packet handler is destroyed before the processor it feeds
+        struct Pipeline {
+            int n_returns = 1;
+            ouster_ros::Cloud cloud;
+            std::unique_ptr<ouster_ros::ImageProcessor> image_processor;
+            std::unique_ptr<ouster_ros::LidarPacketHandler>
+                    lidar_packet_handler;
+            // null unless max_packet_lag is set
+            std::unique_ptr<ouster_ros::PacketBacklog> packet_backlog;
+
+            bool admit(const uint8_t *packet_buf) {
+                return !packet_backlog || packet_backlog->admit(packet_buf);
+            }
+        };
+
+        std::shared_ptr<Pipeline> create_pipeline(
+                const sensor::sensor_info &info) {
+            auto p = std::make_shared<Pipeline>();
+            p->n_returns = ouster_ros::get_n_returns(info);
+            if (use_lidar_packets) {
+                auto *raw = p.get();
+                p->lidar_packet_handler =
+                        std::make_unique<ouster_ros::LidarPacketHandler>(
+                                info, use_ros_time,
+                                [raw](const ouster::LidarScan &ls,
+                                      std::chrono::nanoseconds scan_ts,
+                                      const ros::Time &msg_ts) {
+                                    (*raw->image_processor)(ls, scan_ts,
+                                                            msg_ts);
+                                });
+                // stale packets are worth less than no packets at all
+                if (max_packet_lag > 0.0)
+                    p->packet_backlog =
+                            std::make_unique<ouster_ros::PacketBacklog>(
+                                    info,
+                                    std::chrono::duration_cast<
+                                            std::chrono::nanoseconds>(
+                                            std::chrono::duration<double>(
+                                                    max_packet_lag)));
+            } else {
+                uint32_t H = info.format.pixels_per_column;
+                uint32_t W = info.format.columns_per_frame;
+                p->cloud = ouster_ros::Cloud{W, H};
             }
 
-            uint32_t H = info.format.pixels_per_column;
-            uint32_t W = info.format.columns_per_frame;
-            cloud = ouster_ros::Cloud{W, H};
+            // only subscribe to the point clouds or packets while someone
+            // watches the images, so that they aren't generated for nothing
+            ros::SubscriberStatusCallback on_connection =
+                    [this](const ros::SingleSubscriberPublisher &) {
+                        update_subscriptions();
+                    };
+            p->image_processor = std::make_unique<ouster_ros::ImageProcessor>(
+                    info, getNodeHandle(), on_connection, images_queue_size);
+            return p;
+        }
 
-            // image processing
-            pc1_sub = nh.subscribe<sensor_msgs::PointCloud2>(
-                    topic("points", 0), 100, &OusterImage::first_cloud_handler, this);
+        bool has_subscribers(const Pipeline &p, int sub_index) const {
+            return use_lidar_packets
+                           ? p.image_processor->has_subscribers()
+                           : p.image_processor->has_subscribers(sub_index);
+        }
 
-            if (n_returns > 1) {
-                pc2_sub = nh.subscribe<sensor_msgs::PointCloud2>(
-                        topic("points", 1), 100, &OusterImage::second_cloud_handler,
-                        this);
-            }
+        ros::Subscriber subscribe(int sub_index) {
+            auto &nh = getNodeHandle();
+            if (use_lidar_packets && use_packet_batches)
+                return nh.subscribe<PacketBatchMsg>(
+                        input_topic, input_queue_size,
+                        &OusterImage::lidar_batch_handler, this,
+                        input_transport);
+            if (use_lidar_packets)
+                return nh.subscribe<PacketMsg>(
+                        input_topic, input_queue_size,
+                        &OusterImage::lidar_handler, this, input_transport);
+            if (sub_index == 0)
+                return nh.subscribe<sensor_msgs::PointCloud2>(
+                        "points", input_queue_size,
+                        &OusterImage::first_cloud_handler, this,
+                        input_transport);
+            return nh.subscribe<sensor_msgs::PointCloud2>(
+                    "points2", input_queue_size,
+                    &OusterImage::second_cloud_handler, this, input_transport);
         }
 
-        void base_cloud_handler(const sensor_msgs::PointCloud2::ConstPtr &m,
-                                int return_index) {
-            pcl::fromROSMsg(*m, cloud);
-
-            const bool first = (return_index == 0);
-            uint32_t H = info.format.pixels_per_column;
-            uint32_t W = info.format.columns_per_frame;
-
-            auto range_image = make_image_msg(H, W, m->header.stamp);
-            auto signal_image = make_image_msg(H, W, m->header.stamp);
-            auto reflec_image = make_image_msg(H, W, m->header.stamp);
-            auto nearir_image = make_image_msg(H, W, m->header.stamp);
-
-            ouster::img_t<float> nearir_image_eigen(H, W);
-            ouster::img_t<float> signal_image_eigen(H, W);
-            ouster::img_t<float> reflec_image_eigen(H, W);
-
-            // views into message data
-            auto range_image_map = Eigen::Map<ouster::img_t<pixel_type>>(
-                    (pixel_type *) range_image->data.data(), H, W);
-            auto signal_image_map = Eigen::Map<ouster::img_t<pixel_type>>(
-                    (pixel_type *) signal_image->data.data(), H, W);
-            auto reflec_image_map = Eigen::Map<ouster::img_t<pixel_type>>(
-                    (pixel_type *) reflec_image->data.data(), H, W);
-
-            auto nearir_image_map = Eigen::Map<ouster::img_t<pixel_type>>(
-                    (pixel_type *) nearir_image->data.data(), H, W);
-
-            const auto &px_offset = info.format.pixel_shift_by_row;
-
-            // copy data out of Cloud message, with destaggering
-            for (size_t u = 0; u < H; u++) {
-                for (size_t v = 0; v < W; v++) {
-                    const size_t vv = (v + W - px_offset[u]) % W;
-                    const auto &pt = cloud[u * W + vv];
-
-                    // 16 bit img: use 4mm resolution and throw out returns >
-                    // 260m
-                    auto r = (pt.range + 0b10) >> 2;
-                    range_image_map(u, v) = r > pixel_value_max ? 0 : r;
-
-                    signal_image_eigen(u, v) = pt.intensity;
-                    reflec_image_eigen(u, v) = pt.reflectivity;
-                    nearir_image_eigen(u, v) = pt.ambient;
+        void update_subscriptions() {
+            std::lock_guard<std::mutex> lock(subscription_mutex);
+            // publishers advertised by a pipeline that isn't active yet
+            // are handled once it is
+            auto p = pipelines.get();
+            if (!p) return;
+            const size_t n_subs = use_lidar_packets ? 1 : p->n_returns;
+            for (size_t i = n_subs; i < subs.size(); ++i) subs[i].shutdown();
+            subs.resize(n_subs);
+            for (size_t i = 0; i < subs.size(); ++i) {
+                const bool subscribed = static_cast<bool>(subs[i]);
+                if (has_subscribers(*p, i) == subscribed) continue;
+
+                if (subscribed) {
+                    subs[i].shutdown();
+                    subs[i] = ros::Subscriber();
+                } else {
+                    subs[i] = subscribe(i);
                 }
             }
+        }
 
-            signal_ae(signal_image_eigen, first);
-            reflec_ae(reflec_image_eigen, first);
-            nearir_buc(nearir_image_eigen);
-            nearir_ae(nearir_image_eigen, first);
-            nearir_image_eigen = nearir_image_eigen.sqrt();
-            signal_image_eigen = signal_image_eigen.sqrt();
-
-            // copy data into image messages
-            signal_image_map =
-                    (signal_image_eigen * pixel_value_max).cast<pixel_type>();
-            reflec_image_map =
-                    (reflec_image_eigen * pixel_value_max).cast<pixel_type>();
-            if (first) {
-                nearir_image_map =
-                        (nearir_image_eigen * pixel_value_max).cast<pixel_type>();
-                nearir_image_pub.publish(nearir_image);
+        void base_cloud_handler(const sensor_msgs::PointCloud2::ConstPtr &m,
+                                int return_index) {
+            auto p = pipelines.get();
+            if (return_index >= p->n_returns ||
+                !p->image_processor->has_subscribers(return_index))
+                return;
+            // decimated or dense clouds no longer map onto the image pixels
+            if (m->width != p->cloud.width || m->height != p->cloud.height) {
+                NODELET_ERROR_THROTTLE(
+                        1, "OusterImage: the point clouds don't match the "
+                           "sensor resolution, generate the images from the "
+                           "lidar packets or the scans instead");
+                return;
             }
-
-            // publish at return index
-            range_image_pubs[return_index].publish(range_image);
-            signal_image_pubs[return_index].publish(signal_image);
-            reflec_image_pubs[return_index].publish(reflec_image);
+            pcl::fromROSMsg(*m, p->cloud);
+            (*p->image_processor)(p->cloud, return_index, m->header.stamp);
         }
 
         void first_cloud_handler(const sensor_msgs::PointCloud2::ConstPtr &m) {
@@ -185,32 +243,45 @@ namespace nodelets_os {
             base_cloud_handler(m, 1);
         }
 
-        static sensor_msgs::ImagePtr make_image_msg(size_t H, size_t W,
-                                                    const ros::Time &stamp) {
-            auto msg = boost::make_shared<sensor_msgs::Image>();
-            msg->width = W;
-            msg->height = H;
-            msg->step = W * sizeof(pixel_type);
-            msg->encoding = sensor_msgs::image_encodings::MONO16;
-            msg->data.resize(W * H * sizeof(pixel_type));
-            msg->header.stamp = stamp;
-            return msg;
+        void lidar_handler(const PacketMsg::ConstPtr &packet) {
+            auto p = pipelines.for_lidar_packet(packet->buf.data());
+            if (p && p->admit(packet->buf.data()))
+                (*p->lidar_packet_handler)(packet->buf.data(),
+                                           ros::Time::now());
         }
 
-    private:
-        ros::Publisher nearir_image_pub;
-        std::vector<ros::Publisher> range_image_pubs;
-        std::vector<ros::Publisher> signal_image_pubs;
-        std::vector<ros::Publisher> reflec_image_pubs;
-
-        ros::Subscriber pc1_sub;
-        ros::Subscriber pc2_sub;
+        void lidar_batch_handler(const PacketBatchMsg::ConstPtr &batch) {
+            const auto packet_count = batch->stamps.size();
+            if (batch->buf.size() < packet_count * batch->packet_size) {
+                NODELET_ERROR_THROTTLE(
+                        1, "OusterImage: dropping malformed packet batch");
+                return;
+            }
 
-        sensor::sensor_info info;
+            for (size_t i = 0; i < packet_count; ++i) {
+                const auto *buf = batch->buf.data() + i * batch->packet_size;
+                auto p = pipelines.for_lidar_packet(buf);
+                if (p && p->admit(buf))
+                    (*p->lidar_packet_handler)(buf, batch->stamps[i]);
+            }
+        }
 
-        ouster_ros::Cloud cloud;
-        viz::AutoExposure nearir_ae, signal_ae, reflec_ae;
-        viz::BeamUniformityCorrector nearir_buc;
+    private:
+        bool use_lidar_packets = false;
+        bool use_packet_batches = false;
+        bool use_ros_time = false;
+        std::string input_topic;
+        int input_queue_size = 100;
+        ros::TransportHints input_transport;
+        int images_queue_size = 100;
+        double max_packet_lag = 0.0;
+
+        std::mutex subscription_mutex;
+        std::vector<ros::Subscriber> subs;
+
+        ouster_ros::PipelineSwitch<Pipeline> pipelines;
+        // stopped before the pipelines are destroyed
+        std::unique_ptr<ouster_ros::MetadataListener> metadata_listener;
     };
 }  // namespace nodelets_os
 
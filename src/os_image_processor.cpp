@@ -0,0 +1,213 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_image_processor.cpp
+ * @brief implementation of the ImageProcessor
+ */
+
+#include "ouster_ros/os_image_processor.h"
+
+#include <sensor_msgs/image_encodings.h>
+
+#include <limits>
+
+#include "ouster_ros/os_point_cloud_processor.h"
+
+using ouster::sensor::ChanField;
+
+namespace ouster_ros {
+
+namespace {
+
+const size_t pixel_value_max =
+    std::numeric_limits<ImageProcessor::pixel_type>::max();
+
+// reads the channels of a return straight from the fields of a scan
+struct ScanSource {
+    FieldView range;
+    FieldView signal;
+    FieldView reflec;
+    FieldView nearir;
+};
+
+// reads a channel of the points of a staggered cloud, like a FieldView
+template <typename M>
+struct CloudField {
+    const Cloud& cloud;
+    M Point::*member;
+
+    template <typename T>
+    void read(size_t idx, int n, T* dest) const {
+        for (int k = 0; k < n; ++k) dest[k] = cloud[idx + k].*member;
+    }
+};
+
+// reads the channels of a return from the points of its staggered cloud
+struct CloudSource {
+    explicit CloudSource(const Cloud& cloud)
+        : range{cloud, &Point::range},
+          signal{cloud, &Point::intensity},
+          reflec{cloud, &Point::reflectivity},
+          nearir{cloud, &Point::ambient} {}
+
+    CloudField<uint32_t> range;
+    CloudField<float> signal;
+    CloudField<uint16_t> reflec;
+    CloudField<uint16_t> nearir;
+};
+
+}  // namespace
+
+ImageProcessor::ImageProcessor(
+    const sensor::sensor_info& info, ros::NodeHandle& nh,
+    const ros::SubscriberStatusCallback& on_connection, int queue_size)
+    : info(info), n_returns(get_n_returns(info)) {
+    const size_t H = info.format.pixels_per_column;
+    const size_t W = info.format.columns_per_frame;
+
+    row_shift.resize(H);
+    for (size_t u = 0; u < H; u++) {
+        const int w = static_cast<int>(W);
+        row_shift[u] = (info.format.pixel_shift_by_row[u] % w + w) % w;
+    }
+
+    range_buf.resize(H, W);
+    signal_buf.resize(H, W);
+    reflec_buf.resize(H, W);
+    nearir_buf.resize(H, W);
+
+    const size_t n_topics = 3 * n_returns + 1;
+    image_pool = std::make_unique<MessagePool<sensor_msgs::Image>>(
+        frame_pool_capacity(n_topics), [H, W](sensor_msgs::Image& msg) {
+            msg.width = W;
+            msg.height = H;
+            msg.step = W * sizeof(pixel_type);
+            msg.encoding = sensor_msgs::image_encodings::MONO16;
+            msg.data.resize(W * H * sizeof(pixel_type));
+        });
+
+    nearir_image_pub = nh.advertise<sensor_msgs::Image>(
+        "nearir_image", queue_size, on_connection, on_connection);
+
+    for (int i = 0; i < n_returns; i++) {
+        range_image_pubs.push_back(nh.advertise<sensor_msgs::Image>(
+            std::string("range_image") + topic_suffix(i), queue_size,
+            on_connection, on_connection));
+        signal_image_pubs.push_back(nh.advertise<sensor_msgs::Image>(
+            std::string("signal_image") + topic_suffix(i), queue_size,
+            on_connection, on_connection));
+        reflec_image_pubs.push_back(nh.advertise<sensor_msgs::Image>(
+            std::string("reflec_image") + topic_suffix(i), queue_size,
+            on_connection, on_connection));
+    }
+}
+
+bool ImageProcessor::has_subscribers(int return_index) const {
+    return range_image_pubs[return_index].getNumSubscribers() > 0 ||
+           signal_image_pubs[return_index].getNumSubscribers() > 0 ||
+           reflec_image_pubs[return_index].getNumSubscribers() > 0 ||
+           (return_index == 0 && nearir_image_pub.getNumSubscribers() > 0);
+}
+
+bool ImageProcessor::has_subscribers() const {
+    for (int i = 0; i < n_returns; i++)
+        if (has_subscribers(i)) return true;
+    return false;
+}
+
+void ImageProcessor::operator()(const ouster::LidarScan& ls,
+                                std::chrono::nanoseconds,
+                                const ros::Time& msg_ts) {
+    for (int i = 0; i < n_returns; i++) {
+        const bool second = (i == 1);
+        const ScanSource source{
+            get_field_view(suitable_return(ChanField::RANGE, second), ls),
+            get_field_view(suitable_return(ChanField::SIGNAL, second), ls),
+            get_field_view(suitable_return(ChanField::REFLECTIVITY, second),
+                           ls),
+            get_field_view(suitable_return(ChanField::NEAR_IR, second), ls)};
+        process(i, msg_ts, source);
+    }
+}
+
+void ImageProcessor::operator()(const Cloud& cloud, int return_index,
+                                const ros::Time& msg_ts) {
+    process(return_index, msg_ts, CloudSource(cloud));
+}
+
+template <typename Source>
+void ImageProcessor::process(int return_index, const ros::Time& msg_ts,
+                             const Source& source) {
+    const bool first = (return_index == 0);
+    const bool publish_range =
+        range_image_pubs[return_index].getNumSubscribers() > 0;
+    const bool publish_signal =
+        signal_image_pubs[return_index].getNumSubscribers() > 0;
+    const bool publish_reflec =
+        reflec_image_pubs[return_index].getNumSubscribers() > 0;
+    const bool publish_nearir =
+        first && nearir_image_pub.getNumSubscribers() > 0;
+
+    const size_t H = info.format.pixels_per_column;
+    const size_t W = info.format.columns_per_frame;
+    const float scale = static_cast<float>(pixel_value_max);
+
+    // views into message data
+    auto image_map = [H, W](sensor_msgs::Image& msg) {
+        return Eigen::Map<ouster::img_t<pixel_type>>(
+            reinterpret_cast<pixel_type*>(msg.data.data()), H, W);
+    };
+
+    if (publish_range) {
+        destagger_into(range_buf.data(), H, W, row_shift, source.range);
+        auto range_image = make_image_msg(msg_ts);
+        auto* px = reinterpret_cast<pixel_type*>(range_image->data.data());
+        const uint32_t* rg = range_buf.data();
+        for (size_t i = 0; i < H * W; i++) {
+            // 16 bit img: use 4mm resolution and throw out returns > 260m
+            const uint32_t r = (rg[i] + 0b10) >> 2;
+            px[i] = r > pixel_value_max ? 0 : static_cast<pixel_type>(r);
+        }
+        range_image_pubs[return_index].publish(range_image);
+    }
+
+    // auto exposure dominates the cost, only run it for the images that are
+    // published. The second return normally reuses the exposure of the first
+    // one, unless the first one isn't computed. The sqrt, scaling and cast
+    // are evaluated as a single expression straight into the message.
+    if (publish_signal) {
+        destagger_into(signal_buf.data(), H, W, row_shift, source.signal);
+        signal_ae(signal_buf,
+                  first || signal_image_pubs[0].getNumSubscribers() == 0);
+        auto signal_image = make_image_msg(msg_ts);
+        image_map(*signal_image) =
+            (signal_buf.sqrt() * scale).cast<pixel_type>();
+        signal_image_pubs[return_index].publish(signal_image);
+    }
+    if (publish_reflec) {
+        destagger_into(reflec_buf.data(), H, W, row_shift, source.reflec);
+        reflec_ae(reflec_buf,
+                  first || reflec_image_pubs[0].getNumSubscribers() == 0);
+        auto reflec_image = make_image_msg(msg_ts);
+        image_map(*reflec_image) = (reflec_buf * scale).cast<pixel_type>();
+        reflec_image_pubs[return_index].publish(reflec_image);
+    }
+    if (publish_nearir) {
+        destagger_into(nearir_buf.data(), H, W, row_shift, source.nearir);
+        nearir_buc(nearir_buf);
+        nearir_ae(nearir_buf, first);
+        auto nearir_image = make_image_msg(msg_ts);
+        image_map(*nearir_image) =
+            (nearir_buf.sqrt() * scale).cast<pixel_type>();
+        nearir_image_pub.publish(nearir_image);
+    }
+}
+
+sensor_msgs::ImagePtr ImageProcessor::make_image_msg(const ros::Time& stamp) {
+    auto msg = image_pool->acquire();
+    msg->header.stamp = stamp;
+    return msg;
+}
+
+}  // namespace ouster_ros
@@ -0,0 +1,68 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_imu_packet_handler.cpp
+ * @brief implementation of the ImuPacketHandler
+ */
+
+// prevent clang-format from altering the location of "ouster_ros/ros.h", the
+// header file needs to be the first include due to PCL_NO_PRECOMPILE flag
+// clang-format off
+#include "ouster_ros/os_ros.h"
+// clang-format on
+
+#include "ouster_ros/os_imu_packet_handler.h"
+
+namespace ouster_ros {
+
+ImuPacketHandler::ImuPacketHandler(const sensor::sensor_info& info,
+                                   ros::NodeHandle& nh,
+                                   const std::string& imu_frame,
+                                   bool use_ros_time, size_t batch_size)
+    : pf(sensor::get_format(info)),
+      use_ros_time(use_ros_time),
+      batch_size(batch_size) {
+    imu_pub = nh.advertise<sensor_msgs::Imu>("imu", 100);
+    // a second worth of samples, the constant fields are only written once
+    imu_pool = std::make_unique<MessagePool<sensor_msgs::Imu>>(
+        100, [imu_frame](sensor_msgs::Imu& msg) {
+            init_imu_msg(imu_frame, msg);
+        });
+
+    if (batch_size == 0) return;
+    imu_batch_pub = nh.advertise<ImuBatchMsg>("imu_batch", 10);
+    batch_pool = std::make_unique<MessagePool<ImuBatchMsg>>(
+        4, [imu_frame, batch_size](ImuBatchMsg& msg) {
+            msg.header.frame_id = imu_frame;
+            msg.samples.resize(batch_size);
+            for (auto& sample : msg.samples) init_imu_msg(imu_frame, sample);
+        });
+}
+
+void ImuPacketHandler::operator()(const uint8_t* packet_buf) {
+    ros::Time msg_ts;
+    if (use_ros_time)
+        msg_ts = ros::Time::now();
+    else
+        msg_ts.fromNSec(pf.imu_gyro_ts(packet_buf));
+
+    if (!batch_pool || imu_pub.getNumSubscribers() > 0) {
+        auto imu_msg = imu_pool->acquire();
+        fill_imu_msg(packet_buf, msg_ts, pf, *imu_msg);
+        imu_pub.publish(imu_msg);
+    }
+
+    if (!batch_pool) return;
+    if (!batch) {
+        batch = batch_pool->acquire();
+        batch->header.stamp = msg_ts;
+    }
+    fill_imu_msg(packet_buf, msg_ts, pf, batch->samples[batch_count]);
+    if (++batch_count < batch_size) return;
+    imu_batch_pub.publish(batch);
+    batch.reset();
+    batch_count = 0;
+}
+
+}  // namespace ouster_ros
@@ -0,0 +1,194 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_lidar_packet_handler.cpp
+ * @brief implementation of the LidarPacketHandler
+ */
+
+#include "ouster_ros/os_lidar_packet_handler.h"
+
+#include <algorithm>
+
+namespace sensor = ouster::sensor;
+
+namespace ouster_ros {
+
+namespace {
+
+ros::Time to_ros_time(std::chrono::nanoseconds ts) {
+    ros::Time t;
+    t.fromNSec(ts.count());
+    return t;
+}
+
+bool scan_start_ts(const ouster::LidarScan& ls,
+                   std::chrono::nanoseconds& scan_ts) {
+    auto ts_v = ls.timestamp();
+    auto idx = std::find_if(ts_v.data(), ts_v.data() + ts_v.size(),
+                            [](uint64_t h) { return h != 0; });
+    if (idx == ts_v.data() + ts_v.size()) return false;
+    scan_ts = std::chrono::nanoseconds{ts_v(idx - ts_v.data())};
+    return true;
+}
+
+}  // namespace
+
+LidarPacketHandler::LidarPacketHandler(const sensor::sensor_info& info,
+                                       bool use_ros_time, ScanCallback on_scan,
+                                       size_t scan_buffers, int conversion_cpu,
+                                       std::shared_ptr<PipelineStats> stats,
+                                       std::shared_ptr<WorkStealingPool> pool)
+    : pf(sensor::get_format(info)),
+      scan_batcher(std::make_unique<ouster::ScanBatcher>(info)),
+      use_ros_time(use_ros_time),
+      columns_per_frame(info.format.columns_per_frame),
+      stats(std::move(stats)) {
+    if (this->stats) {
+        batching_time = &this->stats->histogram("scan_batching");
+        scan_count = &this->stats->counter("scans");
+    }
+
+    if (pool) {
+        pipeline = std::make_unique<ScanPipeline>(
+            info, std::max<size_t>(scan_buffers, 2), std::move(on_scan),
+            std::move(pool), this->stats);
+    } else if (scan_buffers > 1) {
+        // the pipeline records the conversion on its worker
+        pipeline = std::make_unique<ScanPipeline>(info, scan_buffers,
+                                                  std::move(on_scan),
+                                                  conversion_cpu, this->stats);
+    } else {
+        if (this->stats) {
+            conversion_time = &this->stats->histogram("scan_conversion");
+            scan_latency = &this->stats->histogram("scan_latency");
+        }
+        ls = ouster::LidarScan(info.format.columns_per_frame,
+                               info.format.pixels_per_column,
+                               info.format.udp_profile_lidar);
+        this->on_scan = std::move(on_scan);
+    }
+}
+
+void LidarPacketHandler::operator()(const uint8_t* packet_buf,
+                                    const ros::Time& packet_receive_time) {
+    if (stats) packet_received_at = StageTimer::clock::now();
+
+    // a packet starting a sector may be held back by the batcher until the
+    // next packet, which still belongs to the same sector
+    if (on_sector &&
+        pf.col_measurement_id(pf.nth_col(0, packet_buf)) % sector_columns == 0)
+        sector_receive_ts = packet_receive_time;
+
+    if (use_ros_time)
+        handle_ros_time(packet_buf, packet_receive_time);
+    else
+        handle_sensor_time(packet_buf);
+}
+
+void LidarPacketHandler::set_sector_callback(uint32_t sector_columns,
+                                             SectorCallback on_sector) {
+    this->sector_columns = sector_columns;
+    this->on_sector = std::move(on_sector);
+}
+
+void LidarPacketHandler::track_sector(const uint8_t* packet_buf) {
+    // reordered packets of the previous frame are dropped by the batcher
+    if (pf.frame_id(packet_buf) != current_scan().frame_id) return;
+    const uint8_t* last_col =
+        pf.nth_col(pf.columns_per_packet - 1, packet_buf);
+    const uint32_t col_end = pf.col_measurement_id(last_col) + 1;
+    if (col_end > columns_per_frame) return;
+    written_end = col_end;
+    // a packet lost at the end of a sector leaves it to the first packet past
+    // it, and the first packet of a frame is only written along with the
+    // next one, so a packet may complete several sectors
+    emit_sectors(written_end == columns_per_frame
+                     ? written_end
+                     : written_end / sector_columns * sector_columns);
+}
+
+void LidarPacketHandler::emit_sectors(uint32_t col_end) {
+    while (emitted_end < col_end) {
+        const uint32_t col_begin = emitted_end;
+        emitted_end = std::min(
+            col_end, (col_begin / sector_columns + 1) * sector_columns);
+        emit_sector(col_begin, emitted_end);
+    }
+}
+
+void LidarPacketHandler::emit_sector(uint32_t col_begin, uint32_t col_end) {
+    const auto& scan = current_scan();
+    auto ts_v = scan.timestamp();
+    auto begin = ts_v.data() + col_begin;
+    auto end = ts_v.data() + col_end;
+    auto idx = std::find_if(begin, end, [](uint64_t h) { return h != 0; });
+    if (idx == end) return;
+    const std::chrono::nanoseconds sector_ts{*idx};
+    on_sector(scan, col_begin, col_end, sector_ts,
+              use_ros_time ? sector_receive_ts : to_ros_time(sector_ts));
+}
+
+bool LidarPacketHandler::batch_packet(const uint8_t* packet_buf) {
+    if (!stats) return (*scan_batcher)(packet_buf, current_scan());
+    const StageTimer timer;
+    const bool complete = (*scan_batcher)(packet_buf, current_scan());
+    scan_batching += timer.elapsed();
+    return complete;
+}
+
+bool LidarPacketHandler::complete_scan(const ros::Time* msg_ts) {
+    if (on_sector) {
+        // a frame cut short by a column window ends with a partial sector
+        emit_sectors(written_end);
+        written_end = emitted_end = 0;
+    }
+
+    auto& scan = current_scan();
+    std::chrono::nanoseconds scan_ts;
+    if (!scan_start_ts(scan, scan_ts)) return false;
+    const ros::Time stamp = msg_ts ? *msg_ts : to_ros_time(scan_ts);
+    if (stats) {
+        scan_count->add();
+        batching_time->record(scan_batching);
+        scan_batching = std::chrono::nanoseconds{0};
+    }
+    if (pipeline) {
+        // a dropped scan leaves its buffer to the next one
+        if (!pipeline->push(scan_ts, stamp, packet_received_at))
+            ROS_WARN_THROTTLE(1, "LidarPacketHandler: converting scans is "
+                                 "falling behind, dropping scans");
+    } else if (stats) {
+        const auto start = StageTimer::clock::now();
+        on_scan(scan, scan_ts, stamp);
+        const auto end = StageTimer::clock::now();
+        conversion_time->record(end - start);
+        scan_latency->record(end - packet_received_at);
+    } else {
+        on_scan(scan, scan_ts, stamp);
+    }
+    return true;
+}
+
+void LidarPacketHandler::handle_sensor_time(const uint8_t* packet_buf) {
+    if (!batch_packet(packet_buf)) {
+        if (on_sector) track_sector(packet_buf);
+        return;
+    }
+    complete_scan(nullptr);
+}
+
+void LidarPacketHandler::handle_ros_time(const uint8_t* packet_buf,
+                                         const ros::Time& packet_receive_time) {
+    // first point cloud time
+    if (frame_ts.isZero()) frame_ts = packet_receive_time;
+    if (!batch_packet(packet_buf)) {
+        if (on_sector) track_sector(packet_buf);
+        return;
+    }
+    if (!complete_scan(&frame_ts)) return;
+
+    frame_ts = packet_receive_time;  // set time for next point cloud msg
+}
+
+}  // namespace ouster_ros
@@ -0,0 +1,403 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_metadata_cache.cpp
+ * @brief implementation of the sensor metadata sharing and cache
+ */
+
+#include "ouster_ros/os_metadata_cache.h"
+
+#include <sys/stat.h>
+
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "ouster_ros/GetMetadata.h"
+
+namespace sensor = ouster::sensor;
+
+namespace ouster_ros {
+
+namespace {
+
+constexpr char file_magic[8] = {'O', 'U', 'S', 'T', 'R', 'O', 'S', 'M'};
+// to be bumped whenever the layout of the entries or sensor_info changes
+constexpr uint32_t file_version = 1;
+
+// the metadata parsed within the process, and the metadata of the services
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::weak_ptr<const SensorMetadata>> parsed;
+    std::map<std::string, std::shared_ptr<const SensorMetadata>> served;
+
+    // to be called with the mutex held, drops the expired entries
+    template <typename Pred>
+    std::shared_ptr<const SensorMetadata> find(Pred&& pred) {
+        std::shared_ptr<const SensorMetadata> found;
+        auto it = parsed.begin();
+        while (it != parsed.end()) {
+            auto metadata = it->lock();
+            if (!metadata) {
+                it = parsed.erase(it);
+                continue;
+            }
+            if (!found && pred(*metadata)) found = std::move(metadata);
+            ++it;
+        }
+        return found;
+    }
+
+    // no two entries hold the same json, the first one is kept
+    std::shared_ptr<const SensorMetadata> add(
+        std::shared_ptr<const SensorMetadata> metadata) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = find([&](const SensorMetadata& m) {
+            return m.json() == metadata->json();
+        });
+        if (found) return found;
+        parsed.push_back(metadata);
+        return metadata;
+    }
+};
+
+Registry& registry() {
+    static Registry r;
+    return r;
+}
+
+class Writer {
+   public:
+    template <typename T>
+    void put(T v) {
+        buf.append(reinterpret_cast<const char*>(&v), sizeof(T));
+    }
+
+    void put(const std::string& s) {
+        put(static_cast<uint64_t>(s.size()));
+        buf.append(s);
+    }
+
+    template <typename T>
+    void put(const std::vector<T>& v) {
+        put(static_cast<uint64_t>(v.size()));
+        put_array(v.data(), v.size());
+    }
+
+    template <typename T>
+    void put_array(const T* data, size_t n) {
+        buf.append(reinterpret_cast<const char*>(data), n * sizeof(T));
+    }
+
+    std::string buf;
+};
+
+// every read fails once the end of the entry is reached
+class Reader {
+   public:
+    explicit Reader(const std::string& buf)
+        : p(buf.data()), end(buf.data() + buf.size()) {}
+
+    template <typename T>
+    bool get(T& v) {
+        return get_array(&v, 1);
+    }
+
+    bool get(std::string& s) {
+        uint64_t n;
+        if (!get(n) || n > static_cast<uint64_t>(end - p)) return false;
+        s.assign(p, n);
+        p += n;
+        return true;
+    }
+
+    template <typename T>
+    bool get(std::vector<T>& v) {
+        uint64_t n;
+        if (!get(n) || n > static_cast<uint64_t>(end - p) / sizeof(T))
+            return false;
+        v.resize(n);
+        return get_array(v.data(), n);
+    }
+
+    template <typename T>
+    bool get_array(T* data, size_t n) {
+        if (n > static_cast<size_t>(end - p) / sizeof(T)) return false;
+        std::memcpy(data, p, n * sizeof(T));
+        p += n * sizeof(T);
+        return true;
+    }
+
+    bool done() const { return p == end; }
+
+   private:
+    const char* p;
+    const char* end;
+};
+
+void put_info(Writer& w, const sensor::sensor_info& info) {
+    w.put(info.name);
+    w.put(info.sn);
+    w.put(info.fw_rev);
+    w.put(static_cast<uint32_t>(info.mode));
+    w.put(info.prod_line);
+    const auto& f = info.format;
+    w.put(f.pixels_per_column);
+    w.put(f.columns_per_packet);
+    w.put(f.columns_per_frame);
+    w.put(f.pixel_shift_by_row);
+    w.put(static_cast<int32_t>(f.column_window.first));
+    w.put(static_cast<int32_t>(f.column_window.second));
+    w.put(static_cast<uint32_t>(f.udp_profile_lidar));
+    w.put(static_cast<uint32_t>(f.udp_profile_imu));
+    w.put(f.fps);
+    w.put(info.beam_azimuth_angles);
+    w.put(info.beam_altitude_angles);
+    w.put(info.lidar_origin_to_beam_origin_mm);
+    for (const auto* m :
+         {&info.beam_to_lidar_transform, &info.imu_to_sensor_transform,
+          &info.lidar_to_sensor_transform, &info.extrinsic})
+        w.put_array(m->data(), 16);
+    w.put(info.init_id);
+    w.put(info.udp_port_lidar);
+    w.put(info.udp_port_imu);
+}
+
+bool get_info(Reader& r, sensor::sensor_info& info) {
+    uint32_t mode, profile_lidar, profile_imu;
+    int32_t window_first, window_second;
+    auto& f = info.format;
+    bool ok = r.get(info.name) && r.get(info.sn) && r.get(info.fw_rev) &&
+              r.get(mode) && r.get(info.prod_line) &&
+              r.get(f.pixels_per_column) && r.get(f.columns_per_packet) &&
+              r.get(f.columns_per_frame) && r.get(f.pixel_shift_by_row) &&
+              r.get(window_first) && r.get(window_second) &&
+              r.get(profile_lidar) && r.get(profile_imu) && r.get(f.fps) &&
+              r.get(info.beam_azimuth_angles) &&
+              r.get(info.beam_altitude_angles) &&
+              r.get(info.lidar_origin_to_beam_origin_mm);
+    for (auto* m :
+         {&info.beam_to_lidar_transform, &info.imu_to_sensor_transform,
+          &info.lidar_to_sensor_transform, &info.extrinsic})
+        ok = ok && r.get_array(m->data(), 16);
+    ok = ok && r.get(info.init_id) && r.get(info.udp_port_lidar) &&
+         r.get(info.udp_port_imu);
+    if (!ok) return false;
+    info.mode = static_cast<sensor::lidar_mode>(mode);
+    f.column_window = {window_first, window_second};
+    f.udp_profile_lidar = static_cast<sensor::UDPProfileLidar>(profile_lidar);
+    f.udp_profile_imu = static_cast<sensor::UDPProfileIMU>(profile_imu);
+    return true;
+}
+
+// hostnames and firmware revisions are used as file names
+std::string file_name_of(std::string name) {
+    for (auto& c : name)
+        if (!std::isalnum(static_cast<unsigned char>(c)) && c != '.' &&
+            c != '-')
+            c = '_';
+    return name;
+}
+
+bool read_file(const std::string& path, std::string& content) {
+    auto* in = std::fopen(path.c_str(), "rb");
+    if (!in) return false;
+    content.clear();
+    char buf[1 << 16];
+    size_t n;
+    while ((n = std::fread(buf, 1, sizeof(buf), in)) > 0)
+        content.append(buf, n);
+    const bool ok = !std::ferror(in);
+    std::fclose(in);
+    return ok;
+}
+
+// readers of the file see either the previous or the new content
+bool write_file(const std::string& path, const std::string& content) {
+    const auto tmp = path + ".tmp";
+    auto* out = std::fopen(tmp.c_str(), "wb");
+    if (!out) return false;
+    const bool written =
+        std::fwrite(content.data(), 1, content.size(), out) == content.size();
+    if (std::fclose(out) != 0 || !written ||
+        std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+void make_float_lut(const sensor::sensor_info& info,
+                    ouster::PointsF& lut_direction,
+                    ouster::PointsF& lut_offset) {
+    auto xyz_lut = ouster::make_xyz_lut(info);
+    lut_direction = xyz_lut.direction.cast<float>();
+    lut_offset = xyz_lut.offset.cast<float>();
+}
+
+}  // namespace
+
+SensorMetadata::SensorMetadata(std::string json, sensor::sensor_info info)
+    : metadata(std::move(json)), sensor_info(std::move(info)) {}
+
+SensorMetadata::SensorMetadata(std::string json, sensor::sensor_info info,
+                               ouster::PointsF lut_direction,
+                               ouster::PointsF lut_offset)
+    : metadata(std::move(json)),
+      sensor_info(std::move(info)),
+      direction(std::move(lut_direction)),
+      offset(std::move(lut_offset)) {
+    // the lut is known already
+    std::call_once(lut_computed, [] {});
+}
+
+const ouster::PointsF& SensorMetadata::lut_direction() const {
+    std::call_once(lut_computed, [this] { compute_lut(); });
+    return direction;
+}
+
+const ouster::PointsF& SensorMetadata::lut_offset() const {
+    std::call_once(lut_computed, [this] { compute_lut(); });
+    return offset;
+}
+
+void SensorMetadata::compute_lut() const {
+    make_float_lut(sensor_info, direction, offset);
+}
+
+void SensorMetadata::lut_of(const sensor::sensor_info& info,
+                            ouster::PointsF& lut_direction,
+                            ouster::PointsF& lut_offset) {
+    if (auto metadata = find_sensor_metadata(info)) {
+        lut_direction = metadata->lut_direction();
+        lut_offset = metadata->lut_offset();
+        return;
+    }
+    make_float_lut(info, lut_direction, lut_offset);
+}
+
+std::shared_ptr<const SensorMetadata> make_sensor_metadata(
+    const std::string& json) {
+    auto& r = registry();
+    {
+        std::lock_guard<std::mutex> lock(r.mutex);
+        auto found = r.find(
+            [&](const SensorMetadata& m) { return m.json() == json; });
+        if (found) return found;
+    }
+    // parsed outside of the lock, two nodelets parsing the same metadata at
+    // once both do the work but end up sharing the first result
+    return r.add(std::make_shared<const SensorMetadata>(
+        json, sensor::parse_metadata(json)));
+}
+
+std::shared_ptr<const SensorMetadata> find_sensor_metadata(
+    const sensor::sensor_info& info) {
+    auto& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    return r.find([&](const SensorMetadata& m) { return m.info() == info; });
+}
+
+void share_sensor_metadata(const std::string& service,
+                           std::shared_ptr<const SensorMetadata> metadata) {
+    auto& r = registry();
+    metadata = r.add(std::move(metadata));
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.served[service] = std::move(metadata);
+}
+
+std::shared_ptr<const SensorMetadata> fetch_sensor_metadata(
+    ros::NodeHandle& nh) {
+    auto& r = registry();
+    const auto service = nh.resolveName("get_metadata");
+    auto served = [&]() -> std::shared_ptr<const SensorMetadata> {
+        std::lock_guard<std::mutex> lock(r.mutex);
+        auto it = r.served.find(service);
+        return it != r.served.end() ? it->second : nullptr;
+    };
+    if (auto metadata = served()) return metadata;
+
+    auto client = nh.serviceClient<GetMetadata>("get_metadata");
+    client.waitForExistence();
+    // the service may have been advertised by a nodelet of the process
+    if (auto metadata = served()) return metadata;
+
+    GetMetadata request{};
+    if (!client.call(request)) return nullptr;
+    return make_sensor_metadata(request.response.metadata);
+}
+
+MetadataCache::MetadataCache(std::string dir) : dir(std::move(dir)) {
+    if (!this->dir.empty() && this->dir.back() == '/') this->dir.pop_back();
+    for (size_t pos = 1; pos <= this->dir.size(); ++pos) {
+        if (pos != this->dir.size() && this->dir[pos] != '/') continue;
+        const auto parent = this->dir.substr(0, pos);
+        if (mkdir(parent.c_str(), 0755) != 0 && errno != EEXIST)
+            throw std::runtime_error("MetadataCache: failed to create " +
+                                     parent + ": " + std::strerror(errno));
+    }
+}
+
+std::shared_ptr<const SensorMetadata> MetadataCache::load(
+    const std::string& hostname, const std::string& config) const {
+    std::string entry_name, content;
+    if (!read_file(dir + "/" + file_name_of(hostname) + ".sensor",
+                   entry_name) ||
+        !read_file(dir + "/" + entry_name, content) ||
+        content.size() < sizeof(file_magic) ||
+        std::memcmp(content.data(), file_magic, sizeof(file_magic)) != 0)
+        return nullptr;
+
+    Reader r(content);
+    char magic[sizeof(file_magic)];
+    uint32_t version, rows;
+    std::string stored_config, json;
+    sensor::sensor_info info;
+    if (!r.get_array(magic, sizeof(magic)) || !r.get(version) ||
+        version != file_version || !r.get(stored_config) ||
+        stored_config != config || !r.get(json) || !get_info(r, info) ||
+        !r.get(rows) ||
+        rows != info.format.pixels_per_column * info.format.columns_per_frame)
+        return nullptr;
+
+    ouster::PointsF direction(rows, 3), offset(rows, 3);
+    if (!r.get_array(direction.data(), direction.size()) ||
+        !r.get_array(offset.data(), offset.size()) || !r.done())
+        return nullptr;
+
+    return registry().add(std::make_shared<const SensorMetadata>(
+        std::move(json), std::move(info), std::move(direction),
+        std::move(offset)));
+}
+
+bool MetadataCache::store(const std::string& hostname,
+                          const std::string& config,
+                          const SensorMetadata& metadata) const {
+    const auto& info = metadata.info();
+    const auto& direction = metadata.lut_direction();
+    const auto& offset = metadata.lut_offset();
+
+    Writer w;
+    w.put_array(file_magic, sizeof(file_magic));
+    w.put(file_version);
+    w.put(config);
+    w.put(metadata.json());
+    put_info(w, info);
+    w.put(static_cast<uint32_t>(direction.rows()));
+    w.put_array(direction.data(), direction.size());
+    w.put_array(offset.data(), offset.size());
+
+    const auto entry_name =
+        file_name_of(info.sn + "-" + info.fw_rev) + ".bin";
+    return write_file(dir + "/" + entry_name, w.buf) &&
+           write_file(dir + "/" + file_name_of(hostname) + ".sensor",
+                      entry_name);
+}
+
+}  // namespace ouster_ros
@@ -0,0 +1,70 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_metadata_listener.cpp
+ * @brief implementation of the MetadataListener
+ */
+
+#include "ouster_ros/os_metadata_listener.h"
+
+#include <exception>
+#include <utility>
+
+namespace ouster_ros {
+
+MetadataListener::MetadataListener(
+    ros::NodeHandle& nh, std::shared_ptr<const SensorMetadata> current,
+    MetadataCallback on_metadata)
+    : on_metadata(std::move(on_metadata)),
+      current(current ? current->json() : std::string{}),
+      worker([this] { worker_loop(); }) {
+    // the latched message holds the metadata the nodelet started with
+    metadata_sub = nh.subscribe<std_msgs::String>(
+        "metadata", 1, &MetadataListener::metadata_handler, this);
+}
+
+MetadataListener::~MetadataListener() {
+    metadata_sub.shutdown();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        active = false;
+    }
+    cv.notify_one();
+    worker.join();
+}
+
+void MetadataListener::metadata_handler(
+    const std_msgs::String::ConstPtr& msg) {
+    if (msg->data.empty() || msg->data == current) return;
+    current = msg->data;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending = current;
+        has_pending = true;
+    }
+    cv.notify_one();
+}
+
+void MetadataListener::worker_loop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        cv.wait(lock, [this] { return has_pending || !active; });
+        if (!active) return;
+        auto json = std::move(pending);
+        has_pending = false;
+        lock.unlock();
+
+        ROS_INFO("MetadataListener: the sensor metadata changed, rebuilding");
+        try {
+            on_metadata(make_sensor_metadata(json));
+        } catch (const std::exception& e) {
+            ROS_ERROR_STREAM(
+                "MetadataListener: failed to apply the new metadata: "
+                << e.what());
+        }
+        lock.lock();
+    }
+}
+
+}  // namespace ouster_ros
@@ -0,0 +1,130 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_motion_compensator.cpp
+ * @brief implementation of the MotionCompensator
+ */
+
+#include "ouster_ros/os_motion_compensator.h"
+
+#include <Eigen/Geometry>
+#include <algorithm>
+#include <cmath>
+
+namespace ouster_ros {
+
+namespace {
+
+// the rotation of a constant angular velocity over dt seconds
+Eigen::Quaterniond rotation_over(const Eigen::Vector3d& angular_velocity,
+                                 double dt) {
+    const double angle = angular_velocity.norm() * dt;
+    if (angle < 1e-12) return Eigen::Quaterniond::Identity();
+    return Eigen::Quaterniond(
+        Eigen::AngleAxisd(angle, angular_velocity.normalized()));
+}
+
+}  // namespace
+
+MotionCompensator::MotionCompensator(const sensor::sensor_info& info,
+                                     size_t history,
+                                     std::chrono::nanoseconds max_extrapolation)
+    : pf(sensor::get_format(info)),
+      imu_to_sensor(info.imu_to_sensor_transform.topLeftCorner<3, 3>()),
+      max_extrapolation(static_cast<uint64_t>(max_extrapolation.count())),
+      samples(std::max<size_t>(history, 2)) {
+    window.reserve(samples.size());
+}
+
+void MotionCompensator::add_imu_packet(const uint8_t* packet_buf) {
+    const Eigen::Vector3d av{pf.imu_av_x(packet_buf), pf.imu_av_y(packet_buf),
+                             pf.imu_av_z(packet_buf)};
+    const Sample sample{pf.imu_gyro_ts(packet_buf),
+                        imu_to_sensor * av * (M_PI / 180.0)};
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (count > 0) {
+        const auto latest = samples[(head + count - 1) % samples.size()].ts;
+        if (sample.ts == latest) return;
+        // the sensor restarted or a recording looped, the history is stale
+        if (sample.ts < latest) count = 0;
+    }
+    samples[(head + count) % samples.size()] = sample;
+    if (count < samples.size())
+        ++count;
+    else
+        head = (head + 1) % samples.size();
+}
+
+bool MotionCompensator::column_rotations(const ouster::LidarScan& ls,
+                                         std::chrono::nanoseconds scan_ts,
+                                         ColumnRotations& rotations) {
+    const auto ts = ls.timestamp();
+    const size_t w = ls.w;
+    const auto start = static_cast<uint64_t>(scan_ts.count());
+    uint64_t end = start;
+    for (size_t v = 0; v < w; ++v) end = std::max<uint64_t>(end, ts[v]);
+
+    {
+        // the samples from the last one taken before the scan starts up to
+        // the first one taken after it ends
+        std::lock_guard<std::mutex> lock(mutex);
+        window.clear();
+        size_t first = count;
+        for (size_t i = 0; i < count; ++i) {
+            if (samples[(head + i) % samples.size()].ts > start) break;
+            first = i;
+        }
+        if (first == count) return false;
+        for (size_t i = first; i < count; ++i) {
+            window.push_back(samples[(head + i) % samples.size()]);
+            if (window.back().ts >= end) break;
+        }
+    }
+    if (end > window.back().ts + max_extrapolation) return false;
+
+    // the rate over [window[j].ts, window[j + 1].ts], held past the last one
+    auto rate = [this](size_t j) -> Eigen::Vector3d {
+        if (j + 1 == window.size()) return window[j].angular_velocity;
+        return 0.5 * (window[j].angular_velocity +
+                      window[j + 1].angular_velocity);
+    };
+
+    rotations.columns = static_cast<uint32_t>(w);
+    rotations.matrix.resize(9 * w);
+    float* m = rotations.matrix.data();
+
+    // the orientation at t_j, the later of the start and the sample j
+    Eigen::Quaterniond q = Eigen::Quaterniond::Identity();
+    size_t j = 0;
+    uint64_t t_j = start;
+    uint64_t prev = start;
+    for (size_t v = 0; v < w; ++v) {
+        const uint64_t t = ts[v];
+        Eigen::Matrix3f r = Eigen::Matrix3f::Identity();
+        if (t >= start && t != 0) {
+            // columns are in time order within a scan, restart otherwise
+            if (t < prev) {
+                q.setIdentity();
+                j = 0;
+                t_j = start;
+            }
+            while (j + 1 < window.size() && window[j + 1].ts <= t) {
+                q = q * rotation_over(rate(j), (window[j + 1].ts - t_j) * 1e-9);
+                q.normalize();
+                t_j = window[++j].ts;
+            }
+            r = (q * rotation_over(rate(j), (t - t_j) * 1e-9))
+                    .toRotationMatrix()
+                    .cast<float>();
+            prev = t;
+        }
+        for (int row = 0; row < 3; ++row)
+            for (int col = 0; col < 3; ++col)
+                m[(3 * row + col) * w + v] = r(row, col);
+    }
+    return true;
+}
+
+}  // namespace ouster_ros
@@ -0,0 +1,423 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_multi_sensor_nodelet.cpp
+ * @brief A nodelet that connects to several live ouster sensors and publishes
+ * their point clouds and imu messages from a shared set of threads
+ */
+
+// prevent clang-format from altering the location of "ouster_ros/ros.h", the
+// header file needs to be the first include due to PCL_NO_PRECOMPILE flag
+// clang-format off
+#include "ouster_ros/os_ros.h"
+// clang-format on
+
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#include <std_msgs/String.h>
+#include <tf2_ros/static_transform_broadcaster.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "ouster_ros/GetMetadata.h"
+#include "ouster_ros/os_imu_packet_handler.h"
+#include "ouster_ros/os_lidar_packet_handler.h"
+#include "ouster_ros/os_metadata_cache.h"
+#include "ouster_ros/os_motion_compensator.h"
+#include "ouster_ros/os_point_cloud_processor.h"
+#include "ouster_ros/os_processing_params.h"
+#include "ouster_ros/os_scan_monitor.h"
+#include "ouster_ros/os_stats.h"
+#include "ouster_ros/os_tensor_processor.h"
+#include "ouster_ros/os_transport.h"
+#include "ouster_ros/os_udp_event_loop.h"
+#include "ouster_ros/os_work_stealing_pool.h"
+
+namespace sensor = ouster::sensor;
+using ouster_ros::GetMetadata;
+
+namespace nodelets_os {
+
+/**
+ * Runs any number of sensors in a single nodelet: the udp packets of all the
+ * sensors are received by one thread and their scans converted by a work
+ * stealing pool sized to the host rather than by threads per sensor. Every
+ * sensor publishes the topics of OusterDriver, along with its get_metadata
+ * service and metadata topic, in its own namespace.
+ *
+ * The processing of a sensor is constructed on its home worker in the pool so
+ * that its buffers and lookup tables are allocated on the NUMA node of that
+ * worker, which only holds with worker_threads_cpu set: unpinned workers may
+ * run on any node.
+ */
+class OusterMultiSensor : public nodelet::Nodelet {
+   public:
+    ~OusterMultiSensor() override {
+        // no packet may reach the sensors while they are torn down
+        if (event_loop) event_loop->stop();
+    }
+
+   private:
+    struct Sensor {
+        std::string hostname;
+        std::string ns;
+        ros::NodeHandle nh;
+        sensor::sensor_info info;
+        std::string metadata;
+        size_t lidar_packet_size = 0;
+        size_t imu_packet_size = 0;
+        ros::ServiceServer get_metadata_srv;
+        ros::Publisher metadata_pub;
+
+        std::shared_ptr<ouster_ros::PipelineStats> stats;
+        std::unique_ptr<ouster_ros::StatsPublisher> stats_publisher;
+        ouster_ros::StatsCounter* lidar_packet_count = nullptr;
+        ouster_ros::StatsCounter* imu_packet_count = nullptr;
+        ouster_ros::StatsCounter* lidar_read_failures = nullptr;
+        ouster_ros::StatsCounter* imu_read_failures = nullptr;
+
+        std::unique_ptr<ouster_ros::ImuPacketHandler> imu_packet_handler;
+        std::shared_ptr<ouster_ros::MotionCompensator> motion_compensator;
+        std::unique_ptr<ouster_ros::ScanMonitor> scan_monitor;
+        std::unique_ptr<ouster_ros::PointCloudProcessor> point_cloud_processor;
+        std::unique_ptr<ouster_ros::TensorProcessor> tensor_processor;
+        // destroyed first, it converts scans with the members above
+        std::unique_ptr<ouster_ros::LidarPacketHandler> lidar_packet_handler;
+    };
+
+    bool is_arg_set(const std::string& arg) {
+        return arg.find_first_not_of(' ') != std::string::npos;
+    }
+
+    std::vector<std::string> split(const std::string& list) {
+        std::istringstream iss(list);
+        std::vector<std::string> items;
+        for (std::string item; iss >> item;) items.push_back(item);
+        return items;
+    }
+
+    virtual void onInit() override {
+        auto& pnh = getPrivateNodeHandle();
+        auto hostnames = split(pnh.param("sensor_hostnames", std::string{}));
+        if (hostnames.empty()) {
+            auto error_msg =
+                "OusterMultiSensor: Must specify at least one sensor hostname";
+            NODELET_ERROR_STREAM(error_msg);
+            throw std::runtime_error(error_msg);
+        }
+        auto namespaces = split(pnh.param("sensor_namespaces", std::string{}));
+        if (!namespaces.empty() && namespaces.size() != hostnames.size()) {
+            auto error_msg =
+                "OusterMultiSensor: sensor_namespaces must name every sensor";
+            NODELET_ERROR_STREAM(error_msg);
+            throw std::runtime_error(error_msg);
+        }
+        auto lidar_port_base = pnh.param("lidar_port_base", 0);
+        if (lidar_port_base < 0 ||
+            lidar_port_base + 2 * static_cast<int>(hostnames.size()) > 65536) {
+            auto error_msg =
+                "OusterMultiSensor: the ports from lidar_port_base must be in "
+                "the range [0, 65535]";
+            NODELET_ERROR_STREAM(error_msg);
+            throw std::runtime_error(error_msg);
+        }
+
+        auto config = create_sensor_config(pnh);
+        auto worker_threads = pnh.param("worker_threads", 0);
+        pool = std::make_shared<ouster_ros::WorkStealingPool>(
+            static_cast<size_t>(std::max(worker_threads, 0)),
+            pnh.param("worker_threads_cpu", -1));
+        event_loop = std::make_unique<ouster_ros::UdpEventLoop>();
+        NODELET_INFO_STREAM("OusterMultiSensor: converting the scans of "
+                            << hostnames.size() << " sensors on "
+                            << pool->size() << " workers");
+
+        std::vector<geometry_msgs::TransformStamped> transforms;
+        for (size_t i = 0; i < hostnames.size(); ++i) {
+            auto s = std::make_unique<Sensor>();
+            s->hostname = hostnames[i];
+            s->ns = namespaces.empty() ? "sensor_" + std::to_string(i)
+                                       : namespaces[i];
+            s->nh = ros::NodeHandle(getNodeHandle(), s->ns);
+
+            const auto base = static_cast<uint16_t>(
+                lidar_port_base ? lidar_port_base + 2 * i : 0);
+            Sensor* sp = s.get();
+            auto lidar_port = event_loop->add_socket(
+                base, [this, sp](const uint8_t* buf, size_t size,
+                                 const ros::Time& stamp) {
+                    on_lidar_packet(*sp, buf, size, stamp);
+                });
+            auto imu_port = event_loop->add_socket(
+                base ? base + 1 : 0,
+                [this, sp](const uint8_t* buf, size_t size,
+                           const ros::Time&) {
+                    on_imu_packet(*sp, buf, size);
+                });
+
+            auto sensor_config = config;
+            sensor_config.udp_port_lidar = lidar_port;
+            sensor_config.udp_port_imu = imu_port;
+            configure_sensor(*s, sensor_config);
+            fetch_metadata(*s);
+            create_processing(*s, transforms);
+            sensors.push_back(std::move(s));
+        }
+
+        // the extrinsics never change, late subscribers get them latched
+        static_tf_bcast.sendTransform(transforms);
+
+        event_loop->start(pnh.param("receive_thread_cpu", -1),
+                          pnh.param("receive_thread_priority", 0));
+    }
+
+    sensor::sensor_config create_sensor_config(ros::NodeHandle& nh) {
+        auto udp_dest = nh.param("udp_dest", std::string{});
+        auto lidar_mode_arg = nh.param("lidar_mode", std::string{});
+        auto timestamp_mode_arg = nh.param("timestamp_mode", std::string{});
+        auto udp_profile_lidar_arg =
+            nh.param("udp_profile_lidar", std::string{});
+
+        sensor::sensor_config config;
+        if (is_arg_set(udp_profile_lidar_arg)) {
+            config.udp_profile_lidar =
+                sensor::udp_profile_lidar_of_string(udp_profile_lidar_arg);
+            if (!config.udp_profile_lidar) {
+                auto error_msg =
+                    "Invalid udp profile lidar: " + udp_profile_lidar_arg;
+                NODELET_ERROR_STREAM(error_msg);
+                throw std::runtime_error(error_msg);
+            }
+        }
+
+        if (is_arg_set(lidar_mode_arg)) {
+            auto lidar_mode = sensor::lidar_mode_of_string(lidar_mode_arg);
+            if (!lidar_mode) {
+                auto error_msg = "Invalid lidar mode: " + lidar_mode_arg;
+                NODELET_ERROR_STREAM(error_msg);
+                throw std::runtime_error(error_msg);
+            }
+            config.ld_mode = lidar_mode;
+        }
+
+        // TIME_FROM_ROS_TIME leaves the timestamp mode of the sensors alone
+        use_ros_time = timestamp_mode_arg == "TIME_FROM_ROS_TIME";
+        if (is_arg_set(timestamp_mode_arg) && !use_ros_time) {
+            auto timestamp_mode =
+                sensor::timestamp_mode_of_string(timestamp_mode_arg);
+            if (!timestamp_mode) {
+                auto error_msg =
+                    "Invalid timestamp mode: " + timestamp_mode_arg;
+                NODELET_ERROR_STREAM(error_msg);
+                throw std::runtime_error(error_msg);
+            }
+            config.ts_mode = timestamp_mode;
+        }
+
+        config.operating_mode = sensor::OPERATING_NORMAL;
+        config_flags = 0;
+        if (is_arg_set(udp_dest)) {
+            NODELET_INFO("Will send UDP data to %s", udp_dest.c_str());
+            config.udp_dest = udp_dest;
+        } else {
+            NODELET_INFO("Will use automatic UDP destination");
+            config_flags |= sensor::CONFIG_UDP_DEST_AUTO;
+        }
+        return config;
+    }
+
+    void configure_sensor(const Sensor& s,
+                          const sensor::sensor_config& config) {
+        try {
+            if (!sensor::set_config(s.hostname, config, config_flags)) {
+                auto error_msg = "Error connecting to sensor " + s.hostname;
+                NODELET_ERROR_STREAM(error_msg);
+                throw std::runtime_error(error_msg);
+            }
+        } catch (const std::exception& e) {
+            NODELET_ERROR("Error setting config:  %s", e.what());
+            throw;
+        }
+
+        NODELET_INFO_STREAM("Sensor " << s.hostname << " configured to send "
+                                      << "to ports "
+                                      << config.udp_port_lidar.value() << "/"
+                                      << config.udp_port_imu.value());
+    }
+
+    void fetch_metadata(Sensor& s) {
+        // the client only serves the metadata request, the packets are
+        // received on the sockets of the event loop
+        auto cli = sensor::init_client(s.hostname, 0, 0);
+        if (!cli) {
+            auto error_msg = "Failed to initialize client for " + s.hostname;
+            NODELET_ERROR_STREAM(error_msg);
+            throw std::runtime_error(error_msg);
+        }
+        try {
+            s.metadata = sensor::get_metadata(*cli);
+        } catch (const std::exception& e) {
+            NODELET_ERROR_STREAM(
+                "sensor::get_metadata exception: " << e.what());
+        }
+        if (s.metadata.empty()) {
+            auto error_msg =
+                "Failed to collect sensor metadata of " + s.hostname;
+            NODELET_ERROR_STREAM(error_msg);
+            throw std::runtime_error(error_msg);
+        }
+
+        auto metadata = ouster_ros::make_sensor_metadata(s.metadata);
+        s.info = metadata->info();
+        const auto& pf = sensor::get_format(s.info);
+        s.lidar_packet_size = pf.lidar_packet_size;
+        s.imu_packet_size = pf.imu_packet_size;
+        NODELET_INFO("%s: %s sn: %s firmware rev: %s, lidar_mode: %s",
+                     s.ns.c_str(), s.info.prod_line.c_str(),
+                     s.info.sn.c_str(), s.info.fw_rev.c_str(),
+                     sensor::to_string(s.info.mode).c_str());
+
+        // the nodelets of the process skip the service call and the parsing
+        ouster_ros::share_sensor_metadata(s.nh.resolveName("get_metadata"),
+                                          std::move(metadata));
+        Sensor* sp = &s;
+        s.get_metadata_srv =
+            s.nh.advertiseService<GetMetadata::Request, GetMetadata::Response>(
+                "get_metadata",
+                [sp](GetMetadata::Request&, GetMetadata::Response& res) {
+                    res.metadata = sp->metadata;
+                    return true;
+                });
+        s.metadata_pub = s.nh.advertise<std_msgs::String>("metadata", 1, true);
+        std_msgs::String msg;
+        msg.data = s.metadata;
+        s.metadata_pub.publish(msg);
+    }
+
+    void create_processing(
+        Sensor& s, std::vector<geometry_msgs::TransformStamped>& transforms) {
+        auto& pnh = getPrivateNodeHandle();
+        auto tf_prefix = pnh.param("tf_prefix", std::string{});
+        if (!is_arg_set(tf_prefix))
+            tf_prefix.clear();
+        else if (tf_prefix.back() != '/')
+            tf_prefix.append("/");
+        tf_prefix += s.ns + "/";
+        auto sensor_frame = tf_prefix + "os_sensor";
+        auto imu_frame = tf_prefix + "os_imu";
+        auto lidar_frame = tf_prefix + "os_lidar";
+
+        const auto params =
+            ouster_ros::processing_params_of(pnh, "OusterMultiSensor");
+
+        transforms.push_back(ouster_ros::transform_to_tf_msg(
+            s.info.imu_to_sensor_transform, sensor_frame, imu_frame));
+        transforms.push_back(ouster_ros::transform_to_tf_msg(
+            s.info.lidar_to_sensor_transform, sensor_frame, lidar_frame));
+
+        auto period = pnh.param("diagnostics_period", 0.0);
+        if (period > 0.0) {
+            s.stats = std::make_shared<ouster_ros::PipelineStats>();
+            s.lidar_packet_count = &s.stats->counter("lidar_packets");
+            s.imu_packet_count = &s.stats->counter("imu_packets");
+            s.lidar_read_failures =
+                &s.stats->counter("lidar_packet_read_failures", true);
+            s.imu_read_failures =
+                &s.stats->counter("imu_packet_read_failures", true);
+            s.stats_publisher = std::make_unique<ouster_ros::StatsPublisher>(
+                s.nh, getName() + "/" + s.ns, s.info.sn, s.stats, period);
+        }
+
+        // first touch places the scan buffers, the point clouds and the
+        // lookup tables on the node of the home worker, which the scan
+        // pipeline then keeps converting on
+        const auto scan_buffers = std::max(pnh.param("scan_buffers", 2), 2);
+        const auto deskew = pnh.param("deskew", false);
+        const auto publish_tensors = pnh.param("publish_tensors", false);
+        const auto tensor_xyz = pnh.param("tensor_xyz", false);
+        const auto points_queue_size =
+            ouster_ros::queue_size_of_params(pnh, "points", 10);
+        pool->run_on(pool->assign_worker(), [&] {
+            std::shared_ptr<const ouster_ros::PointCloudSerializer>
+                serializer =
+                    ouster_ros::make_point_cloud_serializer(params, s.info);
+            s.imu_packet_handler =
+                std::make_unique<ouster_ros::ImuPacketHandler>(
+                    s.info, s.nh, imu_frame, use_ros_time,
+                    params.imu_batch_size);
+            s.scan_monitor = std::make_unique<ouster_ros::ScanMonitor>(
+                s.info, s.nh, sensor_frame, params.frame_policy,
+                params.min_completeness, s.stats);
+            if (deskew)
+                s.motion_compensator =
+                    std::make_shared<ouster_ros::MotionCompensator>(s.info);
+            s.point_cloud_processor =
+                std::make_unique<ouster_ros::PointCloudProcessor>(
+                    s.info, s.nh, sensor_frame, params.staggered,
+                    params.destagger, serializer, nullptr, s.stats,
+                    s.motion_compensator, points_queue_size);
+            if (publish_tensors)
+                s.tensor_processor =
+                    std::make_unique<ouster_ros::TensorProcessor>(
+                        s.info, s.nh, sensor_frame, tensor_xyz);
+            Sensor* sp = &s;
+            s.lidar_packet_handler =
+                std::make_unique<ouster_ros::LidarPacketHandler>(
+                    s.info, use_ros_time,
+                    [sp](const ouster::LidarScan& ls,
+                         std::chrono::nanoseconds scan_ts,
+                         const ros::Time& msg_ts) {
+                        using Policy = ouster_ros::ScanMonitor::Policy;
+                        const auto policy = (*sp->scan_monitor)(ls, msg_ts);
+                        if (policy == Policy::DROP) return;
+                        (*sp->point_cloud_processor)(ls, scan_ts, msg_ts,
+                                                     policy != Policy::MARK);
+                        if (sp->tensor_processor)
+                            (*sp->tensor_processor)(ls, scan_ts, msg_ts);
+                    },
+                    scan_buffers, -1, s.stats, pool);
+        });
+    }
+
+    void on_lidar_packet(Sensor& s, const uint8_t* buf, size_t size,
+                         const ros::Time& stamp) {
+        if (size != s.lidar_packet_size) {
+            if (s.lidar_read_failures) s.lidar_read_failures->add();
+            NODELET_ERROR_THROTTLE(1, "%s: lidar packet of unexpected size",
+                                   s.ns.c_str());
+            return;
+        }
+        if (s.lidar_packet_count) s.lidar_packet_count->add();
+        (*s.lidar_packet_handler)(buf, stamp);
+    }
+
+    void on_imu_packet(Sensor& s, const uint8_t* buf, size_t size) {
+        if (size != s.imu_packet_size) {
+            if (s.imu_read_failures) s.imu_read_failures->add();
+            NODELET_ERROR_THROTTLE(1, "%s: imu packet of unexpected size",
+                                   s.ns.c_str());
+            return;
+        }
+        if (s.imu_packet_count) s.imu_packet_count->add();
+        if (s.motion_compensator) s.motion_compensator->add_imu_packet(buf);
+        (*s.imu_packet_handler)(buf);
+    }
+
+    bool use_ros_time = false;
+    uint8_t config_flags = 0;
+    tf2_ros::StaticTransformBroadcaster static_tf_bcast;
+    // declared before the sensors whose pipelines post to it
+    std::shared_ptr<ouster_ros::WorkStealingPool> pool;
+    std::vector<std::unique_ptr<Sensor>> sensors;
+    std::unique_ptr<ouster_ros::UdpEventLoop> event_loop;
+};
+
+}  // namespace nodelets_os
+
+PLUGINLIB_EXPORT_CLASS(nodelets_os::OusterMultiSensor, nodelet::Nodelet)
@@ -0,0 +1,477 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_osc_file.cpp
+ * @brief implementation of the .osc recording format
+ */
+
+#include "ouster_ros/os_osc_file.h"
+
+#include <ros/console.h>
+#include <zstd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+namespace sensor = ouster::sensor;
+
+namespace ouster_ros {
+
+namespace {
+
+constexpr char file_magic[8] = {'O', 'U', 'S', 'T', 'R', 'O', 'S', 'C'};
+constexpr uint32_t file_version = 1;
+constexpr uint32_t chunk_magic = 0x4b43534f;  // "OSCK"
+
+// file header: magic, version, size of the metadata, then the metadata
+constexpr size_t file_header_size = sizeof(file_magic) + 2 * sizeof(uint32_t);
+
+// chunk header: magic, packets, lidar packets, raw size, compressed size,
+// reserved, first stamp
+constexpr size_t chunk_header_size = 6 * sizeof(uint32_t) + sizeof(int64_t);
+
+// a chunk holds a frame, the margin covers the packets of a frame reordered
+// past the first packet of the next one
+constexpr size_t max_chunk_frames = 2;
+
+struct ChunkHeader {
+    uint32_t n_packets;
+    uint32_t n_lidar;
+    uint32_t raw_size;
+    uint32_t compressed_size;
+    int64_t first_stamp;
+};
+
+template <typename T>
+uint8_t* put(uint8_t* p, T v) {
+    std::memcpy(p, &v, sizeof(T));
+    return p + sizeof(T);
+}
+
+template <typename T>
+const uint8_t* get(const uint8_t* p, T& v) {
+    std::memcpy(&v, p, sizeof(T));
+    return p + sizeof(T);
+}
+
+void write_chunk_header(uint8_t* p, const ChunkHeader& h) {
+    p = put(p, chunk_magic);
+    p = put(p, h.n_packets);
+    p = put(p, h.n_lidar);
+    p = put(p, h.raw_size);
+    p = put(p, h.compressed_size);
+    p = put(p, uint32_t{0});
+    put(p, h.first_stamp);
+}
+
+bool read_chunk_header(const uint8_t* p, ChunkHeader& h) {
+    uint32_t magic, reserved;
+    p = get(p, magic);
+    p = get(p, h.n_packets);
+    p = get(p, h.n_lidar);
+    p = get(p, h.raw_size);
+    p = get(p, h.compressed_size);
+    p = get(p, reserved);
+    get(p, h.first_stamp);
+    return magic == chunk_magic && h.n_lidar <= h.n_packets;
+}
+
+size_t raw_chunk_size(const sensor::packet_format& pf, size_t n_packets,
+                      size_t n_lidar) {
+    return n_packets * (1 + sizeof(int64_t)) + n_lidar * pf.lidar_packet_size +
+           (n_packets - n_lidar) * pf.imu_packet_size;
+}
+
+// writes the planes of 16 bit words of n records of the given size, every
+// word delta coded against the same word of the previous record; the last
+// byte of records of odd size is stored as is
+template <typename Record>
+uint8_t* encode_planes(Record record, size_t n, size_t size, uint8_t* out) {
+    for (size_t w = 0; w + 1 < size; w += 2) {
+        uint16_t prev = 0;
+        for (size_t i = 0; i < n; ++i) {
+            uint16_t v;
+            std::memcpy(&v, record(i) + w, sizeof(v));
+            out = put(out, static_cast<uint16_t>(v - prev));
+            prev = v;
+        }
+    }
+    if (size % 2)
+        for (size_t i = 0; i < n; ++i) *out++ = record(i)[size - 1];
+    return out;
+}
+
+template <typename Record>
+const uint8_t* decode_planes(Record record, size_t n, size_t size,
+                             const uint8_t* in) {
+    for (size_t w = 0; w + 1 < size; w += 2) {
+        uint16_t prev = 0;
+        for (size_t i = 0; i < n; ++i) {
+            uint16_t d;
+            in = get(in, d);
+            prev = static_cast<uint16_t>(prev + d);
+            std::memcpy(record(i) + w, &prev, sizeof(prev));
+        }
+    }
+    if (size % 2)
+        for (size_t i = 0; i < n; ++i) record(i)[size - 1] = *in++;
+    return in;
+}
+
+// the layout of a lidar packet: header, column records and footer
+struct PacketLayout {
+    size_t packet_size;
+    size_t header_size;
+    size_t columns;
+    size_t col_size;
+    size_t footer_size;
+
+    explicit PacketLayout(const sensor::packet_format& pf)
+        : packet_size(pf.lidar_packet_size),
+          header_size(pf.packet_header_size),
+          columns(pf.columns_per_packet),
+          col_size(pf.col_size),
+          footer_size(packet_size - header_size - columns * col_size) {}
+
+    size_t col_offset(size_t col) const {
+        return header_size + col * col_size;
+    }
+    size_t footer_offset() const { return col_offset(columns); }
+};
+
+}  // namespace
+
+namespace osc {
+
+void transpose_lidar_packets(const sensor::packet_format& pf,
+                             const uint8_t* packets, size_t n, uint8_t* out) {
+    const PacketLayout l(pf);
+    out = encode_planes(
+        [&](size_t m) {
+            return packets + (m / l.columns) * l.packet_size +
+                   l.col_offset(m % l.columns);
+        },
+        n * l.columns, l.col_size, out);
+    out = encode_planes(
+        [&](size_t p) { return packets + p * l.packet_size; }, n,
+        l.header_size, out);
+    encode_planes(
+        [&](size_t p) {
+            return packets + p * l.packet_size + l.footer_offset();
+        },
+        n, l.footer_size, out);
+}
+
+void restore_lidar_packets(const sensor::packet_format& pf,
+                           const uint8_t* planes, size_t n, uint8_t* packets) {
+    const PacketLayout l(pf);
+    planes = decode_planes(
+        [&](size_t m) {
+            return packets + (m / l.columns) * l.packet_size +
+                   l.col_offset(m % l.columns);
+        },
+        n * l.columns, l.col_size, planes);
+    planes = decode_planes(
+        [&](size_t p) { return packets + p * l.packet_size; }, n,
+        l.header_size, planes);
+    decode_planes(
+        [&](size_t p) {
+            return packets + p * l.packet_size + l.footer_offset();
+        },
+        n, l.footer_size, planes);
+}
+
+}  // namespace osc
+
+void OscWriter::Chunk::clear() {
+    kinds.clear();
+    stamps.clear();
+    lidar.clear();
+    imu.clear();
+    n_lidar = n_imu = 0;
+}
+
+OscWriter::OscWriter(const std::string& file, const std::string& metadata,
+                     int level, size_t max_pending)
+    : info(sensor::parse_metadata(metadata)),
+      pf(sensor::get_format(info)),
+      level(level),
+      max_pending(std::max<size_t>(max_pending, 1)),
+      current(std::make_unique<Chunk>()) {
+    out = std::fopen(file.c_str(), "wb");
+    if (!out)
+        throw std::runtime_error("OscWriter: failed to create " + file + ": " +
+                                 std::strerror(errno));
+    // chunks are written in one go, a large buffer saves a few syscalls
+    std::setvbuf(out, nullptr, _IOFBF, 1 << 20);
+
+    uint8_t header[file_header_size];
+    std::memcpy(header, file_magic, sizeof(file_magic));
+    uint8_t* p = put(header + sizeof(file_magic), file_version);
+    put(p, static_cast<uint32_t>(metadata.size()));
+    if (std::fwrite(header, 1, sizeof(header), out) != sizeof(header) ||
+        std::fwrite(metadata.data(), 1, metadata.size(), out) !=
+            metadata.size()) {
+        std::fclose(out);
+        throw std::runtime_error("OscWriter: failed to write " + file);
+    }
+
+    cctx = ZSTD_createCCtx();
+    writer = std::thread([this] { write_loop(); });
+}
+
+OscWriter::~OscWriter() {
+    submit();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        active = false;
+    }
+    cv.notify_one();
+    if (writer.joinable()) writer.join();
+    std::fclose(out);
+    ZSTD_freeCCtx(cctx);
+}
+
+void OscWriter::add_lidar_packet(const uint8_t* buf, size_t size,
+                                 std::chrono::nanoseconds stamp) {
+    if (size != pf.lidar_packet_size) return;
+    const uint16_t frame_id = pf.frame_id(buf);
+    const size_t packets_per_frame =
+        info.format.columns_per_frame / pf.columns_per_packet;
+    if (current->n_lidar > 0 &&
+        (frame_id != current->frame_id ||
+         current->n_lidar >= max_chunk_frames * packets_per_frame))
+        submit();
+    if (current->n_lidar == 0) current->frame_id = frame_id;
+    add_packet(true, buf, stamp);
+}
+
+void OscWriter::add_imu_packet(const uint8_t* buf, size_t size,
+                               std::chrono::nanoseconds stamp) {
+    if (size != pf.imu_packet_size) return;
+    add_packet(false, buf, stamp);
+}
+
+void OscWriter::add_packet(bool lidar, const uint8_t* buf,
+                           std::chrono::nanoseconds stamp) {
+    auto& chunk = *current;
+    chunk.kinds.push_back(lidar ? 1 : 0);
+    chunk.stamps.push_back(stamp.count());
+    if (lidar) {
+        chunk.lidar.insert(chunk.lidar.end(), buf, buf + pf.lidar_packet_size);
+        ++chunk.n_lidar;
+    } else {
+        chunk.imu.insert(chunk.imu.end(), buf, buf + pf.imu_packet_size);
+        ++chunk.n_imu;
+    }
+}
+
+void OscWriter::submit() {
+    if (current->kinds.empty()) return;
+    bool queued = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pending.size() < max_pending) {
+            pending.push_back(std::move(current));
+            queued = true;
+            if (!spare.empty()) {
+                current = std::move(spare.back());
+                spare.pop_back();
+            }
+        }
+    }
+
+    if (queued) {
+        cv.notify_one();
+    } else {
+        ++dropped;
+        ROS_WARN_THROTTLE(1, "OscWriter: falling behind, dropping frames");
+    }
+    if (!current) current = std::make_unique<Chunk>();
+    current->clear();
+}
+
+void OscWriter::write_loop() {
+    while (true) {
+        std::unique_ptr<Chunk> chunk;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this] { return !active || !pending.empty(); });
+            if (pending.empty()) return;
+            chunk = std::move(pending.front());
+            pending.pop_front();
+        }
+
+        write_chunk(*chunk);
+
+        // the buffers of written chunks keep their capacity for the next ones
+        std::lock_guard<std::mutex> lock(mutex);
+        spare.push_back(std::move(chunk));
+    }
+}
+
+void OscWriter::write_chunk(const Chunk& chunk) {
+    const size_t n = chunk.kinds.size();
+    raw.resize(raw_chunk_size(pf, n, chunk.n_lidar));
+    uint8_t* p = raw.data();
+    std::memcpy(p, chunk.kinds.data(), n);
+    p += n;
+    int64_t prev = chunk.stamps.front();
+    for (int64_t stamp : chunk.stamps) {
+        p = put(p, stamp - prev);
+        prev = stamp;
+    }
+    osc::transpose_lidar_packets(pf, chunk.lidar.data(), chunk.n_lidar, p);
+    p += chunk.lidar.size();
+    std::memcpy(p, chunk.imu.data(), chunk.imu.size());
+
+    compressed.resize(chunk_header_size + ZSTD_compressBound(raw.size()));
+    const size_t size = ZSTD_compressCCtx(
+        cctx, compressed.data() + chunk_header_size,
+        compressed.size() - chunk_header_size, raw.data(), raw.size(), level);
+    if (ZSTD_isError(size)) {
+        ROS_ERROR_STREAM_THROTTLE(1, "OscWriter: failed to compress frame: "
+                                         << ZSTD_getErrorName(size));
+        return;
+    }
+
+    ChunkHeader header{static_cast<uint32_t>(n),
+                       static_cast<uint32_t>(chunk.n_lidar),
+                       static_cast<uint32_t>(raw.size()),
+                       static_cast<uint32_t>(size), chunk.stamps.front()};
+    write_chunk_header(compressed.data(), header);
+    const size_t total = chunk_header_size + size;
+    if (std::fwrite(compressed.data(), 1, total, out) != total)
+        ROS_ERROR_STREAM_THROTTLE(
+            1, "OscWriter: failed to write frame: " << std::strerror(errno));
+}
+
+OscReader::OscReader(const std::string& file) {
+    in = std::fopen(file.c_str(), "rb");
+    if (!in)
+        throw std::runtime_error("OscReader: failed to open " + file + ": " +
+                                 std::strerror(errno));
+
+    auto fail = [&](const std::string& reason) {
+        std::fclose(in);
+        throw std::runtime_error("OscReader: " + reason + ": " + file);
+    };
+
+    uint8_t header[file_header_size];
+    if (std::fread(header, 1, sizeof(header), in) != sizeof(header) ||
+        std::memcmp(header, file_magic, sizeof(file_magic)) != 0)
+        fail("not an osc file");
+    uint32_t version, metadata_size;
+    get(get(header + sizeof(file_magic), version), metadata_size);
+    if (version != file_version) fail("unsupported version");
+
+    metadata_json.resize(metadata_size);
+    if (std::fread(&metadata_json[0], 1, metadata_size, in) != metadata_size)
+        fail("truncated metadata");
+    try {
+        info = sensor::parse_metadata(metadata_json);
+    } catch (const std::exception& e) {
+        fail(std::string("invalid metadata (") + e.what() + ")");
+    }
+    pf = &sensor::get_format(info);
+
+    // index the chunks, a recording cut short ends with the last complete one
+    uint64_t offset = file_header_size + metadata_size;
+    uint8_t chunk_header[chunk_header_size];
+    while (fseeko(in, static_cast<off_t>(offset), SEEK_SET) == 0 &&
+           std::fread(chunk_header, 1, chunk_header_size, in) ==
+               chunk_header_size) {
+        ChunkHeader h;
+        if (!read_chunk_header(chunk_header, h)) break;
+        const uint64_t end = offset + chunk_header_size + h.compressed_size;
+        if (fseeko(in, static_cast<off_t>(end - 1), SEEK_SET) != 0 ||
+            std::fgetc(in) == EOF)
+            break;
+        chunk_offsets.push_back(offset);
+        offset = end;
+    }
+
+    dctx = ZSTD_createDCtx();
+    rewind();
+}
+
+OscReader::~OscReader() {
+    std::fclose(in);
+    ZSTD_freeDCtx(dctx);
+}
+
+void OscReader::seek(size_t chunk) {
+    next_chunk = chunk;
+    n_packets = packet_index = 0;
+}
+
+bool OscReader::load_chunk() {
+    if (next_chunk >= chunk_offsets.size()) return false;
+    const auto offset = chunk_offsets[next_chunk++];
+
+    auto corrupted = [&]() {
+        return std::runtime_error("OscReader: corrupted chunk at offset " +
+                                  std::to_string(offset));
+    };
+
+    uint8_t chunk_header[chunk_header_size];
+    ChunkHeader h;
+    if (fseeko(in, static_cast<off_t>(offset), SEEK_SET) != 0 ||
+        std::fread(chunk_header, 1, chunk_header_size, in) !=
+            chunk_header_size ||
+        !read_chunk_header(chunk_header, h) ||
+        h.raw_size != raw_chunk_size(*pf, h.n_packets, h.n_lidar))
+        throw corrupted();
+
+    compressed.resize(h.compressed_size);
+    if (std::fread(compressed.data(), 1, h.compressed_size, in) !=
+        h.compressed_size)
+        throw corrupted();
+    raw.resize(h.raw_size);
+    const size_t size = ZSTD_decompressDCtx(dctx, raw.data(), raw.size(),
+                                            compressed.data(),
+                                            compressed.size());
+    if (ZSTD_isError(size) || size != raw.size()) throw corrupted();
+
+    const uint8_t* p = raw.data();
+    kinds = p;
+    p += h.n_packets;
+    // next() indexes the packets of either kind by the flags
+    if (static_cast<size_t>(std::count_if(
+            kinds, p, [](uint8_t kind) { return kind != 0; })) != h.n_lidar)
+        throw corrupted();
+    stamp_deltas = p;
+    p += h.n_packets * sizeof(int64_t);
+    lidar_packets.resize(h.n_lidar * pf->lidar_packet_size);
+    osc::restore_lidar_packets(*pf, p, h.n_lidar, lidar_packets.data());
+    imu_packets = p + lidar_packets.size();
+
+    n_packets = h.n_packets;
+    packet_index = lidar_index = imu_index = 0;
+    stamp = h.first_stamp;
+    return true;
+}
+
+bool OscReader::next(Packet& packet) {
+    while (packet_index >= n_packets)
+        if (!load_chunk()) return false;
+
+    int64_t delta;
+    get(stamp_deltas + packet_index * sizeof(int64_t), delta);
+    stamp += delta;
+    packet.stamp = std::chrono::nanoseconds{stamp};
+    packet.lidar = kinds[packet_index++] != 0;
+    if (packet.lidar) {
+        packet.size = pf->lidar_packet_size;
+        packet.data = lidar_packets.data() + lidar_index++ * packet.size;
+    } else {
+        packet.size = pf->imu_packet_size;
+        packet.data = imu_packets + imu_index++ * packet.size;
+    }
+    return true;
+}
+
+}  // namespace ouster_ros
@@ -0,0 +1,95 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_packet_backlog.cpp
+ * @brief implementation of the PacketBacklog
+ */
+
+#include "ouster_ros/os_packet_backlog.h"
+
+#include <ros/console.h>
+
+#include <algorithm>
+#include <utility>
+
+namespace sensor = ouster::sensor;
+using namespace std::chrono_literals;
+
+namespace ouster_ros {
+
+namespace {
+
+// the smallest delay is tracked over two windows of this length, so that it
+// follows the drift between the sensor and the host clocks
+constexpr auto window_length = 10s;
+
+// draining a backlog takes a fraction of the time it took to build up, a
+// lag that persists while discarding means the sensor clock stepped back
+constexpr auto max_discarding_time = 1s;
+
+}  // namespace
+
+PacketBacklog::PacketBacklog(const sensor::sensor_info& info,
+                             std::chrono::nanoseconds max_lag,
+                             std::shared_ptr<PipelineStats> stats)
+    : pf(sensor::get_format(info)),
+      max_lag(max_lag.count()),
+      window_start(clock::now()),
+      stats(std::move(stats)) {
+    if (this->stats)
+        dropped_count = &this->stats->counter("backlog_dropped_frames", true);
+}
+
+int64_t PacketBacklog::lag_of(const uint8_t* packet_buf,
+                              clock::time_point now) {
+    const auto ts = pf.col_timestamp(pf.nth_col(0, packet_buf));
+    // the columns outside of the azimuth window carry no timestamp
+    if (ts == 0) return -1;
+
+    const int64_t delay =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            now.time_since_epoch())
+            .count() -
+        static_cast<int64_t>(ts);
+    if (now - window_start > window_length) {
+        previous_min = window_min;
+        window_min = delay;
+        window_start = now;
+    }
+    window_min = std::min(window_min, delay);
+    return delay - std::min(window_min, previous_min);
+}
+
+bool PacketBacklog::admit(const uint8_t* packet_buf) {
+    const auto now = clock::now();
+    const auto lag = lag_of(packet_buf, now);
+    const int id = pf.frame_id(packet_buf);
+    if (id == frame_id) return !discarding;
+
+    // the decision holds for the whole frame
+    frame_id = id;
+    const bool behind = lag > max_lag;
+    if (behind && discarding && now - discarding_since > max_discarding_time) {
+        ROS_WARN("PacketBacklog: the sensor clock stepped back, resetting");
+        window_min = previous_min = std::numeric_limits<int64_t>::max();
+        discarding = false;
+        return true;
+    }
+    if (!behind) {
+        discarding = false;
+        return true;
+    }
+
+    if (!discarding) discarding_since = now;
+    discarding = true;
+    ++dropped;
+    if (dropped_count) dropped_count->add();
+    ROS_WARN_STREAM_THROTTLE(
+        1, "PacketBacklog: the lidar packets lag by "
+               << lag / 1000000 << " ms, discarding whole frames ("
+               << dropped << " so far)");
+    return false;
+}
+
+}  // namespace ouster_ros
@@ -0,0 +1,86 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_packet_batcher.cpp
+ * @brief implementation of the LidarPacketBatcher
+ */
+
+#include "ouster_ros/os_packet_batcher.h"
+
+namespace ouster_ros {
+
+LidarPacketBatcher::LidarPacketBatcher(const sensor::sensor_info& info,
+                                       Mode mode, size_t count,
+                                       ros::Duration duration)
+    : pf(sensor::get_format(info)),
+      mode(mode),
+      count(count),
+      duration(duration) {
+    const size_t packets_per_frame =
+        info.format.columns_per_frame / pf.columns_per_packet;
+    const size_t max_packets = mode == Mode::COUNT ? count : packets_per_frame;
+    const size_t packet_size = pf.lidar_packet_size;
+
+    // a few batches are enough to cover the messages sitting in subscriber
+    // queues, the pool grows on demand otherwise
+    pool = std::make_unique<MessagePool<PacketBatchMsg>>(
+        4, [max_packets, packet_size](PacketBatchMsg& msg) {
+            msg.packet_size = packet_size;
+            msg.stamps.reserve(max_packets);
+            msg.buf.reserve(max_packets * packet_size);
+        });
+}
+
+PacketBatchMsg::Ptr LidarPacketBatcher::add(const uint8_t* buf,
+                                            const ros::Time& stamp) {
+    PacketBatchMsg::Ptr completed;
+    const uint16_t frame_id = pf.frame_id(buf);
+    if (mode == Mode::FRAME && batch && frame_id != batch_frame_id)
+        completed = flush();
+    // a packet received past the budget starts the next batch
+    if (mode == Mode::TIME) completed = expire(stamp);
+
+    if (!batch) {
+        batch = pool->acquire();
+        // keep the capacity of recycled messages
+        batch->stamps.clear();
+        batch->buf.clear();
+        batch_frame_id = frame_id;
+    }
+
+    batch->stamps.push_back(stamp);
+    batch->buf.insert(batch->buf.end(), buf, buf + batch->packet_size);
+
+    if (mode == Mode::COUNT && batch->stamps.size() >= count)
+        completed = flush();
+
+    return completed;
+}
+
+PacketBatchMsg::Ptr LidarPacketBatcher::flush() {
+    PacketBatchMsg::Ptr completed;
+    completed.swap(batch);
+    return completed;
+}
+
+PacketBatchMsg::Ptr LidarPacketBatcher::expire(const ros::Time& now) {
+    if (mode != Mode::TIME || !batch || now - batch->stamps.front() < duration)
+        return nullptr;
+    return flush();
+}
+
+bool packet_batch_mode_of_string(const std::string& mode_arg,
+                                 LidarPacketBatcher::Mode& mode) {
+    if (mode_arg == "count")
+        mode = LidarPacketBatcher::Mode::COUNT;
+    else if (mode_arg == "frame")
+        mode = LidarPacketBatcher::Mode::FRAME;
+    else if (mode_arg == "time")
+        mode = LidarPacketBatcher::Mode::TIME;
+    else
+        return false;
+    return true;
+}
+
+}  // namespace ouster_ros
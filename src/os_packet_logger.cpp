@@ -0,0 +1,292 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_packet_logger.cpp
+ * @brief implementation of the memory mapped pcap packet logger
+ */
+
+#include "ouster_ros/os_packet_logger.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+namespace ouster_ros {
+
+namespace {
+
+constexpr size_t global_header_size = 24;
+constexpr size_t record_header_size = 16;
+constexpr size_t ip_header_size = 20;
+constexpr size_t udp_header_size = 8;
+constexpr size_t max_payload_size =
+    65535 - ip_header_size - udp_header_size;
+
+constexpr uint32_t magic_nsec = 0xa1b23c4d;
+constexpr uint32_t linktype_raw = 101;
+constexpr uint8_t ip_proto_udp = 17;
+
+// pages are faulted in that far ahead of the logged packets, which covers
+// about a second of the highest sensor data rates
+constexpr size_t populate_window = 64 << 20;
+
+template <typename T>
+uint8_t* put(uint8_t* p, T v) {
+    std::memcpy(p, &v, sizeof(T));
+    return p + sizeof(T);
+}
+
+uint8_t* put_be16(uint8_t* p, uint16_t v) {
+    p[0] = static_cast<uint8_t>(v >> 8);
+    p[1] = static_cast<uint8_t>(v);
+    return p + 2;
+}
+
+uint16_t ip_checksum(const uint8_t* header) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < ip_header_size; i += 2)
+        sum += static_cast<uint32_t>(header[i] << 8 | header[i + 1]);
+    while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+    return static_cast<uint16_t>(~sum);
+}
+
+size_t align_down(size_t v, size_t page) { return v / page * page; }
+
+}  // namespace
+
+PacketLogger::PacketLogger(const std::string& prefix, size_t segment_size,
+                           uint16_t lidar_port, uint16_t imu_port,
+                           std::shared_ptr<PipelineStats> stats,
+                           std::chrono::milliseconds flush_period)
+    : prefix(prefix),
+      segment_size(segment_size),
+      lidar_port(lidar_port),
+      imu_port(imu_port),
+      flush_period(flush_period),
+      page_size(static_cast<size_t>(sysconf(_SC_PAGESIZE))) {
+    if (segment_size < global_header_size + record_header_size +
+                           ip_header_size + udp_header_size +
+                           max_payload_size)
+        throw std::runtime_error(
+            "PacketLogger: segments must hold at least one datagram");
+
+    if (stats) {
+        logged_count = &stats->counter("logged_packets");
+        dropped_count = &stats->counter("dropped_logged_packets", true);
+        flush_time = &stats->histogram("packet_log_flush");
+    }
+
+    current = open_segment();
+    offset = global_header_size;
+    committed = offset;
+    flushing = current.get();
+    flush_thread = std::thread([this] { flush_loop(); });
+}
+
+PacketLogger::~PacketLogger() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        active = false;
+    }
+    cv.notify_one();
+    if (flush_thread.joinable()) flush_thread.join();
+
+    close_segment(*current, offset);
+    // the prepared segment never received a packet
+    if (next) close_segment(*next, 0);
+}
+
+bool PacketLogger::log(uint16_t port, const uint8_t* buf, size_t size,
+                       const ros::Time& stamp) {
+    const size_t datagram_size = ip_header_size + udp_header_size + size;
+    const size_t record_size = record_header_size + datagram_size;
+    if (size > max_payload_size ||
+        (offset + record_size > current->size && !switch_segment())) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        if (dropped_count) dropped_count->add();
+        ROS_WARN_THROTTLE(1, "PacketLogger: no room left, dropping packets");
+        return false;
+    }
+
+    uint8_t* p = current->base + offset;
+    p = put(p, static_cast<uint32_t>(stamp.sec));
+    p = put(p, static_cast<uint32_t>(stamp.nsec));
+    p = put(p, static_cast<uint32_t>(datagram_size));
+    p = put(p, static_cast<uint32_t>(datagram_size));
+
+    uint8_t* ip = p;
+    std::memset(ip, 0, ip_header_size);
+    ip[0] = 0x45;
+    put_be16(ip + 2, static_cast<uint16_t>(datagram_size));
+    put_be16(ip + 4, ip_id++);
+    // don't fragment
+    put_be16(ip + 6, 0x4000);
+    ip[8] = 64;
+    ip[9] = ip_proto_udp;
+    put_be16(ip + 10, ip_checksum(ip));
+    p += ip_header_size;
+
+    p = put_be16(p, port);
+    p = put_be16(p, port);
+    p = put_be16(p, static_cast<uint16_t>(udp_header_size + size));
+    // no checksum
+    p = put_be16(p, 0);
+    std::memcpy(p, buf, size);
+
+    offset += record_size;
+    committed.store(offset, std::memory_order_release);
+    if (logged_count) logged_count->add();
+    return true;
+}
+
+bool PacketLogger::switch_segment() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!next) return false;
+        retired.push_back(Retired{std::move(current), offset});
+        current = std::move(next);
+        flushing = current.get();
+        offset = global_header_size;
+        committed.store(offset, std::memory_order_release);
+    }
+    // prepare the following segment right away
+    cv.notify_one();
+    return true;
+}
+
+std::unique_ptr<PacketLogger::Segment> PacketLogger::open_segment() {
+    char suffix[16];
+    std::snprintf(suffix, sizeof(suffix), "_%04zu.pcap", segment_index++);
+    auto segment = std::make_unique<Segment>();
+    segment->path = prefix + suffix;
+    segment->size = segment_size;
+
+    auto fail = [&](const char* what) {
+        const auto error = std::string("PacketLogger: failed to ") + what +
+                           " " + segment->path + ": " + std::strerror(errno);
+        if (segment->fd >= 0) ::close(segment->fd);
+        throw std::runtime_error(error);
+    };
+
+    segment->fd = ::open(segment->path.c_str(), O_RDWR | O_CREAT | O_TRUNC,
+                         0644);
+    if (segment->fd < 0) fail("create");
+    // allocating the blocks upfront keeps the file system off the logging
+    // path and turns running out of disk space into an error here rather
+    // than a SIGBUS on the mapping
+    const int error = posix_fallocate(segment->fd, 0, segment_size);
+    if (error != 0) {
+        errno = error;
+        fail("allocate");
+    }
+    void* mapping = mmap(nullptr, segment_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, segment->fd, 0);
+    if (mapping == MAP_FAILED) fail("map");
+    segment->base = static_cast<uint8_t*>(mapping);
+
+    uint8_t* p = segment->base;
+    p = put(p, magic_nsec);
+    p = put(p, uint16_t{2});
+    p = put(p, uint16_t{4});
+    p = put(p, int32_t{0});
+    p = put(p, uint32_t{0});
+    p = put(p, uint32_t{65535});
+    put(p, linktype_raw);
+    return segment;
+}
+
+void PacketLogger::close_segment(Segment& segment, size_t used) {
+    if (used > 0 && msync(segment.base, used, MS_SYNC) != 0)
+        ROS_ERROR_STREAM("PacketLogger: failed to write "
+                         << segment.path << ": " << std::strerror(errno));
+    munmap(segment.base, segment.size);
+    if (used == 0) {
+        ::unlink(segment.path.c_str());
+    } else if (ftruncate(segment.fd, static_cast<off_t>(used)) != 0) {
+        ROS_ERROR_STREAM("PacketLogger: failed to truncate "
+                         << segment.path << ": " << std::strerror(errno));
+    }
+    ::close(segment.fd);
+}
+
+void PacketLogger::flush(Segment& segment, size_t begin, size_t end) {
+    // the page holding end is still being written to, pages before it are
+    // written back and released
+    const size_t released = align_down(end, page_size);
+    begin = align_down(begin, page_size);
+    if (released <= begin) return;
+    StageTimer timer;
+    if (msync(segment.base + begin, released - begin, MS_SYNC) != 0)
+        ROS_ERROR_STREAM_THROTTLE(1, "PacketLogger: failed to write "
+                                         << segment.path << ": "
+                                         << std::strerror(errno));
+    madvise(segment.base + begin, released - begin, MADV_DONTNEED);
+    if (flush_time) flush_time->record(timer.elapsed());
+}
+
+void PacketLogger::flush_loop() {
+    Segment* segment = nullptr;
+    size_t flushed = 0;
+    size_t populated = 0;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        cv.wait_for(lock, flush_period,
+                    [this] { return !active || !retired.empty() || !next; });
+        auto done = std::move(retired);
+        retired.clear();
+        Segment* followed = flushing;
+        const size_t end = committed.load(std::memory_order_acquire);
+        const bool stop = !active;
+        const bool prepare = active && !next;
+        lock.unlock();
+
+        for (auto& r : done) {
+            if (r.segment.get() == segment) segment = nullptr;
+            close_segment(*r.segment, r.used);
+        }
+
+        if (followed != segment) {
+            segment = followed;
+            flushed = populated = 0;
+        }
+        if (!stop) {
+            flush(*segment, flushed, end);
+            flushed = align_down(end, page_size);
+#ifdef MADV_POPULATE_WRITE
+            // the logging thread then writes to resident pages
+            const size_t target =
+                std::min(segment->size, end + populate_window);
+            populated = std::max(populated, align_down(end, page_size));
+            if (target > populated &&
+                madvise(segment->base + populated, target - populated,
+                        MADV_POPULATE_WRITE) == 0)
+                populated = target;
+#endif
+        }
+
+        std::unique_ptr<Segment> prepared;
+        if (prepare) {
+            try {
+                prepared = open_segment();
+            } catch (const std::runtime_error& e) {
+                ROS_ERROR_STREAM_THROTTLE(1, e.what());
+                // try again with the next period rather than spinning
+                std::this_thread::sleep_for(flush_period);
+            }
+        }
+
+        lock.lock();
+        if (prepared) next = std::move(prepared);
+        if (stop) return;
+    }
+}
+
+}  // namespace ouster_ros
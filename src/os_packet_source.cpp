@@ -0,0 +1,215 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_packet_source.cpp
+ * @brief implementation of the bag, pcap and osc packet sources
+ */
+
+#include "ouster_ros/os_packet_source.h"
+
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+
+#include <unistd.h>
+
+#include <stdexcept>
+#include <vector>
+
+#include "ouster_ros/PacketBatchMsg.h"
+#include "ouster_ros/PacketMsg.h"
+#include "ouster_ros/os_osc_file.h"
+#include "ouster_ros/os_pcap_reader.h"
+
+namespace sensor = ouster::sensor;
+
+namespace ouster_ros {
+
+namespace {
+
+bool ends_with(const std::string& str, const std::string& suffix) {
+    return str.size() >= suffix.size() &&
+           str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// matches the topic regardless of the namespace it was recorded under
+bool is_topic(const std::string& topic, const std::string& name) {
+    return topic == name || ends_with(topic, "/" + name);
+}
+
+// the segments written by PacketLogger are named <prefix>_<n>.pcap, starting
+// from a segment the following ones are played back as well
+std::vector<std::string> pcap_segments(const std::string& file) {
+    std::vector<std::string> files{file};
+    const auto stem = file.substr(0, file.size() - 5);
+    const auto sep = stem.find_last_of('_');
+    if (sep == std::string::npos || sep + 1 == stem.size() ||
+        stem.find_first_not_of("0123456789", sep + 1) != std::string::npos)
+        return files;
+
+    const auto digits = stem.size() - sep - 1;
+    for (size_t n = std::stoul(stem.substr(sep + 1)) + 1;; ++n) {
+        auto index = std::to_string(n);
+        if (index.size() < digits)
+            index.insert(0, digits - index.size(), '0');
+        auto segment = stem.substr(0, sep + 1) + index + ".pcap";
+        if (access(segment.c_str(), R_OK) != 0) break;
+        files.push_back(std::move(segment));
+    }
+    return files;
+}
+
+class PcapPacketSource : public PacketSource {
+   public:
+    PcapPacketSource(const std::string& file, const sensor::sensor_info& info)
+        : files(pcap_segments(file)),
+          reader(std::make_unique<PcapReader>(file)) {
+        const auto& pf = sensor::get_format(info);
+        lidar_packet_size = pf.lidar_packet_size;
+        imu_packet_size = pf.imu_packet_size;
+    }
+
+    bool next(ReplayPacket& packet) override {
+        PcapReader::Packet udp;
+        while (true) {
+            while (reader->next(udp)) {
+                if (udp.size != lidar_packet_size &&
+                    udp.size != imu_packet_size)
+                    continue;
+                packet.lidar = udp.size == lidar_packet_size;
+                packet.buf = udp.data;
+                packet.size = udp.size;
+                packet.stamp.fromNSec(udp.stamp.count());
+                return true;
+            }
+            if (file_index + 1 >= files.size()) return false;
+            reader = std::make_unique<PcapReader>(files[++file_index]);
+        }
+    }
+
+    void rewind() override {
+        if (file_index != 0) {
+            file_index = 0;
+            reader = std::make_unique<PcapReader>(files.front());
+        } else {
+            reader->rewind();
+        }
+    }
+
+   private:
+    std::vector<std::string> files;
+    size_t file_index = 0;
+    std::unique_ptr<PcapReader> reader;
+    size_t lidar_packet_size;
+    size_t imu_packet_size;
+};
+
+class OscPacketSource : public PacketSource {
+   public:
+    explicit OscPacketSource(const std::string& file) : reader(file) {}
+
+    bool next(ReplayPacket& packet) override {
+        OscReader::Packet osc;
+        if (!reader.next(osc)) return false;
+        packet.lidar = osc.lidar;
+        packet.buf = osc.data;
+        packet.size = osc.size;
+        packet.stamp.fromNSec(osc.stamp.count());
+        return true;
+    }
+
+    void rewind() override { reader.rewind(); }
+
+   private:
+    OscReader reader;
+};
+
+class BagPacketSource : public PacketSource {
+   public:
+    explicit BagPacketSource(const std::string& file) {
+        bag.open(file, rosbag::bagmode::Read);
+
+        // a bag recorded with batching may also hold individual packets
+        // published to other subscribers, only one of the two is replayed
+        bool has_packets = false;
+        rosbag::View all(bag);
+        for (const auto* connection : all.getConnections())
+            has_packets |= is_topic(connection->topic, "lidar_packets");
+
+        view = std::make_unique<rosbag::View>(
+            bag, [has_packets](const rosbag::ConnectionInfo* connection) {
+                return is_topic(connection->topic, "lidar_packets") ||
+                       is_topic(connection->topic, "imu_packets") ||
+                       (!has_packets &&
+                        is_topic(connection->topic, "lidar_packet_batches"));
+            });
+        it = view->begin();
+    }
+
+    bool next(ReplayPacket& packet) override {
+        while (true) {
+            if (batch && batch_index < batch->stamps.size()) {
+                packet.lidar = true;
+                packet.buf =
+                    batch->buf.data() + batch_index * batch->packet_size;
+                packet.size = batch->packet_size;
+                packet.stamp = batch->stamps[batch_index++];
+                return true;
+            }
+            batch.reset();
+
+            if (it == view->end()) return false;
+            const auto& message = *it;
+            const auto& topic = message.getTopic();
+            if (is_topic(topic, "lidar_packet_batches")) {
+                batch = message.instantiate<PacketBatchMsg>();
+                batch_index = 0;
+                ++it;
+                if (batch && batch->buf.size() < batch->stamps.size() *
+                                                     batch->packet_size) {
+                    ROS_WARN_THROTTLE(1, "skipping malformed packet batch");
+                    batch.reset();
+                }
+                continue;
+            }
+
+            packet_msg = message.instantiate<PacketMsg>();
+            packet.stamp = message.getTime();
+            packet.lidar = is_topic(topic, "lidar_packets");
+            ++it;
+            if (!packet_msg) continue;
+            packet.buf = packet_msg->buf.data();
+            packet.size = packet_msg->buf.size();
+            return true;
+        }
+    }
+
+    void rewind() override {
+        it = view->begin();
+        batch.reset();
+    }
+
+   private:
+    rosbag::Bag bag;
+    std::unique_ptr<rosbag::View> view;
+    rosbag::View::iterator it;
+    // the message currently handed out
+    PacketMsg::ConstPtr packet_msg;
+    PacketBatchMsg::ConstPtr batch;
+    size_t batch_index = 0;
+};
+
+}  // namespace
+
+std::unique_ptr<PacketSource> open_packet_source(
+    const std::string& file, const sensor::sensor_info& info) {
+    if (ends_with(file, ".pcap"))
+        return std::make_unique<PcapPacketSource>(file, info);
+    if (ends_with(file, ".bag"))
+        return std::make_unique<BagPacketSource>(file);
+    if (ends_with(file, ".osc"))
+        return std::make_unique<OscPacketSource>(file);
+    throw std::runtime_error("unsupported recording format: " + file);
+}
+
+}  // namespace ouster_ros
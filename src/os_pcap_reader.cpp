@@ -0,0 +1,281 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_pcap_reader.cpp
+ * @brief implementation of the PcapReader
+ */
+
+#include "ouster_ros/os_pcap_reader.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+namespace ouster_ros {
+
+namespace {
+
+constexpr size_t global_header_size = 24;
+constexpr size_t record_header_size = 16;
+
+constexpr uint32_t magic_usec = 0xa1b2c3d4;
+constexpr uint32_t magic_nsec = 0xa1b23c4d;
+
+constexpr uint32_t linktype_null = 0;
+constexpr uint32_t linktype_ethernet = 1;
+constexpr uint32_t linktype_raw = 101;
+constexpr uint32_t linktype_linux_sll = 113;
+
+constexpr uint16_t ethertype_ipv4 = 0x0800;
+constexpr uint16_t ethertype_ipv6 = 0x86dd;
+constexpr uint16_t ethertype_vlan = 0x8100;
+constexpr uint16_t ethertype_qinq = 0x88a8;
+
+constexpr uint8_t ip_proto_udp = 17;
+constexpr size_t udp_header_size = 8;
+
+// datagrams split across more fragments than that are given up on
+constexpr size_t max_pending_datagrams = 64;
+
+// the mapping is prefetched and released in windows of that size
+constexpr size_t read_ahead_window = 64 << 20;
+
+uint16_t be16(const uint8_t* p) {
+    return static_cast<uint16_t>(p[0] << 8 | p[1]);
+}
+
+uint32_t be32(const uint8_t* p) {
+    return static_cast<uint32_t>(p[0]) << 24 |
+           static_cast<uint32_t>(p[1]) << 16 |
+           static_cast<uint32_t>(p[2]) << 8 | static_cast<uint32_t>(p[3]);
+}
+
+uint32_t swap32(uint32_t v) {
+    return (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+}
+
+}  // namespace
+
+PcapReader::PcapReader(const std::string& file) {
+    int fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("PcapReader: failed to open " + file + ": " +
+                                 std::strerror(errno));
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        static_cast<size_t>(st.st_size) < global_header_size) {
+        ::close(fd);
+        throw std::runtime_error("PcapReader: not a pcap file: " + file);
+    }
+    file_size = static_cast<size_t>(st.st_size);
+
+    void* mapping = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping holds its own reference to the file
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+        throw std::runtime_error("PcapReader: failed to map " + file + ": " +
+                                 std::strerror(errno));
+    base = static_cast<uint8_t*>(mapping);
+    madvise(base, file_size, MADV_SEQUENTIAL);
+
+    uint32_t magic;
+    std::memcpy(&magic, base, sizeof(magic));
+    if (magic == magic_usec || magic == magic_nsec) {
+        swapped = false;
+    } else if (swap32(magic) == magic_usec || swap32(magic) == magic_nsec) {
+        swapped = true;
+        magic = swap32(magic);
+    } else {
+        munmap(base, file_size);
+        throw std::runtime_error(
+            "PcapReader: unsupported capture format (pcapng?): " + file);
+    }
+    nanosecond = magic == magic_nsec;
+    link_type = read32(base + 20) & 0xffff;
+    if (link_type != linktype_null && link_type != linktype_ethernet &&
+        link_type != linktype_raw && link_type != linktype_linux_sll) {
+        munmap(base, file_size);
+        throw std::runtime_error("PcapReader: unsupported link type " +
+                                 std::to_string(link_type) + ": " + file);
+    }
+
+    rewind();
+}
+
+PcapReader::~PcapReader() {
+    if (base) munmap(base, file_size);
+}
+
+void PcapReader::rewind() {
+    offset = global_header_size;
+    advised_end = released_end = 0;
+    fragments.clear();
+    read_ahead();
+}
+
+uint32_t PcapReader::read32(const uint8_t* p) const {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return swapped ? swap32(v) : v;
+}
+
+void PcapReader::read_ahead() {
+    // keep a full window prefetched ahead of the cursor
+    if (offset + read_ahead_window / 2 >= advised_end &&
+        advised_end < file_size) {
+        const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        const size_t begin = offset / page * page;
+        const size_t end = std::min(file_size, offset + read_ahead_window);
+        madvise(base + begin, end - begin, MADV_WILLNEED);
+        advised_end = end;
+    }
+
+    // and release the pages a window behind it, the packets handed out never
+    // reach that far back
+    if (offset >= released_end + 2 * read_ahead_window) {
+        const size_t end = released_end + read_ahead_window;
+        madvise(base + released_end, read_ahead_window, MADV_DONTNEED);
+        released_end = end;
+    }
+}
+
+bool PcapReader::next(Packet& packet) {
+    while (offset + record_header_size <= file_size) {
+        read_ahead();
+
+        const uint8_t* record = base + offset;
+        const uint32_t ts_sec = read32(record);
+        const uint32_t ts_frac = read32(record + 4);
+        const size_t incl_len = read32(record + 8);
+        const uint8_t* frame = record + record_header_size;
+        // a truncated last record ends the capture
+        if (offset + record_header_size + incl_len > file_size) break;
+        offset += record_header_size + incl_len;
+
+        packet.stamp =
+            std::chrono::seconds{ts_sec} +
+            std::chrono::nanoseconds{nanosecond ? ts_frac : ts_frac * 1000ull};
+        if (parse_frame(frame, incl_len, packet)) return true;
+    }
+    offset = file_size;
+    return false;
+}
+
+bool PcapReader::parse_frame(const uint8_t* frame, size_t len,
+                             Packet& packet) {
+    uint16_t ethertype;
+    size_t header;
+    switch (link_type) {
+        case linktype_ethernet:
+            if (len < 14) return false;
+            ethertype = be16(frame + 12);
+            header = 14;
+            while ((ethertype == ethertype_vlan ||
+                    ethertype == ethertype_qinq) &&
+                   len >= header + 4) {
+                ethertype = be16(frame + header + 2);
+                header += 4;
+            }
+            break;
+        case linktype_linux_sll:
+            if (len < 16) return false;
+            ethertype = be16(frame + 14);
+            header = 16;
+            break;
+        // the address family of null captures is in the host order of the
+        // capturing machine, the ip version of the payload is used instead
+        case linktype_null:
+        case linktype_raw:
+        default:
+            header = link_type == linktype_null ? 4 : 0;
+            if (len <= header) return false;
+            ethertype = (frame[header] >> 4) == 6 ? ethertype_ipv6
+                                                  : ethertype_ipv4;
+            break;
+    }
+
+    if (ethertype == ethertype_ipv4)
+        return parse_ipv4(frame + header, len - header, packet);
+    if (ethertype == ethertype_ipv6)
+        return parse_ipv6(frame + header, len - header, packet);
+    return false;
+}
+
+bool PcapReader::parse_ipv4(const uint8_t* ip, size_t len, Packet& packet) {
+    if (len < 20 || (ip[0] >> 4) != 4) return false;
+    const size_t header = (ip[0] & 0x0f) * 4u;
+    const size_t total = be16(ip + 2);
+    if (header < 20 || total < header || total > len) return false;
+    if (ip[9] != ip_proto_udp) return false;
+
+    const uint16_t flags_offset = be16(ip + 6);
+    const bool more_fragments = flags_offset & 0x2000;
+    const size_t frag_offset = (flags_offset & 0x1fffu) * 8;
+    const uint8_t* payload = ip + header;
+    const size_t payload_len = total - header;
+
+    if (!more_fragments && frag_offset == 0)
+        return parse_udp(payload, payload_len, packet);
+
+    // lidar packets exceed the usual mtu and are typically captured as ip
+    // fragments, which have to be put back together
+    const FragmentKey key{be32(ip + 12), be32(ip + 16), be16(ip + 4)};
+    auto it = fragments.find(key);
+    if (it == fragments.end()) {
+        if (fragments.size() >= max_pending_datagrams) {
+            auto oldest = std::min_element(
+                fragments.begin(), fragments.end(),
+                [](const std::pair<const FragmentKey, Fragments>& a,
+                   const std::pair<const FragmentKey, Fragments>& b) {
+                    return a.second.seq < b.second.seq;
+                });
+            fragments.erase(oldest);
+        }
+        it = fragments.emplace(key, Fragments{}).first;
+        it->second.seq = fragment_seq++;
+    }
+
+    auto& datagram = it->second;
+    if (datagram.data.size() < frag_offset + payload_len)
+        datagram.data.resize(frag_offset + payload_len);
+    std::memcpy(datagram.data.data() + frag_offset, payload, payload_len);
+    datagram.received += payload_len;
+    if (!more_fragments) datagram.total = frag_offset + payload_len;
+
+    if (datagram.total == 0 || datagram.received < datagram.total)
+        return false;
+
+    assembled.swap(datagram.data);
+    fragments.erase(it);
+    return parse_udp(assembled.data(), assembled.size(), packet);
+}
+
+bool PcapReader::parse_ipv6(const uint8_t* ip, size_t len, Packet& packet) {
+    constexpr size_t header = 40;
+    if (len < header || (ip[0] >> 4) != 6) return false;
+    // extension headers, fragments included, aren't followed
+    if (ip[6] != ip_proto_udp) return false;
+    const size_t payload_len = be16(ip + 4);
+    if (header + payload_len > len) return false;
+    return parse_udp(ip + header, payload_len, packet);
+}
+
+bool PcapReader::parse_udp(const uint8_t* udp, size_t len, Packet& packet) {
+    if (len < udp_header_size) return false;
+    const size_t udp_len = be16(udp + 4);
+    if (udp_len < udp_header_size || udp_len > len) return false;
+    packet.dst_port = be16(udp + 2);
+    packet.data = udp + udp_header_size;
+    packet.size = udp_len - udp_header_size;
+    return true;
+}
+
+}  // namespace ouster_ros
@@ -0,0 +1,196 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_point_cloud_processor.cpp
+ * @brief implementation of the PointCloudProcessor
+ */
+
+#include "ouster_ros/os_point_cloud_processor.h"
+
+using ouster::sensor::ChanField;
+using ouster::sensor::UDPProfileLidar;
+
+namespace ouster_ros {
+
+int get_n_returns(const sensor::sensor_info& info) {
+    return info.format.udp_profile_lidar ==
+                   UDPProfileLidar::PROFILE_RNG19_RFL8_SIG16_NIR16_DUAL
+               ? 2
+               : 1;
+}
+
+std::string topic_suffix(int return_index) {
+    if (return_index == 0) return std::string();
+    return std::to_string(return_index + 1);  // need second return to return 2
+}
+
+PointCloudProcessor::PointCloudProcessor(
+    const sensor::sensor_info& info, ros::NodeHandle& nh,
+    const std::string& sensor_frame, bool staggered, bool destagger,
+    std::shared_ptr<const PointCloudSerializer> serializer,
+    std::shared_ptr<ThreadPool> thread_pool,
+    std::shared_ptr<PipelineStats> stats,
+    std::shared_ptr<MotionCompensator> motion_compensator, int queue_size)
+    : info(info),
+      n_returns(get_n_returns(info)),
+      staggered(staggered),
+      destagger(destagger),
+      sensor_frame(sensor_frame),
+      serializer(std::move(serializer)),
+      thread_pool(std::move(thread_pool)),
+      outputs(new ReturnOutput[n_returns]),
+      motion_compensator(std::move(motion_compensator)),
+      stats(std::move(stats)) {
+    if (staggered) {
+        lidar_pubs.resize(n_returns);
+        for (int i = 0; i < n_returns; i++) {
+            lidar_pubs[i] = nh.advertise<sensor_msgs::PointCloud2>(
+                std::string("points") + topic_suffix(i), queue_size);
+        }
+    }
+
+    if (destagger) {
+        destaggeredlidar_pubs.resize(n_returns);
+        for (int i = 0; i < n_returns; i++) {
+            destaggeredlidar_pubs[i] = nh.advertise<sensor_msgs::PointCloud2>(
+                std::string("destaggeredpoints") + topic_suffix(i),
+                queue_size);
+        }
+    }
+
+    // a few chunks per thread keep the threads busy until the end of a frame
+    if (this->thread_pool)
+        chunks_per_return =
+            std::min<size_t>(this->serializer->rows(),
+                             2 * this->thread_pool->concurrency());
+
+    // messages are laid out and sized once
+    const size_t n_topics =
+        n_returns * ((staggered ? 1 : 0) + (destagger ? 1 : 0));
+    cloud_pool = std::make_unique<MessagePool<sensor_msgs::PointCloud2>>(
+        frame_pool_capacity(n_topics),
+        [this](sensor_msgs::PointCloud2& msg) {
+            this->serializer->layout(msg);
+        });
+
+    if (this->stats) {
+        serialization_time = &this->stats->histogram("cloud_serialization");
+        if (this->motion_compensator)
+            uncompensated_count =
+                &this->stats->counter("uncompensated_scans", true);
+        // ROS doesn't expose the depth of its publish queues, the clouds
+        // still held by the queues and subscribers are the closest measure
+        this->stats->gauge(
+            "clouds_in_flight",
+            [this] { return static_cast<double>(cloud_pool->in_use()); },
+            this);
+    }
+}
+
+PointCloudProcessor::~PointCloudProcessor() {
+    if (stats) stats->remove_gauge("clouds_in_flight", this);
+}
+
+void PointCloudProcessor::operator()(const ouster::LidarScan& ls,
+                                     std::chrono::nanoseconds scan_ts,
+                                     const ros::Time& msg_ts, bool dense) {
+    int active_returns[2];
+    int n_active = 0;
+    for (int i = 0; i < n_returns; ++i) {
+        const bool publish_staggered =
+            staggered && lidar_pubs[i].getNumSubscribers() > 0;
+        const bool publish_destaggered =
+            destagger && destaggeredlidar_pubs[i].getNumSubscribers() > 0;
+        if (!publish_staggered && !publish_destaggered) continue;
+
+        bool second = (i == 1);
+        auto& out = outputs[i];
+        // views into the scan, the serializer casts the channels it reads
+        // while packing the points
+        out.reflectivity = get_field_view(
+            suitable_return(ChanField::REFLECTIVITY, second), ls);
+        out.signal =
+            get_field_view(suitable_return(ChanField::SIGNAL, second), ls);
+        out.near_ir =
+            get_field_view(suitable_return(ChanField::NEAR_IR, second), ls);
+
+        if (publish_staggered) {
+            out.pc_ptr = cloud_pool->acquire();
+            out.pc_ptr->header.stamp = msg_ts;
+            out.pc_ptr->header.frame_id = sensor_frame;
+            out.pc_ptr->is_dense = dense;
+        }
+        if (publish_destaggered) {
+            out.destaggeredpc_ptr = cloud_pool->acquire();
+            out.destaggeredpc_ptr->header.stamp = msg_ts;
+            out.destaggeredpc_ptr->header.frame_id = sensor_frame;
+            out.destaggeredpc_ptr->is_dense = dense;
+        }
+        out.remaining_chunks = chunks_per_return;
+        active_returns[n_active++] = i;
+    }
+
+    const size_t n_tasks = n_active * chunks_per_return;
+    if (n_tasks == 0) return;
+
+    // one rotation per column, shared by every return and chunk
+    const ColumnRotations* column_rotations = nullptr;
+    if (motion_compensator) {
+        if (motion_compensator->column_rotations(ls, scan_ts, rotations)) {
+            column_rotations = &rotations;
+        } else {
+            if (uncompensated_count) uncompensated_count->add();
+            ROS_WARN_THROTTLE(1, "PointCloudProcessor: no imu samples cover "
+                                 "the scan, publishing it uncompensated");
+        }
+    }
+
+    auto task = [&](size_t t) {
+        serialize_chunk(ls, scan_ts, active_returns[t / chunks_per_return],
+                        t % chunks_per_return, column_rotations);
+    };
+    const StageTimer timer;
+    if (thread_pool) {
+        thread_pool->run(n_tasks, task);
+    } else {
+        for (size_t t = 0; t < n_tasks; ++t) task(t);
+    }
+    if (stats) serialization_time->record(timer.elapsed());
+}
+
+void PointCloudProcessor::serialize_chunk(const ouster::LidarScan& ls,
+                                          std::chrono::nanoseconds scan_ts,
+                                          int return_index, size_t chunk,
+                                          const ColumnRotations* rotations) {
+    const bool second = (return_index == 1);
+    auto& out = outputs[return_index];
+
+    const size_t H = serializer->rows();
+    const auto row_begin = static_cast<uint32_t>(chunk * H / chunks_per_return);
+    const auto row_end =
+        static_cast<uint32_t>((chunk + 1) * H / chunks_per_return);
+
+    // across supported lidar profiles range is always 32-bit
+    Eigen::Ref<const ouster::img_t<uint32_t>> range =
+        ls.field<uint32_t>(second ? ChanField::RANGE2 : ChanField::RANGE);
+    serializer->serialize_rows(
+        out.pc_ptr.get(), out.destaggeredpc_ptr.get(), ls, scan_ts, range,
+        out.reflectivity, out.near_ir, out.signal, row_begin, row_end,
+        rotations);
+
+    // whoever writes the last rows of a return publishes it
+    if (out.remaining_chunks.fetch_sub(1) == 1) publish(return_index);
+}
+
+void PointCloudProcessor::publish(int return_index) {
+    auto& out = outputs[return_index];
+    if (out.pc_ptr) lidar_pubs[return_index].publish(out.pc_ptr);
+    if (out.destaggeredpc_ptr)
+        destaggeredlidar_pubs[return_index].publish(out.destaggeredpc_ptr);
+    // hand the messages over to the subscribers, the pool recycles them
+    out.pc_ptr.reset();
+    out.destaggeredpc_ptr.reset();
+}
+
+}  // namespace ouster_ros
@@ -0,0 +1,541 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_point_cloud_serializer.cpp
+ * @brief implementation of the PointCloudSerializer
+ */
+
+#include "ouster_ros/os_point_cloud_serializer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#include "ouster_ros/os_metadata_cache.h"
+
+// On x86 the cartesian kernel is compiled for several instruction sets and the
+// best one supported by the cpu is picked when the library is loaded. Arm
+// targets rely on NEON, which is part of the aarch64 baseline.
+#if defined(__x86_64__) && defined(__linux__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define OUSTER_ROS_SIMD_CLONES \
+    __attribute__((target_clones("avx512f", "avx2", "default")))
+#endif
+#endif
+#ifndef OUSTER_ROS_SIMD_CLONES
+#define OUSTER_ROS_SIMD_CLONES
+#endif
+
+namespace ouster_ros {
+
+namespace {
+
+// pixels are converted in blocks small enough for the cartesian coordinates to
+// stay in L1 until they are packed, so every input is streamed exactly once
+constexpr int block_size = 64;
+
+// must match the values each set_point() overload keeps
+template <typename PointT>
+PointCloudSerializer::Channels point_channels();
+
+template <>
+PointCloudSerializer::Channels point_channels<Point>() {
+    return {true, true, true};
+}
+
+template <>
+PointCloudSerializer::Channels point_channels<PointXYZ>() {
+    return {false, false, false};
+}
+
+template <>
+PointCloudSerializer::Channels point_channels<PointXYZI>() {
+    return {true, false, false};
+}
+
+template <>
+PointCloudSerializer::Channels point_channels<PointXYZIRT>() {
+    return {true, false, false};
+}
+
+// range * direction + offset, pixels without a return or with a range outside
+// [range_min, range_min + range_span] map to the origin just like
+// ouster::cartesianT does for the former
+OUSTER_ROS_SIMD_CLONES
+void cartesian_block(const uint32_t* __restrict range,
+                     const float* __restrict dx, const float* __restrict dy,
+                     const float* __restrict dz, const float* __restrict ox,
+                     const float* __restrict oy, const float* __restrict oz,
+                     uint32_t range_min, uint32_t range_span, int n,
+                     float* __restrict x, float* __restrict y,
+                     float* __restrict z) {
+    for (int k = 0; k < n; ++k) {
+        // ranges never reach 2^31, converting through int32 lets the compiler
+        // use the signed conversion instructions that every simd level has
+        const float r = static_cast<float>(static_cast<int32_t>(range[k]));
+        // a select rather than a branch keeps the loop vectorizable and,
+        // unlike a multiplication by zero, places the invalid pixels at +0
+        // as the reference conversion does; range_min is at least 1 so a
+        // null range wraps past the span
+        const bool valid = range[k] - range_min <= range_span;
+        x[k] = valid ? r * dx[k] + ox[k] : 0.0f;
+        y[k] = valid ? r * dy[k] + oy[k] : 0.0f;
+        z[k] = valid ? r * dz[k] + oz[k] : 0.0f;
+    }
+}
+
+// p = m * p for the points of a block, element (i, j) of the rotation of
+// point k is m[(3 * i + j) * stride + k]
+OUSTER_ROS_SIMD_CLONES
+void rotate_block(const float* __restrict m, size_t stride, int n,
+                  float* __restrict x, float* __restrict y,
+                  float* __restrict z) {
+    const float* m00 = m;
+    const float* m01 = m + stride;
+    const float* m02 = m + 2 * stride;
+    const float* m10 = m + 3 * stride;
+    const float* m11 = m + 4 * stride;
+    const float* m12 = m + 5 * stride;
+    const float* m20 = m + 6 * stride;
+    const float* m21 = m + 7 * stride;
+    const float* m22 = m + 8 * stride;
+    for (int k = 0; k < n; ++k) {
+        const float px = x[k];
+        const float py = y[k];
+        const float pz = z[k];
+        x[k] = m00[k] * px + m01[k] * py + m02[k] * pz;
+        y[k] = m10[k] * px + m11[k] * py + m12[k] * pz;
+        z[k] = m20[k] * px + m21[k] * py + m22[k] * pz;
+    }
+}
+
+constexpr double rad_to_deg = 180.0 / M_PI;
+
+}  // namespace
+
+bool CloudFilter::selects() const {
+    return row_stride > 1 || column_stride > 1 || dense ||
+           azimuth_min > -180.0 || azimuth_max < 180.0 ||
+           elevation_min > -90.0 || elevation_max < 90.0;
+}
+
+PointCloudSerializer::PointCloudSerializer(
+    const sensor::sensor_info& info,
+    std::vector<sensor_msgs::PointField> fields, uint32_t point_step,
+    Channels used_channels, const CloudFilter& filter)
+    : width(info.format.columns_per_frame),
+      height(info.format.pixels_per_column),
+      fields(std::move(fields)),
+      point_step(point_step),
+      used_channels(used_channels),
+      filter(filter),
+      range_min(std::max<uint32_t>(filter.min_range, 1)),
+      range_span(std::max(filter.max_range ? filter.max_range : UINT32_MAX,
+                          range_min) -
+                 range_min),
+      out_width(width),
+      out_height(height) {
+    const auto& pixel_shift_by_row = info.format.pixel_shift_by_row;
+    if (pixel_shift_by_row.size() != height)
+        throw std::invalid_argument{"image height does not match shifts size"};
+
+    SensorMetadata::lut_of(info, lut_direction, lut_offset);
+
+    // same shifts as ouster::destagger, pixel v of row u moves to column
+    // (v + shift) % width
+    destaggered_index.resize(static_cast<size_t>(width) * height);
+    for (uint32_t u = 0; u < height; u++) {
+        const uint32_t offset = (pixel_shift_by_row[u] + width) % width;
+        for (uint32_t v = 0; v < width; v++)
+            destaggered_index[u * width + v] =
+                u * width + (v + offset) % width;
+    }
+
+    if (!filter.selects()) return;
+    this->filter.row_stride = std::max<uint32_t>(filter.row_stride, 1);
+    this->filter.column_stride = std::max<uint32_t>(filter.column_stride, 1);
+    select_pixels(info, false, staggered_selection);
+    select_pixels(info, true, destaggered_selection);
+    if (filter.dense) {
+        out_height = 1;
+        out_width = static_cast<uint32_t>(
+            std::max(staggered_selection.pixels.size(),
+                     destaggered_selection.pixels.size()));
+    } else {
+        const auto rs = this->filter.row_stride;
+        const auto cs = this->filter.column_stride;
+        out_height = (height + rs - 1) / rs;
+        out_width = (width + cs - 1) / cs;
+    }
+}
+
+void PointCloudSerializer::select_pixels(const sensor::sensor_info& info,
+                                         bool destaggered,
+                                         Selection& selection) const {
+    const auto& pixel_shift_by_row = info.format.pixel_shift_by_row;
+    const size_t n_pixels = static_cast<size_t>(width) * height;
+    const float* dir = lut_direction.data();
+    const float* ofs = lut_offset.data();
+
+    auto in_windows = [&](size_t idx) {
+        const double dx = dir[idx];
+        const double dy = dir[n_pixels + idx];
+        const double dz = dir[2 * n_pixels + idx];
+        const double azimuth = std::atan2(dy, dx) * rad_to_deg;
+        const double elevation =
+            std::atan2(dz, std::hypot(dx, dy)) * rad_to_deg;
+        const bool in_azimuth =
+            filter.azimuth_min <= filter.azimuth_max
+                ? azimuth >= filter.azimuth_min &&
+                      azimuth <= filter.azimuth_max
+                : azimuth >= filter.azimuth_min ||
+                      azimuth <= filter.azimuth_max;
+        return in_azimuth && elevation >= filter.elevation_min &&
+               elevation <= filter.elevation_max;
+    };
+
+    std::vector<uint32_t> pixels;
+    std::vector<bool> inside;
+    for (uint32_t u = 0; u < height; u += filter.row_stride) {
+        const uint32_t offset = (pixel_shift_by_row[u] + width) % width;
+        for (uint32_t c = 0; c < width; c += filter.column_stride) {
+            // column c of a destaggered row holds the pixel shifted onto it
+            const uint32_t v = destaggered ? (c + width - offset) % width : c;
+            const uint32_t idx = u * width + v;
+            const bool in = in_windows(idx);
+            if (!in && filter.dense) continue;
+            pixels.push_back(idx);
+            inside.push_back(in);
+        }
+    }
+
+    const size_t n = pixels.size();
+    selection.lut.assign(6 * n, 0.0f);
+    for (size_t i = 0; i < n; ++i) {
+        if (!inside[i]) continue;
+        for (size_t axis = 0; axis < 3; ++axis) {
+            selection.lut[axis * n + i] = dir[axis * n_pixels + pixels[i]];
+            selection.lut[(3 + axis) * n + i] =
+                ofs[axis * n_pixels + pixels[i]];
+        }
+    }
+    selection.pixels = std::move(pixels);
+}
+
+void PointCloudSerializer::layout(sensor_msgs::PointCloud2& msg) const {
+    msg.height = out_height;
+    msg.width = out_width;
+    msg.fields = fields;
+    msg.is_bigendian = false;
+    msg.point_step = point_step;
+    msg.row_step = msg.point_step * out_width;
+    msg.is_dense = true;
+    msg.data.resize(static_cast<size_t>(msg.row_step) * out_height);
+}
+
+void PointCloudSerializer::layout_sector(sensor_msgs::PointCloud2& msg,
+                                         uint32_t columns) const {
+    msg.height = height;
+    msg.width = columns;
+    msg.fields = fields;
+    msg.is_bigendian = false;
+    msg.point_step = point_step;
+    msg.row_step = msg.point_step * columns;
+    msg.is_dense = true;
+    msg.data.resize(static_cast<size_t>(msg.row_step) * height);
+}
+
+template <typename PointT>
+BasicPointCloudSerializer<PointT>::BasicPointCloudSerializer(
+    const sensor::sensor_info& info, const CloudFilter& filter)
+    : PointCloudSerializer(info, make_point_fields<PointT>(), sizeof(PointT),
+                           point_channels<PointT>(), filter) {}
+
+template <typename PointT>
+void BasicPointCloudSerializer<PointT>::serialize_rows(
+    sensor_msgs::PointCloud2* msg, sensor_msgs::PointCloud2* destaggered_msg,
+    const ouster::LidarScan& ls, std::chrono::nanoseconds scan_ts,
+    Eigen::Ref<const ouster::img_t<uint32_t>> range,
+    const FieldView& reflectivity, const FieldView& near_ir,
+    const FieldView& signal, uint32_t row_begin, uint32_t row_end,
+    const ColumnRotations* rotations) const {
+    assert((!rotations || (rotations->columns == width &&
+                           rotations->matrix.size() == 9 * width)) &&
+           "rotations don't match the scan width");
+    if (filter.selects()) {
+        auto write = [&](sensor_msgs::PointCloud2* m, const Selection& sel) {
+            if (!m) return;
+            if (!filter.dense) {
+                assert(m->data.size() ==
+                           sizeof(PointT) * out_width * out_height &&
+                       "message was not prepared by layout()");
+                write_selection(m->data.data(), sel, ls, scan_ts, range,
+                                reflectivity, near_ir, signal,
+                                static_cast<size_t>(row_begin) * out_width,
+                                static_cast<size_t>(std::min(row_end,
+                                                             out_height)) *
+                                    out_width,
+                                rotations);
+                return;
+            }
+            // sized for every selected pixel, then trimmed to those kept
+            m->data.resize(sizeof(PointT) * sel.pixels.size());
+            const size_t n =
+                write_selection(m->data.data(), sel, ls, scan_ts, range,
+                                reflectivity, near_ir, signal, 0,
+                                sel.pixels.size(), rotations);
+            m->height = 1;
+            m->width = static_cast<uint32_t>(n);
+            m->row_step = static_cast<uint32_t>(sizeof(PointT) * n);
+            m->data.resize(m->row_step);
+        };
+        // a dense cloud is a single row written at once
+        if (filter.dense && row_begin > 0) return;
+        write(msg, staggered_selection);
+        write(destaggered_msg, destaggered_selection);
+        return;
+    }
+
+    assert((!msg || msg->data.size() == sizeof(PointT) * width * height) &&
+           (!destaggered_msg ||
+            destaggered_msg->data.size() == sizeof(PointT) * width * height) &&
+           "message was not prepared by layout()");
+    write_points(msg ? msg->data.data() : nullptr, width,
+                 destaggered_msg ? destaggered_msg->data.data() : nullptr, ls,
+                 scan_ts, range, reflectivity, near_ir, signal, row_begin,
+                 std::min(row_end, height), 0, width, rotations);
+}
+
+template <typename PointT>
+void BasicPointCloudSerializer<PointT>::serialize_sector(
+    sensor_msgs::PointCloud2& msg, const ouster::LidarScan& ls,
+    std::chrono::nanoseconds sector_ts,
+    Eigen::Ref<const ouster::img_t<uint32_t>> range,
+    const FieldView& reflectivity, const FieldView& near_ir,
+    const FieldView& signal, uint32_t col_begin, uint32_t col_end) const {
+    col_end = std::min(col_end, width);
+    if (col_begin >= col_end) return;
+    assert(msg.width == col_end - col_begin &&
+           msg.data.size() == sizeof(PointT) * msg.width * height &&
+           "message was not prepared by layout_sector()");
+    write_points(msg.data.data(), col_end - col_begin, nullptr, ls, sector_ts,
+                 range, reflectivity, near_ir, signal, 0, height, col_begin,
+                 col_end, nullptr);
+}
+
+template <typename PointT>
+void BasicPointCloudSerializer<PointT>::write_points(
+    uint8_t* data, uint32_t out_width, uint8_t* destaggered_data,
+    const ouster::LidarScan& ls, std::chrono::nanoseconds scan_ts,
+    Eigen::Ref<const ouster::img_t<uint32_t>> range,
+    const FieldView& reflectivity, const FieldView& near_ir,
+    const FieldView& signal, uint32_t row_begin, uint32_t row_end,
+    uint32_t col_begin, uint32_t col_end,
+    const ColumnRotations* rotations) const {
+    assert(ls.w == static_cast<std::ptrdiff_t>(width) &&
+           ls.h == static_cast<std::ptrdiff_t>(height) &&
+           "point cloud and lidar scan size mismatch");
+
+    auto timestamp = ls.timestamp();
+
+    const auto rg = range.data();
+    const uint32_t* dst_idx = destaggered_index.data();
+
+    // the lut matrices are column major, one contiguous column per axis
+    const size_t n_pixels = static_cast<size_t>(width) * height;
+    const float* dir = lut_direction.data();
+    const float* ofs = lut_offset.data();
+
+    for (uint32_t u = row_begin; u < row_end; u++) {
+        alignas(64) float x[block_size];
+        alignas(64) float y[block_size];
+        alignas(64) float z[block_size];
+        alignas(64) uint32_t ts[block_size];
+        // channels the point type ignores are never read and stay zero
+        alignas(64) uint32_t sg[block_size] = {};
+        alignas(64) uint16_t rf[block_size] = {};
+        alignas(64) uint16_t nr[block_size] = {};
+
+        for (uint32_t v0 = col_begin; v0 < col_end; v0 += block_size) {
+            const int n = static_cast<int>(
+                std::min<uint32_t>(block_size, col_end - v0));
+            const size_t idx0 = static_cast<size_t>(u) * width + v0;
+            const size_t out0 =
+                static_cast<size_t>(u) * out_width + (v0 - col_begin);
+
+            cartesian_block(rg + idx0, dir + idx0, dir + n_pixels + idx0,
+                            dir + 2 * n_pixels + idx0, ofs + idx0,
+                            ofs + n_pixels + idx0, ofs + 2 * n_pixels + idx0,
+                            range_min, range_span, n, x, y, z);
+            // the rotations are indexed by column like the lut rows
+            if (rotations)
+                rotate_block(rotations->matrix.data() + v0, width, n, x, y,
+                             z);
+
+            for (int k = 0; k < n; k++) {
+                const auto t = std::min(
+                    std::chrono::nanoseconds(timestamp[v0 + k]) - scan_ts,
+                    scan_ts);
+                ts[k] = static_cast<uint32_t>(t.count());
+            }
+
+            if (used_channels.signal) signal.read(idx0, n, sg);
+            if (used_channels.reflectivity) reflectivity.read(idx0, n, rf);
+            if (used_channels.near_ir) near_ir.read(idx0, n, nr);
+
+            for (int k = 0; k < n; k++) {
+                PointT pt;
+                set_point(pt, x[k], y[k], z[k], sg[k], ts[k], rf[k],
+                          static_cast<uint16_t>(u), nr[k], rg[idx0 + k]);
+                // the data buffers carry no alignment guarantee
+                if (data)
+                    std::memcpy(data + (out0 + k) * sizeof(PointT), &pt,
+                                sizeof(PointT));
+                if (destaggered_data)
+                    std::memcpy(destaggered_data +
+                                    dst_idx[idx0 + k] * sizeof(PointT),
+                                &pt, sizeof(PointT));
+            }
+        }
+    }
+}
+
+template <typename PointT>
+size_t BasicPointCloudSerializer<PointT>::write_selection(
+    uint8_t* data, const Selection& selection, const ouster::LidarScan& ls,
+    std::chrono::nanoseconds scan_ts,
+    Eigen::Ref<const ouster::img_t<uint32_t>> range,
+    const FieldView& reflectivity, const FieldView& near_ir,
+    const FieldView& signal, size_t begin, size_t end,
+    const ColumnRotations* rotations) const {
+    assert(ls.w == static_cast<std::ptrdiff_t>(width) &&
+           ls.h == static_cast<std::ptrdiff_t>(height) &&
+           "point cloud and lidar scan size mismatch");
+
+    auto timestamp = ls.timestamp();
+    const uint32_t* rg_scan = range.data();
+    const uint32_t* pixels = selection.pixels.data();
+    const size_t n_selected = selection.pixels.size();
+    const float* lut = selection.lut.data();
+    size_t written = 0;
+
+    alignas(64) float x[block_size];
+    alignas(64) float y[block_size];
+    alignas(64) float z[block_size];
+    alignas(64) uint32_t rg[block_size];
+    alignas(64) uint32_t ts[block_size];
+    // channels the point type ignores are never read and stay zero
+    alignas(64) uint32_t sg[block_size] = {};
+    alignas(64) uint16_t rf[block_size] = {};
+    alignas(64) uint16_t nr[block_size] = {};
+    alignas(64) float rot[9 * block_size];
+
+    for (size_t i0 = begin; i0 < end; i0 += block_size) {
+        const int n =
+            static_cast<int>(std::min<size_t>(block_size, end - i0));
+        const uint32_t* pix = pixels + i0;
+
+        for (int k = 0; k < n; k++) rg[k] = rg_scan[pix[k]];
+        cartesian_block(rg, lut + i0, lut + n_selected + i0,
+                        lut + 2 * n_selected + i0, lut + 3 * n_selected + i0,
+                        lut + 4 * n_selected + i0, lut + 5 * n_selected + i0,
+                        range_min, range_span, n, x, y, z);
+        if (rotations) {
+            // the points of a selection come from arbitrary columns
+            const float* m = rotations->matrix.data();
+            for (int e = 0; e < 9; e++)
+                for (int k = 0; k < n; k++)
+                    rot[e * block_size + k] = m[e * width + pix[k] % width];
+            rotate_block(rot, block_size, n, x, y, z);
+        }
+
+        for (int k = 0; k < n; k++) {
+            const auto t = std::min(
+                std::chrono::nanoseconds(timestamp[pix[k] % width]) - scan_ts,
+                scan_ts);
+            ts[k] = static_cast<uint32_t>(t.count());
+        }
+
+        if (used_channels.signal) signal.gather(pix, n, sg);
+        if (used_channels.reflectivity) reflectivity.gather(pix, n, rf);
+        if (used_channels.near_ir) near_ir.gather(pix, n, nr);
+
+        for (int k = 0; k < n; k++) {
+            // dense clouds skip the points without a return or out of range
+            if (filter.dense && rg[k] - range_min > range_span) continue;
+            PointT pt;
+            set_point(pt, x[k], y[k], z[k], sg[k], ts[k], rf[k],
+                      static_cast<uint16_t>(pix[k] / width), nr[k], rg[k]);
+            // organized clouds hold every selected pixel at its index
+            const size_t out = filter.dense ? written : i0 + k;
+            // the data buffers carry no alignment guarantee
+            std::memcpy(data + out * sizeof(PointT), &pt, sizeof(PointT));
+            ++written;
+        }
+    }
+    return written;
+}
+
+template class BasicPointCloudSerializer<Point>;
+template class BasicPointCloudSerializer<PointXYZ>;
+template class BasicPointCloudSerializer<PointXYZI>;
+template class BasicPointCloudSerializer<PointXYZIRT>;
+
+std::unique_ptr<PointCloudSerializer> make_point_cloud_serializer(
+    const std::string& point_type, const sensor::sensor_info& info,
+    const CloudFilter& filter) {
+    if (point_type == "original")
+        return std::make_unique<BasicPointCloudSerializer<Point>>(info, filter);
+    if (point_type == "xyz")
+        return std::make_unique<BasicPointCloudSerializer<PointXYZ>>(info,
+                                                                     filter);
+    if (point_type == "xyzi")
+        return std::make_unique<BasicPointCloudSerializer<PointXYZI>>(info,
+                                                                      filter);
+    if (point_type == "xyzirt")
+        return std::make_unique<BasicPointCloudSerializer<PointXYZIRT>>(
+            info, filter);
+    return nullptr;
+}
+
+bool is_point_type(const std::string& point_type) {
+    return point_type == "original" || point_type == "xyz" ||
+           point_type == "xyzi" || point_type == "xyzirt";
+}
+
+bool cloud_filter_of_params(ros::NodeHandle& nh, CloudFilter& filter) {
+    const int row_stride = nh.param("row_stride", 1);
+    const int column_stride = nh.param("column_stride", 1);
+    const double min_range = nh.param("min_range", 0.0);
+    const double max_range = nh.param("max_range", 0.0);
+    filter.azimuth_min = nh.param("azimuth_min", -180.0);
+    filter.azimuth_max = nh.param("azimuth_max", 180.0);
+    filter.elevation_min = nh.param("elevation_min", -90.0);
+    filter.elevation_max = nh.param("elevation_max", 90.0);
+    filter.dense = nh.param("dense_output", false);
+
+    auto within = [](double v, double bound) {
+        return v >= -bound && v <= bound;
+    };
+    if (row_stride < 1 || column_stride < 1 || min_range < 0.0 ||
+        max_range < 0.0 || (max_range > 0.0 && max_range < min_range) ||
+        !within(filter.azimuth_min, 180.0) ||
+        !within(filter.azimuth_max, 180.0) ||
+        !within(filter.elevation_min, 90.0) ||
+        !within(filter.elevation_max, 90.0) ||
+        filter.elevation_min > filter.elevation_max)
+        return false;
+
+    filter.row_stride = static_cast<uint32_t>(row_stride);
+    filter.column_stride = static_cast<uint32_t>(column_stride);
+    // the range channel counts millimeters
+    filter.min_range = static_cast<uint32_t>(std::lround(min_range * 1000.0));
+    filter.max_range = static_cast<uint32_t>(std::lround(max_range * 1000.0));
+    return true;
+}
+
+}  // namespace ouster_ros
@@ -0,0 +1,84 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_processing_params.cpp
+ * @brief The parameters of the scan processing shared by the nodelets that
+ * generate point clouds
+ */
+
+// prevent clang-format from altering the location of "ouster_ros/ros.h", the
+// header file needs to be the first include due to PCL_NO_PRECOMPILE flag
+// clang-format off
+#include "ouster_ros/os_ros.h"
+// clang-format on
+
+#include "ouster_ros/os_processing_params.h"
+
+#include <stdexcept>
+
+#include "ouster_ros/os_cuda_point_cloud_serializer.h"
+
+namespace ouster_ros {
+
+namespace {
+
+[[noreturn]] void invalid_params(const std::string& error_msg) {
+    ROS_ERROR_STREAM(error_msg);
+    throw std::runtime_error(error_msg);
+}
+
+}  // namespace
+
+ProcessingParams processing_params_of(ros::NodeHandle& pnh,
+                                      const std::string& name) {
+    ProcessingParams params;
+    params.point_type = pnh.param("point_type", params.point_type);
+    if (!is_point_type(params.point_type))
+        invalid_params(name + ": unsupported point_type: " + params.point_type);
+    if (!cloud_filter_of_params(pnh, params.filter))
+        invalid_params(name + ": invalid cloud filter parameters");
+
+    params.cloud_backend = pnh.param("cloud_backend", params.cloud_backend);
+    std::string reason;
+    if (params.cloud_backend == "cuda" &&
+        !cuda_backend_supports(params.filter, reason))
+        invalid_params(name + ": the cuda cloud_backend is unavailable: " +
+                       reason);
+    if (params.cloud_backend != "cpu" && params.cloud_backend != "cuda")
+        invalid_params(name + ": unsupported cloud_backend: " +
+                       params.cloud_backend);
+
+    params.staggered = pnh.param("staggered", params.staggered);
+    params.destagger = pnh.param("destagger", params.destagger);
+    if (!params.staggered && !params.destagger)
+        invalid_params(name +
+                       ": at least one of staggered and destagger must be set");
+
+    auto frame_policy_arg =
+        pnh.param("incomplete_frame_policy", std::string{"publish"});
+    if (!frame_policy_of_string(frame_policy_arg, params.frame_policy))
+        invalid_params(name + ": unsupported incomplete_frame_policy: " +
+                       frame_policy_arg);
+    params.min_completeness =
+        pnh.param("min_frame_completeness", params.min_completeness);
+    if (params.min_completeness < 0.0 || params.min_completeness > 1.0)
+        invalid_params(name + ": min_frame_completeness must be within [0, 1]");
+
+    params.imu_batch_size = pnh.param("imu_batch_size", params.imu_batch_size);
+    if (params.imu_batch_size < 0)
+        invalid_params(name + ": imu_batch_size must not be negative");
+    return params;
+}
+
+std::unique_ptr<PointCloudSerializer> make_point_cloud_serializer(
+    const ProcessingParams& params, const sensor::sensor_info& info) {
+    // both were checked by processing_params_of()
+    if (params.cloud_backend == "cuda")
+        return make_cuda_point_cloud_serializer(params.point_type, info,
+                                                params.filter);
+    return make_point_cloud_serializer(params.point_type, info,
+                                       params.filter);
+}
+
+}  // namespace ouster_ros
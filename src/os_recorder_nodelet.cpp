@@ -0,0 +1,136 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_recorder_nodelet.cpp
+ * @brief A nodelet that records the lidar and imu packets to an .osc file
+ */
+
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#include <ros/console.h>
+#include <ros/ros.h>
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "ouster_ros/PacketBatchMsg.h"
+#include "ouster_ros/PacketMsg.h"
+#include "ouster_ros/os_metadata_cache.h"
+#include "ouster_ros/os_osc_file.h"
+#include "ouster_ros/os_transport.h"
+
+using ouster_ros::PacketBatchMsg;
+using ouster_ros::PacketMsg;
+
+namespace nodelets_os {
+
+class OusterRecorder : public nodelet::Nodelet {
+   public:
+    ~OusterRecorder() override {
+        if (!writer) return;
+        const auto dropped = writer->dropped_chunks();
+        if (dropped > 0)
+            NODELET_WARN("OusterRecorder: %zu frames were dropped", dropped);
+    }
+
+   private:
+    virtual void onInit() override {
+        auto& pnh = getPrivateNodeHandle();
+        auto osc_file = pnh.param("osc_file", std::string{});
+        if (osc_file.empty()) {
+            auto error_msg = "OusterRecorder: osc_file must be specified";
+            NODELET_ERROR_STREAM(error_msg);
+            throw std::runtime_error(error_msg);
+        }
+        auto level = pnh.param("compression_level", 1);
+
+        auto& nh = getNodeHandle();
+        auto metadata = ouster_ros::fetch_sensor_metadata(nh);
+        if (!metadata) {
+            auto error_msg =
+                "OusterRecorder: Calling get_metadata service failed";
+            NODELET_ERROR_STREAM(error_msg);
+            throw std::runtime_error(error_msg);
+        }
+
+        try {
+            writer = std::make_unique<ouster_ros::OscWriter>(
+                osc_file, metadata->json(), level);
+        } catch (const std::runtime_error& e) {
+            NODELET_ERROR_STREAM(e.what());
+            throw;
+        }
+
+        auto transport_of = [&pnh, this](const std::string& topic) {
+            ros::TransportHints hints;
+            if (!ouster_ros::transport_hints_of_params(pnh, topic, hints)) {
+                auto error_msg =
+                    "OusterRecorder: unsupported transport for " + topic;
+                NODELET_ERROR_STREAM(error_msg);
+                throw std::runtime_error(error_msg);
+            }
+            return hints;
+        };
+        // a recording favors completeness, the queues are deep by default
+        using ouster_ros::queue_size_of_params;
+        if (pnh.param("use_packet_batches", false))
+            lidar_packet_sub = nh.subscribe<PacketBatchMsg>(
+                "lidar_packet_batches",
+                queue_size_of_params(pnh, "lidar_packet_batches", 100),
+                &OusterRecorder::lidar_packet_batch_handler, this,
+                transport_of("lidar_packet_batches"));
+        else
+            lidar_packet_sub = nh.subscribe<PacketMsg>(
+                "lidar_packets",
+                queue_size_of_params(pnh, "lidar_packets", 2048),
+                &OusterRecorder::lidar_packet_handler, this,
+                transport_of("lidar_packets"));
+        imu_packet_sub = nh.subscribe<PacketMsg>(
+            "imu_packets", queue_size_of_params(pnh, "imu_packets", 100),
+            &OusterRecorder::imu_packet_handler, this,
+            transport_of("imu_packets"));
+
+        NODELET_INFO("OusterRecorder: recording to %s", osc_file.c_str());
+    }
+
+    static std::chrono::nanoseconds now() {
+        return std::chrono::nanoseconds{ros::Time::now().toNSec()};
+    }
+
+    void lidar_packet_handler(const PacketMsg::ConstPtr& packet) {
+        std::lock_guard<std::mutex> lock(mutex);
+        writer->add_lidar_packet(packet->buf.data(), packet->buf.size(),
+                                 now());
+    }
+
+    void lidar_packet_batch_handler(const PacketBatchMsg::ConstPtr& batch) {
+        if (batch->buf.size() < batch->stamps.size() * batch->packet_size) {
+            NODELET_WARN_THROTTLE(1, "skipping malformed packet batch");
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < batch->stamps.size(); ++i)
+            writer->add_lidar_packet(
+                batch->buf.data() + i * batch->packet_size, batch->packet_size,
+                std::chrono::nanoseconds{batch->stamps[i].toNSec()});
+    }
+
+    void imu_packet_handler(const PacketMsg::ConstPtr& packet) {
+        std::lock_guard<std::mutex> lock(mutex);
+        writer->add_imu_packet(packet->buf.data(), packet->buf.size(), now());
+    }
+
+   private:
+    std::unique_ptr<ouster_ros::OscWriter> writer;
+    // callbacks may run on several threads of the nodelet manager
+    std::mutex mutex;
+    ros::Subscriber lidar_packet_sub;
+    ros::Subscriber imu_packet_sub;
+};
+
+}  // namespace nodelets_os
+
+PLUGINLIB_EXPORT_CLASS(nodelets_os::OusterRecorder, nodelet::Nodelet)
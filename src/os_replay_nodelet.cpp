@@ -3,20 +3,41 @@
  * All rights reserved.
  *
  * @file os_replay_nodelet.cpp
- * @brief This nodelet mainly handles publishing saved metadata
+ * @brief This nodelet mainly handles publishing saved metadata, it can also
+ * play back recorded packets itself
  *
  */
 
 #include <pluginlib/class_list_macros.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+#include "ouster_ros/PacketBatchMsg.h"
+#include "ouster_ros/PacketMsg.h"
 #include "ouster_ros/os_client_base_nodelet.h"
+#include "ouster_ros/os_message_pool.h"
+#include "ouster_ros/os_metadata_cache.h"
+#include "ouster_ros/os_packet_batcher.h"
+#include "ouster_ros/os_packet_source.h"
+#include "ouster_ros/os_transport.h"
 
 namespace sensor = ouster::sensor;
+using ouster_ros::PacketBatchMsg;
+using ouster_ros::PacketMsg;
 
 namespace nodelets_os {
 
 class OusterReplay : public OusterClientBase {
+   public:
+    ~OusterReplay() override { stop_replay(); }
+
    private:
+    using PacketMsgPool = ouster_ros::MessagePool<ouster_ros::PacketMsg>;
+
     virtual void onInit() override {
         auto& pnh = getPrivateNodeHandle();
         auto meta_file = pnh.param("metadata", std::string{});
@@ -32,14 +53,220 @@ class OusterReplay : public OusterClientBase {
             info = sensor::metadata_from_json(meta_file);
             cached_metadata = to_string(info);
             display_lidar_info(info);
+            ouster_ros::share_sensor_metadata(
+                getNodeHandle().resolveName("get_metadata"),
+                ouster_ros::make_sensor_metadata(cached_metadata));
         } catch (const std::runtime_error& e) {
             NODELET_ERROR("Error when running in replay mode: %s", e.what());
         }
 
         OusterClientBase::onInit();
+
+        auto replay_file = pnh.param("replay_file", std::string{});
+        if (is_arg_set(replay_file)) start_replay(pnh, replay_file);
+    }
+
+    void start_replay(ros::NodeHandle& pnh, const std::string& replay_file) {
+        if (cached_metadata.empty()) {
+            auto error_msg = "Can't replay " + replay_file +
+                             " without valid metadata";
+            NODELET_ERROR_STREAM(error_msg);
+            throw std::runtime_error(error_msg);
+        }
+
+        try {
+            packet_source = ouster_ros::open_packet_source(replay_file, info);
+        } catch (const std::runtime_error& e) {
+            auto error_msg =
+                "Failed to open " + replay_file + ": " + e.what();
+            NODELET_ERROR_STREAM(error_msg);
+            throw std::runtime_error(error_msg);
+        }
+
+        replay_rate = pnh.param("replay_rate", 1.0);
+        replay_loop = pnh.param("replay_loop", false);
+        if (replay_rate < 0.0) {
+            auto error_msg = "replay_rate must not be negative";
+            NODELET_ERROR_STREAM(error_msg);
+            throw std::runtime_error(error_msg);
+        }
+
+        const auto& pf = sensor::get_format(info);
+        const auto packets_per_frame =
+            info.format.columns_per_frame / pf.columns_per_packet;
+        const auto lidar_packet_size = pf.lidar_packet_size;
+        const auto imu_packet_size = pf.imu_packet_size;
+        lidar_packet_pool = std::make_unique<PacketMsgPool>(
+            2 * packets_per_frame, [lidar_packet_size](PacketMsg& packet) {
+                packet.buf.reserve(lidar_packet_size + 1);
+            });
+        imu_packet_pool = std::make_unique<PacketMsgPool>(
+            100, [imu_packet_size](PacketMsg& packet) {
+                packet.buf.reserve(imu_packet_size + 1);
+            });
+
+        auto& nh = getNodeHandle();
+        lidar_packet_pub = nh.advertise<PacketMsg>(
+            "lidar_packets",
+            ouster_ros::queue_size_of_params(pnh, "lidar_packets", 1280));
+        imu_packet_pub = nh.advertise<PacketMsg>(
+            "imu_packets",
+            ouster_ros::queue_size_of_params(pnh, "imu_packets", 100));
+        create_lidar_packet_batcher(pnh);
+
+        replay_active = true;
+        replay_thread = std::thread([this] { replay_packets(); });
+
+        if (replay_rate > 0.0)
+            NODELET_INFO("Replaying %s at %.2fx", replay_file.c_str(),
+                         replay_rate);
+        else
+            NODELET_INFO("Replaying %s as fast as possible",
+                         replay_file.c_str());
+    }
+
+    void create_lidar_packet_batcher(ros::NodeHandle& nh) {
+        auto batch_mode_arg = nh.param("packet_batch_mode", std::string{});
+        if (!is_arg_set(batch_mode_arg)) return;
+
+        ouster_ros::LidarPacketBatcher::Mode batch_mode;
+        if (!ouster_ros::packet_batch_mode_of_string(batch_mode_arg,
+                                                     batch_mode)) {
+            auto error_msg = "Invalid packet batch mode: " + batch_mode_arg;
+            NODELET_ERROR_STREAM(error_msg);
+            throw std::runtime_error(error_msg);
+        }
+
+        auto batch_size = nh.param("packet_batch_size", 16);
+        auto batch_duration = nh.param("packet_batch_duration", 0.01);
+        if (batch_size < 1 || batch_duration <= 0.0) {
+            auto error_msg =
+                "packet_batch_size and packet_batch_duration must be positive";
+            NODELET_ERROR_STREAM(error_msg);
+            throw std::runtime_error(error_msg);
+        }
+
+        lidar_packet_batcher = std::make_unique<ouster_ros::LidarPacketBatcher>(
+            info, batch_mode, batch_size, ros::Duration(batch_duration));
+        lidar_packet_batch_pub = getNodeHandle().advertise<PacketBatchMsg>(
+            "lidar_packet_batches",
+            ouster_ros::queue_size_of_params(nh, "lidar_packet_batches", 100));
+
+        NODELET_INFO("Publishing lidar packet batches, mode: %s",
+                     batch_mode_arg.c_str());
+    }
+
+    void stop_replay() {
+        replay_active = false;
+        if (replay_thread.joinable()) replay_thread.join();
+    }
+
+    void replay_packets() {
+        using clock = std::chrono::steady_clock;
+        // recordings paused for longer than that are replayed without the
+        // pause, a timeline going backwards restarts the pacing as well
+        const ros::Duration max_gap(1.0);
+
+        bool paced = false;
+        clock::time_point base_wall;
+        ros::Time base_stamp, last_stamp;
+
+        ouster_ros::ReplayPacket packet;
+        while (replay_active && ros::ok()) {
+            if (!packet_source->next(packet)) {
+                if (lidar_packet_batcher) {
+                    auto batch = lidar_packet_batcher->flush();
+                    if (batch) lidar_packet_batch_pub.publish(batch);
+                }
+                if (!replay_loop) break;
+                packet_source->rewind();
+                paced = false;
+                continue;
+            }
+
+            if (replay_rate > 0.0) {
+                if (!paced || packet.stamp < last_stamp ||
+                    packet.stamp - last_stamp > max_gap) {
+                    base_wall = clock::now();
+                    base_stamp = packet.stamp;
+                    paced = true;
+                }
+                last_stamp = packet.stamp;
+                const auto offset = std::chrono::nanoseconds{
+                    static_cast<int64_t>((packet.stamp - base_stamp).toNSec() /
+                                         replay_rate)};
+                // sleep in short steps to remain responsive to shutdown and
+                // to hand over a batch whose budget elapses in the meantime
+                const auto target = base_wall + offset;
+                while (replay_active && clock::now() < target) {
+                    std::this_thread::sleep_until(std::min(
+                        target, clock::now() + std::chrono::milliseconds(10)));
+                    if (lidar_packet_batcher) {
+                        // the position of the playback in the recording
+                        const std::chrono::duration<double, std::nano> played =
+                            (clock::now() - base_wall) * replay_rate;
+                        auto batch = lidar_packet_batcher->expire(
+                            base_stamp + ros::Duration().fromNSec(
+                                             static_cast<int64_t>(
+                                                 played.count())));
+                        if (batch) lidar_packet_batch_pub.publish(batch);
+                    }
+                }
+            }
+
+            if (packet.lidar)
+                publish_lidar_packet(packet);
+            else
+                publish_imu_packet(packet);
+        }
+
+        NODELET_INFO("Replay finished");
+    }
+
+    void publish_lidar_packet(const ouster_ros::ReplayPacket& packet) {
+        const auto& pf = sensor::get_format(info);
+        if (packet.size < pf.lidar_packet_size) return;
+
+        // batches are filled straight from the recording, without going
+        // through an individual packet message
+        if (!lidar_packet_batcher || lidar_packet_pub.getNumSubscribers() > 0)
+            lidar_packet_pub.publish(
+                make_packet_msg(*lidar_packet_pool, packet));
+
+        if (lidar_packet_batcher) {
+            auto batch = lidar_packet_batcher->add(packet.buf, packet.stamp);
+            if (batch) lidar_packet_batch_pub.publish(batch);
+        }
+    }
+
+    void publish_imu_packet(const ouster_ros::ReplayPacket& packet) {
+        imu_packet_pub.publish(make_packet_msg(*imu_packet_pool, packet));
     }
+
+    static PacketMsg::Ptr make_packet_msg(PacketMsgPool& pool,
+                                          const ouster_ros::ReplayPacket& p) {
+        auto msg = pool.acquire();
+        // recycled messages keep their capacity
+        msg->buf.assign(p.buf, p.buf + p.size);
+        return msg;
+    }
+
+   private:
+    std::unique_ptr<ouster_ros::PacketSource> packet_source;
+    double replay_rate = 1.0;
+    bool replay_loop = false;
+
+    ros::Publisher lidar_packet_pub;
+    ros::Publisher imu_packet_pub;
+    ros::Publisher lidar_packet_batch_pub;
+    std::unique_ptr<PacketMsgPool> lidar_packet_pool;
+    std::unique_ptr<PacketMsgPool> imu_packet_pool;
+    std::unique_ptr<ouster_ros::LidarPacketBatcher> lidar_packet_batcher;
+
+    std::thread replay_thread;
+    std::atomic<bool> replay_active{false};
 };
 
 }  // namespace nodelets_os
 
-PLUGINLIB_EXPORT_CLASS(nodelets_os::OusterReplay, nodelet::Nodelet)
\ No newline at end of file
+PLUGINLIB_EXPORT_CLASS(nodelets_os::OusterReplay, nodelet::Nodelet)
@@ -38,15 +38,7 @@ namespace ouster_ros {
         return read_lidar_packet(cli, pm.buf.data(), pf);
     }
 
-    sensor_msgs::Imu packet_to_imu_msg(const PacketMsg &pm,
-                                       const ros::Time &timestamp,
-                                       const std::string &frame,
-                                       const sensor::packet_format &pf) {
-        const double standard_g = 9.80665;
-        sensor_msgs::Imu m;
-        const uint8_t *buf = pm.buf.data();
-
-        m.header.stamp = timestamp;
+    void init_imu_msg(const std::string &frame, sensor_msgs::Imu &m) {
         m.header.frame_id = frame;
 
         m.orientation.x = 0;
@@ -54,14 +46,6 @@ namespace ouster_ros {
         m.orientation.z = 0;
         m.orientation.w = 0;
 
-        m.linear_acceleration.x = pf.imu_la_x(buf) * standard_g;
-        m.linear_acceleration.y = pf.imu_la_y(buf) * standard_g;
-        m.linear_acceleration.z = pf.imu_la_z(buf) * standard_g;
-
-        m.angular_velocity.x = pf.imu_av_x(buf) * M_PI / 180.0;
-        m.angular_velocity.y = pf.imu_av_y(buf) * M_PI / 180.0;
-        m.angular_velocity.z = pf.imu_av_z(buf) * M_PI / 180.0;
-
         for (int i = 0; i < 9; i++) {
             m.orientation_covariance[i] = -1;
             m.angular_velocity_covariance[i] = 0;
@@ -71,10 +55,40 @@ namespace ouster_ros {
             m.linear_acceleration_covariance[i] = 0.01;
             m.angular_velocity_covariance[i] = 6e-4;
         }
+    }
+
+    void fill_imu_msg(const uint8_t *buf, const ros::Time &timestamp,
+                      const sensor::packet_format &pf, sensor_msgs::Imu &m) {
+        const double standard_g = 9.80665;
+
+        m.header.stamp = timestamp;
+
+        m.linear_acceleration.x = pf.imu_la_x(buf) * standard_g;
+        m.linear_acceleration.y = pf.imu_la_y(buf) * standard_g;
+        m.linear_acceleration.z = pf.imu_la_z(buf) * standard_g;
+
+        m.angular_velocity.x = pf.imu_av_x(buf) * M_PI / 180.0;
+        m.angular_velocity.y = pf.imu_av_y(buf) * M_PI / 180.0;
+        m.angular_velocity.z = pf.imu_av_z(buf) * M_PI / 180.0;
+    }
 
+    sensor_msgs::Imu packet_to_imu_msg(const uint8_t *buf,
+                                       const ros::Time &timestamp,
+                                       const std::string &frame,
+                                       const sensor::packet_format &pf) {
+        sensor_msgs::Imu m;
+        init_imu_msg(frame, m);
+        fill_imu_msg(buf, timestamp, pf, m);
         return m;
     }
 
+    sensor_msgs::Imu packet_to_imu_msg(const PacketMsg &pm,
+                                       const ros::Time &timestamp,
+                                       const std::string &frame,
+                                       const sensor::packet_format &pf) {
+        return packet_to_imu_msg(pm.buf.data(), timestamp, frame, pf);
+    }
+
     sensor_msgs::Imu packet_to_imu_msg(const PacketMsg &pm,
                                        const std::string &frame,
                                        const sensor::packet_format &pf) {
@@ -83,14 +97,6 @@ namespace ouster_ros {
         return packet_to_imu_msg(pm, timestamp, frame, pf);
     }
 
-    struct read_and_cast {
-        template<typename T, typename U>
-        void operator()(Eigen::Ref<const ouster::img_t<T>> field,
-                        ouster::img_t<U> &dest) {
-            dest = field.template cast<U>();
-        }
-    };
-
     sensor::ChanField suitable_return(sensor::ChanField input_field, bool second) {
         switch (input_field) {
             case sensor::ChanField::RANGE:
@@ -112,18 +118,6 @@ namespace ouster_ros {
         }
     }
 
-    template<typename T>
-    inline ouster::img_t<T> get_or_fill_zero(sensor::ChanField f,
-                                             const ouster::LidarScan &ls) {
-        if (!ls.field_type(f)) {
-            return ouster::img_t<T>::Zero(ls.h, ls.w);
-        }
-
-        ouster::img_t<T> result{ls.h, ls.w};
-        ouster::impl::visit_field(ls, f, read_and_cast(), result);
-        return result;
-    }
-
     void scan_to_cloud(const ouster::XYZLut &xyz_lut,
                        ouster::LidarScan::ts_t scan_ts, const ouster::LidarScan &ls,
                        ouster_ros::Cloud &cloud, int return_index) {
@@ -163,49 +157,53 @@ namespace ouster_ros {
         }
     }
 
-    template<typename PointT, typename RangeT, typename ReflectivityT,
-            typename NearIrT, typename SignalT>
-    void copy_scan_to_cloud(ouster_ros::Cloud &cloud, const ouster::LidarScan &ls,
-                            std::chrono::nanoseconds scan_ts, const PointT &points,
-                            const ouster::img_t<RangeT> &range,
-                            const ouster::img_t<ReflectivityT> &reflectivity,
-                            const ouster::img_t<NearIrT> &near_ir,
-                            const ouster::img_t<SignalT> &signal) {
+    // fills the destaggered cloud in the same pass when one is given, so that
+    // destaggering costs no more than a second store per point
+    template<typename PointT, typename PointsT>
+    void copy_scan_to_cloud(pcl::PointCloud<PointT> &cloud,
+                            pcl::PointCloud<PointT> *destaggeredcloud,
+                            const std::vector<int> &pixel_shift_by_row,
+                            const ouster::LidarScan &ls,
+                            std::chrono::nanoseconds scan_ts, const PointsT &points,
+                            Eigen::Ref<const ouster::img_t<uint32_t>> range,
+                            const FieldView &reflectivity,
+                            const FieldView &near_ir,
+                            const FieldView &signal) {
         auto timestamp = ls.timestamp();
 
         const auto rg = range.data();
-        const auto rf = reflectivity.data();
-        const auto nr = near_ir.data();
-        const auto sg = signal.data();
 
-#ifdef __OUSTER_UTILIZE_OPENMP__
-#pragma omp parallel for collapse(2)
-#endif
         for (auto u = 0; u < ls.h; u++) {
             for (auto v = 0; v < ls.w; v++) {
                 const auto ts = std::min(
                         std::chrono::nanoseconds(timestamp[v]) - scan_ts, scan_ts);
                 const auto idx = u * ls.w + v;
                 const auto xyz = points.row(idx);
-                cloud.points[idx] = ouster_ros::Point{
-                        {static_cast<float>(xyz(0)), static_cast<float>(xyz(1)),
-                         static_cast<float>(xyz(2)), 1.0f},
-                        static_cast<float>(sg[idx]),
-                        static_cast<uint32_t>(ts.count()),
-                        static_cast<uint16_t>(rf[idx]),
-                        static_cast<uint16_t>(u),
-                        static_cast<uint16_t>(nr[idx]),
-                        static_cast<uint32_t>(rg[idx]),
-                };
+                auto &pt = cloud.points[idx];
+                set_point(pt, static_cast<float>(xyz(0)),
+                          static_cast<float>(xyz(1)), static_cast<float>(xyz(2)),
+                          signal.at<uint32_t>(idx),
+                          static_cast<uint32_t>(ts.count()),
+                          reflectivity.at<uint16_t>(idx),
+                          static_cast<uint16_t>(u),
+                          near_ir.at<uint16_t>(idx), rg[idx]);
+                if (destaggeredcloud) {
+                    auto dv = v + (pixel_shift_by_row[u] + ls.w) % ls.w;
+                    if (dv >= ls.w) dv -= ls.w;
+                    destaggeredcloud->points[u * ls.w + dv] = pt;
+                }
             }
         }
     }
 
+    template<typename PointT>
     void scan_to_cloud_f(ouster::PointsF &points,
                          const ouster::PointsF &lut_direction,
                          const ouster::PointsF &lut_offset,
                          ouster::LidarScan::ts_t scan_ts,
-                         const ouster::LidarScan &ls, ouster_ros::Cloud &cloud, ouster_ros::Cloud &destaggeredcloud,
+                         const ouster::LidarScan &ls,
+                         pcl::PointCloud<PointT> &cloud,
+                         pcl::PointCloud<PointT> &destaggeredcloud,
                          int return_index, std::vector<int> &pixel_shift_by_row, bool destagger) {
         bool second = (return_index == 1);
 
@@ -216,33 +214,31 @@ namespace ouster_ros {
         // across supported lidar profiles range is always 32-bit
         auto range_channel_field =
                 second ? sensor::ChanField::RANGE2 : sensor::ChanField::RANGE;
-        ouster::img_t<uint32_t> range = ls.field<uint32_t>(range_channel_field);
-        ouster::img_t<uint16_t> reflectivity = get_or_fill_zero<uint16_t>(
+        Eigen::Ref<const ouster::img_t<uint32_t>> range =
+                ls.field<uint32_t>(range_channel_field);
+        // channels are cast as they are packed rather than copied
+        auto reflectivity = get_field_view(
                 suitable_return(sensor::ChanField::REFLECTIVITY, second), ls);
-
-        ouster::img_t<uint32_t> signal = get_or_fill_zero<uint32_t>(
+        auto signal = get_field_view(
                 suitable_return(sensor::ChanField::SIGNAL, second), ls);
-
-        ouster::img_t<uint16_t> near_ir = get_or_fill_zero<uint16_t>(
+        auto near_ir = get_field_view(
                 suitable_return(sensor::ChanField::NEAR_IR, second), ls);
 
-        if (destagger) {
-            //destagger the range
-            ouster::cartesianT(points, range, lut_direction, lut_offset);
-            copy_scan_to_cloud(cloud, ls, scan_ts, points, range, reflectivity, near_ir,
-                               signal);
-            //destagger the point cloud
-            destaggeredcloud = cloud;
-            destaggeredcloud = clouddestagger(cloud, pixel_shift_by_row);
-
+        ouster::cartesianT(points, range, lut_direction, lut_offset);
 
-        } else {
-            ouster::cartesianT(points, range, lut_direction, lut_offset);
-
-            copy_scan_to_cloud(cloud, ls, scan_ts, points, range, reflectivity, near_ir,
-                               signal);
+        if (destagger) {
+            if (pixel_shift_by_row.size() != static_cast<size_t>(ls.h))
+                throw std::invalid_argument{
+                        "image height does not match shifts size"};
+            if (destaggeredcloud.width != cloud.width ||
+                destaggeredcloud.height != cloud.height)
+                destaggeredcloud = pcl::PointCloud<PointT>(cloud.width,
+                                                           cloud.height);
         }
 
+        copy_scan_to_cloud(cloud, destagger ? &destaggeredcloud : nullptr,
+                           pixel_shift_by_row, ls, scan_ts, points, range,
+                           reflectivity, near_ir, signal);
     }
 
     bool checkofDestagger(ouster_ros::Cloud destaggeredcloud) {
@@ -278,11 +274,13 @@ namespace ouster_ros {
     }
 
 
-    ouster_ros::Cloud clouddestagger(const ouster_ros::Cloud &cloud, const std::vector<int> &pixel_shift_by_row) {
+    template<typename PointT>
+    pcl::PointCloud<PointT> clouddestagger(
+            const pcl::PointCloud<PointT> &cloud,
+            const std::vector<int> &pixel_shift_by_row) {
         //like destagger in lidar_scan_impl
-        const size_t h = cloud.height;
         const size_t w = cloud.width;
-        ouster_ros::Cloud destaggered(cloud.width, cloud.height);
+        pcl::PointCloud<PointT> destaggered(cloud.width, cloud.height);
         if (pixel_shift_by_row.size() != destaggered.height) {
             throw std::invalid_argument{"image height does not match shifts size"};
         }
@@ -292,7 +290,7 @@ namespace ouster_ros {
             const std::ptrdiff_t offset =
                     (pixel_shift_by_row[asd] + destaggered.width) % destaggered.width;
             int i = 0;
-            for (int j = offset; j < w - offset; j++) {
+            for (int j = offset; j < w; j++) {
                 destaggered.at(j, asd) = cloud.at(i, asd);
                 i++;
             }
@@ -305,6 +303,22 @@ namespace ouster_ros {
         return destaggered;
     }
 
+#define INSTANTIATE_SCAN_TO_CLOUD_F(PointT)                                   \
+    template void scan_to_cloud_f<PointT>(                                   \
+            ouster::PointsF &, const ouster::PointsF &,                      \
+            const ouster::PointsF &, ouster::LidarScan::ts_t,                \
+            const ouster::LidarScan &, pcl::PointCloud<PointT> &,            \
+            pcl::PointCloud<PointT> &, int, std::vector<int> &, bool);       \
+    template pcl::PointCloud<PointT> clouddestagger<PointT>(                 \
+            const pcl::PointCloud<PointT> &, const std::vector<int> &);
+
+    INSTANTIATE_SCAN_TO_CLOUD_F(Point)
+    INSTANTIATE_SCAN_TO_CLOUD_F(PointXYZ)
+    INSTANTIATE_SCAN_TO_CLOUD_F(PointXYZI)
+    INSTANTIATE_SCAN_TO_CLOUD_F(PointXYZIRT)
+
+#undef INSTANTIATE_SCAN_TO_CLOUD_F
+
     sensor_msgs::PointCloud2 cloud_to_cloud_msg(const Cloud &cloud,
                                                 const ros::Time &timestamp,
                                                 const std::string &frame) {
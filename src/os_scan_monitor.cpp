@@ -0,0 +1,104 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_scan_monitor.cpp
+ * @brief implementation of the ScanMonitor
+ */
+
+#include "ouster_ros/os_scan_monitor.h"
+
+namespace sensor = ouster::sensor;
+
+namespace ouster_ros {
+
+ScanMonitor::ScanMonitor(const sensor::sensor_info& info, ros::NodeHandle& nh,
+                         const std::string& frame, Policy policy,
+                         double min_completeness,
+                         std::shared_ptr<PipelineStats> stats)
+    : columns_per_packet(info.format.columns_per_packet),
+      policy(policy),
+      min_completeness(min_completeness),
+      stats(std::move(stats)) {
+    // the azimuth window may wrap around the end of the frame
+    const int w = info.format.columns_per_frame;
+    const auto& window = info.format.column_window;
+    expected_columns = (window.second - window.first + w) % w + 1;
+
+    status_pub = nh.advertise<ScanStatusMsg>("scan_status", 10);
+    status_msg.header.frame_id = frame;
+
+    if (this->stats) {
+        missing_packet_count = &this->stats->counter("missing_packets", true);
+        skipped_frame_count = &this->stats->counter("skipped_frames", true);
+        incomplete_scan_count = &this->stats->counter("incomplete_scans");
+        dropped_scan_count = &this->stats->counter("dropped_incomplete_scans");
+    }
+}
+
+ScanMonitor::Policy ScanMonitor::operator()(const ouster::LidarScan& ls,
+                                            const ros::Time& msg_ts) {
+    // columns of dropped packets are left with a zero status by the
+    // batcher, the lowest status bit flags valid columns of every profile
+    const uint32_t valid_columns =
+        ls.status().unaryExpr([](uint32_t s) { return s & 0x01u; }).sum();
+    const uint32_t missing_columns =
+        expected_columns > valid_columns ? expected_columns - valid_columns
+                                         : 0;
+    const uint32_t missing_packets =
+        (missing_columns + columns_per_packet - 1) / columns_per_packet;
+
+    // frame ids are 16 bit and wrap around, a frame id going backwards
+    // (sensor restart, replay loop) restarts the tracking
+    uint32_t skipped_frames = 0;
+    const uint16_t frame_id = static_cast<uint16_t>(ls.frame_id);
+    if (last_frame_id >= 0) {
+        const uint16_t gap = frame_id - static_cast<uint16_t>(last_frame_id);
+        if (gap > 0 && gap < 0x8000) skipped_frames = gap - 1;
+    }
+    last_frame_id = frame_id;
+
+    const float completeness =
+        static_cast<float>(valid_columns) / expected_columns;
+    const bool incomplete = completeness < min_completeness;
+
+    if (stats) {
+        missing_packet_count->add(missing_packets);
+        skipped_frame_count->add(skipped_frames);
+        if (incomplete) incomplete_scan_count->add();
+        if (incomplete && policy == Policy::DROP) dropped_scan_count->add();
+    }
+
+    if (status_pub.getNumSubscribers() > 0) {
+        status_msg.header.stamp = msg_ts;
+        status_msg.frame_id = frame_id;
+        status_msg.expected_columns = expected_columns;
+        status_msg.valid_columns = valid_columns;
+        status_msg.missing_packets = missing_packets;
+        status_msg.skipped_frames = skipped_frames;
+        status_msg.completeness = completeness;
+        status_msg.incomplete = incomplete;
+        status_pub.publish(status_msg);
+    }
+
+    if (incomplete)
+        ROS_WARN_THROTTLE(1, "ScanMonitor: frame %u is %.1f%% complete",
+                          frame_id, 100.0 * completeness);
+
+    return incomplete ? policy : Policy::PUBLISH;
+}
+
+bool frame_policy_of_string(const std::string& policy_arg,
+                            ScanMonitor::Policy& policy) {
+    if (policy_arg == "publish")
+        policy = ScanMonitor::Policy::PUBLISH;
+    else if (policy_arg == "mark")
+        policy = ScanMonitor::Policy::MARK;
+    else if (policy_arg == "drop")
+        policy = ScanMonitor::Policy::DROP;
+    else
+        return false;
+    return true;
+}
+
+}  // namespace ouster_ros
@@ -0,0 +1,206 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_scan_pipeline.cpp
+ * @brief implementation of the ScanPipeline
+ */
+
+#include "ouster_ros/os_scan_pipeline.h"
+
+#include <algorithm>
+#include <exception>
+
+#include "ouster_ros/os_thread_utils.h"
+
+namespace sensor = ouster::sensor;
+
+namespace ouster_ros {
+
+bool ScanPipeline::IndexQueue::push(size_t index) {
+    const size_t t = tail.load(std::memory_order_relaxed);
+    const size_t next = (t + 1) % ring.size();
+    if (next == head.load(std::memory_order_acquire)) return false;
+    ring[t] = index;
+    tail.store(next, std::memory_order_release);
+    return true;
+}
+
+bool ScanPipeline::IndexQueue::pop(size_t& index) {
+    const size_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire)) return false;
+    index = ring[h];
+    head.store((h + 1) % ring.size(), std::memory_order_release);
+    return true;
+}
+
+bool ScanPipeline::IndexQueue::empty() const {
+    return head.load(std::memory_order_acquire) ==
+           tail.load(std::memory_order_acquire);
+}
+
+size_t ScanPipeline::IndexQueue::size() const {
+    const size_t h = head.load(std::memory_order_acquire);
+    const size_t t = tail.load(std::memory_order_acquire);
+    return (t + ring.size() - h) % ring.size();
+}
+
+ScanPipeline::ScanPipeline(const sensor::sensor_info& info, size_t n_buffers,
+                           ScanCallback on_scan, int cpu,
+                           std::shared_ptr<PipelineStats> stats)
+    : ready(std::max<size_t>(n_buffers, 2)),
+      free(std::max<size_t>(n_buffers, 2)),
+      stats(std::move(stats)),
+      on_scan(std::move(on_scan)) {
+    init(info, n_buffers);
+
+    worker = std::thread([this] { worker_loop(); });
+    // pinning is best effort, an unavailable cpu leaves the thread free
+    if (cpu >= 0 && !set_thread_cpu_affinity(worker, {cpu}))
+        ROS_WARN_STREAM("ScanPipeline: failed to pin the worker to cpu "
+                        << cpu);
+}
+
+ScanPipeline::ScanPipeline(const sensor::sensor_info& info, size_t n_buffers,
+                           ScanCallback on_scan,
+                           std::shared_ptr<WorkStealingPool> pool,
+                           std::shared_ptr<PipelineStats> stats)
+    : ready(std::max<size_t>(n_buffers, 2)),
+      free(std::max<size_t>(n_buffers, 2)),
+      stats(std::move(stats)),
+      on_scan(std::move(on_scan)),
+      pool(std::move(pool)) {
+    init(info, n_buffers);
+    // the buffers were just touched by the calling thread, a worker of the
+    // pool keeps them local to its caches and node
+    const int self = this->pool->worker_index();
+    home_worker =
+        self >= 0 ? static_cast<size_t>(self) : this->pool->assign_worker();
+}
+
+void ScanPipeline::init(const sensor::sensor_info& info, size_t n_buffers) {
+    if (stats) {
+        queue_wait_time = &stats->histogram("scan_queue_wait");
+        conversion_time = &stats->histogram("scan_conversion");
+        scan_latency = &stats->histogram("scan_latency");
+        dropped_count = &stats->counter("dropped_scans", true);
+        stats->gauge(
+            "scan_queue_depth",
+            [this] { return static_cast<double>(ready.size()); }, this);
+    }
+
+    n_buffers = std::max<size_t>(n_buffers, 2);
+    slots.reserve(n_buffers);
+    for (size_t i = 0; i < n_buffers; ++i)
+        slots.push_back(Slot{
+            ouster::LidarScan(info.format.columns_per_frame,
+                              info.format.pixels_per_column,
+                              info.format.udp_profile_lidar),
+            std::chrono::nanoseconds{0}, ros::Time(), {}, {}});
+    for (size_t i = 1; i < n_buffers; ++i) free.push(i);
+}
+
+ScanPipeline::~ScanPipeline() {
+    if (stats) stats->remove_gauge("scan_queue_depth", this);
+    active = false;
+    if (pool) {
+        // a running drain task stops after its current scan
+        std::unique_lock<std::mutex> lock(wake_mutex);
+        wake_cv.wait(lock, [this] { return !draining && !scheduled; });
+        return;
+    }
+    {
+        // orders the notification after the predicate check of the worker
+        std::lock_guard<std::mutex> lock(wake_mutex);
+    }
+    wake_cv.notify_one();
+    if (worker.joinable()) worker.join();
+}
+
+bool ScanPipeline::push(std::chrono::nanoseconds scan_ts,
+                        const ros::Time& msg_ts,
+                        StageTimer::clock::time_point received_at) {
+    size_t next;
+    if (!free.pop(next)) {
+        ++dropped_scans;
+        if (stats) dropped_count->add();
+        return false;
+    }
+
+    auto& slot = slots[current];
+    slot.scan_ts = scan_ts;
+    slot.msg_ts = msg_ts;
+    if (stats) {
+        slot.received_at = received_at;
+        slot.pushed_at = StageTimer::clock::now();
+    }
+    // can't fail, the queue holds as many indices as there are buffers
+    ready.push(current);
+    current = next;
+
+    if (pool) {
+        if (!scheduled.exchange(true))
+            pool->post(home_worker, [this] { drain(); });
+        return true;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+    }
+    wake_cv.notify_one();
+    return true;
+}
+
+void ScanPipeline::worker_loop() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(wake_mutex);
+            wake_cv.wait(lock, [this] { return !active || !ready.empty(); });
+        }
+        if (!active) return;
+
+        size_t index;
+        while (ready.pop(index)) convert(index);
+    }
+}
+
+void ScanPipeline::convert(size_t index) {
+    const auto& slot = slots[index];
+    const auto start =
+        stats ? StageTimer::clock::now() : StageTimer::clock::time_point{};
+    try {
+        on_scan(slot.ls, slot.scan_ts, slot.msg_ts);
+    } catch (const std::exception& e) {
+        ROS_ERROR_STREAM_THROTTLE(
+            1, "ScanPipeline: failed to convert scan: " << e.what());
+    }
+    if (stats) {
+        const auto end = StageTimer::clock::now();
+        queue_wait_time->record(start - slot.pushed_at);
+        conversion_time->record(end - start);
+        scan_latency->record(end - slot.received_at);
+    }
+    free.push(index);
+}
+
+void ScanPipeline::drain() {
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        draining = true;
+    }
+
+    while (true) {
+        size_t index;
+        while (active && ready.pop(index)) convert(index);
+        scheduled = false;
+        // a scan pushed after the last pop found the task still scheduled
+        // and didn't post another one
+        if (!active || ready.empty() || scheduled.exchange(true)) break;
+    }
+
+    std::lock_guard<std::mutex> lock(wake_mutex);
+    draining = false;
+    wake_cv.notify_all();
+}
+
+}  // namespace ouster_ros
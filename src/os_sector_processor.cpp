@@ -0,0 +1,95 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_sector_processor.cpp
+ * @brief implementation of the SectorProcessor
+ */
+
+#include "ouster_ros/os_sector_processor.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "ouster_ros/os_point_cloud_processor.h"
+
+using ouster::sensor::ChanField;
+
+namespace ouster_ros {
+
+SectorProcessor::SectorProcessor(
+    const sensor::sensor_info& info, ros::NodeHandle& nh,
+    const std::string& sensor_frame,
+    std::shared_ptr<const PointCloudSerializer> serializer,
+    uint32_t sector_columns)
+    : n_returns(get_n_returns(info)),
+      sensor_frame(sensor_frame),
+      serializer(std::move(serializer)) {
+    for (int i = 0; i < n_returns; i++) {
+        sector_pubs.push_back(nh.advertise<sensor_msgs::PointCloud2>(
+            std::string("sector_points") + topic_suffix(i), 10));
+    }
+
+    // sectors are published at a high rate, keep a few messages per topic
+    // for the ones still held by subscribers
+    sector_pool = std::make_unique<MessagePool<sensor_msgs::PointCloud2>>(
+        4 * n_returns, [this, sector_columns](sensor_msgs::PointCloud2& msg) {
+            this->serializer->layout_sector(msg, sector_columns);
+        });
+}
+
+void SectorProcessor::operator()(const ouster::LidarScan& ls,
+                                 uint32_t col_begin, uint32_t col_end,
+                                 std::chrono::nanoseconds sector_ts,
+                                 const ros::Time& msg_ts) {
+    const uint32_t columns = col_end - col_begin;
+    for (int i = 0; i < n_returns; ++i) {
+        if (sector_pubs[i].getNumSubscribers() == 0) continue;
+
+        bool second = (i == 1);
+        auto msg = sector_pool->acquire();
+        // the last sector of a frame may be narrower, the data buffer keeps
+        // its capacity across sizes
+        if (msg->width != columns) serializer->layout_sector(*msg, columns);
+
+        // across supported lidar profiles range is always 32-bit
+        Eigen::Ref<const ouster::img_t<uint32_t>> range =
+            ls.field<uint32_t>(second ? ChanField::RANGE2 : ChanField::RANGE);
+        serializer->serialize_sector(
+            *msg, ls, sector_ts, range,
+            get_field_view(suitable_return(ChanField::REFLECTIVITY, second),
+                           ls),
+            get_field_view(suitable_return(ChanField::NEAR_IR, second), ls),
+            get_field_view(suitable_return(ChanField::SIGNAL, second), ls),
+            col_begin, col_end);
+
+        msg->header.stamp = msg_ts;
+        msg->header.frame_id = sensor_frame;
+        sector_pubs[i].publish(msg);
+    }
+}
+
+bool sector_columns_of_params(const sensor::sensor_info& info,
+                              const std::string& mode, int size, double angle,
+                              uint32_t& columns) {
+    const int columns_per_frame = info.format.columns_per_frame;
+    const int columns_per_packet = info.format.columns_per_packet;
+
+    int n;
+    if (mode == "columns")
+        n = size;
+    else if (mode == "packets")
+        n = size * columns_per_packet;
+    else if (mode == "angle")
+        n = static_cast<int>(std::ceil(columns_per_frame * angle / 360.0));
+    else
+        return false;
+    if (n <= 0) return false;
+
+    // sectors complete with the packet holding their last column
+    n = (n + columns_per_packet - 1) / columns_per_packet * columns_per_packet;
+    columns = static_cast<uint32_t>(std::min(n, columns_per_frame));
+    return true;
+}
+
+}  // namespace ouster_ros
@@ -12,386 +12,801 @@
 #include "ouster_ros/os_ros.h"
 // clang-format on
 
+#include "ouster_ros/os_sensor_nodelet.h"
+
+#include <arpa/inet.h>
+#include <netdb.h>
 #include <pluginlib/class_list_macros.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 #include <fstream>
 #include <string>
 #include <tuple>
 
 #include "ouster_ros/GetConfig.h"
-#include "ouster_ros/PacketMsg.h"
 #include "ouster_ros/SetConfig.h"
-#include "ouster_ros/os_client_base_nodelet.h"
+#include "ouster_ros/os_thread_utils.h"
+#include "ouster_ros/os_transport.h"
 
 namespace sensor = ouster::sensor;
 using nonstd::optional;
 using ouster_ros::GetConfig;
+using ouster_ros::PacketBatchMsg;
 using ouster_ros::PacketMsg;
 using ouster_ros::SetConfig;
 
 namespace nodelets_os {
 
-class OusterSensor : public OusterClientBase {
-   private:
-    virtual void onInit() override {
-        auto& pnh = getPrivateNodeHandle();
-        sensor_hostname = get_sensor_hostname(pnh);
-        sensor::sensor_config config;
-        u_int8_t flags;
-        std::tie(config, flags) = create_sensor_config_rosparams(pnh);
-        configure_sensor(sensor_hostname, config, flags);
-        sensor_client = create_sensor_client(sensor_hostname, config);
-        update_config_and_metadata(*sensor_client);
-        save_metadata(pnh);
-        OusterClientBase::onInit();
-        create_get_config_service();
-        create_set_config_service();
-        start_connection_loop();
-    }
-
-    std::string get_sensor_hostname(ros::NodeHandle& nh) {
-        auto hostname = nh.param("sensor_hostname", std::string{});
-        if (!is_arg_set(hostname)) {
-            auto error_msg = "Must specify a sensor hostname";
-            NODELET_ERROR_STREAM(error_msg);
-            throw std::runtime_error(error_msg);
-        }
+namespace {
+
+// the address of the interface the traffic to a host leaves through, which
+// is what the sensor picks as its automatic udp destination
+std::string local_address_towards(const std::string& hostname) {
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo* addresses = nullptr;
+    if (getaddrinfo(hostname.c_str(), "7501", &hints, &addresses) != 0)
+        return {};
+
+    std::string local;
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in address{};
+    socklen_t size = sizeof(address);
+    // connecting a udp socket sends nothing, it only picks the route
+    if (fd >= 0 &&
+        connect(fd, addresses->ai_addr, addresses->ai_addrlen) == 0 &&
+        getsockname(fd, reinterpret_cast<sockaddr*>(&address), &size) == 0) {
+        char buf[INET_ADDRSTRLEN];
+        if (inet_ntop(AF_INET, &address.sin_addr, buf, sizeof(buf)))
+            local = buf;
+    }
+    if (fd >= 0) close(fd);
+    freeaddrinfo(addresses);
+    return local;
+}
+
+}  // namespace
+
+OusterSensor::~OusterSensor() {
+    metadata_check_cancelled = true;
+    if (metadata_check.joinable()) metadata_check.join();
+    metadata_update_timer.stop();
+    stop_receive_thread();
+    if (stats) stats->remove_gauge("lidar_packets_in_flight");
+}
+
+void OusterSensor::create_stats(ros::NodeHandle& nh) {
+    auto period = nh.param("diagnostics_period", 0.0);
+    if (period <= 0.0) return;
+
+    stats = std::make_shared<ouster_ros::PipelineStats>();
+    lidar_packet_count = &stats->counter("lidar_packets");
+    imu_packet_count = &stats->counter("imu_packets");
+    lidar_read_failures = &stats->counter("lidar_packet_read_failures", true);
+    imu_read_failures = &stats->counter("imu_packet_read_failures", true);
+    poll_errors = &stats->counter("poll_errors", true);
+    stats_publisher = std::make_unique<ouster_ros::StatsPublisher>(
+        getNodeHandle(), getName(), info.sn, stats, period);
+
+    NODELET_INFO("Publishing pipeline diagnostics every %.2f s", period);
+}
+
+void OusterSensor::create_packet_logger(ros::NodeHandle& nh) {
+    auto packet_log = nh.param("packet_log", std::string{});
+    if (!is_arg_set(packet_log)) return;
+
+    auto segment_size = nh.param("packet_log_segment_size", 1024);
+    if (segment_size < 1) {
+        auto error_msg = "packet_log_segment_size must be a positive number";
+        NODELET_ERROR_STREAM(error_msg);
+        throw std::runtime_error(error_msg);
+    }
 
-        return hostname;
+    try {
+        packet_logger = std::make_unique<ouster_ros::PacketLogger>(
+            packet_log, static_cast<size_t>(segment_size) << 20,
+            info.udp_port_lidar, info.udp_port_imu, stats);
+    } catch (const std::runtime_error& e) {
+        NODELET_ERROR_STREAM(e.what());
+        throw;
     }
 
-    bool update_config_and_metadata(sensor::client& cli) {
-        sensor::sensor_config config;
-        auto success = get_config(sensor_hostname, config);
-        if (!success) {
-            NODELET_ERROR("Failed to collect sensor config");
-            cached_config.clear();
-            cached_metadata.clear();
-            return false;
-        }
+    NODELET_INFO("Logging packets to %s_*.pcap, segments of %d MiB",
+                 packet_log.c_str(), segment_size);
+}
 
-        cached_config = to_string(config);
+void OusterSensor::create_metadata_cache(ros::NodeHandle& nh) {
+    auto dir = nh.param("metadata_cache", std::string{});
+    if (!is_arg_set(dir)) return;
 
-        try {
-            cached_metadata = sensor::get_metadata(cli);
-        } catch (const std::exception& e) {
-            NODELET_ERROR_STREAM(
-                "sensor::get_metadata exception: " << e.what());
-            cached_metadata.clear();
-        }
+    try {
+        metadata_cache = std::make_unique<ouster_ros::MetadataCache>(dir);
+    } catch (const std::runtime_error& e) {
+        NODELET_ERROR_STREAM(e.what());
+        throw;
+    }
 
-        if (cached_metadata.empty()) {
-            NODELET_ERROR("Failed to collect sensor metadata");
-            return false;
-        }
+    NODELET_INFO("Caching the sensor metadata in %s", dir.c_str());
+}
+
+void OusterSensor::onInit() {
+    auto& pnh = getPrivateNodeHandle();
+    sensor_hostname = get_sensor_hostname(pnh);
+    sensor::sensor_config config;
+    u_int8_t flags;
+    std::tie(config, flags) = create_sensor_config_rosparams(pnh);
+    create_metadata_cache(pnh);
+    const bool reconfigure = !pnh.param("skip_unchanged_config", false) ||
+                             !sensor_config_applied(config, flags);
+    if (reconfigure) configure_sensor(sensor_hostname, config, flags);
+    sensor_client = create_sensor_client(sensor_hostname, config);
+    // a reconfigured sensor may report different metadata
+    const bool cached = !reconfigure && load_cached_metadata();
+    if (!cached) update_config_and_metadata(*sensor_client);
+    save_metadata(pnh);
+    OusterClientBase::onInit();
+    create_get_config_service();
+    create_set_config_service();
+    create_stats(pnh);
+    create_packet_logger(pnh);
+    on_metadata_updated(info);
+    start_connection_loop();
+    // a sensor replaced or updated under the same config reports other
+    // metadata, which is checked behind the startup
+    if (cached) start_metadata_check();
+}
+
+void OusterSensor::on_metadata_updated(const sensor::sensor_info&) {}
+
+std::string OusterSensor::get_sensor_hostname(ros::NodeHandle& nh) {
+    auto hostname = nh.param("sensor_hostname", std::string{});
+    if (!is_arg_set(hostname)) {
+        auto error_msg = "Must specify a sensor hostname";
+        NODELET_ERROR_STREAM(error_msg);
+        throw std::runtime_error(error_msg);
+    }
 
-        info = sensor::parse_metadata(cached_metadata);
-        // TODO: revist when *min_version* is changed
-        populate_metadata_defaults(info, sensor::MODE_UNSPEC);
-        display_lidar_info(info);
+    return hostname;
+}
+
+bool OusterSensor::update_config_and_metadata(sensor::client& cli) {
+    sensor::sensor_config config;
+    auto success = get_config(sensor_hostname, config);
+    if (!success) {
+        NODELET_ERROR("Failed to collect sensor config");
+        cached_config.clear();
+        cached_metadata.clear();
+        return false;
+    }
 
-        return cached_config.size() > 0 && cached_metadata.size() > 0;
+    cached_config = to_string(config);
+
+    try {
+        cached_metadata = sensor::get_metadata(cli);
+    } catch (const std::exception& e) {
+        NODELET_ERROR_STREAM(
+            "sensor::get_metadata exception: " << e.what());
+        cached_metadata.clear();
     }
 
-    void save_metadata(ros::NodeHandle& nh) {
-        auto meta_file = nh.param("metadata", std::string{});
-        if (!is_arg_set(meta_file)) {
-            meta_file = sensor_hostname.substr(0, sensor_hostname.rfind('.')) +
-                        "-metadata.json";
-            NODELET_INFO_STREAM(
-                "No metadata file was specified, using: " << meta_file);
-        }
+    if (cached_metadata.empty()) {
+        NODELET_ERROR("Failed to collect sensor metadata");
+        return false;
+    }
 
-        // write metadata file. If metadata_path is relative, will use cwd
-        // (usually ~/.ros)
-        if (!write_metadata(meta_file, cached_metadata)) {
-            NODELET_ERROR("Exiting because of failure to write metadata path");
-            throw std::runtime_error("Failure to write metadata path");
-        }
+    auto metadata = ouster_ros::make_sensor_metadata(cached_metadata);
+    use_metadata(metadata);
+    if (metadata_cache &&
+        !metadata_cache->store(sensor_hostname, cached_config, *metadata))
+        NODELET_WARN("Failed to store the sensor metadata in the cache");
+
+    return cached_config.size() > 0 && cached_metadata.size() > 0;
+}
+
+void OusterSensor::use_metadata(
+    std::shared_ptr<const ouster_ros::SensorMetadata> metadata) {
+    cached_metadata = metadata->json();
+    info = metadata->info();
+    // TODO: revist when *min_version* is changed
+    populate_metadata_defaults(info, sensor::MODE_UNSPEC);
+    display_lidar_info(info);
+    // the nodelets of the process skip the service call and the parsing
+    ouster_ros::share_sensor_metadata(
+        getNodeHandle().resolveName("get_metadata"), std::move(metadata));
+}
+
+bool OusterSensor::sensor_config_applied(const sensor::sensor_config& config,
+                                         uint8_t config_flags) {
+    // without fixed ports the client assigns random ones, which reconfigures
+    // the sensor anyway
+    if (!config.udp_port_lidar || !config.udp_port_imu) return false;
+
+    sensor::sensor_config active;
+    if (!get_config(sensor_hostname, active)) return false;
+    cached_config = to_string(active);
+
+    auto udp_dest = config.udp_dest;
+    if (config_flags & sensor::CONFIG_UDP_DEST_AUTO)
+        udp_dest = local_address_towards(sensor_hostname);
+
+    // only the values set by the parameters are compared
+    auto matches = [](const auto& requested, const auto& current) {
+        return !requested || requested == current;
+    };
+    const bool applied =
+        udp_dest && !udp_dest->empty() && matches(udp_dest, active.udp_dest) &&
+        matches(config.udp_port_lidar, active.udp_port_lidar) &&
+        matches(config.udp_port_imu, active.udp_port_imu) &&
+        matches(config.ts_mode, active.ts_mode) &&
+        matches(config.ld_mode, active.ld_mode) &&
+        matches(config.operating_mode, active.operating_mode) &&
+        matches(config.udp_profile_lidar, active.udp_profile_lidar);
+    if (applied)
+        NODELET_INFO_STREAM("Sensor " << sensor_hostname
+                                      << " is configured already");
+    return applied;
+}
+
+bool OusterSensor::load_cached_metadata() {
+    if (!metadata_cache) return false;
+
+    auto metadata = metadata_cache->load(sensor_hostname, cached_config);
+    if (!metadata) {
+        NODELET_INFO("No cached metadata matches the sensor config");
+        return false;
     }
 
-    void create_get_config_service() {
-        auto& nh = getNodeHandle();
-        get_config_srv =
-            nh.advertiseService<GetConfig::Request, GetConfig::Response>(
-                "get_config",
-                [this](GetConfig::Request&, GetConfig::Response& response) {
-                    response.config = cached_config;
-                    return cached_config.size() > 0;
-                });
-
-        NODELET_INFO("get_config service created");
-    }
-
-    void create_set_config_service() {
-        auto& nh = getNodeHandle();
-        set_config_srv =
-            nh.advertiseService<SetConfig::Request, SetConfig::Response>(
-                "set_config", [this](SetConfig::Request& request,
-                                     SetConfig::Response& response) {
-                    sensor::sensor_config config;
-                    response.config = "";
-                    auto success =
-                        load_config_file(request.config_file, config);
-                    if (!success) {
-                        NODELET_ERROR_STREAM("Failed to load and parse file: "
-                                             << request.config_file);
-                        return false;
-                    }
-
-                    try {
-                        configure_sensor(sensor_hostname, config, 0);
-                    } catch (const std::exception& e) {
-                        return false;
-                    }
-                    success = update_config_and_metadata(*sensor_client);
-                    response.config = cached_config;
-                    return success;
-                });
-
-        NODELET_INFO("set_config service created");
-    }
-
-    std::shared_ptr<sensor::client> create_sensor_client(
-        const std::string& hostname, const sensor::sensor_config& config) {
-        NODELET_INFO_STREAM("Starting sensor " << hostname
-                                               << " initialization...");
-
-        int lidar_port =
-            config.udp_port_lidar ? config.udp_port_lidar.value() : 0;
-        int imu_port = config.udp_port_imu ? config.udp_port_imu.value() : 0;
-
-        std::shared_ptr<sensor::client> cli;
-        if (lidar_port != 0 && imu_port != 0) {
-            // use no-config version of init_client to bind to pre-configured
-            // ports
-            cli = sensor::init_client(hostname, lidar_port, imu_port);
-        } else {
-            // use the full init_client to generate and assign random ports to
-            // sensor
-            auto udp_dest = config.udp_dest ? config.udp_dest.value() : "";
-            cli = sensor::init_client(hostname, udp_dest, sensor::MODE_UNSPEC,
-                                      sensor::TIME_FROM_UNSPEC, lidar_port,
-                                      imu_port);
+    NODELET_INFO("Using the cached metadata of the sensor");
+    use_metadata(metadata);
+    return true;
+}
+
+void OusterSensor::start_metadata_check() {
+    auto cached = ouster_ros::make_sensor_metadata(cached_metadata);
+    metadata_check = std::thread([this, cached, config = cached_config] {
+        check_cached_metadata(*cached, config);
+    });
+}
+
+void OusterSensor::check_cached_metadata(
+    const ouster_ros::SensorMetadata& cached, const std::string& config) {
+    std::shared_ptr<const ouster_ros::SensorMetadata> current;
+    try {
+        // the client only serves the metadata request, which is retried
+        // with a short timeout so that the nodelet can be unloaded meanwhile
+        auto cli = sensor::init_client(sensor_hostname, 0, 0);
+        std::string metadata;
+        for (int attempt = 0; cli && metadata.empty() && attempt < 10 &&
+                              !metadata_check_cancelled;
+             ++attempt) {
+            try {
+                metadata = sensor::get_metadata(*cli, 1);
+            } catch (const std::runtime_error&) {
+                // timed out, the sensor may still be initializing
+            }
         }
+        if (!metadata.empty())
+            current = ouster_ros::make_sensor_metadata(metadata);
+    } catch (const std::exception& e) {
+        NODELET_WARN_STREAM("sensor::get_metadata exception: " << e.what());
+    }
 
-        if (!cli) {
-            auto error_msg = "Failed to initialize client";
-            NODELET_ERROR_STREAM(error_msg);
-            throw std::runtime_error(error_msg);
-        }
+    if (metadata_check_cancelled) return;
+    if (!current) {
+        NODELET_WARN("Failed to check the cached metadata against the sensor");
+        return;
+    }
+    if (current->info() == cached.info()) return;
+
+    if (!metadata_cache->store(sensor_hostname, config, *current))
+        NODELET_WARN("Failed to store the sensor metadata in the cache");
+    NODELET_WARN(
+        "The sensor metadata changed since it was cached, switching to the "
+        "current metadata");
+    // swapped on the callback queue, which the packet reception and the
+    // services run on as well
+    metadata_update_timer = getNodeHandle().createTimer(
+        ros::Duration(0),
+        [this, current](const ros::TimerEvent&) {
+            // stop_reception() waits for a timer_callback in flight and keeps
+            // the reception timer from re-arming, so no packet is read into
+            // the pools and processing replaced here until start_reception()
+            stop_reception();
+            use_metadata(current);
+            rebuild_processing();
+            publish_metadata();
+            start_reception();
+        },
+        true);
+}
+
+void OusterSensor::save_metadata(ros::NodeHandle& nh) {
+    auto meta_file = nh.param("metadata", std::string{});
+    if (!is_arg_set(meta_file)) {
+        meta_file = sensor_hostname.substr(0, sensor_hostname.rfind('.')) +
+                    "-metadata.json";
+        NODELET_INFO_STREAM(
+            "No metadata file was specified, using: " << meta_file);
+    }
+
+    // write metadata file. If metadata_path is relative, will use cwd
+    // (usually ~/.ros)
+    if (!write_metadata(meta_file, cached_metadata)) {
+        NODELET_ERROR("Exiting because of failure to write metadata path");
+        throw std::runtime_error("Failure to write metadata path");
+    }
+}
+
+void OusterSensor::create_get_config_service() {
+    auto& nh = getNodeHandle();
+    get_config_srv =
+        nh.advertiseService<GetConfig::Request, GetConfig::Response>(
+            "get_config",
+            [this](GetConfig::Request&, GetConfig::Response& response) {
+                response.config = cached_config;
+                return cached_config.size() > 0;
+            });
+
+    NODELET_INFO("get_config service created");
+}
+
+void OusterSensor::create_set_config_service() {
+    auto& nh = getNodeHandle();
+    set_config_srv =
+        nh.advertiseService<SetConfig::Request, SetConfig::Response>(
+            "set_config", [this](SetConfig::Request& request,
+                                 SetConfig::Response& response) {
+                sensor::sensor_config config;
+                response.config = "";
+                auto success =
+                    load_config_file(request.config_file, config);
+                if (!success) {
+                    NODELET_ERROR_STREAM("Failed to load and parse file: "
+                                         << request.config_file);
+                    return false;
+                }
 
-        return cli;
+                // no packet is read while the metadata and everything sized
+                // after it are replaced
+                stop_reception();
+                try {
+                    configure_sensor(sensor_hostname, config, 0);
+                } catch (const std::exception& e) {
+                    start_reception();
+                    return false;
+                }
+                success = update_config_and_metadata(*sensor_client);
+                response.config = cached_config;
+                if (success) {
+                    rebuild_processing();
+                    // the consumers rebuild their processing in the
+                    // background
+                    publish_metadata();
+                }
+                start_reception();
+                return success;
+            });
+
+    NODELET_INFO("set_config service created");
+}
+
+std::shared_ptr<sensor::client> OusterSensor::create_sensor_client(
+    const std::string& hostname, const sensor::sensor_config& config) {
+    NODELET_INFO_STREAM("Starting sensor " << hostname
+                                           << " initialization...");
+
+    int lidar_port =
+        config.udp_port_lidar ? config.udp_port_lidar.value() : 0;
+    int imu_port = config.udp_port_imu ? config.udp_port_imu.value() : 0;
+
+    std::shared_ptr<sensor::client> cli;
+    if (lidar_port != 0 && imu_port != 0) {
+        // use no-config version of init_client to bind to pre-configured
+        // ports
+        cli = sensor::init_client(hostname, lidar_port, imu_port);
+    } else {
+        // use the full init_client to generate and assign random ports to
+        // sensor
+        auto udp_dest = config.udp_dest ? config.udp_dest.value() : "";
+        cli = sensor::init_client(hostname, udp_dest, sensor::MODE_UNSPEC,
+                                  sensor::TIME_FROM_UNSPEC, lidar_port,
+                                  imu_port);
     }
 
-    std::pair<sensor::sensor_config, u_int8_t> create_sensor_config_rosparams(
-        ros::NodeHandle& nh) {
-        auto udp_dest = nh.param("udp_dest", std::string{});
-        auto lidar_port = nh.param("lidar_port", 0);
-        auto imu_port = nh.param("imu_port", 0);
-        auto lidar_mode_arg = nh.param("lidar_mode", std::string{});
-        auto timestamp_mode_arg = nh.param("timestamp_mode", std::string{});
-        auto udp_profile_lidar_arg =
-            nh.param("udp_profile_lidar", std::string{});
+    if (!cli) {
+        auto error_msg = "Failed to initialize client";
+        NODELET_ERROR_STREAM(error_msg);
+        throw std::runtime_error(error_msg);
+    }
+
+    return cli;
+}
+
+std::pair<sensor::sensor_config, u_int8_t>
+OusterSensor::create_sensor_config_rosparams(ros::NodeHandle& nh) {
+    auto udp_dest = nh.param("udp_dest", std::string{});
+    auto lidar_port = nh.param("lidar_port", 0);
+    auto imu_port = nh.param("imu_port", 0);
+    auto lidar_mode_arg = nh.param("lidar_mode", std::string{});
+    auto timestamp_mode_arg = nh.param("timestamp_mode", std::string{});
+    auto udp_profile_lidar_arg =
+        nh.param("udp_profile_lidar", std::string{});
+
+    if (lidar_port < 0 || lidar_port > 65535) {
+        auto error_msg =
+            "Invalid lidar port number! port value should be in the range "
+            "[0, 65535].";
+        NODELET_ERROR_STREAM(error_msg);
+        throw std::runtime_error(error_msg);
+    }
+
+    if (imu_port < 0 || imu_port > 65535) {
+        auto error_msg =
+            "Invalid imu port number! port value should be in the range "
+            "[0, 65535].";
+        NODELET_ERROR_STREAM(error_msg);
+        throw std::runtime_error(error_msg);
+    }
 
-        if (lidar_port < 0 || lidar_port > 65535) {
+    optional<sensor::UDPProfileLidar> udp_profile_lidar;
+    if (is_arg_set(udp_profile_lidar_arg)) {
+        // set lidar profile from param
+        udp_profile_lidar =
+            sensor::udp_profile_lidar_of_string(udp_profile_lidar_arg);
+        if (!udp_profile_lidar) {
             auto error_msg =
-                "Invalid lidar port number! port value should be in the range "
-                "[0, 65535].";
+                "Invalid udp profile lidar: " + udp_profile_lidar_arg;
             NODELET_ERROR_STREAM(error_msg);
             throw std::runtime_error(error_msg);
         }
+    }
 
-        if (imu_port < 0 || imu_port > 65535) {
-            auto error_msg =
-                "Invalid imu port number! port value should be in the range "
-                "[0, 65535].";
+    // set lidar mode from param
+    sensor::lidar_mode lidar_mode = sensor::MODE_UNSPEC;
+    if (is_arg_set(lidar_mode_arg)) {
+        lidar_mode = sensor::lidar_mode_of_string(lidar_mode_arg);
+        if (!lidar_mode) {
+            auto error_msg = "Invalid lidar mode: " + lidar_mode_arg;
             NODELET_ERROR_STREAM(error_msg);
             throw std::runtime_error(error_msg);
         }
+    }
 
-        optional<sensor::UDPProfileLidar> udp_profile_lidar;
-        if (is_arg_set(udp_profile_lidar_arg)) {
-            // set lidar profile from param
-            udp_profile_lidar =
-                sensor::udp_profile_lidar_of_string(udp_profile_lidar_arg);
-            if (!udp_profile_lidar) {
+    // set timestamp mode from param
+    sensor::timestamp_mode timestamp_mode = sensor::TIME_FROM_UNSPEC;
+    if (is_arg_set(timestamp_mode_arg)) {
+        // In case the option TIME_FROM_ROS_TIME is set then leave the
+        // sensor timestamp_mode unmodified
+        if (timestamp_mode_arg == "TIME_FROM_ROS_TIME") {
+            NODELET_INFO(
+                "TIME_FROM_ROS_TIME timestamp mode specified."
+                " IMU and pointcloud messages will use ros time");
+        } else {
+            timestamp_mode =
+                sensor::timestamp_mode_of_string(timestamp_mode_arg);
+            if (!timestamp_mode) {
                 auto error_msg =
-                    "Invalid udp profile lidar: " + udp_profile_lidar_arg;
+                    "Invalid timestamp mode: " + timestamp_mode_arg;
                 NODELET_ERROR_STREAM(error_msg);
                 throw std::runtime_error(error_msg);
             }
         }
+    }
 
-        // set lidar mode from param
-        sensor::lidar_mode lidar_mode = sensor::MODE_UNSPEC;
-        if (is_arg_set(lidar_mode_arg)) {
-            lidar_mode = sensor::lidar_mode_of_string(lidar_mode_arg);
-            if (!lidar_mode) {
-                auto error_msg = "Invalid lidar mode: " + lidar_mode_arg;
-                NODELET_ERROR_STREAM(error_msg);
-                throw std::runtime_error(error_msg);
-            }
-        }
-
-        // set timestamp mode from param
-        sensor::timestamp_mode timestamp_mode = sensor::TIME_FROM_UNSPEC;
-        if (is_arg_set(timestamp_mode_arg)) {
-            // In case the option TIME_FROM_ROS_TIME is set then leave the
-            // sensor timestamp_mode unmodified
-            if (timestamp_mode_arg == "TIME_FROM_ROS_TIME") {
-                NODELET_INFO(
-                    "TIME_FROM_ROS_TIME timestamp mode specified."
-                    " IMU and pointcloud messages will use ros time");
-            } else {
-                timestamp_mode =
-                    sensor::timestamp_mode_of_string(timestamp_mode_arg);
-                if (!timestamp_mode) {
-                    auto error_msg =
-                        "Invalid timestamp mode: " + timestamp_mode_arg;
-                    NODELET_ERROR_STREAM(error_msg);
-                    throw std::runtime_error(error_msg);
-                }
-            }
-        }
-
-        sensor::sensor_config config;
-        if (lidar_port == 0) {
-            NODELET_WARN(
-                "lidar port set to zero, the client will assign a random port "
-                "number!");
-        } else {
-            config.udp_port_lidar = lidar_port;
-        }
-
-        if (imu_port == 0) {
-            NODELET_WARN(
-                "imu port set to zero, the client will assign a random port "
-                "number!");
-        } else {
-            config.udp_port_imu = imu_port;
-        }
+    sensor::sensor_config config;
+    if (lidar_port == 0) {
+        NODELET_WARN(
+            "lidar port set to zero, the client will assign a random port "
+            "number!");
+    } else {
+        config.udp_port_lidar = lidar_port;
+    }
 
-        config.udp_profile_lidar = udp_profile_lidar;
-        config.operating_mode = sensor::OPERATING_NORMAL;
-        if (lidar_mode) config.ld_mode = lidar_mode;
-        if (timestamp_mode) config.ts_mode = timestamp_mode;
+    if (imu_port == 0) {
+        NODELET_WARN(
+            "imu port set to zero, the client will assign a random port "
+            "number!");
+    } else {
+        config.udp_port_imu = imu_port;
+    }
 
-        uint8_t config_flags = 0;
+    config.udp_profile_lidar = udp_profile_lidar;
+    config.operating_mode = sensor::OPERATING_NORMAL;
+    if (lidar_mode) config.ld_mode = lidar_mode;
+    if (timestamp_mode) config.ts_mode = timestamp_mode;
 
-        if (is_arg_set(udp_dest)) {
-            NODELET_INFO("Will send UDP data to %s", udp_dest.c_str());
-            config.udp_dest = udp_dest;
-        } else {
-            NODELET_INFO("Will use automatic UDP destination");
-            config_flags |= ouster::sensor::CONFIG_UDP_DEST_AUTO;
-        }
+    uint8_t config_flags = 0;
 
-        return std::make_pair(config, config_flags);
+    if (is_arg_set(udp_dest)) {
+        NODELET_INFO("Will send UDP data to %s", udp_dest.c_str());
+        config.udp_dest = udp_dest;
+    } else {
+        NODELET_INFO("Will use automatic UDP destination");
+        config_flags |= ouster::sensor::CONFIG_UDP_DEST_AUTO;
     }
 
-    void configure_sensor(const std::string& hostname,
-                          const sensor::sensor_config& config,
-                          int config_flags) {
-        try {
-            if (!set_config(hostname, config, config_flags)) {
-                auto err_msg = "Error connecting to sensor " + hostname;
-                NODELET_ERROR_STREAM(err_msg);
-                throw std::runtime_error(err_msg);
-            }
-        } catch (const std::exception& e) {
-            NODELET_ERROR("Error setting config:  %s", e.what());
-            throw;
+    return std::make_pair(config, config_flags);
+}
+
+void OusterSensor::configure_sensor(const std::string& hostname,
+                                    const sensor::sensor_config& config,
+                                    int config_flags) {
+    try {
+        if (!set_config(hostname, config, config_flags)) {
+            auto err_msg = "Error connecting to sensor " + hostname;
+            NODELET_ERROR_STREAM(err_msg);
+            throw std::runtime_error(err_msg);
         }
+    } catch (const std::exception& e) {
+        NODELET_ERROR("Error setting config:  %s", e.what());
+        throw;
+    }
 
-        NODELET_INFO_STREAM("Sensor " << hostname
-                                      << " configured successfully");
-    }
-
-    bool load_config_file(const std::string& config_file,
-                          sensor::sensor_config& out_config) {
-        std::ifstream ifs{};
-        ifs.open(config_file);
-        if (ifs.fail()) return false;
-        std::stringstream buf;
-        buf << ifs.rdbuf();
-        out_config = sensor::parse_config(buf.str());
-        return true;
-    }
-
-   private:
-    // fill in values that could not be parsed from metadata
-    void populate_metadata_defaults(sensor::sensor_info& info,
-                                    sensor::lidar_mode specified_lidar_mode) {
-        if (!info.name.size()) info.name = "UNKNOWN";
-
-        if (!info.sn.size()) info.sn = "UNKNOWN";
-
-        ouster::util::version v = ouster::util::version_of_string(info.fw_rev);
-        if (v == ouster::util::invalid_version)
-            NODELET_WARN(
-                "Unknown sensor firmware version; output may not be reliable");
-        else if (v < sensor::min_version)
-            NODELET_WARN(
-                "Firmware < %s not supported; output may not be reliable",
-                to_string(sensor::min_version).c_str());
-
-        if (!info.mode) {
-            NODELET_WARN(
-                "Lidar mode not found in metadata; output may not be reliable");
-            info.mode = specified_lidar_mode;
-        }
+    NODELET_INFO_STREAM("Sensor " << hostname
+                                  << " configured successfully");
+}
+
+bool OusterSensor::load_config_file(const std::string& config_file,
+                                    sensor::sensor_config& out_config) {
+    std::ifstream ifs{};
+    ifs.open(config_file);
+    if (ifs.fail()) return false;
+    std::stringstream buf;
+    buf << ifs.rdbuf();
+    out_config = sensor::parse_config(buf.str());
+    return true;
+}
+
+// fill in values that could not be parsed from metadata
+void OusterSensor::populate_metadata_defaults(
+    sensor::sensor_info& info, sensor::lidar_mode specified_lidar_mode) {
+    if (!info.name.size()) info.name = "UNKNOWN";
+
+    if (!info.sn.size()) info.sn = "UNKNOWN";
+
+    ouster::util::version v = ouster::util::version_of_string(info.fw_rev);
+    if (v == ouster::util::invalid_version)
+        NODELET_WARN(
+            "Unknown sensor firmware version; output may not be reliable");
+    else if (v < sensor::min_version)
+        NODELET_WARN(
+            "Firmware < %s not supported; output may not be reliable",
+            to_string(sensor::min_version).c_str());
+
+    if (!info.mode) {
+        NODELET_WARN(
+            "Lidar mode not found in metadata; output may not be reliable");
+        info.mode = specified_lidar_mode;
+    }
 
-        if (!info.prod_line.size()) info.prod_line = "UNKNOWN";
+    if (!info.prod_line.size()) info.prod_line = "UNKNOWN";
 
-        if (info.beam_azimuth_angles.empty() ||
-            info.beam_altitude_angles.empty()) {
-            NODELET_ERROR(
-                "Beam angles not found in metadata; using design values");
-            info.beam_azimuth_angles = sensor::gen1_azimuth_angles;
-            info.beam_altitude_angles = sensor::gen1_altitude_angles;
-        }
+    if (info.beam_azimuth_angles.empty() ||
+        info.beam_altitude_angles.empty()) {
+        NODELET_ERROR(
+            "Beam angles not found in metadata; using design values");
+        info.beam_azimuth_angles = sensor::gen1_azimuth_angles;
+        info.beam_altitude_angles = sensor::gen1_altitude_angles;
     }
-
-    // try to write metadata file
-    bool write_metadata(const std::string& meta_file,
-                        const std::string& metadata) {
-        std::ofstream ofs;
-        ofs.open(meta_file);
-        ofs << metadata << std::endl;
-        ofs.close();
-        if (ofs) {
-            NODELET_INFO("Wrote metadata to %s", meta_file.c_str());
-        } else {
-            NODELET_WARN(
-                "Failed to write metadata to %s; check that the path is valid. "
-                "If "
-                "you provided a relative path, please note that the working "
-                "directory of all ROS nodes is set by default to $ROS_HOME",
-                meta_file.c_str());
-            return false;
-        }
-        return true;
+}
+
+// try to write metadata file
+bool OusterSensor::write_metadata(const std::string& meta_file,
+                                  const std::string& metadata) {
+    std::ofstream ofs;
+    ofs.open(meta_file);
+    ofs << metadata << std::endl;
+    ofs.close();
+    if (ofs) {
+        NODELET_INFO("Wrote metadata to %s", meta_file.c_str());
+    } else {
+        NODELET_WARN(
+            "Failed to write metadata to %s; check that the path is valid. "
+            "If "
+            "you provided a relative path, please note that the working "
+            "directory of all ROS nodes is set by default to $ROS_HOME",
+            meta_file.c_str());
+        return false;
+    }
+    return true;
+}
+
+void OusterSensor::start_connection_loop() {
+    auto& nh = getNodeHandle();
+    create_packet_pools();
+
+    auto& pnh = getPrivateNodeHandle();
+    lidar_packet_pub = nh.advertise<PacketMsg>(
+        "lidar_packets",
+        ouster_ros::queue_size_of_params(pnh, "lidar_packets", 1280));
+    imu_packet_pub = nh.advertise<PacketMsg>(
+        "imu_packets",
+        ouster_ros::queue_size_of_params(pnh, "imu_packets", 100));
+
+    // ROS doesn't expose the depth of its publish queues, the packets still
+    // held by the queues and subscribers are the closest approximation
+    if (stats)
+        stats->gauge("lidar_packets_in_flight", [this] {
+            std::lock_guard<std::mutex> lock(packet_pools_mutex);
+            return static_cast<double>(lidar_packet_pool->in_use());
+        });
+
+    create_lidar_packet_batcher(pnh);
+    start_reception();
+}
+
+void OusterSensor::create_packet_pools() {
+    // keep enough packet buffers around to cover two frames worth of
+    // lidar packets and a second worth of imu packets, the pools grow if
+    // subscribers hold on to packets for longer than that
+    const auto& pf = sensor::get_format(info);
+    const auto packets_per_frame =
+        info.format.columns_per_frame / pf.columns_per_packet;
+    const auto lidar_packet_size = pf.lidar_packet_size;
+    const auto imu_packet_size = pf.imu_packet_size;
+    std::lock_guard<std::mutex> lock(packet_pools_mutex);
+    lidar_packet_pool = std::make_unique<PacketMsgPool>(
+        2 * packets_per_frame, [lidar_packet_size](PacketMsg& packet) {
+            packet.buf.resize(lidar_packet_size + 1);
+        });
+    imu_packet_pool = std::make_unique<PacketMsgPool>(
+        100, [imu_packet_size](PacketMsg& packet) {
+            packet.buf.resize(imu_packet_size + 1);
+        });
+}
+
+void OusterSensor::start_reception() {
+    {
+        std::lock_guard<std::mutex> lock(reception_mutex);
+        reception_active = true;
+    }
+    auto& pnh = getPrivateNodeHandle();
+    if (pnh.param("receive_thread", false)) {
+        start_receive_thread(pnh);
+        return;
     }
 
-    void start_connection_loop() {
-        auto& nh = getNodeHandle();
-
-        auto pf = sensor::get_format(info);
-        lidar_packet.buf.resize(pf.lidar_packet_size + 1);
-        imu_packet.buf.resize(pf.imu_packet_size + 1);
+    timer_ = getNodeHandle().createTimer(
+        ros::Duration(0),
+        boost::bind(&OusterSensor::timer_callback, this, _1), true);
+}
+
+void OusterSensor::stop_reception() {
+    // waits for a timer_callback in progress, ros::Timer::stop() alone
+    // doesn't as the callback re-arms the timer. Callbacks firing until the
+    // timer is stopped return right away.
+    {
+        std::lock_guard<std::mutex> lock(reception_mutex);
+        reception_active = false;
+    }
+    timer_.stop();
+    stop_receive_thread();
+}
+
+void OusterSensor::rebuild_processing() {
+    // the packets of the previous metadata are left to the old pools, which
+    // release them once their subscribers are done
+    create_packet_pools();
+    {
+        std::lock_guard<std::mutex> lock(lidar_packet_batcher_mutex);
+        create_lidar_packet_batcher(getPrivateNodeHandle());
+    }
+    on_metadata_updated(info);
+}
+
+void OusterSensor::create_lidar_packet_batcher(ros::NodeHandle& nh) {
+    auto batch_mode_arg = nh.param("packet_batch_mode", std::string{});
+    if (!is_arg_set(batch_mode_arg)) return;
+
+    ouster_ros::LidarPacketBatcher::Mode batch_mode;
+    if (!ouster_ros::packet_batch_mode_of_string(batch_mode_arg,
+                                                 batch_mode)) {
+        auto error_msg = "Invalid packet batch mode: " + batch_mode_arg;
+        NODELET_ERROR_STREAM(error_msg);
+        throw std::runtime_error(error_msg);
+    }
 
-        lidar_packet_pub = nh.advertise<PacketMsg>("lidar_packets", 1280);
-        imu_packet_pub = nh.advertise<PacketMsg>("imu_packets", 100);
+    auto batch_size = nh.param("packet_batch_size", 16);
+    auto batch_duration = nh.param("packet_batch_duration", 0.01);
+    if (batch_size < 1 || batch_duration <= 0.0) {
+        auto error_msg =
+            "packet_batch_size and packet_batch_duration must be positive";
+        NODELET_ERROR_STREAM(error_msg);
+        throw std::runtime_error(error_msg);
+    }
 
-        timer_ = nh.createTimer(
-            ros::Duration(0),
-            boost::bind(&OusterSensor::timer_callback, this, _1), true);
+    lidar_packet_batcher = std::make_unique<ouster_ros::LidarPacketBatcher>(
+        info, batch_mode, batch_size, ros::Duration(batch_duration));
+    lidar_packet_batch_pub = getNodeHandle().advertise<PacketBatchMsg>(
+        "lidar_packet_batches",
+        ouster_ros::queue_size_of_params(nh, "lidar_packet_batches", 100));
+
+    // no packet arrives to complete a batch in the dead zone of an azimuth
+    // window or while the stream pauses, the timer hands it over at most a
+    // quarter of its budget late
+    if (batch_mode == ouster_ros::LidarPacketBatcher::Mode::TIME)
+        batch_deadline_timer = getNodeHandle().createTimer(
+            ros::Duration(batch_duration / 4),
+            boost::bind(&OusterSensor::batch_deadline_callback, this, _1));
+
+    NODELET_INFO("Publishing lidar packet batches, mode: %s",
+                 batch_mode_arg.c_str());
+}
+
+void OusterSensor::on_lidar_packet(const PacketMsg::Ptr& packet,
+                                   const ros::Time& stamp) {
+    if (!lidar_packet_batcher) {
+        lidar_packet_pub.publish(packet);
+        return;
     }
 
-    void connection_loop(sensor::client& cli, const sensor::sensor_info& info) {
-        auto pf = sensor::get_format(info);
+    // once batching is enabled, individual packets are only published
+    // for whoever subscribes to them explicitly
+    if (lidar_packet_pub.getNumSubscribers() > 0)
+        lidar_packet_pub.publish(packet);
+
+    std::lock_guard<std::mutex> lock(lidar_packet_batcher_mutex);
+    auto batch = lidar_packet_batcher->add(packet->buf.data(), stamp);
+    if (batch) lidar_packet_batch_pub.publish(batch);
+}
+
+void OusterSensor::on_imu_packet(const PacketMsg::Ptr& packet,
+                                 const ros::Time&) {
+    imu_packet_pub.publish(packet);
+}
+
+void OusterSensor::start_receive_thread(ros::NodeHandle& nh) {
+    auto batch_size = nh.param("receive_batch_size", 64);
+    if (batch_size < 1) {
+        auto error_msg = "receive_batch_size must be a positive number";
+        NODELET_ERROR_STREAM(error_msg);
+        throw std::runtime_error(error_msg);
+    }
 
+    // the rings are filled with buffers from the packet pools while
+    // draining the sockets, so collecting a batch never allocates
+    lidar_packet_ring.assign(batch_size, nullptr);
+    lidar_packet_stamps.resize(batch_size);
+    imu_packet_ring.assign(batch_size, nullptr);
+    imu_packet_stamps.resize(batch_size);
+
+    receive_thread_active = true;
+    receive_thread = std::thread([this] { receive_loop(); });
+
+    auto priority = nh.param("receive_thread_priority", 0);
+    if (!ouster_ros::set_thread_realtime_priority(receive_thread,
+                                                  priority))
+        NODELET_WARN(
+            "Failed to set receive thread priority to %d; check that the "
+            "process has the CAP_SYS_NICE capability",
+            priority);
+
+    auto cpu = nh.param("receive_thread_cpu", -1);
+    if (cpu >= 0 &&
+        !ouster_ros::set_thread_cpu_affinity(receive_thread, {cpu}))
+        NODELET_WARN("Failed to pin receive thread to cpu %d", cpu);
+
+    NODELET_INFO("Receiving packets on a dedicated thread, batch size: %d",
+                 batch_size);
+}
+
+void OusterSensor::stop_receive_thread() {
+    receive_thread_active = false;
+    if (receive_thread.joinable()) receive_thread.join();
+}
+
+// drains all packets that are available on the sockets, up to the size of
+// the packet rings, then publishes them. The sensor client exposes no
+// socket handles, so rather than a single recvmmsg call each batch is
+// collected by reading until a non-blocking poll reports no more data.
+void OusterSensor::receive_loop() {
+    auto& cli = *sensor_client;
+    const auto& pf = sensor::get_format(info);
+    const auto batch_size = lidar_packet_ring.size();
+
+    while (receive_thread_active && ros::ok()) {
         auto state = sensor::poll_client(cli);
         if (state == sensor::EXIT) {
             NODELET_INFO("poll_client: caught signal, exiting");
@@ -399,36 +814,117 @@ class OusterSensor : public OusterClientBase {
         }
         if (state & sensor::CLIENT_ERROR) {
             NODELET_ERROR("poll_client: returned error");
-            return;
+            if (stats) poll_errors->add();
+            continue;
+        }
+
+        size_t lidar_count = 0;
+        size_t imu_count = 0;
+        while ((state & (sensor::LIDAR_DATA | sensor::IMU_DATA)) &&
+               lidar_count < batch_size && imu_count < batch_size) {
+            if (state & sensor::LIDAR_DATA) {
+                auto& packet = lidar_packet_ring[lidar_count];
+                if (!packet) packet = lidar_packet_pool->acquire();
+                if (sensor::read_lidar_packet(cli, packet->buf.data(), pf))
+                    lidar_packet_stamps[lidar_count++] = ros::Time::now();
+                else if (stats)
+                    lidar_read_failures->add();
+            }
+            if (state & sensor::IMU_DATA) {
+                auto& packet = imu_packet_ring[imu_count];
+                if (!packet) packet = imu_packet_pool->acquire();
+                if (sensor::read_imu_packet(cli, packet->buf.data(), pf))
+                    imu_packet_stamps[imu_count++] = ros::Time::now();
+                else if (stats)
+                    imu_read_failures->add();
+            }
+            state = sensor::poll_client(cli, 0);
+        }
+
+        if (stats) {
+            lidar_packet_count->add(lidar_count);
+            imu_packet_count->add(imu_count);
+        }
+
+        if (packet_logger) {
+            for (size_t i = 0; i < lidar_count; ++i)
+                packet_logger->log_lidar_packet(
+                    lidar_packet_ring[i]->buf.data(), pf.lidar_packet_size,
+                    lidar_packet_stamps[i]);
+            for (size_t i = 0; i < imu_count; ++i)
+                packet_logger->log_imu_packet(imu_packet_ring[i]->buf.data(),
+                                              pf.imu_packet_size,
+                                              imu_packet_stamps[i]);
         }
-        if (state & sensor::LIDAR_DATA) {
-            if (sensor::read_lidar_packet(cli, lidar_packet.buf.data(), pf))
-                lidar_packet_pub.publish(lidar_packet);
+
+        // hand the buffers over to the subscribers, they go back to the
+        // pools once every subscriber is done with them
+        for (size_t i = 0; i < lidar_count; ++i) {
+            on_lidar_packet(lidar_packet_ring[i], lidar_packet_stamps[i]);
+            lidar_packet_ring[i].reset();
         }
-        if (state & sensor::IMU_DATA) {
-            if (sensor::read_imu_packet(cli, imu_packet.buf.data(), pf))
-                imu_packet_pub.publish(imu_packet);
+        for (size_t i = 0; i < imu_count; ++i) {
+            on_imu_packet(imu_packet_ring[i], imu_packet_stamps[i]);
+            imu_packet_ring[i].reset();
         }
     }
+}
+
+void OusterSensor::connection_loop(sensor::client& cli,
+                                   const sensor::sensor_info& info) {
+    const auto& pf = sensor::get_format(info);
 
-    void timer_callback(const ros::TimerEvent&) {
-        connection_loop(*sensor_client, info);
-        timer_.stop();
-        timer_.start();
-    }
-
-   private:
-    PacketMsg lidar_packet;
-    PacketMsg imu_packet;
-    ros::Publisher lidar_packet_pub;
-    ros::Publisher imu_packet_pub;
-    std::shared_ptr<sensor::client> sensor_client;
-    ros::Timer timer_;
-    std::string sensor_hostname;
-    ros::ServiceServer get_config_srv;
-    ros::ServiceServer set_config_srv;
-    std::string cached_config;
-};
+    auto state = sensor::poll_client(cli);
+    if (state == sensor::EXIT) {
+        NODELET_INFO("poll_client: caught signal, exiting");
+        return;
+    }
+    if (state & sensor::CLIENT_ERROR) {
+        NODELET_ERROR("poll_client: returned error");
+        if (stats) poll_errors->add();
+        return;
+    }
+    if (state & sensor::LIDAR_DATA) {
+        auto lidar_packet = lidar_packet_pool->acquire();
+        if (sensor::read_lidar_packet(cli, lidar_packet->buf.data(), pf)) {
+            const auto stamp = ros::Time::now();
+            if (stats) lidar_packet_count->add();
+            if (packet_logger)
+                packet_logger->log_lidar_packet(lidar_packet->buf.data(),
+                                                pf.lidar_packet_size, stamp);
+            on_lidar_packet(lidar_packet, stamp);
+        } else if (stats) {
+            lidar_read_failures->add();
+        }
+    }
+    if (state & sensor::IMU_DATA) {
+        auto imu_packet = imu_packet_pool->acquire();
+        if (sensor::read_imu_packet(cli, imu_packet->buf.data(), pf)) {
+            const auto stamp = ros::Time::now();
+            if (stats) imu_packet_count->add();
+            if (packet_logger)
+                packet_logger->log_imu_packet(imu_packet->buf.data(),
+                                              pf.imu_packet_size, stamp);
+            on_imu_packet(imu_packet, stamp);
+        } else if (stats) {
+            imu_read_failures->add();
+        }
+    }
+}
+
+void OusterSensor::timer_callback(const ros::TimerEvent&) {
+    std::lock_guard<std::mutex> lock(reception_mutex);
+    if (!reception_active) return;
+    connection_loop(*sensor_client, info);
+    timer_.stop();
+    timer_.start();
+}
+
+void OusterSensor::batch_deadline_callback(const ros::TimerEvent&) {
+    std::lock_guard<std::mutex> lock(lidar_packet_batcher_mutex);
+    auto batch = lidar_packet_batcher->expire(ros::Time::now());
+    if (batch) lidar_packet_batch_pub.publish(batch);
+}
 
 }  // namespace nodelets_os
 
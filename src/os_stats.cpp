@@ -0,0 +1,194 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_stats.cpp
+ * @brief implementation of the pipeline statistics
+ */
+
+#include "ouster_ros/os_stats.h"
+
+#include <diagnostic_msgs/KeyValue.h>
+
+#include <algorithm>
+#include <sstream>
+#include <vector>
+
+namespace ouster_ros {
+
+namespace {
+
+void add_value(diagnostic_msgs::DiagnosticStatus& status,
+               const std::string& key, double value) {
+    std::ostringstream ss;
+    ss << value;
+    diagnostic_msgs::KeyValue kv;
+    kv.key = key;
+    kv.value = ss.str();
+    status.values.push_back(std::move(kv));
+}
+
+double to_us(std::chrono::nanoseconds ns) { return ns.count() / 1000.0; }
+
+}  // namespace
+
+LatencyHistogram::LatencyHistogram() {
+    for (auto& b : buckets) b.store(0, std::memory_order_relaxed);
+}
+
+size_t LatencyHistogram::bucket_of(uint64_t ns) {
+    constexpr uint64_t sub_buckets = 1 << sub_bucket_bits;
+    if (ns < sub_buckets) return ns;
+    const int e = 63 - __builtin_clzll(ns);
+    const uint64_t mantissa = (ns >> (e - sub_bucket_bits)) & (sub_buckets - 1);
+    return (e - sub_bucket_bits + 1) * sub_buckets + mantissa;
+}
+
+uint64_t LatencyHistogram::bucket_value(size_t bucket) {
+    constexpr uint64_t sub_buckets = 1 << sub_bucket_bits;
+    if (bucket < sub_buckets) return bucket;
+    const int shift = static_cast<int>(bucket / sub_buckets) - 1;
+    const uint64_t lower = (sub_buckets + bucket % sub_buckets) << shift;
+    // the middle of the bucket
+    return lower + ((uint64_t{1} << shift) >> 1);
+}
+
+void LatencyHistogram::record(std::chrono::nanoseconds duration) {
+    const uint64_t ns = duration.count() > 0 ? duration.count() : 0;
+    buckets[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+    sum_ns.fetch_add(ns, std::memory_order_relaxed);
+    uint64_t prev = max_ns.load(std::memory_order_relaxed);
+    while (ns > prev && !max_ns.compare_exchange_weak(
+                            prev, ns, std::memory_order_relaxed)) {
+    }
+}
+
+LatencyHistogram::Summary LatencyHistogram::take() {
+    std::array<uint64_t, n_buckets> counts;
+    uint64_t count = 0;
+    for (size_t i = 0; i < n_buckets; ++i) {
+        counts[i] = buckets[i].exchange(0, std::memory_order_relaxed);
+        count += counts[i];
+    }
+    const uint64_t sum = sum_ns.exchange(0, std::memory_order_relaxed);
+    const uint64_t max = max_ns.exchange(0, std::memory_order_relaxed);
+
+    Summary summary{count, {}, {}, {}, {}, std::chrono::nanoseconds{max}};
+    if (count == 0) return summary;
+    summary.mean = std::chrono::nanoseconds{sum / count};
+
+    auto percentile = [&](double p) {
+        const uint64_t rank = static_cast<uint64_t>(p * (count - 1));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < n_buckets; ++i) {
+            seen += counts[i];
+            if (seen > rank)
+                return std::chrono::nanoseconds{
+                    std::min<uint64_t>(bucket_value(i), max)};
+        }
+        return std::chrono::nanoseconds{max};
+    };
+    summary.p50 = percentile(0.50);
+    summary.p90 = percentile(0.90);
+    summary.p99 = percentile(0.99);
+    return summary;
+}
+
+LatencyHistogram& PipelineStats::histogram(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& h = histograms[name];
+    if (!h) h = std::make_unique<LatencyHistogram>();
+    return *h;
+}
+
+StatsCounter& PipelineStats::counter(const std::string& name, bool warn) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& c = counters[name];
+    if (!c) {
+        c = std::make_unique<Counter>();
+        c->warn = warn;
+    }
+    return c->counter;
+}
+
+void PipelineStats::gauge(const std::string& name,
+                          std::function<double()> read, const void* owner) {
+    std::lock_guard<std::mutex> lock(mutex);
+    gauges[name] = {owner, std::move(read)};
+}
+
+void PipelineStats::remove_gauge(const std::string& name, const void* owner) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = gauges.find(name);
+    if (it != gauges.end() && it->second.first == owner) gauges.erase(it);
+}
+
+void PipelineStats::report(diagnostic_msgs::DiagnosticStatus& status,
+                           std::chrono::duration<double> elapsed) {
+    std::lock_guard<std::mutex> lock(mutex);
+    const double seconds = elapsed.count() > 0 ? elapsed.count() : 1.0;
+
+    status.level = diagnostic_msgs::DiagnosticStatus::OK;
+    std::vector<std::string> warnings;
+    for (auto& entry : counters) {
+        auto& c = *entry.second;
+        const uint64_t value = c.counter.load();
+        const uint64_t delta = value - c.reported;
+        c.reported = value;
+        add_value(status, entry.first, static_cast<double>(value));
+        add_value(status, entry.first + " rate [Hz]", delta / seconds);
+        if (c.warn && delta > 0) warnings.push_back(entry.first);
+    }
+
+    for (const auto& entry : gauges)
+        add_value(status, entry.first, entry.second.second());
+
+    for (const auto& entry : histograms) {
+        const auto summary = entry.second->take();
+        const auto& name = entry.first;
+        add_value(status, name + " count", static_cast<double>(summary.count));
+        add_value(status, name + " mean [us]", to_us(summary.mean));
+        add_value(status, name + " p50 [us]", to_us(summary.p50));
+        add_value(status, name + " p90 [us]", to_us(summary.p90));
+        add_value(status, name + " p99 [us]", to_us(summary.p99));
+        add_value(status, name + " max [us]", to_us(summary.max));
+    }
+
+    if (warnings.empty()) {
+        status.message = "OK";
+        return;
+    }
+    status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+    status.message = "increased:";
+    for (const auto& w : warnings) status.message += " " + w;
+}
+
+StatsPublisher::StatsPublisher(ros::NodeHandle& nh, const std::string& name,
+                               const std::string& hardware_id,
+                               std::shared_ptr<PipelineStats> stats,
+                               double period)
+    : name(name),
+      hardware_id(hardware_id),
+      stats(std::move(stats)),
+      last_report(ros::WallTime::now()) {
+    diagnostics_pub =
+        nh.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 10);
+    timer = nh.createWallTimer(ros::WallDuration(period),
+                               &StatsPublisher::publish, this);
+}
+
+void StatsPublisher::publish(const ros::WallTimerEvent&) {
+    const auto now = ros::WallTime::now();
+    diagnostic_msgs::DiagnosticArray msg;
+    msg.header.stamp = ros::Time::now();
+    msg.status.resize(1);
+    auto& status = msg.status.front();
+    status.name = name + ": pipeline";
+    status.hardware_id = hardware_id;
+    stats->report(status, std::chrono::duration<double>(
+                              (now - last_report).toSec()));
+    last_report = now;
+    diagnostics_pub.publish(msg);
+}
+
+}  // namespace ouster_ros
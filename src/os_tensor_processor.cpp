@@ -0,0 +1,115 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_tensor_processor.cpp
+ * @brief implementation of the TensorProcessor
+ */
+
+#include "ouster_ros/os_tensor_processor.h"
+
+#include "ouster_ros/os_metadata_cache.h"
+#include "ouster_ros/os_point_cloud_processor.h"
+
+using ouster::sensor::ChanField;
+
+namespace ouster_ros {
+
+namespace {
+
+const std::vector<std::string> raw_channels = {"range", "signal",
+                                               "reflectivity", "near_ir"};
+const std::vector<std::string> xyz_channels = {"x", "y", "z"};
+
+}  // namespace
+
+TensorProcessor::TensorProcessor(const sensor::sensor_info& info,
+                                 ros::NodeHandle& nh, const std::string& frame,
+                                 bool xyz)
+    : n_returns(get_n_returns(info)),
+      height(info.format.pixels_per_column),
+      width(info.format.columns_per_frame),
+      xyz(xyz) {
+    const size_t H = height;
+    const size_t W = width;
+    row_shift.resize(H);
+    for (size_t u = 0; u < H; u++) {
+        const int w = static_cast<int>(W);
+        row_shift[u] = (info.format.pixel_shift_by_row[u] % w + w) % w;
+    }
+
+    if (xyz) {
+        ouster::PointsF lut_direction, lut_offset;
+        SensorMetadata::lut_of(info, lut_direction, lut_offset);
+        const size_t n = H * W;
+        direction.resize(3 * n);
+        offset.resize(3 * n);
+        for (size_t u = 0; u < H; u++) {
+            for (size_t v = 0; v < W; v++) {
+                const size_t src = u * W + v;
+                const size_t dst = u * W + (v + row_shift[u]) % W;
+                for (size_t c = 0; c < 3; c++) {
+                    direction[c * n + dst] = lut_direction(src, c);
+                    offset[c * n + dst] = lut_offset(src, c);
+                }
+            }
+        }
+    }
+
+    auto channels = raw_channels;
+    if (xyz)
+        channels.insert(channels.end(), xyz_channels.begin(),
+                        xyz_channels.end());
+    tensor_pool = std::make_unique<MessagePool<ScanTensorMsg>>(
+        frame_pool_capacity(n_returns),
+        [H, W, channels, frame](ScanTensorMsg& msg) {
+            msg.header.frame_id = frame;
+            msg.height = H;
+            msg.width = W;
+            msg.channels = channels;
+            msg.data.resize(channels.size() * H * W);
+        });
+
+    for (int i = 0; i < n_returns; i++)
+        tensor_pubs.push_back(nh.advertise<ScanTensorMsg>(
+            std::string("scan_tensor") + topic_suffix(i), 10));
+}
+
+void TensorProcessor::operator()(const ouster::LidarScan& ls,
+                                 std::chrono::nanoseconds,
+                                 const ros::Time& msg_ts) {
+    const size_t H = height;
+    const size_t W = width;
+    const size_t n = H * W;
+    for (int i = 0; i < n_returns; i++) {
+        if (tensor_pubs[i].getNumSubscribers() == 0) continue;
+
+        const bool second = (i == 1);
+        auto msg = tensor_pool->acquire();
+        msg->header.stamp = msg_ts;
+        float* data = msg->data.data();
+        const ChanField fields[] = {ChanField::RANGE, ChanField::SIGNAL,
+                                    ChanField::REFLECTIVITY,
+                                    ChanField::NEAR_IR};
+        for (size_t c = 0; c < 4; c++)
+            destagger_into(data + c * n, H, W, row_shift,
+                           get_field_view(suitable_return(fields[c], second),
+                                          ls));
+
+        if (xyz) {
+            // the range plane is destaggered already, as are the luts
+            const float* range = data;
+            for (size_t c = 0; c < 3; c++) {
+                const float* dir = direction.data() + c * n;
+                const float* ofs = offset.data() + c * n;
+                float* out = data + (4 + c) * n;
+                for (size_t k = 0; k < n; k++)
+                    out[k] = range[k] > 0.0f ? range[k] * dir[k] + ofs[k]
+                                             : 0.0f;
+            }
+        }
+        tensor_pubs[i].publish(msg);
+    }
+}
+
+}  // namespace ouster_ros
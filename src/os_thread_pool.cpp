@@ -0,0 +1,97 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_thread_pool.cpp
+ * @brief implementation of the ThreadPool
+ */
+
+#include "ouster_ros/os_thread_pool.h"
+
+#include "ouster_ros/os_thread_utils.h"
+
+namespace ouster_ros {
+
+ThreadPool::ThreadPool(size_t n_threads, int first_cpu) {
+    for (size_t i = 1; i < n_threads; ++i) {
+        workers.emplace_back(&ThreadPool::worker_loop, this);
+        // pinning is best effort, an unavailable cpu leaves the thread free
+        if (first_cpu >= 0)
+            set_thread_cpu_affinity(workers.back(),
+                                    {first_cpu + static_cast<int>(i) - 1});
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work_cv.notify_all();
+    for (auto& worker : workers) worker.join();
+}
+
+void ThreadPool::run(size_t n_tasks, const Task& task) {
+    if (n_tasks == 0) return;
+
+    auto current = std::make_shared<Batch>();
+    current->task = &task;
+    current->n_tasks = n_tasks;
+    if (!workers.empty()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            batch = current;
+            ++generation;
+        }
+        work_cv.notify_all();
+    }
+
+    work_on(*current);
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        done_cv.wait(lock, [&current] {
+            return current->completed == current->n_tasks;
+        });
+        // workers that wake up late must not pick up a finished batch
+        if (batch == current) batch.reset();
+    }
+
+    if (current->error) std::rethrow_exception(current->error);
+}
+
+void ThreadPool::worker_loop() {
+    uint64_t seen_generation = 0;
+    while (true) {
+        std::shared_ptr<Batch> current;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            work_cv.wait(lock, [this, seen_generation] {
+                return stopping || generation != seen_generation;
+            });
+            if (stopping) return;
+            seen_generation = generation;
+            current = batch;
+        }
+        if (current) work_on(*current);
+    }
+}
+
+void ThreadPool::work_on(Batch& current) {
+    size_t i;
+    while ((i = current.next.fetch_add(1)) < current.n_tasks) {
+        try {
+            (*current.task)(i);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(current.error_mutex);
+            if (!current.error) current.error = std::current_exception();
+        }
+        if (current.completed.fetch_add(1) + 1 == current.n_tasks) {
+            // taking the lock orders the notification after the wait check
+            std::lock_guard<std::mutex> lock(mutex);
+            done_cv.notify_all();
+        }
+    }
+}
+
+}  // namespace ouster_ros
@@ -0,0 +1,60 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_thread_utils.cpp
+ * @brief implementation of the thread scheduling helpers
+ */
+
+#include "ouster_ros/os_thread_utils.h"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace ouster_ros {
+
+bool set_thread_realtime_priority(std::thread& thread, int priority) {
+    if (priority <= 0) return true;
+
+    sched_param param{};
+    param.sched_priority = std::min(priority, sched_get_priority_max(SCHED_FIFO));
+    return pthread_setschedparam(thread.native_handle(), SCHED_FIFO, &param) ==
+           0;
+}
+
+bool set_thread_cpu_affinity(std::thread& thread, const std::vector<int>& cpus) {
+    if (cpus.empty()) return true;
+
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for (auto cpu : cpus) {
+        if (cpu < 0 || cpu >= CPU_SETSIZE) return false;
+        CPU_SET(cpu, &cpu_set);
+    }
+    return pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set),
+                                  &cpu_set) == 0;
+}
+
+int cpu_numa_node(int cpu) {
+    // sysfs links every cpu to its node as cpu<n>/node<m>
+    const auto path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+    DIR* dir = opendir(path.c_str());
+    if (!dir) return -1;
+    int node = -1;
+    while (const dirent* entry = readdir(dir)) {
+        if (std::strncmp(entry->d_name, "node", 4) == 0) {
+            node = std::atoi(entry->d_name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+}  // namespace ouster_ros
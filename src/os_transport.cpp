@@ -0,0 +1,36 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_transport.cpp
+ * @brief implementation of the topic queue and transport parameters
+ */
+
+#include "ouster_ros/os_transport.h"
+
+#include <algorithm>
+
+namespace ouster_ros {
+
+int queue_size_of_params(ros::NodeHandle& pnh, const std::string& topic,
+                         int default_size) {
+    return std::max(pnh.param(topic + "_queue_size", default_size), 1);
+}
+
+bool transport_hints_of_params(ros::NodeHandle& pnh, const std::string& topic,
+                               ros::TransportHints& hints) {
+    const auto transport = pnh.param(
+        topic + "_transport", pnh.param("transport", std::string{"tcp"}));
+    if (transport == "tcp") {
+        hints = ros::TransportHints().reliable();
+    } else if (transport == "tcp_nodelay") {
+        hints = ros::TransportHints().reliable().tcpNoDelay();
+    } else if (transport == "udp") {
+        hints = ros::TransportHints().unreliable().reliable().tcpNoDelay();
+    } else {
+        return false;
+    }
+    return true;
+}
+
+}  // namespace ouster_ros
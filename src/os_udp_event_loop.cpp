@@ -0,0 +1,204 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_udp_event_loop.cpp
+ * @brief implementation of the UdpEventLoop
+ */
+
+#include "ouster_ros/os_udp_event_loop.h"
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "ouster_ros/os_thread_utils.h"
+
+namespace ouster_ros {
+
+namespace {
+
+constexpr size_t max_datagram_size = 65536;
+// the receive buffer the sdk client requests for its sockets
+constexpr int receive_buffer_size = 256 * 1024;
+constexpr int poll_timeout_ms = 100;
+constexpr int max_events = 16;
+
+std::runtime_error socket_error(const std::string& what) {
+    return std::runtime_error("UdpEventLoop: failed to " + what + ": " +
+                              std::strerror(errno));
+}
+
+// bind a non blocking socket, dual stack when the host supports IPv6
+int bind_socket(uint16_t port) {
+    int fd = socket(AF_INET6, SOCK_DGRAM, 0);
+    if (fd >= 0) {
+        int off = 0;
+        sockaddr_in6 addr{};
+        addr.sin6_family = AF_INET6;
+        addr.sin6_addr = in6addr_any;
+        addr.sin6_port = htons(port);
+        if (setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off)) ||
+            bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    if (fd < 0) {
+        fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (fd < 0) throw socket_error("create a socket");
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(port);
+        if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))) {
+            const auto error =
+                socket_error("bind port " + std::to_string(port));
+            ::close(fd);
+            throw error;
+        }
+    }
+
+    const int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        const auto error = socket_error("make the socket non blocking");
+        ::close(fd);
+        throw error;
+    }
+    // the kernel caps the size at net.core.rmem_max, which is fine
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &receive_buffer_size,
+               sizeof(receive_buffer_size));
+    return fd;
+}
+
+uint16_t bound_port(int fd) {
+    sockaddr_storage addr{};
+    socklen_t len = sizeof(addr);
+    if (getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len))
+        throw socket_error("get the bound port");
+    if (addr.ss_family == AF_INET6)
+        return ntohs(reinterpret_cast<sockaddr_in6*>(&addr)->sin6_port);
+    return ntohs(reinterpret_cast<sockaddr_in*>(&addr)->sin_port);
+}
+
+}  // namespace
+
+UdpEventLoop::UdpEventLoop(size_t batch_size)
+    : batch_size(std::max<size_t>(batch_size, 1)) {
+    epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0) throw socket_error("create the epoll set");
+}
+
+UdpEventLoop::~UdpEventLoop() {
+    stop();
+    for (auto& socket : sockets) ::close(socket->fd);
+    ::close(epoll_fd);
+}
+
+uint16_t UdpEventLoop::add_socket(uint16_t port, Handler handler) {
+    auto socket = std::make_unique<Socket>();
+    socket->fd = bind_socket(port);
+    uint16_t bound;
+    try {
+        bound = bound_port(socket->fd);
+    } catch (const std::runtime_error&) {
+        ::close(socket->fd);
+        throw;
+    }
+
+    socket->handler = std::move(handler);
+    // left uninitialized, the pages are only faulted in once written to
+    socket->buffers.reset(new uint8_t[batch_size * max_datagram_size]);
+    socket->msgs.resize(batch_size);
+    socket->iovs.resize(batch_size);
+    for (size_t i = 0; i < batch_size; ++i) {
+        socket->iovs[i].iov_base =
+            socket->buffers.get() + i * max_datagram_size;
+        socket->iovs[i].iov_len = max_datagram_size;
+        socket->msgs[i].msg_hdr.msg_iov = &socket->iovs[i];
+        socket->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.ptr = socket.get();
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, socket->fd, &event)) {
+        const auto error = socket_error("watch the socket");
+        ::close(socket->fd);
+        throw error;
+    }
+
+    sockets.push_back(std::move(socket));
+    return bound;
+}
+
+void UdpEventLoop::start(int cpu, int priority) {
+    if (active.exchange(true)) return;
+    thread = std::thread([this] { loop(); });
+    // both are best effort, the loop still runs without them
+    if (cpu >= 0 && !set_thread_cpu_affinity(thread, {cpu}))
+        ROS_WARN_STREAM("UdpEventLoop: failed to pin the thread to cpu "
+                        << cpu);
+    if (!set_thread_realtime_priority(thread, priority))
+        ROS_WARN_STREAM("UdpEventLoop: failed to set the thread priority to "
+                        << priority);
+}
+
+void UdpEventLoop::stop() {
+    active = false;
+    if (thread.joinable()) thread.join();
+}
+
+void UdpEventLoop::loop() {
+    epoll_event events[max_events];
+    while (active) {
+        const int n = epoll_wait(epoll_fd, events, max_events,
+                                 poll_timeout_ms);
+        if (n < 0) {
+            if (errno != EINTR)
+                ROS_ERROR_STREAM_THROTTLE(1, "UdpEventLoop: epoll_wait failed: "
+                                                 << std::strerror(errno));
+            continue;
+        }
+        for (int i = 0; i < n; ++i)
+            drain(*static_cast<Socket*>(events[i].data.ptr));
+    }
+}
+
+void UdpEventLoop::drain(Socket& socket) {
+    while (true) {
+        for (auto& msg : socket.msgs) msg.msg_hdr.msg_flags = 0;
+        const int n = recvmmsg(socket.fd, socket.msgs.data(),
+                               static_cast<unsigned>(batch_size), 0, nullptr);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                ROS_ERROR_STREAM_THROTTLE(1, "UdpEventLoop: recvmmsg failed: "
+                                                 << std::strerror(errno));
+            return;
+        }
+
+        const auto stamp = ros::Time::now();
+        for (int i = 0; i < n; ++i) {
+            const auto& msg = socket.msgs[i];
+            try {
+                socket.handler(
+                    static_cast<const uint8_t*>(msg.msg_hdr.msg_iov->iov_base),
+                    msg.msg_len, stamp);
+            } catch (const std::exception& e) {
+                ROS_ERROR_STREAM_THROTTLE(
+                    1, "UdpEventLoop: failed to handle a packet: " << e.what());
+            }
+        }
+        // a short batch emptied the socket
+        if (static_cast<size_t>(n) < batch_size) return;
+    }
+}
+
+}  // namespace ouster_ros
@@ -0,0 +1,180 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file os_work_stealing_pool.cpp
+ * @brief implementation of the WorkStealingPool
+ */
+
+#include "ouster_ros/os_work_stealing_pool.h"
+
+#include <ros/console.h>
+
+#include <algorithm>
+#include <exception>
+
+#include "ouster_ros/os_thread_utils.h"
+
+namespace ouster_ros {
+
+namespace {
+
+// the pool and the worker running on the calling thread
+thread_local const WorkStealingPool* current_pool = nullptr;
+thread_local size_t current_worker = 0;
+
+}  // namespace
+
+WorkStealingPool::WorkStealingPool(size_t n_threads, int first_cpu) {
+    if (n_threads == 0) {
+        const size_t cpus = std::thread::hardware_concurrency();
+        n_threads = cpus > 1 ? cpus - 1 : 1;
+    }
+
+    for (size_t i = 0; i < n_threads; ++i) {
+        workers.push_back(std::make_unique<Worker>());
+        if (first_cpu >= 0)
+            workers.back()->node =
+                cpu_numa_node(first_cpu + static_cast<int>(i));
+    }
+
+    for (size_t i = 0; i < n_threads; ++i) {
+        auto& victims = workers[i]->victims;
+        for (size_t k = 1; k < n_threads; ++k)
+            victims.push_back((i + k) % n_threads);
+        const int node = workers[i]->node;
+        std::stable_partition(
+            victims.begin(), victims.end(),
+            [this, node](size_t v) { return workers[v]->node == node; });
+    }
+
+    for (size_t i = 0; i < n_threads; ++i) {
+        auto& thread = workers[i]->thread;
+        thread = std::thread([this, i] { worker_loop(i); });
+        // pinning is best effort, an unavailable cpu leaves the thread free
+        if (first_cpu >= 0)
+            set_thread_cpu_affinity(thread, {first_cpu + static_cast<int>(i)});
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        stopping = true;
+    }
+    wake_cv.notify_all();
+    for (auto& worker : workers) worker->thread.join();
+}
+
+int WorkStealingPool::worker_index() const {
+    return current_pool == this ? static_cast<int>(current_worker) : -1;
+}
+
+void WorkStealingPool::post(size_t worker, Task task) {
+    auto& w = *workers[worker % workers.size()];
+    {
+        std::lock_guard<std::mutex> lock(w.mutex);
+        w.tasks.push_back(std::move(task));
+        queued.fetch_add(1);
+    }
+    wake(false);
+}
+
+void WorkStealingPool::run_on(size_t worker, const Task& task) {
+    std::mutex done_mutex;
+    std::condition_variable done_cv;
+    bool done = false;
+    std::exception_ptr error;
+
+    auto& w = *workers[worker % workers.size()];
+    {
+        std::lock_guard<std::mutex> lock(w.mutex);
+        w.pinned.push_back([&] {
+            try {
+                task();
+            } catch (...) {
+                error = std::current_exception();
+            }
+            std::lock_guard<std::mutex> done_lock(done_mutex);
+            done = true;
+            done_cv.notify_one();
+        });
+        w.has_pinned = true;
+    }
+    // only the given worker may pick the task up
+    wake(true);
+
+    std::unique_lock<std::mutex> lock(done_mutex);
+    done_cv.wait(lock, [&done] { return done; });
+    if (error) std::rethrow_exception(error);
+}
+
+void WorkStealingPool::wake(bool all) {
+    {
+        // taking the lock orders the notification after the wait check
+        std::lock_guard<std::mutex> lock(wake_mutex);
+    }
+    if (all)
+        wake_cv.notify_all();
+    else
+        wake_cv.notify_one();
+}
+
+bool WorkStealingPool::pop(size_t self, Task& task) {
+    auto& w = *workers[self];
+    {
+        std::lock_guard<std::mutex> lock(w.mutex);
+        if (!w.pinned.empty()) {
+            task = std::move(w.pinned.front());
+            w.pinned.pop_front();
+            w.has_pinned = !w.pinned.empty();
+            return true;
+        }
+        if (!w.tasks.empty()) {
+            task = std::move(w.tasks.front());
+            w.tasks.pop_front();
+            queued.fetch_sub(1);
+            return true;
+        }
+    }
+
+    // the most recently posted task of a victim is the least likely to have
+    // its data in the caches of the victim yet
+    for (size_t victim : w.victims) {
+        auto& v = *workers[victim];
+        std::lock_guard<std::mutex> lock(v.mutex);
+        if (v.tasks.empty()) continue;
+        task = std::move(v.tasks.back());
+        v.tasks.pop_back();
+        queued.fetch_sub(1);
+        return true;
+    }
+    return false;
+}
+
+void WorkStealingPool::worker_loop(size_t self) {
+    current_pool = this;
+    current_worker = self;
+    auto& w = *workers[self];
+    Task task;
+    while (true) {
+        if (pop(self, task)) {
+            try {
+                task();
+            } catch (const std::exception& e) {
+                ROS_ERROR_STREAM_THROTTLE(
+                    1, "WorkStealingPool: task failed: " << e.what());
+            }
+            task = nullptr;
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(wake_mutex);
+        wake_cv.wait(lock, [this, &w] {
+            return stopping || queued.load() > 0 || w.has_pinned.load();
+        });
+        if (stopping && queued.load() == 0 && !w.has_pinned.load()) return;
+    }
+}
+
+}  // namespace ouster_ros
@@ -0,0 +1,110 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file lidar_packet_handler_test.cpp
+ * @brief Checks the sectors handed over by the LidarPacketHandler
+ */
+
+#include "ouster_ros/os_lidar_packet_handler.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "synthetic_frames.h"
+
+namespace sensor = ouster::sensor;
+
+namespace {
+
+struct Sector {
+    uint32_t col_begin;
+    uint32_t col_end;
+    // whether every column of the sector was written when handed over
+    bool complete;
+};
+
+class LidarPacketHandlerTest
+    : public testing::TestWithParam<sensor::UDPProfileLidar> {
+   protected:
+    void SetUp() override {
+        frames =
+            ouster_ros::test::make_frames(sensor::MODE_1024x10, GetParam());
+        columns_per_packet = sensor::get_format(frames.info).columns_per_packet;
+    }
+
+    // feed the frames 0, 1 and 0 again, dropping the packets of the second
+    // frame listed in lost, and collect the sectors of that second frame
+    std::vector<Sector> second_frame_sectors(uint32_t sector_columns,
+                                             std::vector<size_t> lost = {}) {
+        std::vector<Sector> sectors;
+        int scans = 0;
+        ouster_ros::LidarPacketHandler handler(
+            frames.info, false,
+            [&scans](const ouster::LidarScan&, std::chrono::nanoseconds,
+                     const ros::Time&) { ++scans; });
+        handler.set_sector_callback(
+            sector_columns,
+            [&](const ouster::LidarScan& ls, uint32_t col_begin,
+                uint32_t col_end, std::chrono::nanoseconds,
+                const ros::Time&) {
+                if (scans != 1) return;
+                bool complete = true;
+                for (uint32_t v = col_begin; v < col_end; ++v)
+                    complete &= ls.timestamp()[v] != 0;
+                sectors.push_back({col_begin, col_end, complete});
+            });
+
+        const ros::Time stamp(1, 0);
+        for (const auto& packet : frames.packets[0])
+            handler(packet.data(), stamp);
+        for (size_t i = 0; i < frames.packets[1].size(); ++i) {
+            if (std::find(lost.begin(), lost.end(), i) != lost.end())
+                continue;
+            handler(frames.packets[1][i].data(), stamp);
+        }
+        for (const auto& packet : frames.packets[0])
+            handler(packet.data(), stamp);
+        EXPECT_EQ(scans, 2);
+        return sectors;
+    }
+
+    ouster_ros::test::Frames frames;
+    uint32_t columns_per_packet = 0;
+};
+
+TEST_P(LidarPacketHandlerTest, SinglePacketSectorsCoverTheFrame) {
+    // the first packet of the frame is held back by the batcher until the
+    // second one completes the next sector
+    const auto sectors = second_frame_sectors(columns_per_packet);
+    const uint32_t W = frames.info.format.columns_per_frame;
+    ASSERT_EQ(sectors.size(), W / columns_per_packet);
+    for (size_t i = 0; i < sectors.size(); ++i) {
+        EXPECT_EQ(sectors[i].col_begin, i * columns_per_packet);
+        EXPECT_EQ(sectors[i].col_end, (i + 1) * columns_per_packet);
+        EXPECT_TRUE(sectors[i].complete) << "sector " << i;
+    }
+}
+
+TEST_P(LidarPacketHandlerTest, SectorsMissingPacketsAreHandedOver) {
+    // the packet 5 ends the third sector and the packet 8 starts the fifth
+    // one, both sectors are handed over with the columns received
+    const uint32_t sector_columns = 2 * columns_per_packet;
+    const auto sectors = second_frame_sectors(sector_columns, {5, 8});
+    const uint32_t W = frames.info.format.columns_per_frame;
+    ASSERT_EQ(sectors.size(), W / sector_columns);
+    for (size_t i = 0; i < sectors.size(); ++i) {
+        EXPECT_EQ(sectors[i].col_begin, i * sector_columns);
+        EXPECT_EQ(sectors[i].col_end, (i + 1) * sector_columns);
+        EXPECT_EQ(sectors[i].complete, i != 2 && i != 4) << "sector " << i;
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(LidarProfiles, LidarPacketHandlerTest,
+                         testing::ValuesIn(ouster_ros::test::lidar_profiles));
+
+}  // namespace
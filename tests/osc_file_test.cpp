@@ -0,0 +1,169 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file osc_file_test.cpp
+ * @brief Round trips packets of every lidar profile through the .osc files
+ */
+
+#include "ouster_ros/os_osc_file.h"
+
+#include <gtest/gtest.h>
+#include <zstd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "synthetic_frames.h"
+
+namespace sensor = ouster::sensor;
+
+namespace {
+
+struct Recorded {
+    bool lidar;
+    std::vector<uint8_t> data;
+    std::chrono::nanoseconds stamp;
+};
+
+class OscFileTest : public testing::TestWithParam<sensor::UDPProfileLidar> {
+   protected:
+    void SetUp() override {
+        auto frames =
+            ouster_ros::test::make_frames(sensor::MODE_1024x10, GetParam());
+        metadata = sensor::to_string(frames.info);
+        file = testing::TempDir() + "osc_file_test_" +
+               sensor::to_string(GetParam()) + ".osc";
+
+        // an imu packet every 8 lidar packets, with irregular receive times
+        std::chrono::nanoseconds stamp{1000000000};
+        for (const auto& frame : frames.packets) {
+            frame_starts.push_back(packets.size());
+            for (size_t i = 0; i < frame.size(); ++i) {
+                stamp += std::chrono::nanoseconds{97000 + 13 * (i % 7)};
+                packets.push_back({true, frame[i], stamp});
+                if (i % 8) continue;
+                auto imu = frames.imu_packet;
+                imu[i % imu.size()] ^= static_cast<uint8_t>(i);
+                packets.push_back({false, imu, stamp});
+            }
+        }
+
+        ouster_ros::OscWriter writer(file, metadata);
+        for (const auto& p : packets) {
+            if (p.lidar)
+                writer.add_lidar_packet(p.data.data(), p.data.size(), p.stamp);
+            else
+                writer.add_imu_packet(p.data.data(), p.data.size(), p.stamp);
+        }
+    }
+
+    void TearDown() override { std::remove(file.c_str()); }
+
+    // the packets read from the first packet of a chunk to the end
+    void expect_packets(ouster_ros::OscReader& reader, size_t first) {
+        ouster_ros::OscReader::Packet packet;
+        for (size_t i = first; i < packets.size(); ++i) {
+            ASSERT_TRUE(reader.next(packet)) << "packet " << i;
+            const auto& expected = packets[i];
+            ASSERT_EQ(packet.lidar, expected.lidar) << "packet " << i;
+            ASSERT_EQ(packet.size, expected.data.size()) << "packet " << i;
+            EXPECT_EQ(std::memcmp(packet.data, expected.data.data(),
+                                  packet.size),
+                      0)
+                << "packet " << i;
+            EXPECT_EQ(packet.stamp, expected.stamp) << "packet " << i;
+        }
+        EXPECT_FALSE(reader.next(packet));
+    }
+
+    std::string metadata;
+    std::string file;
+    std::vector<Recorded> packets;
+    // the index of the first packet of every frame
+    std::vector<size_t> frame_starts;
+};
+
+TEST_P(OscFileTest, RestoresPacketsBitForBit) {
+    ouster_ros::OscReader reader(file);
+    EXPECT_EQ(reader.metadata(), metadata);
+    // one chunk per frame
+    ASSERT_EQ(reader.chunk_count(), 2u);
+    expect_packets(reader, 0);
+
+    reader.rewind();
+    expect_packets(reader, 0);
+}
+
+TEST_P(OscFileTest, SeeksToTheFirstPacketOfAFrame) {
+    ouster_ros::OscReader reader(file);
+    reader.seek(1);
+    expect_packets(reader, frame_starts[1]);
+}
+
+TEST_P(OscFileTest, RejectsFlagsThatDontMatchTheLidarPackets) {
+    std::vector<uint8_t> bytes;
+    {
+        std::ifstream in(file, std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(in), {});
+    }
+
+    // the file header is the magic, the version and the size of the
+    // metadata, a chunk header the magic, the packet counts, the raw and
+    // compressed sizes, a reserved word and the first stamp
+    uint32_t metadata_size;
+    std::memcpy(&metadata_size, bytes.data() + 12, sizeof(metadata_size));
+    const size_t chunk = 16 + metadata_size;
+    const size_t chunk_header_size = 32;
+    uint32_t raw_size, compressed_size;
+    std::memcpy(&raw_size, bytes.data() + chunk + 12, sizeof(raw_size));
+    std::memcpy(&compressed_size, bytes.data() + chunk + 16,
+                sizeof(compressed_size));
+
+    // flag the first imu packet of the chunk as a lidar packet
+    std::vector<uint8_t> raw(raw_size);
+    ASSERT_EQ(ZSTD_decompress(raw.data(), raw.size(),
+                              bytes.data() + chunk + chunk_header_size,
+                              compressed_size),
+              raw.size());
+    size_t imu = 0;
+    while (packets[imu].lidar) ++imu;
+    raw[imu] = 1;
+
+    std::vector<uint8_t> recompressed(ZSTD_compressBound(raw.size()));
+    const size_t size = ZSTD_compress(recompressed.data(),
+                                      recompressed.size(), raw.data(),
+                                      raw.size(), 1);
+    ASSERT_FALSE(ZSTD_isError(size));
+    const uint32_t new_size = static_cast<uint32_t>(size);
+    std::vector<uint8_t> corrupted(bytes.begin(),
+                                   bytes.begin() + chunk + chunk_header_size);
+    std::memcpy(corrupted.data() + chunk + 16, &new_size, sizeof(new_size));
+    corrupted.insert(corrupted.end(), recompressed.begin(),
+                     recompressed.begin() + size);
+    corrupted.insert(corrupted.end(),
+                     bytes.begin() + chunk + chunk_header_size +
+                         compressed_size,
+                     bytes.end());
+    {
+        std::ofstream out(file, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(corrupted.data()),
+                  corrupted.size());
+    }
+
+    ouster_ros::OscReader reader(file);
+    ouster_ros::OscReader::Packet packet;
+    EXPECT_THROW(reader.next(packet), std::runtime_error);
+}
+
+INSTANTIATE_TEST_SUITE_P(LidarProfiles, OscFileTest,
+                         testing::ValuesIn(ouster_ros::test::lidar_profiles));
+
+}  // namespace
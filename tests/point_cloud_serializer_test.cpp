@@ -0,0 +1,289 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file point_cloud_serializer_test.cpp
+ * @brief Checks the serializers against the scan_to_cloud_f and
+ * pcl::toROSMsg reference path
+ */
+
+// prevent clang-format from altering the location of "ouster_ros/ros.h", the
+// header file needs to be the first include due to PCL_NO_PRECOMPILE flag
+// clang-format off
+#include "ouster_ros/os_ros.h"
+// clang-format on
+
+#include <gtest/gtest.h>
+#include <pcl_conversions/pcl_conversions.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <tuple>
+
+#include "ouster_ros/os_cuda_point_cloud_serializer.h"
+#include "ouster_ros/os_point_cloud_serializer.h"
+#include "synthetic_frames.h"
+
+namespace sensor = ouster::sensor;
+using sensor::ChanField;
+
+namespace {
+
+size_t datatype_size(uint8_t datatype) {
+    switch (datatype) {
+        case sensor_msgs::PointField::INT8:
+        case sensor_msgs::PointField::UINT8:
+            return 1;
+        case sensor_msgs::PointField::INT16:
+        case sensor_msgs::PointField::UINT16:
+            return 2;
+        case sensor_msgs::PointField::FLOAT64:
+            return 8;
+        default:
+            return 4;
+    }
+}
+
+// the records are compared field by field, the padding of the point types
+// holds no data and is left to the implementations
+void expect_same_cloud(const sensor_msgs::PointCloud2& expected,
+                       const sensor_msgs::PointCloud2& actual) {
+    ASSERT_EQ(expected.height, actual.height);
+    ASSERT_EQ(expected.width, actual.width);
+    ASSERT_EQ(expected.point_step, actual.point_step);
+    ASSERT_EQ(expected.row_step, actual.row_step);
+    ASSERT_EQ(expected.data.size(), actual.data.size());
+    ASSERT_EQ(expected.fields.size(), actual.fields.size());
+    for (size_t i = 0; i < expected.fields.size(); ++i) {
+        EXPECT_EQ(expected.fields[i].name, actual.fields[i].name);
+        EXPECT_EQ(expected.fields[i].offset, actual.fields[i].offset);
+        EXPECT_EQ(expected.fields[i].datatype, actual.fields[i].datatype);
+        EXPECT_EQ(expected.fields[i].count, actual.fields[i].count);
+    }
+
+    const size_t n = static_cast<size_t>(expected.width) * expected.height;
+    for (size_t i = 0; i < n; ++i) {
+        const size_t record = i * expected.point_step;
+        for (const auto& f : expected.fields) {
+            const size_t at = record + f.offset;
+            if (std::memcmp(expected.data.data() + at, actual.data.data() + at,
+                            f.count * datatype_size(f.datatype)) != 0) {
+                FAIL() << "field " << f.name << " of point " << i
+                       << " differs";
+            }
+        }
+    }
+}
+
+struct Inputs {
+    explicit Inputs(const ouster::LidarScan& ls, bool second)
+        : range(ls.field<uint32_t>(second ? ChanField::RANGE2
+                                          : ChanField::RANGE)),
+          reflectivity(ouster_ros::get_field_view(
+              ouster_ros::suitable_return(ChanField::REFLECTIVITY, second),
+              ls)),
+          near_ir(ouster_ros::get_field_view(
+              ouster_ros::suitable_return(ChanField::NEAR_IR, second), ls)),
+          signal(ouster_ros::get_field_view(
+              ouster_ros::suitable_return(ChanField::SIGNAL, second), ls)) {}
+
+    Eigen::Ref<const ouster::img_t<uint32_t>> range;
+    ouster_ros::FieldView reflectivity;
+    ouster_ros::FieldView near_ir;
+    ouster_ros::FieldView signal;
+};
+
+std::chrono::nanoseconds scan_start(const ouster::LidarScan& ls) {
+    return std::chrono::nanoseconds{ls.timestamp()[0]};
+}
+
+class PointCloudSerializerTest
+    : public testing::TestWithParam<
+          std::tuple<sensor::lidar_mode, sensor::UDPProfileLidar>> {
+   protected:
+    void SetUp() override {
+        frames = ouster_ros::test::make_frames(std::get<0>(GetParam()),
+                                               std::get<1>(GetParam()));
+        // the random returns rarely miss, pixels without a return take the
+        // path that places them at the origin
+        for (auto f : {ChanField::RANGE, ChanField::RANGE2}) {
+            if (!frames.scan.field_type(f)) continue;
+            auto range = frames.scan.field<uint32_t>(f);
+            for (Eigen::Index i = 0; i < range.size(); i += 7)
+                range.data()[i] = 0;
+        }
+        n_returns =
+            frames.scan.field_type(ChanField::RANGE2) ? 2 : 1;
+    }
+
+    template <typename PointT>
+    void expect_matches_reference(const std::string& point_type) {
+        const auto& ls = frames.scan;
+        auto xyz_lut = ouster::make_xyz_lut(frames.info);
+        ouster::PointsF lut_direction = xyz_lut.direction.cast<float>();
+        ouster::PointsF lut_offset = xyz_lut.offset.cast<float>();
+        ouster::PointsF points(lut_direction.rows(), lut_direction.cols());
+        auto shifts = frames.pixel_shift_by_row;
+        auto serializer =
+            ouster_ros::make_point_cloud_serializer(point_type, frames.info);
+        ASSERT_TRUE(serializer);
+
+        for (int i = 0; i < n_returns; ++i) {
+            SCOPED_TRACE("return " + std::to_string(i));
+            pcl::PointCloud<PointT> cloud(ls.w, ls.h);
+            pcl::PointCloud<PointT> destaggered(ls.w, ls.h);
+            ouster_ros::scan_to_cloud_f(points, lut_direction, lut_offset,
+                                        scan_start(ls), ls, cloud,
+                                        destaggered, i, shifts, true);
+            sensor_msgs::PointCloud2 expected, expected_destaggered;
+            pcl::toROSMsg(cloud, expected);
+            pcl::toROSMsg(destaggered, expected_destaggered);
+
+            const Inputs in(ls, i == 1);
+            sensor_msgs::PointCloud2 msg, destaggered_msg;
+            serializer->layout(msg);
+            serializer->layout(destaggered_msg);
+            serializer->serialize(&msg, &destaggered_msg, ls, scan_start(ls),
+                                  in.range, in.reflectivity, in.near_ir,
+                                  in.signal);
+            expect_same_cloud(expected, msg);
+            expect_same_cloud(expected_destaggered, destaggered_msg);
+
+            // the row chunks of the worker pool write the same clouds
+            sensor_msgs::PointCloud2 chunked, chunked_destaggered;
+            serializer->layout(chunked);
+            serializer->layout(chunked_destaggered);
+            const uint32_t half = serializer->rows() / 2;
+            serializer->serialize_rows(&chunked, &chunked_destaggered, ls,
+                                       scan_start(ls), in.range,
+                                       in.reflectivity, in.near_ir,
+                                       in.signal, half, serializer->rows());
+            serializer->serialize_rows(&chunked, &chunked_destaggered, ls,
+                                       scan_start(ls), in.range,
+                                       in.reflectivity, in.near_ir,
+                                       in.signal, 0, half);
+            expect_same_cloud(expected, chunked);
+            expect_same_cloud(expected_destaggered, chunked_destaggered);
+        }
+    }
+
+    void expect_cuda_matches_cpu(const std::string& point_type) {
+        const auto& ls = frames.scan;
+        auto cpu =
+            ouster_ros::make_point_cloud_serializer(point_type, frames.info);
+        auto cuda = ouster_ros::make_cuda_point_cloud_serializer(point_type,
+                                                                 frames.info);
+        ASSERT_TRUE(cpu);
+        ASSERT_TRUE(cuda);
+
+        for (int i = 0; i < n_returns; ++i) {
+            SCOPED_TRACE("return " + std::to_string(i));
+            const Inputs in(ls, i == 1);
+            sensor_msgs::PointCloud2 expected, expected_destaggered;
+            cpu->layout(expected);
+            cpu->layout(expected_destaggered);
+            cpu->serialize(&expected, &expected_destaggered, ls,
+                           scan_start(ls), in.range, in.reflectivity,
+                           in.near_ir, in.signal);
+
+            sensor_msgs::PointCloud2 msg, destaggered_msg;
+            cuda->layout(msg);
+            cuda->layout(destaggered_msg);
+            cuda->serialize(&msg, &destaggered_msg, ls, scan_start(ls),
+                            in.range, in.reflectivity, in.near_ir, in.signal);
+            expect_same_cloud(expected, msg);
+            expect_same_cloud(expected_destaggered, destaggered_msg);
+        }
+    }
+
+    // the row chunks of the worker pool write the same organized clouds as
+    // a single pass, over messages holding the points of another frame
+    void expect_filtered_rows_match(const ouster_ros::CloudFilter& filter) {
+        const auto& ls = frames.scan;
+        auto serializer = ouster_ros::make_point_cloud_serializer(
+            "original", frames.info, filter);
+        ASSERT_TRUE(serializer);
+        const Inputs in(ls, false);
+
+        sensor_msgs::PointCloud2 expected, expected_destaggered;
+        serializer->layout(expected);
+        serializer->layout(expected_destaggered);
+        serializer->serialize(&expected, &expected_destaggered, ls,
+                              scan_start(ls), in.range, in.reflectivity,
+                              in.near_ir, in.signal);
+
+        sensor_msgs::PointCloud2 chunked, chunked_destaggered;
+        serializer->layout(chunked);
+        serializer->layout(chunked_destaggered);
+        std::fill(chunked.data.begin(), chunked.data.end(), 0xab);
+        std::fill(chunked_destaggered.data.begin(),
+                  chunked_destaggered.data.end(), 0xab);
+        const uint32_t half = serializer->rows() / 2;
+        ASSERT_GT(half, 0u);
+        serializer->serialize_rows(&chunked, &chunked_destaggered, ls,
+                                   scan_start(ls), in.range, in.reflectivity,
+                                   in.near_ir, in.signal, half,
+                                   serializer->rows());
+        serializer->serialize_rows(&chunked, &chunked_destaggered, ls,
+                                   scan_start(ls), in.range, in.reflectivity,
+                                   in.near_ir, in.signal, 0, half);
+        expect_same_cloud(expected, chunked);
+        expect_same_cloud(expected_destaggered, chunked_destaggered);
+    }
+
+    ouster_ros::test::Frames frames;
+    int n_returns = 1;
+};
+
+TEST_P(PointCloudSerializerTest, OriginalMatchesReference) {
+    expect_matches_reference<ouster_ros::Point>("original");
+}
+
+TEST_P(PointCloudSerializerTest, XYZMatchesReference) {
+    expect_matches_reference<ouster_ros::PointXYZ>("xyz");
+}
+
+TEST_P(PointCloudSerializerTest, XYZIMatchesReference) {
+    expect_matches_reference<ouster_ros::PointXYZI>("xyzi");
+}
+
+TEST_P(PointCloudSerializerTest, XYZIRTMatchesReference) {
+    expect_matches_reference<ouster_ros::PointXYZIRT>("xyzirt");
+}
+
+TEST_P(PointCloudSerializerTest, StridedRowChunksMatchSinglePass) {
+    ouster_ros::CloudFilter filter;
+    filter.row_stride = 2;
+    filter.column_stride = 3;
+    expect_filtered_rows_match(filter);
+}
+
+TEST_P(PointCloudSerializerTest, WindowedRowChunksMatchSinglePass) {
+    ouster_ros::CloudFilter filter;
+    filter.azimuth_min = -90.0;
+    filter.azimuth_max = 45.0;
+    filter.elevation_min = -10.0;
+    filter.min_range = 1000;
+    filter.max_range = 50000;
+    expect_filtered_rows_match(filter);
+}
+
+TEST_P(PointCloudSerializerTest, CudaMatchesCpu) {
+    std::string reason;
+    if (!ouster_ros::cuda_backend_supports({}, reason))
+        GTEST_SKIP() << reason;
+    for (const std::string point_type : {"original", "xyz", "xyzi", "xyzirt"}) {
+        SCOPED_TRACE(point_type);
+        expect_cuda_matches_cpu(point_type);
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    LidarModesAndProfiles, PointCloudSerializerTest,
+    testing::Combine(testing::Values(sensor::MODE_512x10, sensor::MODE_1024x10,
+                                     sensor::MODE_2048x10),
+                     testing::ValuesIn(ouster_ros::test::lidar_profiles)));
+
+}  // namespace
@@ -0,0 +1,136 @@
+/**
+ * Copyright (c) 2018-2022, Ouster, Inc.
+ * All rights reserved.
+ *
+ * @file synthetic_frames.h
+ * @brief Synthetic lidar packets of every lidar mode and profile, shared by
+ * the tests and the microbenchmarks
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <ouster/lidar_scan.h>
+#include <ouster/types.h>
+
+namespace ouster_ros {
+namespace test {
+
+namespace sensor = ouster::sensor;
+
+const std::vector<sensor::UDPProfileLidar> lidar_profiles = {
+    sensor::PROFILE_LIDAR_LEGACY, sensor::PROFILE_RNG19_RFL8_SIG16_NIR16_DUAL,
+    sensor::PROFILE_RNG19_RFL8_SIG16_NIR16, sensor::PROFILE_RNG15_RFL8_NIR8};
+
+template <typename T>
+void write_le(uint8_t* dst, T value) {
+    std::memcpy(dst, &value, sizeof(T));
+}
+
+/**
+ * A synthetic recording of a sensor: two consecutive frames of lidar packets
+ * with random returns along with the scan they batch into
+ */
+struct Frames {
+    sensor::sensor_info info;
+    std::vector<std::vector<uint8_t>> packets[2];
+    std::vector<uint8_t> imu_packet;
+    ouster::LidarScan scan;
+    std::vector<int> pixel_shift_by_row;
+
+    size_t points() const { return scan.w * scan.h; }
+};
+
+/**
+ * Write the headers of a lidar packet over random contents, with the layouts
+ * of the legacy and the eUDP profiles as documented in the sensor firmware
+ * user manual, checked against packet_format
+ * @param[in] pf the packet format
+ * @param[out] buf the packet
+ * @param[in] frame_id the frame of the packet
+ * @param[in] first_col the measurement id of the first column
+ * @param[in] first_ts the timestamp of the first column of the frame
+ * @param[in] col_dt the time between two columns
+ */
+inline void write_packet(const sensor::packet_format& pf, uint8_t* buf,
+                         uint16_t frame_id, uint16_t first_col,
+                         uint64_t first_ts, uint64_t col_dt) {
+    const bool legacy = pf.udp_profile_lidar == sensor::PROFILE_LIDAR_LEGACY;
+    if (!legacy) {
+        write_le<uint16_t>(buf, 1);  // packet type
+        write_le<uint16_t>(buf + 2, frame_id);
+    }
+
+    for (int i = 0; i < pf.columns_per_packet; ++i) {
+        uint8_t* col = buf + pf.packet_header_size + i * pf.col_size;
+        const uint16_t m_id = static_cast<uint16_t>(first_col + i);
+        write_le<uint64_t>(col, first_ts + m_id * col_dt);
+        write_le<uint16_t>(col + 8, m_id);
+        if (legacy) {
+            write_le<uint16_t>(col + 10, frame_id);
+            write_le<uint32_t>(col + 12, m_id * 90112u / 2048u);
+            write_le<uint32_t>(col + pf.col_size - 4, 0xffffffff);
+        } else {
+            write_le<uint16_t>(col + 10, 0x01);  // valid column
+        }
+    }
+
+    if (pf.frame_id(buf) != frame_id ||
+        pf.col_measurement_id(pf.nth_col(pf.columns_per_packet - 1, buf)) !=
+            first_col + pf.columns_per_packet - 1)
+        throw std::runtime_error("unexpected lidar packet layout for " +
+                                 sensor::to_string(pf.udp_profile_lidar));
+}
+
+/**
+ * Generate two frames of random lidar packets and an imu packet
+ * @param[in] mode the lidar mode
+ * @param[in] profile the lidar profile
+ * @return the frames along with the scan of the first one
+ */
+inline Frames make_frames(sensor::lidar_mode mode,
+                          sensor::UDPProfileLidar profile) {
+    Frames frames{sensor::default_sensor_info(mode), {}, {},
+                  ouster::LidarScan(), {}};
+    frames.info.format.udp_profile_lidar = profile;
+    const auto& info = frames.info;
+    const auto& pf = sensor::get_format(info);
+    const size_t W = info.format.columns_per_frame;
+    const size_t H = info.format.pixels_per_column;
+    frames.pixel_shift_by_row = info.format.pixel_shift_by_row;
+
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> byte(0, 255);
+    const uint64_t col_dt =
+        1000000000ull / (sensor::frequency_of_lidar_mode(mode) * W);
+
+    for (uint16_t f = 0; f < 2; ++f) {
+        for (size_t col = 0; col < W; col += pf.columns_per_packet) {
+            std::vector<uint8_t> buf(pf.lidar_packet_size);
+            for (auto& b : buf) b = static_cast<uint8_t>(byte(rng));
+            write_packet(pf, buf.data(), f, static_cast<uint16_t>(col),
+                         1000000000ull + f * W * col_dt, col_dt);
+            frames.packets[f].push_back(std::move(buf));
+        }
+    }
+
+    frames.imu_packet.resize(pf.imu_packet_size);
+    for (auto& b : frames.imu_packet) b = static_cast<uint8_t>(byte(rng));
+
+    frames.scan = ouster::LidarScan(W, H, profile);
+    ouster::ScanBatcher batcher(info);
+    for (const auto& packet : frames.packets[0])
+        batcher(packet.data(), frames.scan);
+    // the first packet of the next frame completes the scan
+    batcher(frames.packets[1].front().data(), frames.scan);
+    return frames;
+}
+
+}  // namespace test
+}  // namespace ouster_ros